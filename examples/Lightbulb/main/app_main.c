@@ -84,17 +84,28 @@ extern const HAPAccessory* AppGetAccessoryInfo();
  */
 static void InitializePlatform() {
     // Key-value store.
+    /* Configuration (0x90) and pairings (0xA0) are read on every pair verify. */
+    static const HAPPlatformKeyValueStoreDomain readCacheDomains[] = { 0x90, 0xA0 };
     HAPPlatformKeyValueStoreCreate(&platform.keyValueStore, &(const HAPPlatformKeyValueStoreOptions) {
         .part_name = "nvs",
         .namespace_prefix = "hap",
-        .read_only = false
+        .read_only = false,
+        /* Coalesce rapid accessory state changes, e.g., from a dimmer slider, into one flash commit. */
+        .maxWriteBackItems = 4,
+        .writeBackDelay = 2 * HAPSecond,
+        .readCacheSize = 1024,
+        .readCacheDomains = readCacheDomains,
+        .numReadCacheDomains = HAPArrayCount(readCacheDomains),
+        .maxIndexEntries = 64
     });
     platform.hapPlatform.keyValueStore = &platform.keyValueStore;
 
     HAPPlatformKeyValueStoreCreate(&platform.factoryKeyValueStore, &(const HAPPlatformKeyValueStoreOptions) {
         .part_name = CONFIG_EXAMPLE_FACTORY_PARTITION_NAME,
         .namespace_prefix = "hap",
-        .read_only = true
+        .read_only = true,
+        /* Provisioning data never changes at runtime. */
+        .readCacheSize = 512
     });
 
     // Accessory setup manager. Depends on key-value store.
@@ -111,7 +122,15 @@ static void InitializePlatform() {
     HAPPlatformTCPStreamManagerCreate(&platform.tcpStreamManager, &(const HAPPlatformTCPStreamManagerOptions) {
         /* Listen on all available network interfaces. */
         .port = 0 /* Listen on unused port number from the ephemeral port range. */,
-        .maxConcurrentTCPStreams = 9
+        .maxConcurrentTCPStreams = 9,
+        /* Reclaim TCP streams of controllers that disappeared from the network within about a minute. */
+        .keepAlive = { .idleTime = 30 * HAPSecond, .interval = 10 * HAPSecond, .count = 3 },
+        /* Keep connection floods from starving legitimate controllers of Pair Verify time. */
+        .admission = { .sourceRate = 1,
+                       .sourceBurst = 4,
+                       .globalRate = 4,
+                       .globalBurst = 9,
+                       .maxHandshakingTCPStreams = 4 }
     });
 
     // Service discovery.
@@ -173,6 +192,18 @@ static void DeinitializePlatform() {
 
     AppDeinitialize();
 
+    // Key-value stores. Pending writes must be committed while the run loop still exists.
+    HAPError err = HAPPlatformKeyValueStoreFlush(&platform.keyValueStore);
+    if (err) {
+        HAPLogError(&kHAPLog_Default, "Committing pending key-value store writes failed.");
+    }
+    HAPPlatformKeyValueStoreRelease(&platform.keyValueStore);
+    err = HAPPlatformKeyValueStoreFlush(&platform.factoryKeyValueStore);
+    if (err) {
+        HAPLogError(&kHAPLog_Default, "Committing pending factory key-value store writes failed.");
+    }
+    HAPPlatformKeyValueStoreRelease(&platform.factoryKeyValueStore);
+
     // Run loop.
     HAPPlatformRunLoopRelease();
 }
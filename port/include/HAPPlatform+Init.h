@@ -42,6 +42,12 @@ extern "C" {
 #else
 #define HAVE_MFI_HW_AUTH 0
 #endif
+
+#ifdef CONFIG_HAP_VIRTUAL_TIME
+#define HAVE_VIRTUAL_TIME 1
+#else
+#define HAVE_VIRTUAL_TIME 0
+#endif
 /**@}*/
 
 #include <stdlib.h>
@@ -0,0 +1,80 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HAP_PLATFORM_CLOCK_INIT_H
+#define HAP_PLATFORM_CLOCK_INIT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "HAPPlatform.h"
+#include "HAPPlatform+Init.h"
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull begin
+#endif
+
+/**
+ * Gets the time that was returned by the most recent call to HAPPlatformClockGetCurrent.
+ *
+ * - The run loop calls HAPPlatformClockGetCurrent once per iteration after waiting for events, so the returned time
+ *   lags behind the current time by at most the time spent so far in the current run loop iteration.
+ * - This is cheaper than HAPPlatformClockGetCurrent and is meant for callers that can tolerate this granularity.
+ * - May be called from any thread.
+ *
+ * @return Cached time in milliseconds. Identical time base as HAPPlatformClockGetCurrent.
+ */
+HAP_RESULT_USE_CHECK
+HAPTime HAPPlatformClockGetCurrentCoarse(void);
+
+/**
+ * Gets the current time of a monotonic clock with microsecond resolution.
+ *
+ * - The time base is unrelated to HAPPlatformClockGetCurrent. Only differences between two values are meaningful.
+ * - This clock always measures real time, even if virtual time is enabled.
+ * - May be called from any thread.
+ *
+ * @return Current time in microseconds.
+ */
+HAP_RESULT_USE_CHECK
+uint64_t HAPPlatformClockGetCurrentMicroseconds(void);
+
+#if HAVE_VIRTUAL_TIME
+/**
+ * Advances the virtual clock returned by HAPPlatformClockGetCurrent.
+ *
+ * - The run loop advances virtual time automatically whenever it would otherwise block.
+ * - Must be called from the run loop thread.
+ *
+ * @param      now                  New virtual time. Must not be earlier than the current virtual time.
+ */
+void HAPPlatformClockSetVirtualTime(HAPTime now);
+#endif
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull end
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -25,6 +25,12 @@
 extern "C" {
 #endif
 
+#include "sdkconfig.h"
+
+#ifndef CONFIG_HAP_KEY_VALUE_STORE_BACKEND_FILE
+#include <nvs.h>
+#endif
+
 #include "HAPPlatform.h"
 
 #if __has_feature(nullability)
@@ -34,6 +40,12 @@ extern "C" {
 /**@file
  * NVS based key-value store implementation.
  *
+ * With CONFIG_HAP_KEY_VALUE_STORE_BACKEND_FILE, the key-value store is instead kept in an append-only log file on a
+ * POSIX file system, so that it can be used on Linux hosts. Every set, remove and purge appends one checksummed record
+ * and is synced to disk before it returns. On initialization, the log is replayed into an in-memory index and a torn
+ * record at its end is discarded. The log is compacted on the run loop when most of it is superseded. Read-only stores
+ * are loaded from a CSV file in the format of tools/accessory_setup/accessory_setup.csv.
+ *
  * **Example**
 
    @code{.c}
@@ -48,18 +60,26 @@ extern "C" {
            .namespace_prefix = "hap"
        });
 
+   // With CONFIG_HAP_KEY_VALUE_STORE_BACKEND_FILE.
+   HAPPlatformKeyValueStoreCreate(&keyValueStore,
+       &(const HAPPlatformKeyValueStoreOptions) {
+           .part_name = "/var/lib/hap/kvs.log",
+           .namespace_prefix = "hap"
+       });
+
    @endcode
  */
 
 /**
  * Key-value store item.
  *
- * - Each item stores the value of one key in RAM. Values are not stored persistently.
+ * - Each item holds a pending write of one key in RAM until it is written to flash.
  */
 typedef struct {
     // Opaque type. Do not access the instance fields directly.
     /**@cond */
     bool active;
+    bool isRemoved;
     HAPPlatformKeyValueStoreDomain domain;
     HAPPlatformKeyValueStoreKey key;
     size_t numBytes;
@@ -67,34 +87,302 @@ typedef struct {
     /**@endcond */
 } HAPPlatformKeyValueStoreItem;
 
+/**
+ * Key-value store index entry.
+ *
+ * - Each entry records that one key exists, and the length of its value.
+ */
+typedef struct {
+    // Opaque type. Do not access the instance fields directly.
+    /**@cond */
+    uint32_t numBytes;
+    HAPPlatformKeyValueStoreDomain domain;
+    HAPPlatformKeyValueStoreKey key;
+    /**@endcond */
+} HAPPlatformKeyValueStoreIndexEntry;
+
+/**
+ * Domains below this value are accessory specific and may be written back lazily.
+ *
+ * - Platform domains (e.g., provisioning) and HAP domains (e.g., pairings) are always written through.
+ */
+#define kHAPPlatformKeyValueStore_MaxWriteBackDomain ((HAPPlatformKeyValueStoreDomain) 0x3F)
+
+/**
+ * Maximum number of NVS namespaces that are kept open. When exceeded, the least recently used one is closed.
+ */
+#define kHAPPlatformKeyValueStore_MaxOpenNamespaces ((size_t) 4)
+
+/**
+ * Maximum length of the namespace prefix. NVS namespace names are limited to 15 characters, including the
+ * separator and the two hex digits of the domain.
+ */
+#define kHAPPlatformKeyValueStore_MaxNamespacePrefixLength ((size_t) 12)
+
+/**
+ * Default number of superseded bytes in the log file after which the log is compacted.
+ */
+#define kHAPPlatformKeyValueStore_DefaultCompactionThreshold ((size_t) 16384)
+
 /**
  * Key-value store initialization options.
  */
 typedef struct {
     /** Name of flash partition that will be used storing the Key-Value pairs.
      * Recommended names are "nvs" and "fctry" as they are the defaults.
+     * With CONFIG_HAP_KEY_VALUE_STORE_BACKEND_FILE, path of the log file, or path of the CSV file if read_only is set.
      */
     const char *part_name;
     /** Prefix for the namespace under which the Key Value pairs will be stored. Recommended name is "hap"
-     * or any other small name (upto 10 characters).
+     * or any other small name (upto kHAPPlatformKeyValueStore_MaxNamespacePrefixLength characters).
      */
     const char *namespace_prefix;
 
     /** Flag to indicate if erasing this partition is allowed */
     bool read_only;
+
+    /**
+     * Whether values are read through a memory mapping of the log file instead of with pread.
+     *
+     * - Only used with CONFIG_HAP_KEY_VALUE_STORE_BACKEND_FILE.
+     */
+    bool useMemoryMappedReads;
+
+    /**
+     * Number of superseded bytes in the log file after which the log is compacted, once they also make up at least
+     * half of the log file.
+     *
+     * - Only used with CONFIG_HAP_KEY_VALUE_STORE_BACKEND_FILE.
+     * - If 0, kHAPPlatformKeyValueStore_DefaultCompactionThreshold is used. If SIZE_MAX, the log is never compacted.
+     */
+    size_t compactionThreshold;
+
+    /**
+     * Maximum number of pending writes that are held in RAM.
+     *
+     * - Not used with CONFIG_HAP_KEY_VALUE_STORE_BACKEND_FILE, which writes every set and remove through.
+     * - If 0, every set and remove is committed to flash immediately.
+     * - Otherwise, sets and removes in accessory specific domains (see kHAPPlatformKeyValueStore_MaxWriteBackDomain)
+     *   whose values fit into a HAPPlatformKeyValueStoreItem are held in RAM, and repeated writes to the same key are
+     *   merged. Pending writes are committed when writeBackDelay elapses, when no item is free, and on
+     *   HAPPlatformKeyValueStoreFlush. Pending writes are lost on power loss.
+     */
+    size_t maxWriteBackItems;
+
+    /**
+     * Storage for maxWriteBackItems pending writes.
+     *
+     * - If NULL and maxWriteBackItems is not 0, the storage is allocated from the heap.
+     * - Otherwise, the storage must remain valid as long as the key-value store is used.
+     */
+    HAPPlatformKeyValueStoreItem* _Nullable writeBackItems;
+
+    /**
+     * Time after the first pending write after which all pending writes are committed.
+     *
+     * - If 0, pending writes are only committed when no item is free and on HAPPlatformKeyValueStoreFlush.
+     */
+    HAPTime writeBackDelay;
+
+    /**
+     * Size of the read cache in bytes.
+     *
+     * - Not used with CONFIG_HAP_KEY_VALUE_STORE_BACKEND_FILE.
+     * - If 0, every get that is not served from a pending write reads from flash.
+     * - Otherwise, values and absent keys of the domains in readCacheDomains are kept in RAM after they have been
+     *   read, until the cache is full and they are the least recently used. Each cached value takes a few bytes of
+     *   bookkeeping in addition to its length. Sets, removes and purges invalidate the affected entries.
+     */
+    size_t readCacheSize;
+
+    /**
+     * Storage for the read cache of readCacheSize bytes.
+     *
+     * - If NULL and readCacheSize is not 0, the storage is allocated from the heap.
+     * - Otherwise, the storage must remain valid as long as the key-value store is used.
+     */
+    void* _Nullable readCacheBytes;
+
+    /**
+     * Domains whose values are cached, e.g., pairings and provisioning data that are read on every session.
+     *
+     * - If numReadCacheDomains is 0, all domains are cached.
+     */
+    const HAPPlatformKeyValueStoreDomain* _Nullable readCacheDomains;
+
+    /**
+     * Number of domains in readCacheDomains.
+     */
+    size_t numReadCacheDomains;
+
+    /**
+     * Maximum number of keys in the index.
+     *
+     * - Not used with CONFIG_HAP_KEY_VALUE_STORE_BACKEND_FILE, which always indexes all keys.
+     * - If 0, enumerations scan the NVS partition and every get reads from flash.
+     * - Otherwise, the keys in the partition are indexed on initialization, and the index is kept up to date by all
+     *   sets, removes and purges. Enumerations then iterate the index in ascending key order, and gets of keys that
+     *   do not exist and gets that only query the existence of a key are answered without reading from flash.
+     *   If the partition contains more keys, the index is disabled until the store is initialized again.
+     */
+    size_t maxIndexEntries;
+
+    /**
+     * Storage for maxIndexEntries index entries.
+     *
+     * - If NULL and maxIndexEntries is not 0, the storage is allocated from the heap.
+     * - Otherwise, the storage must remain valid as long as the key-value store is used.
+     */
+    HAPPlatformKeyValueStoreIndexEntry* _Nullable indexEntries;
 } HAPPlatformKeyValueStoreOptions;
 
+/**
+ * Key-value store statistics.
+ */
+typedef struct {
+    /**
+     * Number of calls to HAPPlatformKeyValueStoreSet.
+     */
+    size_t numSets;
+
+    /**
+     * Number of calls to HAPPlatformKeyValueStoreRemove.
+     */
+    size_t numRemoves;
+
+    /**
+     * Number of sets and removes that were held in RAM instead of being written through.
+     */
+    size_t numDeferredWrites;
+
+    /**
+     * Number of deferred sets and removes that replaced a pending write of the same key.
+     */
+    size_t numMergedWrites;
+
+    /**
+     * Number of values that were written to or erased from flash.
+     *
+     * - With CONFIG_HAP_KEY_VALUE_STORE_BACKEND_FILE, number of records appended to the log file.
+     */
+    size_t numFlashWrites;
+
+    /**
+     * Number of commits to flash.
+     *
+     * - With CONFIG_HAP_KEY_VALUE_STORE_BACKEND_FILE, number of times the log file was synced to disk.
+     */
+    size_t numFlashCommits;
+
+    /**
+     * Number of times an NVS namespace was opened because it was not open yet.
+     */
+    size_t numNamespaceOpens;
+
+    /**
+     * Number of gets that were served from the read cache.
+     */
+    size_t numReadCacheHits;
+
+    /**
+     * Number of gets in cached domains that had to read from flash.
+     */
+    size_t numReadCacheMisses;
+
+    /**
+     * Number of read cache entries that were dropped to make room for others.
+     */
+    size_t numReadCacheEvictions;
+
+    /**
+     * Number of gets that were answered from the index without reading from flash.
+     */
+    size_t numIndexedGets;
+
+    /**
+     * Number of times the log file was compacted.
+     */
+    size_t numCompactions;
+
+    /**
+     * Number of bytes at the end of the log file that were discarded on initialization because they did not form a
+     * complete record with a valid checksum, e.g., after a crash during a write.
+     */
+    size_t numDiscardedLogBytes;
+} HAPPlatformKeyValueStoreStatistics;
+
+#ifdef CONFIG_HAP_KEY_VALUE_STORE_BACKEND_FILE
 /**
  * Key-value store.
  */
 struct HAPPlatformKeyValueStore {
     // Opaque type. Do not access the instance fields directly.
     /**@cond */
-    const char *part_name;
-    const char *namespace_prefix;
+    char* part_name;
+    bool read_only;
+    int fileDescriptor;
+    size_t numLogBytes;
+    size_t numLiveLogBytes;
+    size_t compactionThreshold;
+    HAPPlatformTimerRef compactionTimer;
+
+    bool useMemoryMappedReads;
+    uint8_t* _Nullable mappedBytes;
+    size_t numMappedBytes;
+
+    uint8_t* _Nullable valueBytes;
+    size_t numValueBytes;
+
+    struct HAPPlatformKeyValueStoreLogEntry* _Nullable logEntries;
+    size_t numLogEntries;
+    size_t maxLogEntries;
+
+    HAPPlatformKeyValueStoreStatistics statistics;
+    /**@endcond */
+};
+#else
+/**
+ * Key-value store.
+ */
+struct HAPPlatformKeyValueStore {
+    // Opaque type. Do not access the instance fields directly.
+    /**@cond */
+    char *part_name;
+    char namespace_name[kHAPPlatformKeyValueStore_MaxNamespacePrefixLength + 4];
+    size_t namespace_prefix_length;
     bool read_only;
+
+    struct {
+        nvs_handle handle;
+        HAPPlatformKeyValueStoreDomain domain;
+        bool isOpen;
+        uint32_t lastUse;
+    } openNamespaces[kHAPPlatformKeyValueStore_MaxOpenNamespaces];
+    uint32_t numNamespaceUses;
+
+    HAPPlatformKeyValueStoreItem* _Nullable writeBackItems;
+    size_t maxWriteBackItems;
+    bool ownsWriteBackItems;
+    HAPTime writeBackDelay;
+    HAPPlatformTimerRef writeBackTimer;
+
+    uint8_t* _Nullable readCacheBytes;
+    size_t readCacheSize;
+    size_t numReadCacheBytes;
+    bool ownsReadCacheBytes;
+    uint32_t readCacheDomains[256 / 32];
+    uint32_t numReadCacheUses;
+
+    HAPPlatformKeyValueStoreIndexEntry* _Nullable indexEntries;
+    size_t maxIndexEntries;
+    size_t numIndexEntries;
+    bool ownsIndexEntries;
+    bool isIndexValid;
+
+    HAPPlatformKeyValueStoreStatistics statistics;
     /**@endcond */
 };
+#endif
 
 /**
  * Initializes the key-value store.
@@ -106,6 +394,41 @@ void HAPPlatformKeyValueStoreCreate(
         HAPPlatformKeyValueStoreRef keyValueStore,
         const HAPPlatformKeyValueStoreOptions* options);
 
+/**
+ * Releases resources associated with an initialized key-value store instance.
+ *
+ * - Pending writes are committed and all open NVS namespaces are closed.
+ * - With CONFIG_HAP_KEY_VALUE_STORE_BACKEND_FILE, a pending compaction is cancelled and the log file is closed.
+ *
+ * @param      keyValueStore        Key-value store.
+ */
+void HAPPlatformKeyValueStoreRelease(HAPPlatformKeyValueStoreRef keyValueStore);
+
+/**
+ * Commits all pending writes to flash.
+ *
+ * - Pending writes are committed once per domain.
+ * - Must be called before the device is restarted on purpose, e.g., before a firmware update is applied.
+ * - With CONFIG_HAP_KEY_VALUE_STORE_BACKEND_FILE, writes are never pending and this has no effect.
+ *
+ * @param      keyValueStore        Key-value store.
+ *
+ * @return kHAPError_None           If successful.
+ * @return kHAPError_Unknown        If an error occurred while writing. Failed writes remain pending.
+ */
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformKeyValueStoreFlush(HAPPlatformKeyValueStoreRef keyValueStore);
+
+/**
+ * Fetches key-value store statistics.
+ *
+ * @param      keyValueStore        Key-value store.
+ * @param[out] statistics           Key-value store statistics.
+ */
+void HAPPlatformKeyValueStoreGetStatistics(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreStatistics* statistics);
+
 #if __has_feature(nullability)
 #pragma clang assume_nonnull end
 #endif
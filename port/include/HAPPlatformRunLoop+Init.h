@@ -26,6 +26,8 @@ extern "C" {
 #endif
 
 #include "HAPPlatform.h"
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformFileHandle.h"
 
 #if __has_feature(nullability)
 #pragma clang assume_nonnull begin
@@ -40,6 +42,22 @@ extern "C" {
  * - HAPPlatformFileHandle (POSIX-specific)
  */
 
+#if HAVE_VIRTUAL_TIME
+/**
+ * Virtual time driver. Invoked whenever the run loop has no pending work and would otherwise wait for events.
+ *
+ * - The driver may inject file handle events with HAPPlatformFileHandleInjectEvents, schedule callbacks, or stop
+ *   the run loop.
+ *
+ * @param      nextWakeupTime       Time at which the next timer needs to fire, or 0 if no timers are registered.
+ * @param      context              The context parameter given to the HAPPlatformRunLoopCreate function.
+ *
+ * @return Virtual time at which the run loop resumes. Must not be earlier than the current virtual time.
+ *         Values later than nextWakeupTime are clamped to nextWakeupTime.
+ */
+typedef HAPTime (*HAPPlatformRunLoopVirtualTimeDriver)(HAPTime nextWakeupTime, void* _Nullable context);
+#endif
+
 /**
  * Run loop initialization options.
  */
@@ -48,8 +66,330 @@ typedef struct {
      * Key-value store.
      */
     HAPPlatformKeyValueStoreRef keyValueStore;
+
+    /**
+     * Number of timers that are preallocated when the run loop is created.
+     *
+     * - If 0, timers are allocated from the heap on demand.
+     */
+    size_t maxTimers;
+
+    /**
+     * Number of file handles that are preallocated when the run loop is created.
+     *
+     * - If 0, file handles are allocated from the heap on demand.
+     */
+    size_t maxFileHandles;
+
+    /**
+     * Whether timers and file handles are allocated from the heap once the preallocated storage is exhausted.
+     *
+     * - If false, registrations fail with kHAPError_OutOfResources once the preallocated storage is exhausted.
+     */
+    bool allowHeapFallback;
+
+#if HAVE_VIRTUAL_TIME
+    /**
+     * Virtual time driver.
+     *
+     * - If NULL, virtual time jumps to the next timer deadline whenever the run loop has no pending work, and the run
+     *   loop stops once no timers are registered.
+     */
+    HAPPlatformRunLoopVirtualTimeDriver _Nullable virtualTimeDriver;
+
+    /**
+     * Context that is passed to the virtual time driver.
+     */
+    void* _Nullable virtualTimeDriverContext;
+#endif
 } HAPPlatformRunLoopOptions;
 
+/**
+ * Allocation statistics of a run loop object pool.
+ */
+typedef struct {
+    /**
+     * Number of objects that are currently allocated.
+     */
+    size_t numObjects;
+
+    /**
+     * Number of preallocated objects.
+     */
+    size_t maxObjects;
+
+    /**
+     * Highest number of objects that were allocated at the same time.
+     */
+    size_t numObjectsHighWaterMark;
+
+    /**
+     * Number of objects that were allocated from the heap.
+     */
+    size_t numHeapAllocations;
+
+    /**
+     * Number of allocations that failed.
+     */
+    size_t numFailedAllocations;
+} HAPPlatformRunLoopPoolStatistics;
+
+/**
+ * Statistics of run loop wakeups to fire timers.
+ */
+typedef struct {
+    /**
+     * Number of run loop iterations that fired at least one timer.
+     */
+    size_t numWakeups;
+
+    /**
+     * Number of wakeups that were saved by delaying timers within their leeway, so that timers with different
+     * deadlines fired together.
+     */
+    size_t numSavedWakeups;
+} HAPPlatformRunLoopTimerWakeupStatistics;
+
+/**
+ * Statistics of callbacks scheduled with HAPPlatformRunLoopScheduleCallback.
+ */
+typedef struct {
+    /**
+     * Size of the buffer holding pending callbacks.
+     */
+    size_t maxBytes;
+
+    /**
+     * Highest number of buffer bytes used by pending callbacks, as observed by the run loop.
+     */
+    size_t numBytesHighWaterMark;
+
+    /**
+     * Number of callbacks that were scheduled successfully.
+     */
+    size_t numScheduledCallbacks;
+
+    /**
+     * Number of callbacks that were dropped because the buffer was full.
+     */
+    size_t numDroppedCallbacks;
+
+    /**
+     * Number of callbacks that were rejected because their context was too large.
+     */
+    size_t numOversizedCallbacks;
+
+    /**
+     * Number of wakeups that were sent to the run loop.
+     */
+    size_t numWakeups;
+
+    /**
+     * Number of scheduled callbacks that did not need to send a wakeup because one was already pending.
+     */
+    size_t numCoalescedWakeups;
+
+    /**
+     * Number of wakeups that could not be sent.
+     */
+    size_t numFailedWakeups;
+
+    /**
+     * Size of the arena holding contexts larger than UINT8_MAX.
+     */
+    size_t maxArenaBytes;
+
+    /**
+     * Number of arena bytes that are currently in use, including space not yet reclaimed by the run loop.
+     */
+    size_t numArenaBytes;
+
+    /**
+     * Highest number of arena bytes in use, as observed by the run loop.
+     */
+    size_t numArenaBytesHighWaterMark;
+
+    /**
+     * Number of callbacks that were scheduled successfully with a context stored in the arena.
+     */
+    size_t numArenaCallbacks;
+
+    /**
+     * Number of callbacks that were dropped because the arena was full.
+     */
+    size_t numFailedArenaAllocations;
+} HAPPlatformRunLoopCallbackQueueStatistics;
+
+/**
+ * Run loop statistics.
+ */
+typedef struct {
+    /**
+     * Timer allocation statistics.
+     */
+    HAPPlatformRunLoopPoolStatistics timers;
+
+    /**
+     * Timer wakeup statistics.
+     */
+    HAPPlatformRunLoopTimerWakeupStatistics timerWakeups;
+
+    /**
+     * File handle allocation statistics.
+     */
+    HAPPlatformRunLoopPoolStatistics fileHandles;
+
+    /**
+     * Scheduled callback statistics.
+     */
+    HAPPlatformRunLoopCallbackQueueStatistics callbacks;
+} HAPPlatformRunLoopStatistics;
+
+#ifdef CONFIG_HAP_RUN_LOOP_INSTRUMENTATION
+/**
+ * Number of buckets of a run loop instrumentation histogram.
+ */
+#define kHAPPlatformRunLoopHistogram_NumBuckets ((size_t) 32)
+
+/**
+ * Maximum number of callbacks tracked in the list of slowest callbacks.
+ */
+#define kHAPPlatformRunLoopInstrumentation_MaxSlowestCallbacks ((size_t) 8)
+
+/**
+ * Logarithmic histogram of run loop instrumentation samples.
+ *
+ * - Bucket 0 counts samples with value 0. Bucket i > 0 counts samples with values in [2^(i-1), 2^i).
+ *   The last bucket also counts all larger samples.
+ */
+typedef struct {
+    /**
+     * Number of samples per bucket.
+     */
+    uint32_t numSamplesPerBucket[kHAPPlatformRunLoopHistogram_NumBuckets];
+
+    /**
+     * Number of samples.
+     */
+    uint32_t numSamples;
+
+    /**
+     * Largest sample.
+     */
+    uint64_t maxValue;
+
+    /**
+     * Sum of all samples.
+     */
+    uint64_t sumValues;
+} HAPPlatformRunLoopHistogram;
+
+/**
+ * Kind of callback that is invoked by the run loop.
+ */
+HAP_ENUM_BEGIN(uint8_t, HAPPlatformRunLoopCallbackKind) {
+    /** Timer callback. */
+    kHAPPlatformRunLoopCallbackKind_Timer = 1,
+
+    /** File handle callback. */
+    kHAPPlatformRunLoopCallbackKind_FileHandle,
+
+    /** Callback scheduled with HAPPlatformRunLoopScheduleCallback. */
+    kHAPPlatformRunLoopCallbackKind_ScheduledCallback,
+
+    /** Run loop observer callback. */
+    kHAPPlatformRunLoopCallbackKind_Observer
+} HAP_ENUM_END(uint8_t, HAPPlatformRunLoopCallbackKind);
+
+/**
+ * Invocation statistics of a slow callback.
+ */
+typedef struct {
+    /**
+     * Address of the callback function.
+     */
+    const void* _Nullable function;
+
+    /**
+     * Kind of callback.
+     */
+    HAPPlatformRunLoopCallbackKind kind;
+
+    /**
+     * Number of invocations since the callback has been tracked.
+     */
+    uint32_t numInvocations;
+
+    /**
+     * Longest invocation in microseconds.
+     */
+    uint64_t maxMicroseconds;
+
+    /**
+     * Total time spent in invocations since the callback has been tracked, in microseconds.
+     */
+    uint64_t sumMicroseconds;
+} HAPPlatformRunLoopSlowCallback;
+
+/**
+ * Run loop instrumentation.
+ */
+typedef struct {
+    /**
+     * Number of run loop iterations.
+     */
+    uint64_t numIterations;
+
+    /**
+     * Time per iteration spent waiting for events in `select` or `poll`, in microseconds.
+     */
+    HAPPlatformRunLoopHistogram waitTime;
+
+    /**
+     * Time per iteration spent invoking timer, file handle and scheduled callbacks, in microseconds.
+     */
+    HAPPlatformRunLoopHistogram dispatchTime;
+
+    /**
+     * Difference between the time when a timer callback is invoked and the timer deadline, in milliseconds.
+     */
+    HAPPlatformRunLoopHistogram timerLateness;
+
+    /**
+     * Callbacks with the longest invocations, ordered by decreasing maximum invocation time.
+     *
+     * - A callback is tracked once one of its invocations is slower than the fastest tracked callback.
+     */
+    HAPPlatformRunLoopSlowCallback slowestCallbacks[kHAPPlatformRunLoopInstrumentation_MaxSlowestCallbacks];
+
+    /**
+     * Number of valid entries in slowestCallbacks.
+     */
+    size_t numSlowestCallbacks;
+} HAPPlatformRunLoopInstrumentation;
+#endif
+
+/**
+ * Callback that is invoked by the run loop at the end of each iteration.
+ *
+ * @param      context              The context parameter given to the HAPPlatformRunLoopAddObserver function.
+ */
+typedef void (*HAPPlatformRunLoopObserverCallback)(void* _Nullable context);
+
+/**
+ * Run loop observer. Storage is provided by the caller and must remain valid until the observer is removed.
+ */
+typedef struct HAPPlatformRunLoopObserver HAPPlatformRunLoopObserver;
+struct HAPPlatformRunLoopObserver {
+    // Opaque type. Do not access the instance fields directly.
+    /**@cond */
+    HAPPlatformRunLoopObserverCallback _Nullable callback;
+    void* _Nullable context;
+    HAPPlatformRunLoopObserver* _Nullable nextObserver;
+    bool isAdded;
+    /**@endcond */
+};
+
 /**
  * Create run loop.
  */
@@ -57,9 +397,138 @@ void HAPPlatformRunLoopCreate(const HAPPlatformRunLoopOptions* options);
 
 /**
  * Release run loop.
+ *
+ * - All timers and file handles must have been deregistered.
  */
 void HAPPlatformRunLoopRelease(void);
 
+/**
+ * Registers a timer that may fire later than its deadline, so that it can fire together with other timers.
+ *
+ * - The timer fires no earlier than the deadline. Unless the run loop is busy, it fires no later than the deadline
+ *   plus the leeway. The run loop wakes up at the earliest time that satisfies this for all timers, and fires all
+ *   timers whose deadlines have passed. This reduces the number of wakeups when timers have nearby deadlines.
+ * - HAPPlatformTimerRegister is equivalent to a leeway of 0.
+ * - Timers with equal deadlines fire in the order in which they were registered.
+ *
+ * @param[out] timer                Non-zero Timer object if successful.
+ * @param      deadline             Time after which the timer shall fire.
+ * @param      leeway               Time in milliseconds by which the timer may be delayed after the deadline.
+ * @param      callback             Function to call when the timer fires.
+ * @param      context              Context that is passed to the callback.
+ *
+ * @return kHAPError_None           If successful.
+ * @return kHAPError_OutOfResources If no more timers can be allocated.
+ */
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformTimerRegisterWithLeeway(
+        HAPPlatformTimerRef* timer,
+        HAPTime deadline,
+        HAPTime leeway,
+        HAPPlatformTimerCallback callback,
+        void* _Nullable context);
+
+/**
+ * Schedules a callback that will be called from the run loop, with a context that may be larger than UINT8_MAX.
+ *
+ * - Contexts of up to UINT8_MAX bytes are handled like in HAPPlatformRunLoopScheduleCallback.
+ * - Larger contexts are copied into a preallocated arena (CONFIG_HAP_RUN_LOOP_CALLBACK_ARENA_SIZE) and released
+ *   automatically after the callback returns.
+ * - Contexts do not wrap around the end of the arena. A context of up to the arena size minus 8 bytes fits once all
+ *   pending large contexts have been released, but contexts larger than half the arena may be rejected while others
+ *   are pending.
+ * - This function may be called from any thread.
+ *
+ * @param      callback             Function to call on the run loop.
+ * @param      context              Context that is passed to the callback.
+ * @param      contextSize          Size of context data that is passed to the callback.
+ *
+ * @return kHAPError_None           If successful.
+ * @return kHAPError_OutOfResources If there is not enough space to store the callback.
+ */
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformRunLoopScheduleCallbackWithLargeContext(
+        HAPPlatformRunLoopCallback callback,
+        const void* _Nullable context,
+        size_t contextSize);
+
+/**
+ * Adds an observer that is invoked at the end of each run loop iteration.
+ *
+ * - The observer is invoked after all timer, file handle and scheduled callbacks of an iteration have been processed,
+ *   before the run loop waits for further events. This allows deferring work, e.g., flushing output that has been
+ *   produced by several callbacks, without adding latency beyond the current iteration.
+ * - Observers are invoked in the order in which they were added.
+ * - Observers may be added or removed from within an observer callback. An observer that is added from within an
+ *   observer callback may first be invoked in the next iteration.
+ * - Must be called from the run loop thread.
+ *
+ * @param      observer             Observer. Must not already be added.
+ * @param      callback             Function to call at the end of each run loop iteration.
+ * @param      context              Context that is passed to the callback.
+ */
+void HAPPlatformRunLoopAddObserver(
+        HAPPlatformRunLoopObserver* observer,
+        HAPPlatformRunLoopObserverCallback callback,
+        void* _Nullable context);
+
+/**
+ * Removes an observer that has been added with HAPPlatformRunLoopAddObserver.
+ *
+ * - Has no effect if the observer is not added.
+ * - Must be called from the run loop thread.
+ *
+ * @param      observer             Observer.
+ */
+void HAPPlatformRunLoopRemoveObserver(HAPPlatformRunLoopObserver* observer);
+
+#if HAVE_VIRTUAL_TIME
+/**
+ * Injects events for a file handle.
+ *
+ * - With virtual time, file descriptors are not monitored. Events are only delivered when injected.
+ * - Injected events are delivered on the next run loop iteration, without advancing virtual time. Events that the
+ *   file handle is not interested in at that point are discarded.
+ * - Must be called from the run loop thread.
+ *
+ * @param      fileHandle           File handle.
+ * @param      events               Events to deliver.
+ */
+void HAPPlatformFileHandleInjectEvents(HAPPlatformFileHandleRef fileHandle, HAPPlatformFileHandleEvent events);
+#endif
+
+/**
+ * Fetches run loop statistics.
+ *
+ * @param[out] statistics           Run loop statistics.
+ */
+void HAPPlatformRunLoopGetStatistics(HAPPlatformRunLoopStatistics* statistics);
+
+#ifdef CONFIG_HAP_RUN_LOOP_INSTRUMENTATION
+/**
+ * Fetches run loop instrumentation.
+ *
+ * - Must be called from the run loop thread.
+ *
+ * @param[out] instrumentation      Run loop instrumentation.
+ */
+void HAPPlatformRunLoopGetInstrumentation(HAPPlatformRunLoopInstrumentation* instrumentation);
+
+/**
+ * Resets run loop instrumentation.
+ *
+ * - Must be called from the run loop thread.
+ */
+void HAPPlatformRunLoopResetInstrumentation(void);
+
+/**
+ * Logs run loop instrumentation.
+ *
+ * - Must be called from the run loop thread.
+ */
+void HAPPlatformRunLoopLogInstrumentation(void);
+#endif
+
 #if __has_feature(nullability)
 #pragma clang assume_nonnull end
 #endif
@@ -27,8 +27,11 @@ extern "C" {
 
 #include <net/if.h>
 
+#include "sdkconfig.h"
+
 #include "HAPPlatform.h"
 #include "HAPPlatformFileHandle.h"
+#include "HAPPlatformRunLoop+Init.h"
 
 #if __has_feature(nullability)
 #pragma clang assume_nonnull begin
@@ -38,8 +41,9 @@ extern "C" {
  * TCP stream manager implementation for POSIX.
  *
  * The following limitations apply if this code is not modified:
- * - Non-null values for the option interfaceName are ignored on platforms without support for the socket option
- *   SO_BINDTODEVICE which binds the socket to a particular network interface.
+ * - The option interfaceNames is ignored on platforms without support for the socket option SO_BINDTODEVICE
+ *   which binds the socket to a particular network interface.
+ * - The option userTimeout is ignored on platforms without support for the socket option TCP_USER_TIMEOUT.
  *
  * **Example**
 
@@ -54,12 +58,86 @@ extern "C" {
          .port = kHAPNetworkPort_Any,
 
            // Allocate enough concurrent TCP streams to support the IP accessory.
-           .maxConcurrentTCPStreams = kHAPIPSessionStorage_DefaultNumElements
+           .maxConcurrentTCPStreams = kHAPIPSessionStorage_DefaultNumElements,
+
+           // Optionally, only accept IPv4 connections on a single network interface.
+           .interfaceNames = (const char* const[]) { "wlan0" },
+           .numInterfaceNames = 1,
+           .addressFamily = kHAPPlatformTCPStreamManagerAddressFamily_IPv4,
+
+           // Optionally, provide static storage for the TCP streams.
+           .tcpStreams = NULL
    });
 
    @endcode
  */
 
+// Opaque type. Do not use directly.
+/**@cond */
+typedef struct HAPPlatformTCPStream HAPPlatformTCPStream;
+/**@endcond */
+
+/**
+ * Maximum number of network interfaces on which a TCP stream manager can listen separately.
+ */
+#define kHAPPlatformTCPStreamManager_MaxInterfaces ((size_t) 4)
+
+/**
+ * Number of peer addresses whose admission rate is tracked.
+ *
+ * - A peer is only forgotten once its bucket has fully refilled, as it would then start over with a full bucket
+ *   anyway. While all buckets are in use by peers that are still rate limited, connections from other peers are
+ *   refused, so that rotating through more peer addresses than there are buckets does not bypass the limit.
+ */
+#ifdef CONFIG_HAP_TCP_STREAM_MANAGER_MAX_ADMISSION_SOURCES
+#define kHAPPlatformTCPStreamManager_MaxAdmissionSources ((size_t) CONFIG_HAP_TCP_STREAM_MANAGER_MAX_ADMISSION_SOURCES)
+#else
+#define kHAPPlatformTCPStreamManager_MaxAdmissionSources ((size_t) 8)
+#endif
+
+/**
+ * Number of responses after which a TCP stream is no longer considered to be in its handshake.
+ *
+ * - Pair Verify takes two request / response exchanges before the session is secured.
+ */
+#define kHAPPlatformTCPStream_NumHandshakeResponses ((size_t) 2)
+
+/**
+ * Maximum time for which closing a TCP stream is deferred until the bytes in its send buffer have been sent.
+ */
+#define kHAPPlatformTCPStream_MaxSendBufferLingerDuration ((HAPTime)(5 * HAPSecond))
+
+/**
+ * Address family of TCP stream listeners.
+ */
+HAP_ENUM_BEGIN(uint8_t, HAPPlatformTCPStreamManagerAddressFamily) {
+    /** IPv6 and IPv4 connections. IPv4 peers are reported as IPv4-mapped IPv6 addresses. */
+    kHAPPlatformTCPStreamManagerAddressFamily_Any,
+
+    /** IPv4 connections only. */
+    kHAPPlatformTCPStreamManagerAddressFamily_IPv4,
+
+    /** IPv6 connections only. */
+    kHAPPlatformTCPStreamManagerAddressFamily_IPv6
+} HAP_ENUM_END(uint8_t, HAPPlatformTCPStreamManagerAddressFamily);
+
+/**
+ * Callback that is invoked before an idle TCP stream is evicted to admit a new connection.
+ *
+ * @param      tcpStreamManager     TCP stream manager.
+ * @param      tcpStream            TCP stream that is about to be evicted.
+ * @param      idleDuration         Time since the last activity on the TCP stream.
+ * @param      context              The context parameter given to the HAPPlatformTCPStreamManagerCreate function.
+ *
+ * @return true                     If the TCP stream may be evicted.
+ * @return false                    If the TCP stream must be kept open.
+ */
+typedef bool (*HAPPlatformTCPStreamManagerShouldEvictCallback)(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager,
+        HAPPlatformTCPStreamRef tcpStream,
+        HAPTime idleDuration,
+        void* _Nullable context);
+
 /**
  * TCP stream manager initialization options.
  */
@@ -72,11 +150,359 @@ typedef struct {
     HAPNetworkPort port;
 
     /**
-     * Maximum number of concurrent TCP streams.
+     * Names of the network interfaces on which to listen, e.g., "wlan0".
+     *
+     * - A separate listener is opened per network interface, all on the same port.
+     * - If numInterfaceNames is 0, a single listener accepts connections on all network interfaces.
+     */
+    const char* _Nonnull const* _Nullable interfaceNames;
+
+    /**
+     * Number of network interfaces in interfaceNames. At most kHAPPlatformTCPStreamManager_MaxInterfaces.
+     */
+    size_t numInterfaceNames;
+
+    /**
+     * Address family of the connections to accept.
+     */
+    HAPPlatformTCPStreamManagerAddressFamily addressFamily;
+
+    /**
+     * Maximum number of concurrent TCP streams. At most UINT16_MAX.
      */
     size_t maxConcurrentTCPStreams;
+
+    /**
+     * Storage for maxConcurrentTCPStreams TCP streams.
+     *
+     * - If NULL, the storage is allocated from the heap.
+     * - Otherwise, the storage must remain valid until the TCP stream manager is released.
+     */
+    HAPPlatformTCPStream* _Nullable tcpStreams;
+
+    /**
+     * Size of the per TCP stream receive buffer in bytes.
+     *
+     * - If 0, reads are forwarded to the socket directly.
+     * - Otherwise, each TCP stream reads ahead as many bytes as are available up to this size, and smaller reads
+     *   are served from memory. This also enables HAPPlatformTCPStreamPeek and HAPPlatformTCPStreamConsume.
+     */
+    size_t receiveBufferSize;
+
+    /**
+     * Storage for maxConcurrentTCPStreams receive buffers of receiveBufferSize bytes each.
+     *
+     * - If NULL and receiveBufferSize is not 0, the storage is allocated from the heap.
+     * - Otherwise, the storage must remain valid until the TCP stream manager is released.
+     */
+    void* _Nullable receiveBuffers;
+
+    /**
+     * Size of the per TCP stream send buffer in bytes.
+     *
+     * - If 0, writes are forwarded to the socket directly.
+     * - Otherwise, writes that fit into the send buffer are accepted without a system call and are sent together at
+     *   the end of the current run loop iteration. Several frames that are written to the same peer within one
+     *   iteration, e.g., a burst of event notifications, then leave in a single segment. Writes that do not fit are
+     *   sent immediately, together with the buffered bytes.
+     * - Closing a TCP stream, or its output, is deferred until the buffered bytes have been sent. The TCP stream
+     *   keeps occupying its slot meanwhile, for at most kHAPPlatformTCPStream_MaxSendBufferLingerDuration.
+     */
+    size_t sendBufferSize;
+
+    /**
+     * Storage for maxConcurrentTCPStreams send buffers of sendBufferSize bytes each.
+     *
+     * - If NULL and sendBufferSize is not 0, the storage is allocated from the heap.
+     * - Otherwise, the storage must remain valid until the TCP stream manager is released.
+     */
+    void* _Nullable sendBuffers;
+
+    /**
+     * Minimum idle time after which a TCP stream may be evicted to admit a new connection.
+     *
+     * - If 0, accepting is suspended while maxConcurrentTCPStreams TCP streams are open.
+     * - Otherwise, when a connection is pending while all TCP streams are in use, the least recently active
+     *   TCP stream that has been idle for at least this duration is shut down. The new connection is accepted
+     *   once the HAP layer has closed the evicted TCP stream.
+     */
+    HAPTime evictionIdleTimeout;
+
+    /**
+     * Optional callback to veto the eviction of a TCP stream, e.g., of an active admin session.
+     */
+    HAPPlatformTCPStreamManagerShouldEvictCallback _Nullable shouldEvictTCPStream;
+
+    /**
+     * Context that is passed to the shouldEvictTCPStream callback.
+     */
+    void* _Nullable shouldEvictTCPStreamContext;
+
+    /**
+     * TCP keepalive configuration of accepted TCP streams, to detect peers that disappeared without closing.
+     *
+     * - If idleTime is 0, keepalive probes are not enabled.
+     * - Times are rounded up to full seconds.
+     */
+    struct {
+        /**
+         * Idle time after which the first keepalive probe is sent.
+         */
+        HAPTime idleTime;
+
+        /**
+         * Time between unanswered keepalive probes. If 0, the network stack default is used.
+         */
+        HAPTime interval;
+
+        /**
+         * Number of unanswered keepalive probes after which the TCP stream is reset.
+         * If 0, the network stack default is used.
+         */
+        uint8_t count;
+    } keepAlive;
+
+    /**
+     * Maximum time that transmitted data may remain unacknowledged before the TCP stream is reset.
+     *
+     * - If 0, the network stack default is used.
+     */
+    HAPTime userTimeout;
+
+    /**
+     * Admission control of new connections, to keep floods of connections and Pair Verify attempts from starving
+     * the run loop.
+     *
+     * - Connections that are not admitted are reset right after they have been accepted, before the HAP layer
+     *   sees them.
+     * - Rates are token buckets: a connection is admitted if a token is available. Tokens are refilled at the
+     *   configured rate up to the configured burst.
+     */
+    struct {
+        /**
+         * Maximum sustained number of connections per second that are admitted from a single peer address.
+         * If 0, connections are not limited per peer address.
+         */
+        uint16_t sourceRate;
+
+        /**
+         * Maximum number of connections that are admitted from a single peer address in a burst.
+         * If 0, sourceRate is used.
+         */
+        uint16_t sourceBurst;
+
+        /**
+         * Maximum sustained number of connections per second that are admitted from all peers.
+         * If 0, connections are not limited globally.
+         */
+        uint16_t globalRate;
+
+        /**
+         * Maximum number of connections that are admitted from all peers in a burst. If 0, globalRate is used.
+         */
+        uint16_t globalBurst;
+
+        /**
+         * Maximum number of concurrent TCP streams that have not completed their handshake yet.
+         * If 0, the number is not limited.
+         *
+         * - See kHAPPlatformTCPStream_NumHandshakeResponses.
+         */
+        size_t maxHandshakingTCPStreams;
+    } admission;
 } HAPPlatformTCPStreamManagerOptions;
 
+/**
+ * TCP stream manager statistics.
+ */
+typedef struct {
+    /**
+     * Number of TCP streams that were accepted.
+     */
+    size_t numAcceptedTCPStreams;
+
+    /**
+     * Number of pending connections that could not be accepted due to an error.
+     */
+    size_t numRejectedTCPStreams;
+
+    /**
+     * Number of times the TCP stream listener reported pending connections.
+     */
+    size_t numAcceptBatches;
+
+    /**
+     * Largest number of TCP streams that were accepted for a single report of pending connections.
+     */
+    size_t maxAcceptBatchSize;
+
+    /**
+     * Number of times a receive buffer was filled from a TCP stream socket.
+     */
+    size_t numReceiveBufferFills;
+
+    /**
+     * Number of reads that were served from a receive buffer without a system call.
+     */
+    size_t numReceiveBufferHits;
+
+    /**
+     * Number of writes that were accepted into a send buffer without a system call.
+     */
+    size_t numBufferedWrites;
+
+    /**
+     * Number of system calls that sent only the contents of a send buffer.
+     */
+    size_t numSendBufferFlushes;
+
+    /**
+     * Number of TCP streams whose close was deferred until their send buffer had been sent.
+     */
+    size_t numDeferredCloses;
+
+    /**
+     * Number of idle TCP streams that were evicted to admit a new connection.
+     */
+    size_t numEvictedTCPStreams;
+
+    /**
+     * Number of evictions that were vetoed by the shouldEvictTCPStream callback.
+     */
+    size_t numVetoedEvictions;
+
+    /**
+     * Number of connections that were pending while all TCP streams were in use.
+     */
+    size_t numDelayedAdmissions;
+
+    /**
+     * Cumulative time connections were pending while all TCP streams were in use.
+     */
+    HAPTime totalAdmissionLatency;
+
+    /**
+     * Longest time a connection was pending while all TCP streams were in use.
+     */
+    HAPTime maxAdmissionLatency;
+
+    /**
+     * Number of connections that were refused because their peer address exceeded the per source rate.
+     */
+    size_t numSourceRateLimitedTCPStreams;
+
+    /**
+     * Number of connections that were refused because the global rate was exceeded.
+     */
+    size_t numGlobalRateLimitedTCPStreams;
+
+    /**
+     * Number of connections that were refused because too many TCP streams had not completed their handshake.
+     */
+    size_t numHandshakeLimitedTCPStreams;
+} HAPPlatformTCPStreamManagerStatistics;
+
+/**
+ * TCP stream statistics.
+ */
+typedef struct {
+    /**
+     * IPv6 address of the peer. IPv4 peers are reported as IPv4-mapped IPv6 addresses.
+     *
+     * - Zero for aggregate totals.
+     */
+    uint8_t peerAddress[16];
+
+    /**
+     * Port of the peer.
+     *
+     * - Zero for aggregate totals.
+     */
+    HAPNetworkPort peerPort;
+
+    /**
+     * Time at which the TCP stream was accepted.
+     *
+     * - Zero for aggregate totals.
+     */
+    HAPTime acceptTime;
+
+    /**
+     * Number of bytes received.
+     */
+    uint64_t numBytesReceived;
+
+    /**
+     * Number of bytes sent.
+     */
+    uint64_t numBytesSent;
+
+    /**
+     * Number of receive system calls.
+     */
+    size_t numReceiveCalls;
+
+    /**
+     * Number of send system calls.
+     */
+    size_t numSendCalls;
+
+    /**
+     * Number of receive system calls that reported that no data was available.
+     */
+    size_t numBusyReceiveCalls;
+
+    /**
+     * Number of send system calls that reported that no space was available.
+     */
+    size_t numBusySendCalls;
+
+    /**
+     * Time from accepting the TCP stream until the first byte was received.
+     *
+     * - Zero if no bytes have been received yet.
+     * - For aggregate totals, the maximum over all TCP streams.
+     */
+    HAPTime timeToFirstByte;
+
+    /**
+     * Number of responses, i.e., transitions from receiving to sending.
+     */
+    size_t numResponses;
+
+    /**
+     * Cumulative time from receiving the first byte of a request until sending the first byte of its response.
+     */
+    HAPTime totalResponseLatency;
+
+    /**
+     * Longest time from receiving the first byte of a request until sending the first byte of its response.
+     */
+    HAPTime maxResponseLatency;
+} HAPPlatformTCPStreamStatistics;
+
+/**
+ * Maximum number of buffers that are submitted to a single vectored TCP stream write.
+ *
+ * - Additional buffers are not written. The caller resubmits them after the partial write completes.
+ */
+#define kHAPPlatformTCPStream_MaxWriteBuffers ((size_t) 16)
+
+/**
+ * Buffer segment of a vectored TCP stream write.
+ */
+typedef struct {
+    /**
+     * Bytes to write.
+     */
+    const void* bytes;
+
+    /**
+     * Number of bytes to write.
+     */
+    size_t numBytes;
+} HAPPlatformTCPStreamBuffer;
+
 // Opaque type. Do not use directly.
 /**@cond */
 typedef struct {
@@ -94,7 +520,7 @@ typedef struct {
 
 // Opaque type. Do not use directly.
 /**@cond */
-typedef struct {
+struct HAPPlatformTCPStream {
     HAPPlatformTCPStreamManagerRef tcpStreamManager;
 
     int fileDescriptor;
@@ -102,7 +528,35 @@ typedef struct {
     HAPPlatformTCPStreamEvent interests;
     HAPPlatformTCPStreamEventCallback _Nullable callback;
     void* _Nullable context;
-} HAPPlatformTCPStream;
+
+    uint16_t generation;
+    HAPPlatformTCPStream* _Nullable nextFreeTCPStream;
+
+    struct {
+        uint8_t* _Nullable bytes;
+        size_t offset;
+        size_t numBytes;
+        bool isEndOfStream;
+        HAPPlatformTimerRef timer;
+    } receiveBuffer;
+
+    struct {
+        uint8_t* _Nullable bytes;
+        size_t numBytes;
+        bool isBlocked;
+        bool isOutputClosePending;
+        bool isClosePending;
+        HAPPlatformTimerRef lingerTimer;
+    } sendBuffer;
+
+    HAPPlatformTCPStreamStatistics statistics;
+    HAPTime requestStartTime;
+    bool isHandshaking;
+
+    HAPTime lastActivityTime;
+    HAPPlatformTCPStream* _Nullable lessRecentlyActiveTCPStream;
+    HAPPlatformTCPStream* _Nullable moreRecentlyActiveTCPStream;
+};
 /**@endcond */
 
 /**
@@ -113,13 +567,73 @@ struct HAPPlatformTCPStreamManager {
     /**@cond */
     size_t numTCPStreams;
     size_t maxTCPStreams;
+    size_t numHandshakingTCPStreams;
 
     struct {
         HAPNetworkPort port;
+        HAPPlatformTCPStreamManagerAddressFamily addressFamily;
+        char interfaceNames[kHAPPlatformTCPStreamManager_MaxInterfaces][IFNAMSIZ];
+        size_t numInterfaceNames;
     } tcpStreamListenerConfiguration;
 
-    HAPPlatformTCPStreamListener tcpStreamListener;
+    HAPPlatformTCPStreamListener tcpStreamListeners[kHAPPlatformTCPStreamManager_MaxInterfaces];
+    size_t numTCPStreamListeners;
+    HAPPlatformTCPStreamListener* _Nullable activeTCPStreamListener;
     HAPPlatformTCPStream* _Nullable tcpStreams;
+    HAPPlatformTCPStream* _Nullable freeTCPStreams;
+    bool ownsTCPStreams;
+
+    size_t receiveBufferSize;
+    uint8_t* _Nullable receiveBuffers;
+    bool ownsReceiveBuffers;
+
+    size_t sendBufferSize;
+    uint8_t* _Nullable sendBuffers;
+    bool ownsSendBuffers;
+    bool hasPendingSendBuffers;
+    bool isFlushObserverAdded;
+    HAPPlatformRunLoopObserver flushObserver;
+
+    HAPTime evictionIdleTimeout;
+    HAPPlatformTCPStreamManagerShouldEvictCallback _Nullable shouldEvictTCPStream;
+    void* _Nullable shouldEvictTCPStreamContext;
+    HAPPlatformTCPStream* _Nullable leastRecentlyActiveTCPStream;
+    HAPPlatformTCPStream* _Nullable mostRecentlyActiveTCPStream;
+    HAPPlatformTCPStream* _Nullable evictedTCPStream;
+    HAPPlatformTimerRef evictionTimer;
+    HAPTime admissionStartTime;
+
+    struct {
+        HAPTime idleTime;
+        HAPTime interval;
+        uint8_t count;
+    } keepAlive;
+    HAPTime userTimeout;
+
+    struct {
+        uint16_t sourceRate;
+        uint16_t sourceBurst;
+        uint16_t globalRate;
+        uint16_t globalBurst;
+        size_t maxHandshakingTCPStreams;
+
+        struct {
+            uint32_t tokens;
+            HAPTime lastRefillTime;
+        } globalBucket;
+
+        struct {
+            uint8_t peerAddress[16];
+            uint32_t tokens;
+            HAPTime lastRefillTime;
+        } sourceBuckets[kHAPPlatformTCPStreamManager_MaxAdmissionSources];
+        size_t numSourceBuckets;
+    } admission;
+
+    size_t numAcceptAttempts;
+    HAPError lastAcceptError;
+    HAPPlatformTCPStreamManagerStatistics statistics;
+    HAPPlatformTCPStreamStatistics closedTCPStreamStatistics;
     /**@endcond */
 };
 
@@ -142,6 +656,136 @@ void HAPPlatformTCPStreamManagerCreate(
  */
 void HAPPlatformTCPStreamManagerRelease(HAPPlatformTCPStreamManagerRef tcpStreamManager);
 
+/**
+ * Fetches TCP stream manager statistics.
+ *
+ * @param      tcpStreamManager     TCP stream manager.
+ * @param[out] statistics           TCP stream manager statistics.
+ */
+void HAPPlatformTCPStreamManagerGetStatistics(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager,
+        HAPPlatformTCPStreamManagerStatistics* statistics);
+
+/**
+ * Fetches statistics of a TCP stream.
+ *
+ * @param      tcpStreamManager     TCP stream manager.
+ * @param      tcpStream            TCP stream.
+ * @param[out] statistics           TCP stream statistics.
+ */
+void HAPPlatformTCPStreamGetStatistics(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager,
+        HAPPlatformTCPStreamRef tcpStream,
+        HAPPlatformTCPStreamStatistics* statistics);
+
+/**
+ * Callback that should be invoked for each open TCP stream.
+ *
+ * @param      context              Context.
+ * @param      tcpStreamManager     TCP stream manager.
+ * @param      tcpStream            TCP stream.
+ * @param      statistics           Statistics of the TCP stream.
+ * @param[in,out] shouldContinue    True if enumeration shall continue, False otherwise. Is set to true on input.
+ */
+typedef void (*HAPPlatformTCPStreamManagerEnumerateTCPStreamsCallback)(
+        void* _Nullable context,
+        HAPPlatformTCPStreamManagerRef tcpStreamManager,
+        HAPPlatformTCPStreamRef tcpStream,
+        const HAPPlatformTCPStreamStatistics* statistics,
+        bool* shouldContinue);
+
+/**
+ * Enumerates all open TCP streams together with their statistics.
+ *
+ * - The callback may close the TCP stream it is invoked for, but must not accept new TCP streams.
+ *
+ * @param      tcpStreamManager     TCP stream manager.
+ * @param      callback             Function to call on each open TCP stream.
+ * @param      context              Context that is passed to the callback.
+ */
+void HAPPlatformTCPStreamManagerEnumerateTCPStreams(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager,
+        HAPPlatformTCPStreamManagerEnumerateTCPStreamsCallback callback,
+        void* _Nullable context);
+
+/**
+ * Fetches the aggregate statistics of all TCP streams, including those that have already been closed.
+ *
+ * @param      tcpStreamManager     TCP stream manager.
+ * @param[out] statistics           Aggregate TCP stream statistics.
+ */
+void HAPPlatformTCPStreamManagerGetTCPStreamStatisticsTotals(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager,
+        HAPPlatformTCPStreamStatistics* statistics);
+
+/**
+ * Returns the contiguous region of received bytes that has not been consumed yet.
+ *
+ * - If no bytes are buffered, the receive buffer is refilled from the socket first.
+ *
+ * - The returned bytes remain valid and may be modified in place until HAPPlatformTCPStreamConsume,
+ *   HAPPlatformTCPStreamRead or HAPPlatformTCPStreamClose is called on the TCP stream.
+ *
+ * - The TCP stream manager must have been created with a non-zero receiveBufferSize.
+ *
+ * @param      tcpStreamManager     TCP stream manager.
+ * @param      tcpStream            TCP stream.
+ * @param[out] bytes                Buffered bytes.
+ * @param[out] numBytes             Number of buffered bytes. 0 if the peer closed its output.
+ *
+ * @return kHAPError_None           If successful.
+ * @return kHAPError_Unknown        If an unknown error occurred while reading.
+ * @return kHAPError_Busy           If no data can be read at this time. Retry later.
+ */
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformTCPStreamPeek(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager,
+        HAPPlatformTCPStreamRef tcpStream,
+        void* _Nullable* _Nonnull bytes,
+        size_t* numBytes);
+
+/**
+ * Discards bytes from the front of the receive buffer after they have been processed.
+ *
+ * @param      tcpStreamManager     TCP stream manager.
+ * @param      tcpStream            TCP stream.
+ * @param      numBytes             Number of bytes to discard. Must not exceed the number returned by the last peek.
+ */
+void HAPPlatformTCPStreamConsume(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager,
+        HAPPlatformTCPStreamRef tcpStream,
+        size_t numBytes);
+
+/**
+ * Writes the contents of multiple buffers to a TCP stream in a single system call.
+ *
+ * - The buffers are written in order as if they were concatenated. This allows framing headers, payloads and
+ *   authentication tags that live in separate buffers to be sent without first copying them together.
+ *
+ * - Like HAPPlatformTCPStreamWrite, the write may be partial. Only the first kHAPPlatformTCPStream_MaxWriteBuffers
+ *   buffers are considered.
+ *
+ * - If the TCP stream manager has been created with a non-zero sendBufferSize, the write may be buffered and sent at
+ *   the end of the current run loop iteration, like HAPPlatformTCPStreamWrite.
+ *
+ * @param      tcpStreamManager     TCP stream manager.
+ * @param      tcpStream            TCP stream.
+ * @param      buffers              Buffers to write.
+ * @param      numBuffers           Number of buffers.
+ * @param[out] numBytes             Total number of bytes written.
+ *
+ * @return kHAPError_None           If successful.
+ * @return kHAPError_Unknown        If an unknown error occurred while writing.
+ * @return kHAPError_Busy           If no data can be written at this time. Retry later.
+ */
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformTCPStreamWritev(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager,
+        HAPPlatformTCPStreamRef tcpStream,
+        const HAPPlatformTCPStreamBuffer* buffers,
+        size_t numBuffers,
+        size_t* numBytes);
+
 #if __has_feature(nullability)
 #pragma clang assume_nonnull end
 #endif
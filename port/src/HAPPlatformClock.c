@@ -23,9 +23,43 @@
 #include <time.h>
 
 #include "HAPPlatform.h"
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformClock+Init.h"
 
 static const HAPLogObject logObject = { .subsystem = kHAPPlatform_LogSubsystem, .category = "Clock" };
 
+/**
+ * Time that was returned by the most recent call to HAPPlatformClockGetCurrent.
+ *
+ * - Accessed atomically, as HAPPlatformClockGetCurrent may be called from any task and 64-bit stores are not atomic
+ *   on 32-bit targets.
+ */
+static HAPTime cachedNow;
+
+#if HAVE_VIRTUAL_TIME
+/**
+ * Current virtual time.
+ */
+static HAPTime virtualNow;
+
+HAPTime HAPPlatformClockGetCurrent(void) {
+    __atomic_store_n(&cachedNow, virtualNow, __ATOMIC_RELAXED);
+    return virtualNow;
+}
+
+void HAPPlatformClockSetVirtualTime(HAPTime now) {
+    HAPPrecondition(now >= virtualNow);
+
+    // Check for overflow.
+    if (now & (1ull << 63)) {
+        HAPLog(&logObject, "Time overflowed (capped at 2^63 - 1).");
+        HAPFatalError();
+    }
+
+    virtualNow = now;
+    __atomic_store_n(&cachedNow, now, __ATOMIC_RELAXED);
+}
+#else
 HAPTime HAPPlatformClockGetCurrent(void) {
     int e;
 
@@ -93,5 +127,41 @@ HAPTime HAPPlatformClockGetCurrent(void) {
     }
 
     previousNow = now;
+    __atomic_store_n(&cachedNow, now, __ATOMIC_RELAXED);
+    return now;
+}
+#endif
+
+HAPTime HAPPlatformClockGetCurrentCoarse(void) {
+    HAPTime now = __atomic_load_n(&cachedNow, __ATOMIC_RELAXED);
+    if (!now) {
+        return HAPPlatformClockGetCurrent();
+    }
     return now;
 }
+
+uint64_t HAPPlatformClockGetCurrentMicroseconds(void) {
+    int e;
+#if defined(CLOCK_MONOTONIC)
+    struct timespec t;
+    e = clock_gettime(CLOCK_MONOTONIC, &t);
+    if (e) {
+        int _errno = errno;
+        HAPAssert(e == -1);
+        HAPLogError(&logObject, "clock_gettime failed: %d.", _errno);
+        HAPFatalError();
+    }
+    return (uint64_t) t.tv_sec * 1000000 + (uint64_t) t.tv_nsec / 1000;
+#else
+    // Portable fallback clock. Susceptible to jumps of the system time, which are only tolerable for measurements.
+    struct timeval t;
+    e = gettimeofday(&t, NULL);
+    if (e) {
+        int _errno = errno;
+        HAPAssert(e == -1);
+        HAPLogError(&logObject, "gettimeofday failed: %d.", _errno);
+        HAPFatalError();
+    }
+    return (uint64_t) t.tv_sec * 1000000 + (uint64_t) t.tv_usec;
+#endif
+}
@@ -0,0 +1,1232 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Log-structured key-value store for POSIX hosts, selected with CONFIG_HAP_KEY_VALUE_STORE_BACKEND_FILE.
+//
+// The log file starts with a header of kLogHeaderSize bytes (magic and version), followed by records:
+//
+//   uint32_t checksum  CRC-32 of the rest of the record header and the value.
+//   uint8_t  type      kLogRecordType_Set, kLogRecordType_Remove or kLogRecordType_PurgeDomain.
+//   uint8_t  domain
+//   uint8_t  key       0 for kLogRecordType_PurgeDomain.
+//   uint8_t  reserved  0.
+//   uint32_t numBytes  Length of the value that follows. 0 unless kLogRecordType_Set.
+//
+// Integers are little-endian. Each mutation appends one record and syncs the file before returning, so a mutation is
+// either fully applied or, if the record is torn by a crash, discarded when the log is replayed on initialization.
+// The in-memory index maps each existing key to the offset of its value in the log. Once superseded records make up
+// both compactionThreshold bytes and half of the log, the live records are rewritten to a new file that atomically
+// replaces the log.
+
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformKeyValueStore+Init.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const HAPLogObject logObject = { .subsystem = kHAPPlatform_LogSubsystem, .category = "KeyValueStore" };
+
+/** Magic at the start of the log file, including the format version. */
+static const uint8_t kLogMagic[] = { 'H', 'A', 'P', 'K', 'V', 'L', 'O', 'G', 1, 0, 0, 0 };
+
+/** Size of the log file header. */
+#define kLogHeaderSize sizeof kLogMagic
+
+/** Size of a record header. */
+#define kLogRecordHeaderSize ((size_t) 12)
+
+/**
+ * Record types.
+ */
+typedef enum {
+    /** Sets the value of a key. */
+    kLogRecordType_Set = 1,
+
+    /** Removes a key. */
+    kLogRecordType_Remove = 2,
+
+    /** Removes all keys of a domain. */
+    kLogRecordType_PurgeDomain = 3
+} LogRecordType;
+
+/**
+ * Index entry of an existing key.
+ */
+struct HAPPlatformKeyValueStoreLogEntry {
+    /** Offset of the value in the log file, or in valueBytes for a read-only store. */
+    uint32_t offset;
+
+    /** Length of the value. */
+    uint32_t numBytes;
+
+    /** Domain. */
+    HAPPlatformKeyValueStoreDomain domain;
+
+    /** Key. */
+    HAPPlatformKeyValueStoreKey key;
+};
+typedef struct HAPPlatformKeyValueStoreLogEntry LogEntry;
+
+static uint32_t ReadUInt32(const uint8_t* bytes) {
+    HAPPrecondition(bytes);
+
+    return (uint32_t) bytes[0] | (uint32_t) bytes[1] << 8 | (uint32_t) bytes[2] << 16 | (uint32_t) bytes[3] << 24;
+}
+
+static void WriteUInt32(uint8_t* bytes, uint32_t value) {
+    HAPPrecondition(bytes);
+
+    bytes[0] = (uint8_t) value;
+    bytes[1] = (uint8_t)(value >> 8);
+    bytes[2] = (uint8_t)(value >> 16);
+    bytes[3] = (uint8_t)(value >> 24);
+}
+
+/**
+ * Updates a CRC-32 (IEEE 802.3) checksum.
+ *
+ * @param      checksum             Checksum of the preceding bytes. 0 for the first bytes.
+ * @param      bytes                Bytes.
+ * @param      numBytes             Length of bytes.
+ *
+ * @return Checksum including the bytes.
+ */
+HAP_RESULT_USE_CHECK
+static uint32_t UpdateChecksum(uint32_t checksum, const void* bytes, size_t numBytes) {
+    HAPPrecondition(bytes || !numBytes);
+
+    static const uint32_t kNibbleTable[] = { 0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4,
+                                             0x4DB26158, 0x5005713C, 0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+                                             0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C };
+
+    const uint8_t* b = bytes;
+    checksum = ~checksum;
+    for (size_t i = 0; i < numBytes; i++) {
+        checksum ^= b[i];
+        checksum = (checksum >> 4) ^ kNibbleTable[checksum & 0xF];
+        checksum = (checksum >> 4) ^ kNibbleTable[checksum & 0xF];
+    }
+    return ~checksum;
+}
+
+/**
+ * Parses two hex digits.
+ *
+ * @param      digits               Hex digits.
+ * @param[out] value                Byte.
+ *
+ * @return true                     If both characters are hex digits.
+ * @return false                    Otherwise.
+ */
+HAP_RESULT_USE_CHECK
+static bool ParseHexDigits(const char digits[2], uint8_t* value) {
+    HAPPrecondition(digits);
+    HAPPrecondition(value);
+
+    *value = 0;
+    for (size_t i = 0; i < 2; i++) {
+        char c = digits[i];
+        uint8_t nibble;
+        if (c >= '0' && c <= '9') {
+            nibble = (uint8_t)(c - '0');
+        } else if (c >= 'A' && c <= 'F') {
+            nibble = (uint8_t)(c - 'A' + 10);
+        } else if (c >= 'a' && c <= 'f') {
+            nibble = (uint8_t)(c - 'a' + 10);
+        } else {
+            return false;
+        }
+        *value = (uint8_t)((*value << 4) | nibble);
+    }
+    return true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/**
+ * Returns the position of the first index entry that is not ordered before a key.
+ *
+ * - Index entries are ordered by domain, then by key.
+ *
+ * @param      keyValueStore        Key-value store.
+ * @param      domain               Domain.
+ * @param      key                  Key.
+ *
+ * @return Position of the first index entry with the same or a greater domain and key.
+ */
+HAP_RESULT_USE_CHECK
+static size_t GetLogEntryPosition(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreKey key) {
+    HAPPrecondition(keyValueStore);
+
+    uint16_t value = (uint16_t)(domain << 8 | key);
+    size_t lower = 0;
+    size_t upper = keyValueStore->numLogEntries;
+    while (lower < upper) {
+        size_t middle = lower + (upper - lower) / 2;
+        const LogEntry* entry = &keyValueStore->logEntries[middle];
+        if ((uint16_t)(entry->domain << 8 | entry->key) < value) {
+            lower = middle + 1;
+        } else {
+            upper = middle;
+        }
+    }
+    return lower;
+}
+
+/**
+ * Returns the index entry of a key.
+ *
+ * @param      keyValueStore        Key-value store.
+ * @param      domain               Domain.
+ * @param      key                  Key.
+ *
+ * @return Index entry of the key, if the key exists. NULL otherwise.
+ */
+HAP_RESULT_USE_CHECK
+static LogEntry* _Nullable FindLogEntry(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreKey key) {
+    HAPPrecondition(keyValueStore);
+
+    size_t i = GetLogEntryPosition(keyValueStore, domain, key);
+    if (i < keyValueStore->numLogEntries && keyValueStore->logEntries[i].domain == domain &&
+        keyValueStore->logEntries[i].key == key) {
+        return &keyValueStore->logEntries[i];
+    }
+    return NULL;
+}
+
+/**
+ * Records in the index where the value of a key is stored.
+ *
+ * - Live log bytes are updated for the new record and for the record it supersedes.
+ *
+ * @param      keyValueStore        Key-value store.
+ * @param      domain               Domain.
+ * @param      key                  Key.
+ * @param      offset               Offset of the value.
+ * @param      numBytes             Length of the value.
+ */
+static void SetLogEntry(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreKey key,
+        uint32_t offset,
+        uint32_t numBytes) {
+    HAPPrecondition(keyValueStore);
+
+    size_t i = GetLogEntryPosition(keyValueStore, domain, key);
+    if (i < keyValueStore->numLogEntries && keyValueStore->logEntries[i].domain == domain &&
+        keyValueStore->logEntries[i].key == key) {
+        keyValueStore->numLiveLogBytes -= kLogRecordHeaderSize + keyValueStore->logEntries[i].numBytes;
+    } else {
+        if (keyValueStore->numLogEntries == keyValueStore->maxLogEntries) {
+            size_t maxLogEntries = keyValueStore->maxLogEntries ? 2 * keyValueStore->maxLogEntries : 16;
+            LogEntry* logEntries = realloc(keyValueStore->logEntries, maxLogEntries * sizeof *logEntries);
+            if (!logEntries) {
+                HAPLogError(&logObject, "Growing key-value store index failed: out of memory.");
+                HAPFatalError();
+            }
+            keyValueStore->logEntries = logEntries;
+            keyValueStore->maxLogEntries = maxLogEntries;
+        }
+        LogEntry* entry = &keyValueStore->logEntries[i];
+        memmove(&entry[1], entry, (keyValueStore->numLogEntries - i) * sizeof *entry);
+        keyValueStore->numLogEntries++;
+        entry->domain = domain;
+        entry->key = key;
+    }
+    keyValueStore->logEntries[i].offset = offset;
+    keyValueStore->logEntries[i].numBytes = numBytes;
+    keyValueStore->numLiveLogBytes += kLogRecordHeaderSize + numBytes;
+}
+
+/**
+ * Removes a key from the index.
+ *
+ * @param      keyValueStore        Key-value store.
+ * @param      domain               Domain.
+ * @param      key                  Key.
+ */
+static void RemoveLogEntry(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreKey key) {
+    HAPPrecondition(keyValueStore);
+
+    LogEntry* entry = FindLogEntry(keyValueStore, domain, key);
+    if (entry) {
+        size_t i = (size_t)(entry - keyValueStore->logEntries);
+        keyValueStore->numLiveLogBytes -= kLogRecordHeaderSize + entry->numBytes;
+        memmove(entry, &entry[1], (keyValueStore->numLogEntries - i - 1) * sizeof *entry);
+        keyValueStore->numLogEntries--;
+    }
+}
+
+/**
+ * Removes all keys of a domain from the index.
+ *
+ * @param      keyValueStore        Key-value store.
+ * @param      domain               Domain.
+ */
+static void RemoveLogDomain(HAPPlatformKeyValueStoreRef keyValueStore, HAPPlatformKeyValueStoreDomain domain) {
+    HAPPrecondition(keyValueStore);
+
+    size_t start = GetLogEntryPosition(keyValueStore, domain, 0);
+    size_t end = start;
+    while (end < keyValueStore->numLogEntries && keyValueStore->logEntries[end].domain == domain) {
+        keyValueStore->numLiveLogBytes -= kLogRecordHeaderSize + keyValueStore->logEntries[end].numBytes;
+        end++;
+    }
+    memmove(&keyValueStore->logEntries[start],
+            &keyValueStore->logEntries[end],
+            (keyValueStore->numLogEntries - end) * sizeof *keyValueStore->logEntries);
+    keyValueStore->numLogEntries -= end - start;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/**
+ * Writes bytes to a file at an offset, retrying partial writes.
+ *
+ * @param      fileDescriptor       File descriptor.
+ * @param      bytes                Bytes.
+ * @param      numBytes             Length of bytes.
+ * @param      offset               Offset in the file.
+ *
+ * @return true                     If successful.
+ * @return false                    If an error occurred. errno is set.
+ */
+HAP_RESULT_USE_CHECK
+static bool WriteFile(int fileDescriptor, const void* bytes, size_t numBytes, size_t offset) {
+    HAPPrecondition(bytes || !numBytes);
+
+    const uint8_t* b = bytes;
+    while (numBytes) {
+        ssize_t n = pwrite(fileDescriptor, b, numBytes, (off_t) offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        b += n;
+        numBytes -= (size_t) n;
+        offset += (size_t) n;
+    }
+    return true;
+}
+
+/**
+ * Reads bytes from a file at an offset, retrying partial reads.
+ *
+ * @param      fileDescriptor       File descriptor.
+ * @param[out] bytes                Buffer.
+ * @param      numBytes             Number of bytes to read.
+ * @param      offset               Offset in the file.
+ *
+ * @return true                     If successful.
+ * @return false                    If an error occurred or the file ended. errno is set.
+ */
+HAP_RESULT_USE_CHECK
+static bool ReadFile(int fileDescriptor, void* bytes, size_t numBytes, size_t offset) {
+    HAPPrecondition(bytes || !numBytes);
+
+    uint8_t* b = bytes;
+    while (numBytes) {
+        ssize_t n = pread(fileDescriptor, b, numBytes, (off_t) offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n == 0) {
+            errno = EIO;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        b += n;
+        numBytes -= (size_t) n;
+        offset += (size_t) n;
+    }
+    return true;
+}
+
+/**
+ * Reads a whole file into a newly allocated buffer.
+ *
+ * @param      path                 Path of the file.
+ * @param[out] numBytes             Length of the file.
+ *
+ * @return NUL-terminated contents of the file, to be freed by the caller, if successful. NULL otherwise.
+ */
+HAP_RESULT_USE_CHECK
+static uint8_t* _Nullable ReadWholeFile(const char* path, size_t* numBytes) {
+    HAPPrecondition(path);
+    HAPPrecondition(numBytes);
+
+    int fileDescriptor = open(path, O_RDONLY | O_CLOEXEC);
+    if (fileDescriptor < 0) {
+        HAPLogError(&logObject, "Opening %s failed: %d.", path, errno);
+        return NULL;
+    }
+    struct stat st;
+    uint8_t* bytes = NULL;
+    if (fstat(fileDescriptor, &st) == 0) {
+        *numBytes = (size_t) st.st_size;
+        // NUL-terminate, so that the contents may be parsed as a string.
+        bytes = malloc(*numBytes + 1);
+        if (bytes && !ReadFile(fileDescriptor, bytes, *numBytes, 0)) {
+            HAPPlatformFreeSafe(bytes);
+        }
+        if (bytes) {
+            bytes[*numBytes] = '\0';
+        }
+    }
+    if (!bytes) {
+        HAPLogError(&logObject, "Reading %s failed: %d.", path, errno);
+    }
+    (void) close(fileDescriptor);
+    return bytes;
+}
+
+/**
+ * Syncs the directory containing a file, so that a newly created or renamed file survives a crash.
+ *
+ * @param      path                 Path of the file.
+ *
+ * @return true                     If successful.
+ * @return false                    If an error occurred.
+ */
+HAP_RESULT_USE_CHECK
+static bool SyncDirectory(const char* path) {
+    HAPPrecondition(path);
+
+    const char* separator = strrchr(path, '/');
+    char* directory = separator ? strndup(path, (size_t)(separator - path + 1)) : strdup(".");
+    if (!directory) {
+        return false;
+    }
+    int fileDescriptor = open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    HAPPlatformFreeSafe(directory);
+    if (fileDescriptor < 0) {
+        return false;
+    }
+    bool result = fsync(fileDescriptor) == 0;
+    (void) close(fileDescriptor);
+    return result;
+}
+
+/**
+ * Drops the memory mapping of the log file.
+ *
+ * @param      keyValueStore        Key-value store.
+ */
+static void UnmapLog(HAPPlatformKeyValueStoreRef keyValueStore) {
+    HAPPrecondition(keyValueStore);
+
+    if (keyValueStore->mappedBytes) {
+        (void) munmap(keyValueStore->mappedBytes, keyValueStore->numMappedBytes);
+        keyValueStore->mappedBytes = NULL;
+        keyValueStore->numMappedBytes = 0;
+    }
+}
+
+/**
+ * Reads the value of a key.
+ *
+ * - Values of read-only stores are held in RAM. Otherwise, values are read from the log file, through a memory
+ *   mapping if enabled. The mapping is extended once the log has grown past it.
+ *
+ * @param      keyValueStore        Key-value store.
+ * @param      entry                Index entry of the key.
+ * @param[out] bytes                Buffer.
+ * @param      numBytes             Number of bytes to read.
+ *
+ * @return kHAPError_None           If successful.
+ * @return kHAPError_Unknown        If reading failed.
+ */
+HAP_RESULT_USE_CHECK
+static HAPError ReadValue(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        const LogEntry* entry,
+        void* bytes,
+        size_t numBytes) {
+    HAPPrecondition(keyValueStore);
+    HAPPrecondition(entry);
+    HAPPrecondition(bytes || !numBytes);
+    HAPPrecondition(numBytes <= entry->numBytes);
+
+    if (keyValueStore->read_only) {
+        HAPAssert(keyValueStore->valueBytes);
+        HAPRawBufferCopyBytes(bytes, &keyValueStore->valueBytes[entry->offset], numBytes);
+        return kHAPError_None;
+    }
+
+    if (keyValueStore->useMemoryMappedReads) {
+        if ((size_t) entry->offset + numBytes > keyValueStore->numMappedBytes) {
+            UnmapLog(keyValueStore);
+            void* mappedBytes =
+                    mmap(NULL, keyValueStore->numLogBytes, PROT_READ, MAP_SHARED, keyValueStore->fileDescriptor, 0);
+            if (mappedBytes != MAP_FAILED) {
+                keyValueStore->mappedBytes = mappedBytes;
+                keyValueStore->numMappedBytes = keyValueStore->numLogBytes;
+            } else {
+                HAPLog(&logObject, "Mapping key-value store log failed: %d. Using pread.", errno);
+            }
+        }
+        if (keyValueStore->mappedBytes) {
+            HAPRawBufferCopyBytes(bytes, &keyValueStore->mappedBytes[entry->offset], numBytes);
+            return kHAPError_None;
+        }
+    }
+
+    if (!ReadFile(keyValueStore->fileDescriptor, bytes, numBytes, entry->offset)) {
+        HAPLogError(&logObject, "Reading key-value store log failed: %d.", errno);
+        return kHAPError_Unknown;
+    }
+    return kHAPError_None;
+}
+
+/**
+ * Serializes a record header.
+ *
+ * @param[out] header               Record header.
+ * @param      type                 Record type.
+ * @param      domain               Domain.
+ * @param      key                  Key.
+ * @param      bytes                Value.
+ * @param      numBytes             Length of value.
+ */
+static void GetRecordHeader(
+        uint8_t header[kLogRecordHeaderSize],
+        LogRecordType type,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreKey key,
+        const void* _Nullable bytes,
+        size_t numBytes) {
+    HAPPrecondition(header);
+    HAPPrecondition(bytes || !numBytes);
+    HAPPrecondition(numBytes <= UINT32_MAX);
+
+    header[4] = (uint8_t) type;
+    header[5] = domain;
+    header[6] = key;
+    header[7] = 0;
+    WriteUInt32(&header[8], (uint32_t) numBytes);
+    uint32_t checksum = UpdateChecksum(0, &header[4], kLogRecordHeaderSize - 4);
+    WriteUInt32(&header[0], UpdateChecksum(checksum, bytes, numBytes));
+}
+
+static void HandleCompactionTimerExpired(HAPPlatformTimerRef timer, void* _Nullable context);
+
+/**
+ * Compacts the log once superseded records make up both the compaction threshold and half of the log.
+ *
+ * - Compaction is scheduled on the run loop, so that it does not delay the current request. If no timer is available,
+ *   the log is compacted immediately.
+ *
+ * @param      keyValueStore        Key-value store.
+ */
+static void ScheduleCompaction(HAPPlatformKeyValueStoreRef keyValueStore);
+
+/**
+ * Appends a record to the log and syncs it to disk.
+ *
+ * - If the record cannot be written completely, the log is truncated to its previous length.
+ *
+ * @param      keyValueStore        Key-value store.
+ * @param      type                 Record type.
+ * @param      domain               Domain.
+ * @param      key                  Key.
+ * @param      bytes                Value.
+ * @param      numBytes             Length of value.
+ * @param[out] valueOffset          Offset of the value in the log file.
+ *
+ * @return kHAPError_None           If successful.
+ * @return kHAPError_Unknown        If the record could not be written.
+ */
+HAP_RESULT_USE_CHECK
+static HAPError AppendRecord(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        LogRecordType type,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreKey key,
+        const void* _Nullable bytes,
+        size_t numBytes,
+        uint32_t* valueOffset) {
+    HAPPrecondition(keyValueStore);
+    HAPPrecondition(bytes || !numBytes);
+    HAPPrecondition(valueOffset);
+
+    if (keyValueStore->read_only) {
+        HAPLogError(&logObject, "Key-value store %s is read-only.", keyValueStore->part_name);
+        return kHAPError_Unknown;
+    }
+    size_t offset = keyValueStore->numLogBytes;
+    if (numBytes > UINT32_MAX - kLogRecordHeaderSize - offset) {
+        HAPLogError(&logObject, "Key-value store log is full.");
+        return kHAPError_Unknown;
+    }
+
+    uint8_t header[kLogRecordHeaderSize];
+    GetRecordHeader(header, type, domain, key, bytes, numBytes);
+    if (!WriteFile(keyValueStore->fileDescriptor, header, sizeof header, offset) ||
+        !WriteFile(keyValueStore->fileDescriptor, bytes, numBytes, offset + sizeof header)) {
+        HAPLogError(&logObject, "Appending to key-value store log failed: %d.", errno);
+        (void) ftruncate(keyValueStore->fileDescriptor, (off_t) offset);
+        return kHAPError_Unknown;
+    }
+    keyValueStore->statistics.numFlashWrites++;
+    if (fdatasync(keyValueStore->fileDescriptor)) {
+        HAPLogError(&logObject, "Syncing key-value store log failed: %d.", errno);
+        (void) ftruncate(keyValueStore->fileDescriptor, (off_t) offset);
+        return kHAPError_Unknown;
+    }
+    keyValueStore->statistics.numFlashCommits++;
+
+    keyValueStore->numLogBytes = offset + sizeof header + numBytes;
+    *valueOffset = (uint32_t)(offset + sizeof header);
+    return kHAPError_None;
+}
+
+/**
+ * Rewrites the live records to a new log file that replaces the current one.
+ *
+ * @param      keyValueStore        Key-value store.
+ *
+ * @return kHAPError_None           If successful.
+ * @return kHAPError_Unknown        If an error occurred. The current log file is kept.
+ */
+HAP_RESULT_USE_CHECK
+static HAPError CompactLog(HAPPlatformKeyValueStoreRef keyValueStore) {
+    HAPPrecondition(keyValueStore);
+    HAPPrecondition(!keyValueStore->read_only);
+
+    size_t numBytes = keyValueStore->numLiveLogBytes;
+    uint8_t* bytes = malloc(numBytes);
+    if (!bytes) {
+        HAPLog(&logObject, "Not enough memory to compact key-value store log.");
+        return kHAPError_Unknown;
+    }
+
+    // Live records are written in index order, so their offsets can be recomputed once the new log is in place.
+    HAPRawBufferCopyBytes(bytes, kLogMagic, kLogHeaderSize);
+    size_t offset = kLogHeaderSize;
+    for (size_t i = 0; i < keyValueStore->numLogEntries; i++) {
+        const LogEntry* entry = &keyValueStore->logEntries[i];
+        uint8_t* value = &bytes[offset + kLogRecordHeaderSize];
+        HAPError err = ReadValue(keyValueStore, entry, value, entry->numBytes);
+        if (err) {
+            HAPPlatformFreeSafe(bytes);
+            return err;
+        }
+        GetRecordHeader(&bytes[offset], kLogRecordType_Set, entry->domain, entry->key, value, entry->numBytes);
+        offset += kLogRecordHeaderSize + entry->numBytes;
+    }
+    HAPAssert(offset == numBytes);
+
+    size_t numPathBytes = HAPStringGetNumBytes(keyValueStore->part_name);
+    static const char kSuffix[] = ".compact";
+    char* path = malloc(numPathBytes + sizeof kSuffix);
+    if (!path) {
+        HAPLog(&logObject, "Not enough memory to compact key-value store log.");
+        HAPPlatformFreeSafe(bytes);
+        return kHAPError_Unknown;
+    }
+    HAPRawBufferCopyBytes(path, keyValueStore->part_name, numPathBytes);
+    HAPRawBufferCopyBytes(&path[numPathBytes], kSuffix, sizeof kSuffix);
+
+    int fileDescriptor = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    bool isCompacted = fileDescriptor >= 0 && WriteFile(fileDescriptor, bytes, numBytes, 0) &&
+                       fsync(fileDescriptor) == 0 && rename(path, keyValueStore->part_name) == 0;
+    HAPPlatformFreeSafe(bytes);
+    if (!isCompacted) {
+        HAPLogError(&logObject, "Compacting key-value store log failed: %d.", errno);
+        if (fileDescriptor >= 0) {
+            (void) close(fileDescriptor);
+            (void) unlink(path);
+        }
+        HAPPlatformFreeSafe(path);
+        return kHAPError_Unknown;
+    }
+    HAPPlatformFreeSafe(path);
+    if (!SyncDirectory(keyValueStore->part_name)) {
+        HAPLog(&logObject, "Syncing directory of key-value store log failed: %d.", errno);
+    }
+
+    UnmapLog(keyValueStore);
+    (void) close(keyValueStore->fileDescriptor);
+    keyValueStore->fileDescriptor = fileDescriptor;
+    HAPLogInfo(&logObject, "Compacted key-value store log from %zu to %zu bytes.", keyValueStore->numLogBytes,
+               numBytes);
+    keyValueStore->numLogBytes = numBytes;
+
+    offset = kLogHeaderSize;
+    for (size_t i = 0; i < keyValueStore->numLogEntries; i++) {
+        keyValueStore->logEntries[i].offset = (uint32_t)(offset + kLogRecordHeaderSize);
+        offset += kLogRecordHeaderSize + keyValueStore->logEntries[i].numBytes;
+    }
+    keyValueStore->statistics.numCompactions++;
+    return kHAPError_None;
+}
+
+static void HandleCompactionTimerExpired(HAPPlatformTimerRef timer, void* _Nullable context) {
+    HAPAssert(timer);
+    HAPAssert(context);
+
+    HAPPlatformKeyValueStoreRef keyValueStore = context;
+    HAPAssert(timer == keyValueStore->compactionTimer);
+    keyValueStore->compactionTimer = 0;
+
+    HAPError err = CompactLog(keyValueStore);
+    if (err) {
+        HAPLog(&logObject, "Key-value store log remains uncompacted.");
+    }
+}
+
+static void ScheduleCompaction(HAPPlatformKeyValueStoreRef keyValueStore) {
+    HAPPrecondition(keyValueStore);
+
+    size_t numSupersededBytes = keyValueStore->numLogBytes - keyValueStore->numLiveLogBytes;
+    if (keyValueStore->compactionTimer || numSupersededBytes < keyValueStore->compactionThreshold ||
+        numSupersededBytes < keyValueStore->numLiveLogBytes) {
+        return;
+    }
+
+    HAPError err = HAPPlatformTimerRegister(
+            &keyValueStore->compactionTimer, 0, HandleCompactionTimerExpired, keyValueStore);
+    if (err) {
+        HAPAssert(err == kHAPError_OutOfResources);
+        keyValueStore->compactionTimer = 0;
+        err = CompactLog(keyValueStore);
+        if (err) {
+            HAPLog(&logObject, "Key-value store log remains uncompacted.");
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/**
+ * Replays the log file into the index.
+ *
+ * - A new log file is initialized with its header.
+ * - Replay stops at the first record that is incomplete or has an invalid checksum. The log is truncated there.
+ *
+ * @param      keyValueStore        Key-value store.
+ */
+static void ReplayLog(HAPPlatformKeyValueStoreRef keyValueStore) {
+    HAPPrecondition(keyValueStore);
+
+    struct stat st;
+    if (fstat(keyValueStore->fileDescriptor, &st)) {
+        HAPLogError(&logObject, "Reading key-value store log %s failed: %d.", keyValueStore->part_name, errno);
+        HAPFatalError();
+    }
+    if (!st.st_size) {
+        if (!WriteFile(keyValueStore->fileDescriptor, kLogMagic, kLogHeaderSize, 0) ||
+            fsync(keyValueStore->fileDescriptor) || !SyncDirectory(keyValueStore->part_name)) {
+            HAPLogError(&logObject, "Initializing key-value store log %s failed: %d.", keyValueStore->part_name, errno);
+            HAPFatalError();
+        }
+        keyValueStore->numLogBytes = kLogHeaderSize;
+        keyValueStore->numLiveLogBytes = kLogHeaderSize;
+        return;
+    }
+    if ((uintmax_t) st.st_size > UINT32_MAX) {
+        HAPLogError(&logObject, "Key-value store log %s is too large.", keyValueStore->part_name);
+        HAPFatalError();
+    }
+
+    size_t numBytes = (size_t) st.st_size;
+    uint8_t* bytes = malloc(numBytes);
+    if (!bytes) {
+        HAPLogError(&logObject, "Allocating key-value store log buffer failed: out of memory.");
+        HAPFatalError();
+    }
+    if (!ReadFile(keyValueStore->fileDescriptor, bytes, numBytes, 0)) {
+        HAPLogError(&logObject, "Reading key-value store log %s failed: %d.", keyValueStore->part_name, errno);
+        HAPFatalError();
+    }
+    if (numBytes < kLogHeaderSize || !HAPRawBufferAreEqual(bytes, kLogMagic, kLogHeaderSize)) {
+        HAPLogError(&logObject, "%s is not a key-value store log.", keyValueStore->part_name);
+        HAPFatalError();
+    }
+
+    keyValueStore->numLiveLogBytes = kLogHeaderSize;
+    size_t numRecords = 0;
+    size_t offset = kLogHeaderSize;
+    while (numBytes - offset >= kLogRecordHeaderSize) {
+        const uint8_t* header = &bytes[offset];
+        size_t numValueBytes = ReadUInt32(&header[8]);
+        if (numValueBytes > numBytes - offset - kLogRecordHeaderSize) {
+            break;
+        }
+        const uint8_t* value = &header[kLogRecordHeaderSize];
+        uint32_t checksum = UpdateChecksum(0, &header[4], kLogRecordHeaderSize - 4);
+        if (UpdateChecksum(checksum, value, numValueBytes) != ReadUInt32(&header[0])) {
+            break;
+        }
+
+        HAPPlatformKeyValueStoreDomain domain = header[5];
+        HAPPlatformKeyValueStoreKey key = header[6];
+        switch (header[4]) {
+            case kLogRecordType_Set: {
+                SetLogEntry(
+                        keyValueStore,
+                        domain,
+                        key,
+                        (uint32_t)(offset + kLogRecordHeaderSize),
+                        (uint32_t) numValueBytes);
+                break;
+            }
+            case kLogRecordType_Remove: {
+                RemoveLogEntry(keyValueStore, domain, key);
+                break;
+            }
+            case kLogRecordType_PurgeDomain: {
+                RemoveLogDomain(keyValueStore, domain);
+                break;
+            }
+            default: {
+                HAPLog(&logObject, "Skipping key-value store log record of unknown type %u.", header[4]);
+                break;
+            }
+        }
+        numRecords++;
+        offset += kLogRecordHeaderSize + numValueBytes;
+    }
+    HAPPlatformFreeSafe(bytes);
+
+    if (offset != numBytes) {
+        HAPLog(&logObject,
+               "Discarding %zu bytes of incomplete records at the end of key-value store log %s.",
+               numBytes - offset,
+               keyValueStore->part_name);
+        if (ftruncate(keyValueStore->fileDescriptor, (off_t) offset) || fsync(keyValueStore->fileDescriptor)) {
+            HAPLogError(&logObject, "Truncating key-value store log %s failed: %d.", keyValueStore->part_name, errno);
+            HAPFatalError();
+        }
+        keyValueStore->statistics.numDiscardedLogBytes = numBytes - offset;
+    }
+    keyValueStore->numLogBytes = offset;
+    HAPLogInfo(&logObject, "Replayed %zu records of key-value store log %s: %zu keys, %zu of %zu bytes live.",
+               numRecords, keyValueStore->part_name, keyValueStore->numLogEntries, keyValueStore->numLiveLogBytes,
+               keyValueStore->numLogBytes);
+}
+
+/**
+ * Appends a value to the values of a read-only store.
+ *
+ * @param      keyValueStore        Key-value store.
+ * @param      domain               Domain.
+ * @param      key                  Key.
+ * @param      bytes                Value.
+ * @param      numBytes             Length of value.
+ */
+static void AddValue(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreKey key,
+        const void* _Nullable bytes,
+        size_t numBytes) {
+    HAPPrecondition(keyValueStore);
+    HAPPrecondition(bytes || !numBytes);
+
+    if (numBytes > UINT32_MAX - keyValueStore->numValueBytes) {
+        HAPLogError(&logObject, "Values of key-value store %s are too large.", keyValueStore->part_name);
+        HAPFatalError();
+    }
+    uint8_t* valueBytes = realloc(keyValueStore->valueBytes, keyValueStore->numValueBytes + numBytes + 1);
+    if (!valueBytes) {
+        HAPLogError(&logObject, "Allocating key-value store values failed: out of memory.");
+        HAPFatalError();
+    }
+    keyValueStore->valueBytes = valueBytes;
+    if (numBytes) {
+        HAPRawBufferCopyBytes(&valueBytes[keyValueStore->numValueBytes], HAPNonnullVoid(bytes), numBytes);
+    }
+    SetLogEntry(keyValueStore, domain, key, (uint32_t) keyValueStore->numValueBytes, (uint32_t) numBytes);
+    keyValueStore->numValueBytes += numBytes;
+}
+
+/**
+ * Decodes hex text in place, ignoring whitespace.
+ *
+ * @param      bytes                Hex text. Receives the decoded bytes.
+ * @param      numBytes             Length of hex text.
+ * @param[out] numDecodedBytes      Length of decoded bytes.
+ *
+ * @return true                     If the text is valid hex.
+ * @return false                    Otherwise.
+ */
+HAP_RESULT_USE_CHECK
+static bool DecodeHex(char* bytes, size_t numBytes, size_t* numDecodedBytes) {
+    HAPPrecondition(bytes);
+    HAPPrecondition(numDecodedBytes);
+
+    char digits[2];
+    size_t numDigits = 0;
+    *numDecodedBytes = 0;
+    for (size_t i = 0; i < numBytes; i++) {
+        char c = bytes[i];
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            continue;
+        }
+        digits[numDigits++] = c;
+        if (numDigits == 2) {
+            uint8_t value;
+            if (!ParseHexDigits(digits, &value)) {
+                return false;
+            }
+            bytes[(*numDecodedBytes)++] = (char) value;
+            numDigits = 0;
+        }
+    }
+    return numDigits == 0;
+}
+
+/**
+ * Loads a read-only store from a CSV file in the format of tools/accessory_setup/accessory_setup.csv.
+ *
+ * - Each row has the columns key, type, encoding and value. A row of type "namespace" selects the domain of the
+ *   following rows, e.g., "hap.40" for domain 0x40 with namespace prefix "hap". Rows in other namespaces are ignored.
+ * - Keys are two hex digits. Values of type "file" are read from the named file, relative to the CSV file. Values of
+ *   type "data" are given inline. Encodings "binary" and "string" are taken verbatim, "hex2bin" is decoded from hex.
+ *
+ * @param      keyValueStore        Key-value store.
+ * @param      namespace_prefix     Prefix of namespace names.
+ */
+static void LoadCSV(HAPPlatformKeyValueStoreRef keyValueStore, const char* namespace_prefix) {
+    HAPPrecondition(keyValueStore);
+    HAPPrecondition(namespace_prefix);
+
+    size_t numBytes;
+    char* bytes = (char*) ReadWholeFile(keyValueStore->part_name, &numBytes);
+    if (!bytes) {
+        HAPLogError(&logObject, "Loading key-value store %s failed.", keyValueStore->part_name);
+        HAPFatalError();
+    }
+    size_t numPrefixBytes = HAPStringGetNumBytes(namespace_prefix);
+    const char* separator = strrchr(keyValueStore->part_name, '/');
+    size_t numDirectoryBytes = separator ? (size_t)(separator - keyValueStore->part_name + 1) : 0;
+
+    bool hasDomain = false;
+    HAPPlatformKeyValueStoreDomain domain = 0;
+    size_t lineStart = 0;
+    for (size_t lineNumber = 1; lineStart < numBytes; lineNumber++) {
+        size_t lineEnd = lineStart;
+        while (lineEnd < numBytes && bytes[lineEnd] != '\n') {
+            lineEnd++;
+        }
+        size_t nextLineStart = lineEnd + 1;
+        if (lineEnd > lineStart && bytes[lineEnd - 1] == '\r') {
+            lineEnd--;
+        }
+        bytes[lineEnd] = '\0';
+
+        // Split the line into key, type, encoding and value. The value extends to the end of the line.
+        char* columns[4] = { &bytes[lineStart], NULL, NULL, NULL };
+        size_t numColumns = 1;
+        for (size_t i = lineStart; i < lineEnd && numColumns < HAPArrayCount(columns); i++) {
+            if (bytes[i] == ',') {
+                bytes[i] = '\0';
+                columns[numColumns++] = &bytes[i + 1];
+            }
+        }
+        lineStart = nextLineStart;
+        if (numColumns < 2 || (lineNumber == 1 && HAPStringAreEqual(columns[0], "key"))) {
+            continue;
+        }
+        const char* type = columns[1];
+        const char* encoding = columns[2] ? columns[2] : "";
+        char* value = columns[3] ? columns[3] : &bytes[lineEnd];
+
+        if (HAPStringAreEqual(type, "namespace")) {
+            const char* name = columns[0];
+            hasDomain = HAPStringGetNumBytes(name) == numPrefixBytes + 3 &&
+                        HAPRawBufferAreEqual(name, namespace_prefix, numPrefixBytes) && name[numPrefixBytes] == '.' &&
+                        ParseHexDigits(&name[numPrefixBytes + 1], &domain);
+            continue;
+        }
+        HAPPlatformKeyValueStoreKey key;
+        if (!hasDomain || HAPStringGetNumBytes(columns[0]) != 2 || !ParseHexDigits(columns[0], &key)) {
+            HAPLog(&logObject, "%s:%zu: Skipping row.", keyValueStore->part_name, lineNumber);
+            continue;
+        }
+
+        char* valueBytes;
+        size_t numValueBytes;
+        char* fileBytes = NULL;
+        if (HAPStringAreEqual(type, "file")) {
+            size_t numValuePathBytes = HAPStringGetNumBytes(value);
+            char* path = malloc(numDirectoryBytes + numValuePathBytes + 1);
+            if (!path) {
+                HAPLogError(&logObject, "Allocating path failed: out of memory.");
+                HAPFatalError();
+            }
+            size_t o = value[0] == '/' ? 0 : numDirectoryBytes;
+            HAPRawBufferCopyBytes(path, keyValueStore->part_name, o);
+            HAPRawBufferCopyBytes(&path[o], value, numValuePathBytes + 1);
+            fileBytes = (char*) ReadWholeFile(path, &numValueBytes);
+            HAPPlatformFreeSafe(path);
+            if (!fileBytes) {
+                HAPLogError(&logObject, "Loading key-value store %s failed.", keyValueStore->part_name);
+                HAPFatalError();
+            }
+            valueBytes = fileBytes;
+        } else if (HAPStringAreEqual(type, "data")) {
+            valueBytes = value;
+            numValueBytes = HAPStringGetNumBytes(value);
+        } else {
+            HAPLog(&logObject, "%s:%zu: Skipping row of type %s.", keyValueStore->part_name, lineNumber, type);
+            continue;
+        }
+
+        if (HAPStringAreEqual(encoding, "hex2bin")) {
+            if (!DecodeHex(valueBytes, numValueBytes, &numValueBytes)) {
+                HAPLogError(&logObject, "%s:%zu: Invalid hex value.", keyValueStore->part_name, lineNumber);
+                HAPFatalError();
+            }
+        } else if (!HAPStringAreEqual(encoding, "binary") && !HAPStringAreEqual(encoding, "string")) {
+            HAPLog(&logObject, "%s:%zu: Skipping row of encoding %s.", keyValueStore->part_name, lineNumber, encoding);
+            if (fileBytes) {
+                HAPPlatformFreeSafe(fileBytes);
+            }
+            continue;
+        }
+        AddValue(keyValueStore, domain, key, valueBytes, numValueBytes);
+        if (fileBytes) {
+            HAPPlatformFreeSafe(fileBytes);
+        }
+    }
+    HAPPlatformFreeSafe(bytes);
+
+    HAPLogInfo(&logObject, "Loaded %zu keys of key-value store %s.", keyValueStore->numLogEntries,
+               keyValueStore->part_name);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void HAPPlatformKeyValueStoreCreate(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        const HAPPlatformKeyValueStoreOptions* options) {
+    HAPPrecondition(keyValueStore);
+    HAPPrecondition(options);
+    HAPPrecondition(options->part_name);
+    HAPPrecondition(options->namespace_prefix);
+    HAPPrecondition(
+            HAPStringGetNumBytes(options->namespace_prefix) <= kHAPPlatformKeyValueStore_MaxNamespacePrefixLength);
+
+    HAPRawBufferZero(keyValueStore, sizeof *keyValueStore);
+    keyValueStore->part_name = strdup(options->part_name);
+    if (!keyValueStore->part_name) {
+        HAPLogError(&logObject, "Allocating key-value store path failed: out of memory.");
+        HAPFatalError();
+    }
+    keyValueStore->read_only = options->read_only;
+    keyValueStore->fileDescriptor = -1;
+    keyValueStore->useMemoryMappedReads = options->useMemoryMappedReads;
+    keyValueStore->compactionThreshold = options->compactionThreshold ?
+                                                 options->compactionThreshold :
+                                                 kHAPPlatformKeyValueStore_DefaultCompactionThreshold;
+
+    if (keyValueStore->read_only) {
+        LoadCSV(keyValueStore, options->namespace_prefix);
+    } else {
+        keyValueStore->fileDescriptor = open(keyValueStore->part_name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (keyValueStore->fileDescriptor < 0) {
+            HAPLogError(&logObject, "Opening key-value store log %s failed: %d.", keyValueStore->part_name, errno);
+            HAPFatalError();
+        }
+        ReplayLog(keyValueStore);
+    }
+
+    HAPLog(&logObject, "keyValueStore %s Initialised", keyValueStore->part_name);
+}
+
+void HAPPlatformKeyValueStoreRelease(HAPPlatformKeyValueStoreRef keyValueStore) {
+    HAPPrecondition(keyValueStore);
+    HAPPrecondition(keyValueStore->part_name);
+
+    if (keyValueStore->compactionTimer) {
+        HAPPlatformTimerDeregister(keyValueStore->compactionTimer);
+        keyValueStore->compactionTimer = 0;
+    }
+    UnmapLog(keyValueStore);
+    if (keyValueStore->fileDescriptor >= 0) {
+        (void) close(keyValueStore->fileDescriptor);
+        keyValueStore->fileDescriptor = -1;
+    }
+    if (keyValueStore->valueBytes) {
+        HAPPlatformFreeSafe(keyValueStore->valueBytes);
+    }
+    if (keyValueStore->logEntries) {
+        HAPPlatformFreeSafe(keyValueStore->logEntries);
+    }
+    keyValueStore->numLogEntries = 0;
+    keyValueStore->maxLogEntries = 0;
+    HAPPlatformFreeSafe(keyValueStore->part_name);
+}
+
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformKeyValueStoreFlush(HAPPlatformKeyValueStoreRef keyValueStore) {
+    HAPPrecondition(keyValueStore);
+
+    return kHAPError_None;
+}
+
+void HAPPlatformKeyValueStoreGetStatistics(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreStatistics* statistics) {
+    HAPPrecondition(keyValueStore);
+    HAPPrecondition(statistics);
+
+    *statistics = keyValueStore->statistics;
+}
+
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformKeyValueStoreGet(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreKey key,
+        void* _Nullable const bytes,
+        size_t maxBytes,
+        size_t* _Nullable numBytes,
+        bool* found) {
+    HAPPrecondition(keyValueStore);
+    HAPPrecondition(!maxBytes || bytes);
+    HAPPrecondition((bytes == NULL) == (numBytes == NULL));
+    HAPPrecondition(found);
+
+    const LogEntry* entry = FindLogEntry(keyValueStore, domain, key);
+    *found = entry != NULL;
+    if (!entry || !bytes) {
+        keyValueStore->statistics.numIndexedGets++;
+        return kHAPError_None;
+    }
+
+    HAPAssert(numBytes);
+    *numBytes = entry->numBytes < maxBytes ? entry->numBytes : maxBytes;
+    HAPError err = ReadValue(keyValueStore, entry, HAPNonnullVoid(bytes), *numBytes);
+    if (err) {
+        *found = false;
+        return err;
+    }
+    return kHAPError_None;
+}
+
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformKeyValueStoreSet(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreKey key,
+        const void* bytes,
+        size_t numBytes) {
+    HAPPrecondition(keyValueStore);
+    HAPPrecondition(bytes);
+
+    HAPLogBufferDebug(&logObject, bytes, numBytes, "Write %02X.%02X", domain, key);
+
+    keyValueStore->statistics.numSets++;
+    uint32_t offset;
+    HAPError err = AppendRecord(keyValueStore, kLogRecordType_Set, domain, key, bytes, numBytes, &offset);
+    if (err) {
+        return err;
+    }
+    SetLogEntry(keyValueStore, domain, key, offset, (uint32_t) numBytes);
+    ScheduleCompaction(keyValueStore);
+    return kHAPError_None;
+}
+
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformKeyValueStoreRemove(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreKey key) {
+    HAPPrecondition(keyValueStore);
+
+    keyValueStore->statistics.numRemoves++;
+    if (!FindLogEntry(keyValueStore, domain, key)) {
+        return kHAPError_None;
+    }
+    uint32_t offset;
+    HAPError err = AppendRecord(keyValueStore, kLogRecordType_Remove, domain, key, NULL, 0, &offset);
+    if (err) {
+        return err;
+    }
+    RemoveLogEntry(keyValueStore, domain, key);
+    ScheduleCompaction(keyValueStore);
+    return kHAPError_None;
+}
+
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformKeyValueStoreEnumerate(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreEnumerateCallback callback,
+        void* _Nullable context) {
+    HAPPrecondition(keyValueStore);
+    HAPPrecondition(callback);
+
+    // The next key is looked up after each callback, as callbacks may modify the domain.
+    bool shouldContinue = true;
+    size_t i = GetLogEntryPosition(keyValueStore, domain, 0);
+    while (shouldContinue && i < keyValueStore->numLogEntries && keyValueStore->logEntries[i].domain == domain) {
+        HAPPlatformKeyValueStoreKey key = keyValueStore->logEntries[i].key;
+        HAPError err = callback(context, keyValueStore, domain, key, &shouldContinue);
+        if (err) {
+            return kHAPError_Unknown;
+        }
+        if (key == UINT8_MAX) {
+            break;
+        }
+        i = GetLogEntryPosition(keyValueStore, domain, (HAPPlatformKeyValueStoreKey)(key + 1));
+    }
+    return kHAPError_None;
+}
+
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformKeyValueStorePurgeDomain(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain) {
+    HAPPrecondition(keyValueStore);
+
+    size_t i = GetLogEntryPosition(keyValueStore, domain, 0);
+    if (i == keyValueStore->numLogEntries || keyValueStore->logEntries[i].domain != domain) {
+        return kHAPError_None;
+    }
+    uint32_t offset;
+    HAPError err = AppendRecord(keyValueStore, kLogRecordType_PurgeDomain, domain, 0, NULL, 0, &offset);
+    if (err) {
+        return err;
+    }
+    RemoveLogDomain(keyValueStore, domain);
+    ScheduleCompaction(keyValueStore);
+    return kHAPError_None;
+}
@@ -18,12 +18,16 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include "HAPPlatform+Init.h"
 #include "HAPPlatformKeyValueStore+Init.h"
+#include <stdlib.h>
 #include <string.h>
 #include <nvs.h>
 #include <nvs_flash.h>
 static const HAPLogObject logObject = { .subsystem = kHAPPlatform_LogSubsystem, .category = "KeyValueStore" };
 
+static void BuildIndex(HAPPlatformKeyValueStoreRef keyValueStore);
+
 void HAPPlatformKeyValueStoreCreate(
         HAPPlatformKeyValueStoreRef keyValueStore,
         const HAPPlatformKeyValueStoreOptions* options) {
@@ -49,15 +53,244 @@ void HAPPlatformKeyValueStoreCreate(
     }
 
     keyValueStore->part_name = strdup(options->part_name);
-    keyValueStore->namespace_prefix = strdup(options->namespace_prefix);
+    if (!keyValueStore->part_name) {
+        HAPLogError(&logObject, "Allocating key-value store partition name failed: out of memory.");
+        HAPFatalError();
+    }
     keyValueStore->read_only = options->read_only;
 
+    // Namespace names are "<prefix>.<domain>". The prefix and separator are formatted once.
+    size_t namespace_prefix_length = HAPStringGetNumBytes(options->namespace_prefix);
+    HAPPrecondition(namespace_prefix_length <= kHAPPlatformKeyValueStore_MaxNamespacePrefixLength);
+    HAPRawBufferZero(keyValueStore->namespace_name, sizeof keyValueStore->namespace_name);
+    HAPRawBufferCopyBytes(keyValueStore->namespace_name, options->namespace_prefix, namespace_prefix_length);
+    keyValueStore->namespace_name[namespace_prefix_length] = '.';
+    keyValueStore->namespace_prefix_length = namespace_prefix_length + 1;
+
+    HAPRawBufferZero(keyValueStore->openNamespaces, sizeof keyValueStore->openNamespaces);
+    keyValueStore->numNamespaceUses = 0;
+
+    keyValueStore->maxWriteBackItems = options->maxWriteBackItems;
+    keyValueStore->writeBackDelay = options->writeBackDelay;
+    keyValueStore->writeBackTimer = 0;
+    if (!keyValueStore->maxWriteBackItems) {
+        keyValueStore->writeBackItems = NULL;
+        keyValueStore->ownsWriteBackItems = false;
+    } else if (options->writeBackItems) {
+        keyValueStore->writeBackItems = options->writeBackItems;
+        keyValueStore->ownsWriteBackItems = false;
+    } else {
+        keyValueStore->writeBackItems = malloc(keyValueStore->maxWriteBackItems * sizeof(HAPPlatformKeyValueStoreItem));
+        if (!keyValueStore->writeBackItems) {
+            HAPLogError(&logObject, "Allocating key-value store write-back items failed: out of memory.");
+            HAPFatalError();
+        }
+        keyValueStore->ownsWriteBackItems = true;
+    }
+    if (keyValueStore->writeBackItems) {
+        HAPRawBufferZero(
+                keyValueStore->writeBackItems, keyValueStore->maxWriteBackItems * sizeof(HAPPlatformKeyValueStoreItem));
+    }
+
+    keyValueStore->readCacheSize = options->readCacheSize;
+    keyValueStore->numReadCacheBytes = 0;
+    keyValueStore->numReadCacheUses = 0;
+    if (!keyValueStore->readCacheSize) {
+        keyValueStore->readCacheBytes = NULL;
+        keyValueStore->ownsReadCacheBytes = false;
+    } else if (options->readCacheBytes) {
+        keyValueStore->readCacheBytes = options->readCacheBytes;
+        keyValueStore->ownsReadCacheBytes = false;
+    } else {
+        keyValueStore->readCacheBytes = malloc(keyValueStore->readCacheSize);
+        if (!keyValueStore->readCacheBytes) {
+            HAPLogError(&logObject, "Allocating key-value store read cache failed: out of memory.");
+            HAPFatalError();
+        }
+        keyValueStore->ownsReadCacheBytes = true;
+    }
+    HAPPrecondition(!options->numReadCacheDomains || options->readCacheDomains);
+    HAPRawBufferZero(keyValueStore->readCacheDomains, sizeof keyValueStore->readCacheDomains);
+    for (size_t i = 0; i < HAPArrayCount(keyValueStore->readCacheDomains); i++) {
+        keyValueStore->readCacheDomains[i] = options->numReadCacheDomains ? 0 : UINT32_MAX;
+    }
+    for (size_t i = 0; i < options->numReadCacheDomains; i++) {
+        HAPPlatformKeyValueStoreDomain domain = options->readCacheDomains[i];
+        keyValueStore->readCacheDomains[domain / 32] |= (uint32_t) 1 << (domain % 32);
+    }
+
+    HAPRawBufferZero(&keyValueStore->statistics, sizeof keyValueStore->statistics);
+
+    keyValueStore->maxIndexEntries = options->maxIndexEntries;
+    keyValueStore->numIndexEntries = 0;
+    keyValueStore->isIndexValid = false;
+    if (!keyValueStore->maxIndexEntries) {
+        keyValueStore->indexEntries = NULL;
+        keyValueStore->ownsIndexEntries = false;
+    } else if (options->indexEntries) {
+        keyValueStore->indexEntries = options->indexEntries;
+        keyValueStore->ownsIndexEntries = false;
+    } else {
+        keyValueStore->indexEntries =
+                malloc(keyValueStore->maxIndexEntries * sizeof(HAPPlatformKeyValueStoreIndexEntry));
+        if (!keyValueStore->indexEntries) {
+            HAPLogError(&logObject, "Allocating key-value store index failed: out of memory.");
+            HAPFatalError();
+        }
+        keyValueStore->ownsIndexEntries = true;
+    }
+    if (keyValueStore->indexEntries) {
+        BuildIndex(keyValueStore);
+    }
+
     HAPLog(&logObject, "keyValueStore %s Initialised", keyValueStore->part_name);
 }
 
+void HAPPlatformKeyValueStoreRelease(HAPPlatformKeyValueStoreRef keyValueStore) {
+    HAPPrecondition(keyValueStore);
+    HAPPrecondition(keyValueStore->part_name);
+
+    HAPError err = HAPPlatformKeyValueStoreFlush(keyValueStore);
+    if (err) {
+        HAPLogError(&logObject, "Committing pending key-value store writes failed. Discarding them.");
+    }
+    if (keyValueStore->writeBackTimer) {
+        HAPPlatformTimerDeregister(keyValueStore->writeBackTimer);
+        keyValueStore->writeBackTimer = 0;
+    }
+    if (keyValueStore->ownsWriteBackItems) {
+        HAPPlatformFreeSafe(keyValueStore->writeBackItems);
+    }
+    if (keyValueStore->ownsReadCacheBytes) {
+        HAPPlatformFreeSafe(keyValueStore->readCacheBytes);
+    }
+    keyValueStore->readCacheBytes = NULL;
+    keyValueStore->readCacheSize = 0;
+    keyValueStore->numReadCacheBytes = 0;
+    keyValueStore->ownsReadCacheBytes = false;
+    keyValueStore->writeBackItems = NULL;
+    keyValueStore->maxWriteBackItems = 0;
+    keyValueStore->ownsWriteBackItems = false;
+    if (keyValueStore->ownsIndexEntries) {
+        HAPPlatformFreeSafe(keyValueStore->indexEntries);
+    }
+    keyValueStore->indexEntries = NULL;
+    keyValueStore->maxIndexEntries = 0;
+    keyValueStore->numIndexEntries = 0;
+    keyValueStore->ownsIndexEntries = false;
+    keyValueStore->isIndexValid = false;
+
+    for (size_t i = 0; i < HAPArrayCount(keyValueStore->openNamespaces); i++) {
+        if (keyValueStore->openNamespaces[i].isOpen) {
+            nvs_close(keyValueStore->openNamespaces[i].handle);
+            keyValueStore->openNamespaces[i].isOpen = false;
+        }
+    }
+
+    HAPPlatformFreeSafe(keyValueStore->part_name);
+}
+
+/**
+ * Formats a byte as two uppercase hex digits.
+ *
+ * @param      value                Byte.
+ * @param[out] digits               Hex digits.
+ */
+static void GetHexDigits(uint8_t value, char digits[2]) {
+    HAPPrecondition(digits);
+
+    static const char kHexDigits[] = "0123456789ABCDEF";
+    digits[0] = kHexDigits[value >> 4];
+    digits[1] = kHexDigits[value & 0xF];
+}
+
+/**
+ * Parses two hex digits as formatted by GetHexDigits.
+ *
+ * @param      digits               Hex digits.
+ * @param[out] value                Byte.
+ *
+ * @return true                     If both characters are hex digits.
+ * @return false                    Otherwise.
+ */
+HAP_RESULT_USE_CHECK
+static bool ParseHexDigits(const char digits[2], uint8_t* value) {
+    HAPPrecondition(digits);
+    HAPPrecondition(value);
+
+    *value = 0;
+    for (size_t i = 0; i < 2; i++) {
+        char c = digits[i];
+        uint8_t nibble;
+        if (c >= '0' && c <= '9') {
+            nibble = (uint8_t)(c - '0');
+        } else if (c >= 'A' && c <= 'F') {
+            nibble = (uint8_t)(c - 'A' + 10);
+        } else if (c >= 'a' && c <= 'f') {
+            nibble = (uint8_t)(c - 'a' + 10);
+        } else {
+            return false;
+        }
+        *value = (uint8_t)((*value << 4) | nibble);
+    }
+    return true;
+}
+
+/**
+ * Parses an NVS key name as formatted by GetKeyName.
+ *
+ * @param      keyname              NVS key name.
+ * @param[out] key                  Key.
+ *
+ * @return true                     If the key name is valid.
+ * @return false                    Otherwise.
+ */
+HAP_RESULT_USE_CHECK
+static bool ParseKeyName(const char* keyname, HAPPlatformKeyValueStoreKey* key) {
+    HAPPrecondition(keyname);
+    HAPPrecondition(key);
+
+    return HAPStringGetNumBytes(keyname) == 2 && ParseHexDigits(keyname, key);
+}
+
+/**
+ * Gets the NVS key name of a key.
+ *
+ * @param      key                  Key.
+ * @param[out] keyname              NVS key name.
+ */
+static void GetKeyName(HAPPlatformKeyValueStoreKey key, char keyname[3]) {
+    HAPPrecondition(keyname);
+
+    GetHexDigits(key, keyname);
+    keyname[2] = '\0';
+}
+
+/**
+ * Gets the NVS namespace name of a domain.
+ *
+ * @param      keyValueStore        Key-value store.
+ * @param      domain               Domain.
+ * @param[out] name_space           NVS namespace name.
+ */
+static void GetNamespaceName(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain,
+        char name_space[kHAPPlatformKeyValueStore_MaxNamespacePrefixLength + 4]) {
+    HAPPrecondition(keyValueStore);
+    HAPPrecondition(name_space);
+
+    size_t n = keyValueStore->namespace_prefix_length;
+    HAPRawBufferCopyBytes(name_space, keyValueStore->namespace_name, n);
+    GetHexDigits(domain, &name_space[n]);
+    name_space[n + 2] = '\0';
+}
+
 /**
  * Gets the handle for accessing the key value store.
  *
+ * - Handles are kept open and must not be closed by the caller.
+ *
  * @param       keyValueStore   Key-value store.
  * @param       domain          Domain.
  * @param[out]  store_handle    Pointer to an allocated NVS storage handle
@@ -69,10 +302,702 @@ static esp_err_t HAPPlatformKeyValueStoreGetHandle(
     nvs_handle *store_handle)
 {
     HAPPrecondition(keyValueStore);
-    HAPPrecondition(keyValueStore->namespace_prefix);
-    char name_space[15];
-    snprintf(name_space, sizeof(name_space), "%s.%02X", keyValueStore->namespace_prefix, domain);
-    return nvs_open_from_partition(keyValueStore->part_name, name_space, NVS_READWRITE, store_handle);
+    HAPPrecondition(store_handle);
+
+    keyValueStore->numNamespaceUses++;
+
+    for (size_t i = 0; i < HAPArrayCount(keyValueStore->openNamespaces); i++) {
+        if (keyValueStore->openNamespaces[i].isOpen && keyValueStore->openNamespaces[i].domain == domain) {
+            keyValueStore->openNamespaces[i].lastUse = keyValueStore->numNamespaceUses;
+            *store_handle = keyValueStore->openNamespaces[i].handle;
+            return ESP_OK;
+        }
+    }
+
+    // Use a free slot, or close the least recently used namespace.
+    size_t slot = 0;
+    for (size_t i = 0; i < HAPArrayCount(keyValueStore->openNamespaces); i++) {
+        if (!keyValueStore->openNamespaces[i].isOpen) {
+            slot = i;
+            break;
+        }
+        if (keyValueStore->openNamespaces[i].lastUse < keyValueStore->openNamespaces[slot].lastUse) {
+            slot = i;
+        }
+    }
+
+    if (keyValueStore->openNamespaces[slot].isOpen) {
+        nvs_close(keyValueStore->openNamespaces[slot].handle);
+        keyValueStore->openNamespaces[slot].isOpen = false;
+    }
+
+    char name_space[kHAPPlatformKeyValueStore_MaxNamespacePrefixLength + 4];
+    GetNamespaceName(keyValueStore, domain, name_space);
+    esp_err_t err = nvs_open_from_partition(keyValueStore->part_name, name_space, NVS_READWRITE, store_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    keyValueStore->statistics.numNamespaceOpens++;
+
+    keyValueStore->openNamespaces[slot].handle = *store_handle;
+    keyValueStore->openNamespaces[slot].domain = domain;
+    keyValueStore->openNamespaces[slot].isOpen = true;
+    keyValueStore->openNamespaces[slot].lastUse = keyValueStore->numNamespaceUses;
+    return ESP_OK;
+}
+
+/**
+ * Closes the NVS namespace of a domain, if it is open.
+ *
+ * @param       keyValueStore   Key-value store.
+ * @param       domain          Domain.
+ */
+static void HAPPlatformKeyValueStoreCloseHandle(
+    HAPPlatformKeyValueStoreRef keyValueStore,
+    HAPPlatformKeyValueStoreDomain domain)
+{
+    HAPPrecondition(keyValueStore);
+
+    for (size_t i = 0; i < HAPArrayCount(keyValueStore->openNamespaces); i++) {
+        if (keyValueStore->openNamespaces[i].isOpen && keyValueStore->openNamespaces[i].domain == domain) {
+            nvs_close(keyValueStore->openNamespaces[i].handle);
+            keyValueStore->openNamespaces[i].isOpen = false;
+        }
+    }
+}
+
+/**
+ * Returns the position of the first index entry that is not ordered before a key.
+ *
+ * - Index entries are ordered by domain, then by key.
+ *
+ * @param      keyValueStore        Key-value store.
+ * @param      domain               Domain.
+ * @param      key                  Key.
+ *
+ * @return Position of the first index entry with the same or a greater domain and key.
+ */
+HAP_RESULT_USE_CHECK
+static size_t GetIndexPosition(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreKey key) {
+    HAPPrecondition(keyValueStore);
+
+    uint16_t value = (uint16_t)(domain << 8 | key);
+    size_t lower = 0;
+    size_t upper = keyValueStore->numIndexEntries;
+    while (lower < upper) {
+        size_t middle = lower + (upper - lower) / 2;
+        const HAPPlatformKeyValueStoreIndexEntry* entry = &keyValueStore->indexEntries[middle];
+        if ((uint16_t)(entry->domain << 8 | entry->key) < value) {
+            lower = middle + 1;
+        } else {
+            upper = middle;
+        }
+    }
+    return lower;
+}
+
+/**
+ * Returns the index entry of a key.
+ *
+ * @param      keyValueStore        Key-value store.
+ * @param      domain               Domain.
+ * @param      key                  Key.
+ *
+ * @return Index entry of the key, if the key exists. NULL otherwise.
+ */
+HAP_RESULT_USE_CHECK
+static const HAPPlatformKeyValueStoreIndexEntry* _Nullable FindIndexEntry(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreKey key) {
+    HAPPrecondition(keyValueStore);
+
+    size_t i = GetIndexPosition(keyValueStore, domain, key);
+    if (i < keyValueStore->numIndexEntries && keyValueStore->indexEntries[i].domain == domain &&
+        keyValueStore->indexEntries[i].key == key) {
+        return &keyValueStore->indexEntries[i];
+    }
+    return NULL;
+}
+
+/**
+ * Records in the index that a key exists.
+ *
+ * - If the index is full, it is disabled.
+ *
+ * @param      keyValueStore        Key-value store.
+ * @param      domain               Domain.
+ * @param      key                  Key.
+ * @param      numBytes             Length of value.
+ */
+static void AddIndexEntry(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreKey key,
+        size_t numBytes) {
+    HAPPrecondition(keyValueStore);
+
+    if (!keyValueStore->isIndexValid) {
+        return;
+    }
+
+    size_t i = GetIndexPosition(keyValueStore, domain, key);
+    HAPPlatformKeyValueStoreIndexEntry* entry = &keyValueStore->indexEntries[i];
+    if (i == keyValueStore->numIndexEntries || entry->domain != domain || entry->key != key) {
+        if (keyValueStore->numIndexEntries == keyValueStore->maxIndexEntries) {
+            HAPLog(&logObject,
+                   "Key-value store index is full (%zu entries). Disabling it.",
+                   keyValueStore->maxIndexEntries);
+            keyValueStore->isIndexValid = false;
+            return;
+        }
+        memmove(&entry[1], entry, (keyValueStore->numIndexEntries - i) * sizeof *entry);
+        keyValueStore->numIndexEntries++;
+        entry->domain = domain;
+        entry->key = key;
+    }
+    entry->numBytes = (uint32_t) numBytes;
+}
+
+/**
+ * Records in the index that a key does not exist.
+ *
+ * @param      keyValueStore        Key-value store.
+ * @param      domain               Domain.
+ * @param      key                  Key.
+ */
+static void RemoveIndexEntry(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreKey key) {
+    HAPPrecondition(keyValueStore);
+
+    if (!keyValueStore->isIndexValid) {
+        return;
+    }
+
+    const HAPPlatformKeyValueStoreIndexEntry* entry = FindIndexEntry(keyValueStore, domain, key);
+    if (entry) {
+        size_t i = (size_t)(entry - keyValueStore->indexEntries);
+        memmove(&keyValueStore->indexEntries[i],
+                &keyValueStore->indexEntries[i + 1],
+                (keyValueStore->numIndexEntries - i - 1) * sizeof *entry);
+        keyValueStore->numIndexEntries--;
+    }
+}
+
+/**
+ * Removes all keys of a domain from the index.
+ *
+ * @param      keyValueStore        Key-value store.
+ * @param      domain               Domain.
+ */
+static void RemoveIndexDomain(HAPPlatformKeyValueStoreRef keyValueStore, HAPPlatformKeyValueStoreDomain domain) {
+    HAPPrecondition(keyValueStore);
+
+    if (!keyValueStore->isIndexValid) {
+        return;
+    }
+
+    size_t start = GetIndexPosition(keyValueStore, domain, 0);
+    size_t end = start;
+    while (end < keyValueStore->numIndexEntries && keyValueStore->indexEntries[end].domain == domain) {
+        end++;
+    }
+    memmove(&keyValueStore->indexEntries[start],
+            &keyValueStore->indexEntries[end],
+            (keyValueStore->numIndexEntries - end) * sizeof *keyValueStore->indexEntries);
+    keyValueStore->numIndexEntries -= end - start;
+}
+
+/**
+ * Indexes all keys of the key-value store that are stored in the NVS partition.
+ *
+ * @param      keyValueStore        Key-value store.
+ */
+static void BuildIndex(HAPPlatformKeyValueStoreRef keyValueStore) {
+    HAPPrecondition(keyValueStore);
+    HAPPrecondition(keyValueStore->indexEntries);
+
+    keyValueStore->numIndexEntries = 0;
+    keyValueStore->isIndexValid = true;
+
+    size_t n = keyValueStore->namespace_prefix_length;
+    nvs_iterator_t it = nvs_entry_find(keyValueStore->part_name, NULL, NVS_TYPE_BLOB);
+    while (it && keyValueStore->isIndexValid) {
+        nvs_entry_info_t info;
+        nvs_entry_info(it, &info);
+        it = nvs_entry_next(it);
+
+        // Skip entries that do not belong to this key-value store.
+        HAPPlatformKeyValueStoreDomain domain;
+        HAPPlatformKeyValueStoreKey key;
+        if (HAPStringGetNumBytes(info.namespace_name) != n + 2 ||
+            !HAPRawBufferAreEqual(info.namespace_name, keyValueStore->namespace_name, n) ||
+            !ParseHexDigits(&info.namespace_name[n], &domain) || !ParseKeyName(info.key, &key)) {
+            continue;
+        }
+
+        nvs_handle store_handle;
+        esp_err_t err = HAPPlatformKeyValueStoreGetHandle(keyValueStore, domain, &store_handle);
+        size_t numBytes = 0;
+        if (err == ESP_OK) {
+            err = nvs_get_blob(store_handle, info.key, NULL, &numBytes);
+        }
+        if (err != ESP_OK) {
+            HAPLogError(&logObject, "Error (%d) indexing NVS key %s.%s! Disabling index.", err, info.namespace_name,
+                        info.key);
+            keyValueStore->isIndexValid = false;
+            break;
+        }
+        AddIndexEntry(keyValueStore, domain, key, numBytes);
+    }
+    if (it) {
+        nvs_release_iterator(it);
+    }
+
+    if (keyValueStore->isIndexValid) {
+        HAPLogInfo(&logObject, "Indexed %zu keys of key-value store %s.", keyValueStore->numIndexEntries,
+                   keyValueStore->part_name);
+    } else {
+        keyValueStore->numIndexEntries = 0;
+    }
+}
+
+/**
+ * Header of a read cache entry. The value follows the header directly.
+ *
+ * - Entries are stored back to back without padding, so headers are copied in and out of the cache.
+ */
+typedef struct {
+    /** Time of the last use, in units of numReadCacheUses. */
+    uint32_t lastUse;
+
+    /** Length of the value. */
+    uint16_t numBytes;
+
+    /** Domain. */
+    HAPPlatformKeyValueStoreDomain domain;
+
+    /** Key. */
+    HAPPlatformKeyValueStoreKey key;
+
+    /** Whether the key exists. If false, the entry records that the key is absent. */
+    bool found;
+} ReadCacheEntryHeader;
+
+/**
+ * Returns whether values of a domain are cached.
+ *
+ * @param      keyValueStore        Key-value store.
+ * @param      domain               Domain.
+ *
+ * @return true                     If values of the domain are cached.
+ * @return false                    Otherwise.
+ */
+HAP_RESULT_USE_CHECK
+static bool IsReadCacheDomain(HAPPlatformKeyValueStoreRef keyValueStore, HAPPlatformKeyValueStoreDomain domain) {
+    HAPPrecondition(keyValueStore);
+
+    return keyValueStore->readCacheSize &&
+           (keyValueStore->readCacheDomains[domain / 32] & ((uint32_t) 1 << (domain % 32)));
+}
+
+/**
+ * Finds the read cache entry of a key.
+ *
+ * @param      keyValueStore        Key-value store.
+ * @param      domain               Domain.
+ * @param      key                  Key.
+ * @param[out] offset               Offset of the entry in the read cache.
+ * @param[out] header               Header of the entry.
+ *
+ * @return true                     If the key is cached.
+ * @return false                    Otherwise.
+ */
+HAP_RESULT_USE_CHECK
+static bool FindReadCacheEntry(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreKey key,
+        size_t* offset,
+        ReadCacheEntryHeader* header) {
+    HAPPrecondition(keyValueStore);
+    HAPPrecondition(offset);
+    HAPPrecondition(header);
+
+    for (size_t o = 0; o < keyValueStore->numReadCacheBytes; o += sizeof *header + header->numBytes) {
+        HAPRawBufferCopyBytes(header, &keyValueStore->readCacheBytes[o], sizeof *header);
+        if (header->domain == domain && header->key == key) {
+            *offset = o;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Removes a read cache entry and moves the following entries down.
+ *
+ * @param      keyValueStore        Key-value store.
+ * @param      offset               Offset of the entry in the read cache.
+ * @param      header               Header of the entry.
+ */
+static void RemoveReadCacheEntry(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        size_t offset,
+        const ReadCacheEntryHeader* header) {
+    HAPPrecondition(keyValueStore);
+    HAPPrecondition(header);
+
+    size_t numEntryBytes = sizeof *header + header->numBytes;
+    HAPPrecondition(offset + numEntryBytes <= keyValueStore->numReadCacheBytes);
+
+    memmove(&keyValueStore->readCacheBytes[offset],
+            &keyValueStore->readCacheBytes[offset + numEntryBytes],
+            keyValueStore->numReadCacheBytes - offset - numEntryBytes);
+    keyValueStore->numReadCacheBytes -= numEntryBytes;
+}
+
+/**
+ * Removes the read cache entry of a key, if any.
+ *
+ * @param      keyValueStore        Key-value store.
+ * @param      domain               Domain.
+ * @param      key                  Key.
+ */
+static void InvalidateReadCacheEntry(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreKey key) {
+    HAPPrecondition(keyValueStore);
+
+    size_t offset;
+    ReadCacheEntryHeader header;
+    if (FindReadCacheEntry(keyValueStore, domain, key, &offset, &header)) {
+        RemoveReadCacheEntry(keyValueStore, offset, &header);
+    }
+}
+
+/**
+ * Removes all read cache entries of a domain.
+ *
+ * @param      keyValueStore        Key-value store.
+ * @param      domain               Domain.
+ */
+static void InvalidateReadCacheDomain(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain) {
+    HAPPrecondition(keyValueStore);
+
+    size_t offset = 0;
+    while (offset < keyValueStore->numReadCacheBytes) {
+        ReadCacheEntryHeader header;
+        HAPRawBufferCopyBytes(&header, &keyValueStore->readCacheBytes[offset], sizeof header);
+        if (header.domain == domain) {
+            RemoveReadCacheEntry(keyValueStore, offset, &header);
+        } else {
+            offset += sizeof header + header.numBytes;
+        }
+    }
+}
+
+/**
+ * Stores a value or the absence of a key in the read cache, evicting least recently used entries as needed.
+ *
+ * @param      keyValueStore        Key-value store.
+ * @param      domain               Domain.
+ * @param      key                  Key.
+ * @param      bytes                Value. NULL if the key is absent.
+ * @param      numBytes             Length of value.
+ */
+static void InsertReadCacheEntry(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreKey key,
+        const void* _Nullable bytes,
+        size_t numBytes) {
+    HAPPrecondition(keyValueStore);
+    HAPPrecondition(bytes || !numBytes);
+
+    if (!IsReadCacheDomain(keyValueStore, domain)) {
+        return;
+    }
+    ReadCacheEntryHeader header;
+    if (numBytes > UINT16_MAX || sizeof header + numBytes > keyValueStore->readCacheSize) {
+        return;
+    }
+
+    InvalidateReadCacheEntry(keyValueStore, domain, key);
+    while (keyValueStore->readCacheSize - keyValueStore->numReadCacheBytes < sizeof header + numBytes) {
+        size_t leastRecentlyUsedOffset = 0;
+        ReadCacheEntryHeader leastRecentlyUsedHeader;
+        HAPRawBufferCopyBytes(&leastRecentlyUsedHeader, keyValueStore->readCacheBytes, sizeof header);
+        for (size_t o = 0; o < keyValueStore->numReadCacheBytes; o += sizeof header + header.numBytes) {
+            HAPRawBufferCopyBytes(&header, &keyValueStore->readCacheBytes[o], sizeof header);
+            if (header.lastUse < leastRecentlyUsedHeader.lastUse) {
+                leastRecentlyUsedOffset = o;
+                leastRecentlyUsedHeader = header;
+            }
+        }
+        RemoveReadCacheEntry(keyValueStore, leastRecentlyUsedOffset, &leastRecentlyUsedHeader);
+        keyValueStore->statistics.numReadCacheEvictions++;
+    }
+
+    HAPRawBufferZero(&header, sizeof header);
+    header.lastUse = ++keyValueStore->numReadCacheUses;
+    header.numBytes = (uint16_t) numBytes;
+    header.domain = domain;
+    header.key = key;
+    header.found = bytes != NULL;
+    uint8_t* entryBytes = &keyValueStore->readCacheBytes[keyValueStore->numReadCacheBytes];
+    HAPRawBufferCopyBytes(entryBytes, &header, sizeof header);
+    if (numBytes) {
+        HAPRawBufferCopyBytes(&entryBytes[sizeof header], HAPNonnullVoid(bytes), numBytes);
+    }
+    keyValueStore->numReadCacheBytes += sizeof header + numBytes;
+}
+
+/**
+ * Returns the pending write of a key.
+ *
+ * @param      keyValueStore        Key-value store.
+ * @param      domain               Domain.
+ * @param      key                  Key.
+ *
+ * @return Pending write of the key, if any. NULL otherwise.
+ */
+HAP_RESULT_USE_CHECK
+static HAPPlatformKeyValueStoreItem* _Nullable FindWriteBackItem(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreKey key) {
+    HAPPrecondition(keyValueStore);
+
+    for (size_t i = 0; i < keyValueStore->maxWriteBackItems; i++) {
+        HAPPlatformKeyValueStoreItem* item = &keyValueStore->writeBackItems[i];
+        if (item->active && item->domain == domain && item->key == key) {
+            return item;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Writes a pending write to an open NVS namespace, without committing it.
+ *
+ * @param      keyValueStore        Key-value store.
+ * @param      store_handle         NVS handle of the namespace of the item's domain.
+ * @param      item                 Pending write.
+ *
+ * @return ESP_OK                   If successful.
+ * @return Other                    If an error occurred.
+ */
+HAP_RESULT_USE_CHECK
+static esp_err_t WriteWriteBackItem(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        nvs_handle store_handle,
+        const HAPPlatformKeyValueStoreItem* item) {
+    HAPPrecondition(keyValueStore);
+    HAPPrecondition(item);
+    HAPPrecondition(item->active);
+
+    char keyname[3];
+    GetKeyName(item->key, keyname);
+
+    esp_err_t err;
+    if (item->isRemoved) {
+        err = nvs_erase_key(store_handle, keyname);
+        if (err == ESP_ERR_NVS_NOT_FOUND) {
+            return ESP_OK;
+        }
+    } else {
+        err = nvs_set_blob(store_handle, keyname, item->bytes, item->numBytes);
+    }
+    if (err == ESP_OK) {
+        keyValueStore->statistics.numFlashWrites++;
+    }
+    return err;
+}
+
+static void HandleWriteBackTimerExpired(HAPPlatformTimerRef timer, void* _Nullable context) {
+    HAPAssert(timer);
+    HAPAssert(context);
+
+    HAPPlatformKeyValueStoreRef keyValueStore = context;
+    HAPAssert(timer == keyValueStore->writeBackTimer);
+    keyValueStore->writeBackTimer = 0;
+
+    HAPError err = HAPPlatformKeyValueStoreFlush(keyValueStore);
+    if (err) {
+        HAPLogError(&logObject, "Committing pending key-value store writes failed.");
+    }
+}
+
+/**
+ * Schedules pending writes to be committed after the write-back delay, unless they are already scheduled.
+ *
+ * @param      keyValueStore        Key-value store.
+ */
+static void ScheduleWriteBack(HAPPlatformKeyValueStoreRef keyValueStore) {
+    HAPPrecondition(keyValueStore);
+
+    if (!keyValueStore->writeBackDelay || keyValueStore->writeBackTimer) {
+        return;
+    }
+
+    HAPError err = HAPPlatformTimerRegister(
+            &keyValueStore->writeBackTimer,
+            HAPPlatformClockGetCurrent() + keyValueStore->writeBackDelay,
+            HandleWriteBackTimerExpired,
+            keyValueStore);
+    if (err) {
+        HAPAssert(err == kHAPError_OutOfResources);
+        HAPLog(&logObject, "Not enough resources to schedule committing pending key-value store writes.");
+        keyValueStore->writeBackTimer = 0;
+    }
+}
+
+/**
+ * Holds a set or remove in RAM instead of writing it through.
+ *
+ * - If no item is free, all pending writes are committed first.
+ *
+ * @param      keyValueStore        Key-value store.
+ * @param      domain               Domain.
+ * @param      key                  Key.
+ * @param      bytes                Value to set. NULL to remove the key.
+ * @param      numBytes             Length of value.
+ *
+ * @return kHAPError_None           If successful.
+ * @return kHAPError_Unknown        If no item could be freed.
+ */
+HAP_RESULT_USE_CHECK
+static HAPError DeferWrite(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreKey key,
+        const void* _Nullable bytes,
+        size_t numBytes) {
+    HAPPrecondition(keyValueStore);
+    HAPPrecondition(domain <= kHAPPlatformKeyValueStore_MaxWriteBackDomain);
+
+    HAPPlatformKeyValueStoreItem* item = FindWriteBackItem(keyValueStore, domain, key);
+    if (item) {
+        keyValueStore->statistics.numMergedWrites++;
+    } else {
+        for (size_t pass = 0; !item && pass < 2; pass++) {
+            if (pass) {
+                HAPError err = HAPPlatformKeyValueStoreFlush(keyValueStore);
+                if (err) {
+                    HAPLogError(&logObject, "Committing pending key-value store writes failed.");
+                }
+            }
+            for (size_t i = 0; i < keyValueStore->maxWriteBackItems; i++) {
+                if (!keyValueStore->writeBackItems[i].active) {
+                    item = &keyValueStore->writeBackItems[i];
+                    break;
+                }
+            }
+        }
+        if (!item) {
+            return kHAPError_Unknown;
+        }
+    }
+
+    HAPAssert(numBytes <= sizeof item->bytes);
+    item->active = true;
+    item->isRemoved = bytes == NULL;
+    item->domain = domain;
+    item->key = key;
+    item->numBytes = numBytes;
+    if (bytes && numBytes) {
+        HAPRawBufferCopyBytes(item->bytes, bytes, numBytes);
+    }
+    keyValueStore->statistics.numDeferredWrites++;
+
+    ScheduleWriteBack(keyValueStore);
+    return kHAPError_None;
+}
+
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformKeyValueStoreFlush(HAPPlatformKeyValueStoreRef keyValueStore) {
+    HAPPrecondition(keyValueStore);
+
+    if (keyValueStore->writeBackTimer) {
+        HAPPlatformTimerDeregister(keyValueStore->writeBackTimer);
+        keyValueStore->writeBackTimer = 0;
+    }
+
+    HAPError result = kHAPError_None;
+
+    // Write all pending writes of a domain with a single commit.
+    bool isDomainFlushed[kHAPPlatformKeyValueStore_MaxWriteBackDomain + 1];
+    HAPRawBufferZero(isDomainFlushed, sizeof isDomainFlushed);
+    for (size_t i = 0; i < keyValueStore->maxWriteBackItems; i++) {
+        const HAPPlatformKeyValueStoreItem* firstItem = &keyValueStore->writeBackItems[i];
+        if (!firstItem->active || isDomainFlushed[firstItem->domain]) {
+            continue;
+        }
+        HAPPlatformKeyValueStoreDomain domain = firstItem->domain;
+        isDomainFlushed[domain] = true;
+
+        nvs_handle store_handle;
+        esp_err_t err = HAPPlatformKeyValueStoreGetHandle(keyValueStore, domain, &store_handle);
+        if (err != ESP_OK) {
+            HAPLogError(&logObject, "Error (%d) opening NVS!", err);
+            result = kHAPError_Unknown;
+            continue;
+        }
+
+        bool needsCommit = false;
+        for (size_t j = i; j < keyValueStore->maxWriteBackItems; j++) {
+            HAPPlatformKeyValueStoreItem* item = &keyValueStore->writeBackItems[j];
+            if (!item->active || item->domain != domain) {
+                continue;
+            }
+            err = WriteWriteBackItem(keyValueStore, store_handle, item);
+            if (err != ESP_OK) {
+                HAPLogError(&logObject, "Error (%d) writing NVS key %02X.%02X!", err, domain, item->key);
+                result = kHAPError_Unknown;
+                continue;
+            }
+            item->active = false;
+            needsCommit = true;
+        }
+
+        if (needsCommit) {
+            err = nvs_commit(store_handle);
+            if (err != ESP_OK) {
+                HAPLogError(&logObject, "Error (%d) committing to NVS!", err);
+                result = kHAPError_Unknown;
+            } else {
+                keyValueStore->statistics.numFlashCommits++;
+            }
+        }
+    }
+
+    // Retry failed writes later.
+    for (size_t i = 0; i < keyValueStore->maxWriteBackItems; i++) {
+        if (keyValueStore->writeBackItems[i].active) {
+            ScheduleWriteBack(keyValueStore);
+            break;
+        }
+    }
+
+    return result;
+}
+
+void HAPPlatformKeyValueStoreGetStatistics(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreStatistics* statistics) {
+    HAPPrecondition(keyValueStore);
+    HAPPrecondition(statistics);
+
+    *statistics = keyValueStore->statistics;
 }
 
 HAP_RESULT_USE_CHECK
@@ -89,6 +1014,49 @@ HAPError HAPPlatformKeyValueStoreGet(
     HAPPrecondition((bytes == NULL) == (numBytes == NULL));
     HAPPrecondition(found);
 
+    const HAPPlatformKeyValueStoreItem* item = FindWriteBackItem(keyValueStore, domain, key);
+    if (item) {
+        // Values that do not fit are reported as not found, like nvs_get_blob does. NVS may still hold an older value.
+        *found = !item->isRemoved && (!bytes || item->numBytes <= maxBytes);
+        if (*found && bytes) {
+            HAPAssert(numBytes);
+            *numBytes = item->numBytes;
+            HAPRawBufferCopyBytes(HAPNonnullVoid(bytes), item->bytes, *numBytes);
+        }
+        return kHAPError_None;
+    }
+
+    // Absent keys and existence queries do not need to read from flash.
+    if (keyValueStore->isIndexValid) {
+        const HAPPlatformKeyValueStoreIndexEntry* entry = FindIndexEntry(keyValueStore, domain, key);
+        if (!entry || !bytes) {
+            keyValueStore->statistics.numIndexedGets++;
+            *found = entry != NULL;
+            return kHAPError_None;
+        }
+    }
+
+    if (IsReadCacheDomain(keyValueStore, domain)) {
+        size_t offset;
+        ReadCacheEntryHeader header;
+        // Values that do not fit are left to NVS so that the result matches an uncached get.
+        if (FindReadCacheEntry(keyValueStore, domain, key, &offset, &header) &&
+            (!bytes || !header.found || header.numBytes <= maxBytes)) {
+            keyValueStore->statistics.numReadCacheHits++;
+            header.lastUse = ++keyValueStore->numReadCacheUses;
+            HAPRawBufferCopyBytes(&keyValueStore->readCacheBytes[offset], &header, sizeof header);
+            *found = header.found;
+            if (*found && bytes) {
+                HAPAssert(numBytes);
+                *numBytes = header.numBytes;
+                HAPRawBufferCopyBytes(
+                        HAPNonnullVoid(bytes), &keyValueStore->readCacheBytes[offset + sizeof header], *numBytes);
+            }
+            return kHAPError_None;
+        }
+        keyValueStore->statistics.numReadCacheMisses++;
+    }
+
     nvs_handle store_handle;
 
     esp_err_t err;
@@ -99,23 +1067,27 @@ HAPError HAPPlatformKeyValueStoreGet(
         return kHAPError_Unknown;
     }
 
-    char keyname[15]; /* 15 is max key length for NVS */
-    snprintf(keyname, sizeof(keyname), "%02X", key);
+    char keyname[3];
+    GetKeyName(key, keyname);
 
     size_t num_bytes = maxBytes;
 
     *found = false;
     err = nvs_get_blob(store_handle, keyname, bytes, &num_bytes);
-    nvs_close(store_handle);
-    /* Checking error code after nvs_close(), because the close has to be called in any case */
     if (err != ESP_OK) {
         HAPLog(&logObject, "Error (%d). Key %02X not found in KeyStore", err, key);
+        if (err == ESP_ERR_NVS_NOT_FOUND) {
+            InsertReadCacheEntry(keyValueStore, domain, key, NULL, 0);
+        }
         return kHAPError_None;
     }
     *found = true;
     if(numBytes != NULL){
         *numBytes = num_bytes;
     }
+    if (bytes) {
+        InsertReadCacheEntry(keyValueStore, domain, key, bytes, num_bytes);
+    }
 
     return kHAPError_None;
 }
@@ -132,6 +1104,23 @@ HAPError HAPPlatformKeyValueStoreSet(
 
     HAPLogBufferDebug(&logObject, bytes, numBytes, "Write %02X.%02X", domain, key);
 
+    keyValueStore->statistics.numSets++;
+    InvalidateReadCacheEntry(keyValueStore, domain, key);
+    if (keyValueStore->maxWriteBackItems && domain <= kHAPPlatformKeyValueStore_MaxWriteBackDomain) {
+        if (numBytes <= sizeof keyValueStore->writeBackItems->bytes) {
+            HAPError err = DeferWrite(keyValueStore, domain, key, bytes, numBytes);
+            if (!err) {
+                AddIndexEntry(keyValueStore, domain, key, numBytes);
+            }
+            return err;
+        }
+        // Values that do not fit are written through, superseding a pending write of the key.
+        HAPPlatformKeyValueStoreItem* item = FindWriteBackItem(keyValueStore, domain, key);
+        if (item) {
+            item->active = false;
+        }
+    }
+
     nvs_handle store_handle;
     esp_err_t err;
     err = HAPPlatformKeyValueStoreGetHandle(keyValueStore, domain, &store_handle);
@@ -140,22 +1129,22 @@ HAPError HAPPlatformKeyValueStoreSet(
         return kHAPError_Unknown;
     }
 
-    char keyname[15]; /* 15 is max key length for NVS */
-    snprintf(keyname, sizeof(keyname), "%02X", key);
+    char keyname[3];
+    GetKeyName(key, keyname);
     err = nvs_set_blob(store_handle, keyname, (const void *) bytes, (size_t) numBytes);
     if (err != ESP_OK) {
         HAPLogError(&logObject, "Error (%d) setting NVS blob!", err);
-        nvs_close(store_handle);
         return kHAPError_Unknown;
     }
+    keyValueStore->statistics.numFlashWrites++;
+    AddIndexEntry(keyValueStore, domain, key, numBytes);
 
     err = nvs_commit(store_handle);
-    nvs_close(store_handle);
-    /* Checking error code after nvs_close(), because the close has to be called in any case */
     if (err != ESP_OK) {
         HAPLogError(&logObject, "Error (%d) committing to NVS!", err);
         return kHAPError_Unknown;
     }
+    keyValueStore->statistics.numFlashCommits++;
 
     return kHAPError_None;
 }
@@ -167,6 +1156,16 @@ HAPError HAPPlatformKeyValueStoreRemove(
         HAPPlatformKeyValueStoreKey key) {
     HAPPrecondition(keyValueStore);
 
+    keyValueStore->statistics.numRemoves++;
+    InvalidateReadCacheEntry(keyValueStore, domain, key);
+    if (keyValueStore->maxWriteBackItems && domain <= kHAPPlatformKeyValueStore_MaxWriteBackDomain) {
+        HAPError err = DeferWrite(keyValueStore, domain, key, NULL, 0);
+        if (!err) {
+            RemoveIndexEntry(keyValueStore, domain, key);
+        }
+        return err;
+    }
+
     nvs_handle store_handle;
     esp_err_t err;
     err = HAPPlatformKeyValueStoreGetHandle(keyValueStore, domain, &store_handle);
@@ -175,22 +1174,22 @@ HAPError HAPPlatformKeyValueStoreRemove(
         return kHAPError_Unknown;
     }
 
-    char keyname[15]; /* 15 is max key length for NVS */
-    snprintf(keyname, sizeof(keyname), "%02X", key);
+    char keyname[3];
+    GetKeyName(key, keyname);
     err = nvs_erase_key(store_handle, keyname);
     if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
         HAPLogError(&logObject, "Error (%d) erasing NVS key!", err);
-        nvs_close(store_handle);
         return kHAPError_Unknown;
     }
+    keyValueStore->statistics.numFlashWrites++;
+    RemoveIndexEntry(keyValueStore, domain, key);
 
     err = nvs_commit(store_handle);
-    nvs_close(store_handle);
-    /* Checking error code after nvs_close(), because the close has to be called in any case */
     if (err != ESP_OK) {
         HAPLogError(&logObject, "Error (%d) committing to NVS!", err);
         return kHAPError_Unknown;
     }
+    keyValueStore->statistics.numFlashCommits++;
 
     return kHAPError_None;
 }
@@ -204,20 +1203,63 @@ HAPError HAPPlatformKeyValueStoreEnumerate(
     HAPPrecondition(keyValueStore);
     HAPPrecondition(callback);
 
+    // The index reflects pending writes. The next key is looked up after each callback, as callbacks may modify the
+    // domain.
+    if (keyValueStore->isIndexValid) {
+        bool shouldContinue = true;
+        size_t i = GetIndexPosition(keyValueStore, domain, 0);
+        while (shouldContinue && keyValueStore->isIndexValid && i < keyValueStore->numIndexEntries &&
+               keyValueStore->indexEntries[i].domain == domain) {
+            HAPPlatformKeyValueStoreKey key = keyValueStore->indexEntries[i].key;
+            HAPError err = callback(context, keyValueStore, domain, key, &shouldContinue);
+            if (err) {
+                return kHAPError_Unknown;
+            }
+            if (key == UINT8_MAX) {
+                break;
+            }
+            i = GetIndexPosition(keyValueStore, domain, (HAPPlatformKeyValueStoreKey)(key + 1));
+        }
+        return kHAPError_None;
+    }
+
+    // Pending writes are committed first, so that enumeration reflects them.
+    for (size_t i = 0; i < keyValueStore->maxWriteBackItems; i++) {
+        if (keyValueStore->writeBackItems[i].active && keyValueStore->writeBackItems[i].domain == domain) {
+            HAPError err = HAPPlatformKeyValueStoreFlush(keyValueStore);
+            if (err) {
+                return err;
+            }
+            break;
+        }
+    }
+
     bool shouldContinue = true;
-    char name_space[15];
-    snprintf(name_space, sizeof(name_space), "%s.%02X", keyValueStore->namespace_prefix, domain);
+    char name_space[kHAPPlatformKeyValueStore_MaxNamespacePrefixLength + 4];
+    GetNamespaceName(keyValueStore, domain, name_space);
 
     nvs_iterator_t it = nvs_entry_find(keyValueStore->part_name, name_space, NVS_TYPE_BLOB);
     while (it != NULL && shouldContinue) {
         nvs_entry_info_t info;
         nvs_entry_info(it, &info);
         it = nvs_entry_next(it);
-        HAPError hap_err = callback(context, keyValueStore, domain, (HAPPlatformKeyValueStoreKey)atoi(info.key), &shouldContinue);
-            if (hap_err != kHAPError_None) {
-                return kHAPError_Unknown;
+        HAPPlatformKeyValueStoreKey key;
+        if (!ParseKeyName(info.key, &key)) {
+            HAPLog(&logObject, "Skipping NVS key %s.%s that was not written by the key-value store.", name_space,
+                   info.key);
+            continue;
+        }
+        HAPError hap_err = callback(context, keyValueStore, domain, key, &shouldContinue);
+        if (hap_err != kHAPError_None) {
+            if (it) {
+                nvs_release_iterator(it);
             }
-    };
+            return kHAPError_Unknown;
+        }
+    }
+    if (it) {
+        nvs_release_iterator(it);
+    }
     return kHAPError_None;
 }
 
@@ -227,7 +1269,13 @@ HAPError HAPPlatformKeyValueStorePurgeDomain(
         HAPPlatformKeyValueStoreDomain domain) {
     HAPPrecondition(keyValueStore);
 
-    (void) domain;
+    for (size_t i = 0; i < keyValueStore->maxWriteBackItems; i++) {
+        if (keyValueStore->writeBackItems[i].domain == domain) {
+            keyValueStore->writeBackItems[i].active = false;
+        }
+    }
+    InvalidateReadCacheDomain(keyValueStore, domain);
+    RemoveIndexDomain(keyValueStore, domain);
 
     nvs_handle store_handle;
     esp_err_t err;
@@ -240,16 +1288,17 @@ HAPError HAPPlatformKeyValueStorePurgeDomain(
     err = nvs_erase_all(store_handle);
     if (err != ESP_OK) {
         HAPLogError(&logObject, "Error (%d) erasing NVS namespace!", err);
-        nvs_close(store_handle);
+        HAPPlatformKeyValueStoreCloseHandle(keyValueStore, domain);
         return kHAPError_Unknown;
     }
 
     err = nvs_commit(store_handle);
-    nvs_close(store_handle);
-    /* Checking error code after nvs_close(), because the close has to be called in any case */
+    // The namespace is reopened on next use.
+    HAPPlatformKeyValueStoreCloseHandle(keyValueStore, domain);
     if (err != ESP_OK) {
         HAPLogError(&logObject, "Error (%d) committing to NVS!", err);
         return kHAPError_Unknown;
     }
+    keyValueStore->statistics.numFlashCommits++;
     return kHAPError_None;
 }
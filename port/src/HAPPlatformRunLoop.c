@@ -18,17 +18,69 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-// This implementation is based on `select` for maximum portability but may be extended to also support
-// `poll`, `epoll` or `kqueue`.
+// This implementation is based on `select` for maximum portability. Alternatively, `poll` may be selected through
+// CONFIG_HAP_RUN_LOOP_BACKEND_POLL. The `poll` backend keeps a persistent array of descriptors that is only updated
+// when file handle registrations change, and only dispatches file handles that are reported as ready.
+// On Linux hosts, `epoll` may be selected through CONFIG_HAP_RUN_LOOP_BACKEND_EPOLL. Descriptors are registered with
+// the kernel once, so waiting does not scale with the number of file handles. Where `epoll` is not available, the
+// `poll` backend is used instead.
+// With CONFIG_HAP_VIRTUAL_TIME, the run loop does not wait at all. Virtual time advances to the next timer deadline
+// and file handle events are injected by a driver, for deterministic simulations on the host.
 
 #include "HAPPlatform.h"
 
+/**
+ * Whether `epoll` is used instead of `select` to wait for file handle events.
+ */
+#if defined(CONFIG_HAP_RUN_LOOP_BACKEND_EPOLL) && defined(__has_include)
+#if __has_include(<sys/epoll.h>)
+#define HAP_PLATFORM_RUN_LOOP_USE_EPOLL 1
+#endif
+#endif
+#ifndef HAP_PLATFORM_RUN_LOOP_USE_EPOLL
+#define HAP_PLATFORM_RUN_LOOP_USE_EPOLL 0
+#endif
+
+/**
+ * Whether `poll` is used instead of `select` to wait for file handle events.
+ */
+#if defined(CONFIG_HAP_RUN_LOOP_BACKEND_POLL) || \
+        (defined(CONFIG_HAP_RUN_LOOP_BACKEND_EPOLL) && !HAP_PLATFORM_RUN_LOOP_USE_EPOLL)
+#define HAP_PLATFORM_RUN_LOOP_USE_POLL 1
+#else
+#define HAP_PLATFORM_RUN_LOOP_USE_POLL 0
+#endif
+
+/**
+ * Whether file handles that are reported as ready are collected in a list before their callbacks are invoked.
+ */
+#define HAP_PLATFORM_RUN_LOOP_USE_READY_LIST (HAP_PLATFORM_RUN_LOOP_USE_POLL || HAP_PLATFORM_RUN_LOOP_USE_EPOLL)
+
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/select.h>
+#if HAP_PLATFORM_RUN_LOOP_USE_READY_LIST
+#include <limits.h>
+#endif
+#if HAP_PLATFORM_RUN_LOOP_USE_POLL
+#include <poll.h>
+#endif
+#if HAP_PLATFORM_RUN_LOOP_USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+/**
+ * Whether run loop instrumentation is collected.
+ */
+#ifdef CONFIG_HAP_RUN_LOOP_INSTRUMENTATION
+#define HAP_PLATFORM_RUN_LOOP_INSTRUMENTATION 1
+#else
+#define HAP_PLATFORM_RUN_LOOP_INSTRUMENTATION 0
+#endif
 
 #include "HAPPlatform+Init.h"
+#include "HAPPlatformClock+Init.h"
 #include "HAPPlatformFileHandle.h"
 #include "HAPPlatformLog+Init.h"
 #include "HAPPlatformRunLoop+Init.h"
@@ -37,12 +89,37 @@
 #include <string.h>
 #include <sys/types.h>
 #include <lwip/sockets.h>
-#include <sys/syslimits.h>
 
 static const HAPLogObject logObject = { .subsystem = kHAPPlatform_LogSubsystem, .category = "RunLoop" };
 
 #define LOOPBACK_PORT   12321
 
+/**
+ * Size in bytes of the ring buffer holding callbacks scheduled with HAPPlatformRunLoopScheduleCallback.
+ */
+#ifdef CONFIG_HAP_RUN_LOOP_CALLBACK_BUFFER_SIZE
+#define kHAPPlatformRunLoop_CallbackBufferSize ((uint32_t) CONFIG_HAP_RUN_LOOP_CALLBACK_BUFFER_SIZE)
+#else
+#define kHAPPlatformRunLoop_CallbackBufferSize ((uint32_t) 2048)
+#endif
+HAP_STATIC_ASSERT(
+        kHAPPlatformRunLoop_CallbackBufferSize >= 512 &&
+                !(kHAPPlatformRunLoop_CallbackBufferSize & (kHAPPlatformRunLoop_CallbackBufferSize - 1)),
+        kHAPPlatformRunLoop_CallbackBufferSize_IsPowerOfTwo);
+
+/**
+ * Size in bytes of the arena holding contexts larger than UINT8_MAX of scheduled callbacks.
+ */
+#ifdef CONFIG_HAP_RUN_LOOP_CALLBACK_ARENA_SIZE
+#define kHAPPlatformRunLoop_CallbackArenaSize ((uint32_t) CONFIG_HAP_RUN_LOOP_CALLBACK_ARENA_SIZE)
+#else
+#define kHAPPlatformRunLoop_CallbackArenaSize ((uint32_t) 4096)
+#endif
+HAP_STATIC_ASSERT(
+        kHAPPlatformRunLoop_CallbackArenaSize >= 512 &&
+                !(kHAPPlatformRunLoop_CallbackArenaSize & (kHAPPlatformRunLoop_CallbackArenaSize - 1)),
+        kHAPPlatformRunLoop_CallbackArenaSize_IsPowerOfTwo);
+
 /**
  * Internal file handle type, representing the registration of a platform-specific file descriptor.
  */
@@ -84,8 +161,44 @@ struct HAPPlatformFileHandle {
 
     /**
      * Flag indicating whether the platform-specific file descriptor is registered with an I/O multiplexer or not.
+     *
+     * - With the `poll` and `epoll` backends, this indicates that the file handle is part of the list of ready file
+     *   handles.
      */
     bool isAwaitingEvents;
+
+#if HAP_PLATFORM_RUN_LOOP_USE_POLL
+    /**
+     * Index of the file handle in the array of polled file descriptors, or SIZE_MAX if not polled.
+     */
+    size_t pollIndex;
+#endif
+
+#if HAP_PLATFORM_RUN_LOOP_USE_EPOLL
+    /**
+     * Events for which the file descriptor is registered with the `epoll` instance, or 0 if it is not registered.
+     */
+    uint32_t epollEvents;
+#endif
+
+#if HAP_PLATFORM_RUN_LOOP_USE_READY_LIST
+    /**
+     * Events that were reported as ready by the last wait.
+     */
+    HAPPlatformFileHandleEvent readyEvents;
+
+    /**
+     * Next file handle in list of ready file handles.
+     */
+    HAPPlatformFileHandle* _Nullable nextReadyFileHandle;
+#endif
+
+#if HAVE_VIRTUAL_TIME
+    /**
+     * Events that were injected with HAPPlatformFileHandleInjectEvents and have not been delivered yet.
+     */
+    HAPPlatformFileHandleEvent injectedEvents;
+#endif
 };
 
 /**
@@ -102,6 +215,11 @@ struct HAPPlatformTimer {
      */
     HAPTime deadline;
 
+    /**
+     * Time after the deadline by which the timer may be delayed to fire together with other timers.
+     */
+    HAPTime leeway;
+
     /**
      * Callback that is invoked when the timer expires.
      */
@@ -113,11 +231,149 @@ struct HAPPlatformTimer {
     void* _Nullable context;
 
     /**
-     * Next timer in linked list.
+     * Registration sequence number, used to fire timers with equal deadlines in order of registration.
+     */
+    uint64_t sequenceNumber;
+
+    /**
+     * Index of the timer in the timer heap, or SIZE_MAX if the timer is not registered.
      */
-    HAPPlatformTimer* _Nullable nextTimer;
+    size_t heapIndex;
 };
 
+/**
+ * State of a ring buffer record.
+ */
+HAP_ENUM_BEGIN(uint32_t, HAPPlatformRunLoopRingRecordState) { /**
+                                                               * Claimed by a producer that is still filling it in.
+                                                               *
+                                                               * - Free ring buffer space is kept zeroed, so this is
+                                                               *   the state of every record until it is published.
+                                                               */
+                                                              kHAPPlatformRunLoopRingRecordState_Claimed,
+
+                                                              /**
+                                                               * Published by a producer.
+                                                               */
+                                                              kHAPPlatformRunLoopRingRecordState_Committed,
+
+                                                              /**
+                                                               * Unused space at the end of the ring buffer.
+                                                               */
+                                                              kHAPPlatformRunLoopRingRecordState_Padding,
+
+                                                              /**
+                                                               * Released, but not yet reclaimed by the consumer.
+                                                               */
+                                                              kHAPPlatformRunLoopRingRecordState_Released
+} HAP_ENUM_END(uint32_t, HAPPlatformRunLoopRingRecordState);
+
+/**
+ * Header of a ring buffer record.
+ */
+typedef struct {
+    /**
+     * Record state. Accessed atomically.
+     */
+    uint32_t state;
+
+    /**
+     * Size of the record including the header, a multiple of 8.
+     */
+    uint32_t numBytes;
+} HAPPlatformRunLoopRingRecordHeader;
+
+/**
+ * Bounded multi-producer / single-consumer ring buffer of variable-size records.
+ *
+ * - Producers claim space with a compare-and-swap on the write position and publish records by updating their state.
+ * - Records never wrap around the end of the buffer. If a record does not fit, the remaining space is claimed as
+ *   padding, so records can always be accessed in place.
+ * - Records are 8-byte aligned.
+ * - Records may be released in any order. Their space is reclaimed once all older records have been released.
+ */
+typedef struct {
+    /**
+     * Buffer. Free space is kept zeroed.
+     */
+    uint8_t* bytes;
+
+    /**
+     * Buffer size, a power of two.
+     */
+    uint32_t numBytes;
+
+    /**
+     * Position at which the next record is claimed. Accessed atomically.
+     */
+    uint32_t writePosition;
+
+    /**
+     * Position of the oldest record. Only written by the consumer, accessed atomically.
+     */
+    uint32_t readPosition;
+} HAPPlatformRunLoopRing;
+
+/**
+ * Scheduled callback, stored as a ring buffer record.
+ */
+typedef struct {
+    /**
+     * Record header.
+     */
+    HAPPlatformRunLoopRingRecordHeader header;
+
+    /**
+     * Callback.
+     */
+    HAPPlatformRunLoopCallback callback;
+
+    /**
+     * Context size.
+     */
+    uint32_t contextSize;
+
+    /**
+     * Arena record holding the context if it is larger than UINT8_MAX, or NULL if the context is stored inline.
+     *
+     * - The context follows the record header.
+     */
+    HAPPlatformRunLoopRingRecordHeader* _Nullable arenaRecord;
+
+    /**
+     * Context, if stored inline. The callback is invoked with a pointer into the record, so it is kept 8-byte aligned.
+     */
+    HAP_ALIGNAS(8)
+    uint8_t context[];
+} HAPPlatformRunLoopCallbackRecord;
+
+/**
+ * Fixed-capacity object pool.
+ *
+ * - Free objects are kept in a singly-linked list whose links are stored in the first bytes of each free object.
+ */
+typedef struct {
+    /**
+     * Preallocated storage, or NULL if the pool is empty.
+     */
+    void* _Nullable storage;
+
+    /**
+     * Size of one object.
+     */
+    size_t objectSize;
+
+    /**
+     * Start of linked list of free objects.
+     */
+    void* _Nullable freeObjects;
+
+    /**
+     * Allocation statistics.
+     */
+    HAPPlatformRunLoopPoolStatistics statistics;
+} HAPPlatformRunLoopPool;
+
 /**
  * Run loop state.
  */
@@ -153,41 +409,206 @@ static struct {
      */
     HAPPlatformFileHandle* _Nullable fileHandleCursor;
 
+#if HAP_PLATFORM_RUN_LOOP_USE_READY_LIST
+    /**
+     * Number of registered file handles.
+     */
+    size_t numFileHandles;
+
+    /**
+     * Start of linked list of file handles that were reported as ready by the last wait.
+     */
+    HAPPlatformFileHandle* _Nullable readyFileHandles;
+#endif
+
+#if HAP_PLATFORM_RUN_LOOP_USE_EPOLL
+    /**
+     * File descriptor of the `epoll` instance, or -1 if it has not been created.
+     */
+    int epollFileDescriptor;
+
+    /**
+     * Array receiving the events reported by `epoll_wait`.
+     *
+     * - The array is sized to hold an event for every registered file handle, so that all ready file handles are
+     *   collected by a single wait.
+     */
+    struct epoll_event* _Nullable epollEvents;
+
+    /**
+     * Capacity of the array of events.
+     */
+    size_t maxEpollEvents;
+#endif
+
+#if HAP_PLATFORM_RUN_LOOP_USE_POLL
+    /**
+     * Array of polled file descriptors.
+     *
+     * - Only file handles with non-empty interests are polled.
+     * - The array is sized to hold all registered file handles, so that interest updates never allocate memory.
+     */
+    struct pollfd* _Nullable pollFileDescriptors;
+
+    /**
+     * File handles corresponding to the entries of the array of polled file descriptors.
+     */
+    HAPPlatformFileHandle* _Nullable* _Nullable pollFileHandles;
+
+    /**
+     * Number of polled file descriptors.
+     */
+    size_t numPollFileDescriptors;
+
+    /**
+     * Capacity of the array of polled file descriptors.
+     */
+    size_t maxPollFileDescriptors;
+#endif
+
+    /**
+     * Binary min-heap of timers, ordered by deadline and registration sequence number.
+     */
+    HAPPlatformTimer* _Nullable* _Nullable timers;
+
+    /**
+     * Number of registered timers.
+     */
+    size_t numTimers;
+
+    /**
+     * Capacity of the timer heap.
+     */
+    size_t maxTimers;
+
+    /**
+     * Sequence number of the next registered timer.
+     */
+    uint64_t nextTimerSequenceNumber;
+
+    /**
+     * Time at which the run loop was last scheduled to wake up to fire timers, or 0 if no timers were registered.
+     */
+    HAPTime timerWakeupTime;
+
+    /**
+     * Earliest latest firing time of all registered timers. Only valid if isTimerWakeupTimeCached is set.
+     */
+    HAPTime cachedTimerWakeupTime;
+
+    /**
+     * Whether cachedTimerWakeupTime is up to date.
+     */
+    bool isTimerWakeupTimeCached;
+
     /**
-     * Start of linked list of timers, ordered by deadline.
+     * Timer wakeup statistics.
      */
-    HAPPlatformTimer* _Nullable timers;
+    HAPPlatformRunLoopTimerWakeupStatistics timerWakeupStatistics;
     
     /**
-     * Loopback file descriptor to receive data.
+     * Loopback file descriptor to receive wakeups.
      */
     volatile int loopbackFileDescriptor;
 
     /**
-     * Self-pipe byte buffer.
-     *
-     * - Callbacks are serialized into the buffer as:
-     *   - 8-byte aligned callback pointer.
-     *   - Context size (up to UINT8_MAX).
-     *   - Context (unaligned). When invoking the callback, the context is first moved to be 8-byte aligned.
+     * Loopback file descriptor to send wakeups, connected to the loopback file descriptor to receive wakeups.
+     */
+    volatile int loopbackSendFileDescriptor;
+
+    /**
+     * File handle for loopback.
+     */
+    HAPPlatformFileHandleRef loopbackFileHandle;
+
+    /**
+     * Ring buffer holding scheduled callbacks.
+     */
+    HAPPlatformRunLoopRing callbackRing;
+
+    /**
+     * Storage of the ring buffer holding scheduled callbacks.
      */
     HAP_ALIGNAS(8)
-    char loopbackBytes[sizeof(HAPPlatformRunLoopCallback) + 1 + UINT8_MAX];
+    uint8_t callbackBytes[kHAPPlatformRunLoop_CallbackBufferSize];
 
     /**
-     * Number of bytes in self-pipe byte buffer.
+     * Ring buffer holding contexts of scheduled callbacks that are larger than UINT8_MAX.
      */
-    size_t numLoopbackBytes;
+    HAPPlatformRunLoopRing callbackArena;
 
     /**
-     * File handle for self-pipe.
+     * Storage of the ring buffer holding contexts of scheduled callbacks that are larger than UINT8_MAX.
      */
-    HAPPlatformFileHandleRef loopbackFileHandle;
+    HAP_ALIGNAS(8)
+    uint8_t callbackArenaBytes[kHAPPlatformRunLoop_CallbackArenaSize];
+
+    /**
+     * Whether a wakeup has been sent that the run loop has not yet consumed. Accessed atomically.
+     *
+     * - Producers only send a wakeup when this flag transitions from false to true, so that bursts of scheduled
+     *   callbacks result in a single wakeup.
+     */
+    uint32_t isWakeupPending;
+
+    /**
+     * Scheduled callback statistics. Counters that are updated by producers are accessed atomically.
+     */
+    HAPPlatformRunLoopCallbackQueueStatistics callbackQueueStatistics;
+
+#if HAP_PLATFORM_RUN_LOOP_INSTRUMENTATION
+    /**
+     * Run loop instrumentation.
+     */
+    HAPPlatformRunLoopInstrumentation instrumentation;
+#endif
+
+#if HAVE_VIRTUAL_TIME
+    /**
+     * Virtual time driver.
+     */
+    HAPPlatformRunLoopVirtualTimeDriver _Nullable virtualTimeDriver;
+
+    /**
+     * Context that is passed to the virtual time driver.
+     */
+    void* _Nullable virtualTimeDriverContext;
+
+    /**
+     * Whether events have been injected that have not been delivered yet.
+     */
+    bool hasInjectedEvents;
+#endif
 
     /**
      * Current run loop state.
      */
     HAPPlatformRunLoopState state;
+
+    /**
+     * Pool of timers.
+     */
+    HAPPlatformRunLoopPool timerPool;
+
+    /**
+     * Pool of file handles.
+     */
+    HAPPlatformRunLoopPool fileHandlePool;
+
+    /**
+     * Whether objects are allocated from the heap once a pool is exhausted.
+     */
+    bool allowHeapFallback;
+
+    /**
+     * Singly-linked list of observers that are invoked at the end of each run loop iteration, in order of addition.
+     */
+    HAPPlatformRunLoopObserver* _Nullable observers;
+
+    /**
+     * Observer cursor, used to handle reentrant modifications of the observer list during iteration.
+     */
+    HAPPlatformRunLoopObserver* _Nullable observerCursor;
 } runLoop = { .fileHandleSentinel = { .fileDescriptor = -1,
                                       .interests = { .isReadyForReading = false,
                                                      .isReadyForWriting = false,
@@ -201,66 +622,521 @@ static struct {
               .fileHandleCursor = &runLoop.fileHandleSentinel,
 
               .timers = NULL,
+#if HAP_PLATFORM_RUN_LOOP_USE_EPOLL
+              .epollFileDescriptor = -1,
+#endif
+
+              .loopbackSendFileDescriptor = -1,
+              .callbackRing = { .bytes = runLoop.callbackBytes, .numBytes = kHAPPlatformRunLoop_CallbackBufferSize },
+              .callbackArena = { .bytes = runLoop.callbackArenaBytes,
+                                 .numBytes = kHAPPlatformRunLoop_CallbackArenaSize },
+
+              .timerPool = { .objectSize = sizeof(HAPPlatformTimer) },
+              .fileHandlePool = { .objectSize = sizeof(HAPPlatformFileHandle) },
+              .allowHeapFallback = true,
 
               .loopbackFileDescriptor = -1 };
 
-HAP_RESULT_USE_CHECK
-HAPError HAPPlatformFileHandleRegister(
-        HAPPlatformFileHandleRef* fileHandle_,
-        int fileDescriptor,
-        HAPPlatformFileHandleEvent interests,
-        HAPPlatformFileHandleCallback callback,
-        void* _Nullable context) {
-    HAPPrecondition(fileHandle_);
+/**
+ * Preallocates the storage of a pool.
+ *
+ * @param      pool                 Pool.
+ * @param      maxObjects           Number of objects to preallocate.
+ */
+static void CreatePool(HAPPlatformRunLoopPool* pool, size_t maxObjects) {
+    HAPPrecondition(pool);
+    HAPPrecondition(!pool->storage);
+    HAPPrecondition(pool->objectSize >= sizeof(void*));
 
-    // Prepare fileHandle.
-    HAPPlatformFileHandle* fileHandle = calloc(1, sizeof(HAPPlatformFileHandle));
-    if (!fileHandle) {
-        HAPLog(&logObject, "Cannot allocate more file handles.");
-        *fileHandle_ = 0;
-        return kHAPError_OutOfResources;
+    if (!maxObjects) {
+        return;
     }
-    fileHandle->fileDescriptor = fileDescriptor;
-    fileHandle->interests = interests;
-    fileHandle->callback = callback;
-    fileHandle->context = context;
-    fileHandle->prevFileHandle = runLoop.fileHandles->prevFileHandle;
-    fileHandle->nextFileHandle = runLoop.fileHandles;
-    fileHandle->isAwaitingEvents = false;
-    runLoop.fileHandles->prevFileHandle->nextFileHandle = fileHandle;
-    runLoop.fileHandles->prevFileHandle = fileHandle;
 
-    *fileHandle_ = (HAPPlatformFileHandleRef) fileHandle;
-    return kHAPError_None;
+    pool->storage = calloc(maxObjects, pool->objectSize);
+    if (!pool->storage) {
+        HAPLogError(&logObject, "Cannot allocate run loop pool storage.");
+        HAPFatalError();
+    }
+    pool->statistics.maxObjects = maxObjects;
+
+    // Thread free list through the objects in ascending address order.
+    pool->freeObjects = NULL;
+    for (size_t i = maxObjects; i; i--) {
+        void* object = (uint8_t*) pool->storage + (i - 1) * pool->objectSize;
+        *(void**) object = pool->freeObjects;
+        pool->freeObjects = object;
+    }
 }
 
-void HAPPlatformFileHandleUpdateInterests(
-        HAPPlatformFileHandleRef fileHandle_,
-        HAPPlatformFileHandleEvent interests,
-        HAPPlatformFileHandleCallback callback,
-        void* _Nullable context) {
-    HAPPrecondition(fileHandle_);
-    HAPPlatformFileHandle* fileHandle = (HAPPlatformFileHandle * _Nonnull) fileHandle_;
-
-    fileHandle->interests = interests;
-    fileHandle->callback = callback;
-    fileHandle->context = context;
-}
+/**
+ * Releases the storage of a pool.
+ *
+ * - None of the objects of the pool may be allocated, as they could not be freed afterwards.
+ *
+ * @param      pool                 Pool.
+ */
+static void ReleasePool(HAPPlatformRunLoopPool* pool) {
+    HAPPrecondition(pool);
+    HAPPrecondition(!pool->statistics.numObjects);
 
-void HAPPlatformFileHandleDeregister(HAPPlatformFileHandleRef fileHandle_) {
-    HAPPrecondition(fileHandle_);
-    HAPPlatformFileHandle* fileHandle = (HAPPlatformFileHandle * _Nonnull) fileHandle_;
+    if (!pool->storage) {
+        return;
+    }
 
-    HAPPrecondition(fileHandle->prevFileHandle);
-    HAPPrecondition(fileHandle->nextFileHandle);
+    HAPPlatformFreeSafe(pool->storage);
+    pool->freeObjects = NULL;
+    pool->statistics.maxObjects = 0;
+}
 
-    if (fileHandle == runLoop.fileHandleCursor) {
-        runLoop.fileHandleCursor = fileHandle->nextFileHandle;
+/**
+ * Allocates a zero-initialized object from a pool.
+ *
+ * - Falls back to the heap if the pool is exhausted and heap fallback is allowed, or if the pool is empty.
+ *
+ * @param      pool                 Pool.
+ *
+ * @return Allocated object, or NULL if no more objects can be allocated.
+ */
+HAP_RESULT_USE_CHECK
+static void* _Nullable AllocatePoolObject(HAPPlatformRunLoopPool* pool) {
+    HAPPrecondition(pool);
+
+    void* _Nullable object = pool->freeObjects;
+    if (object) {
+        pool->freeObjects = *(void**) object;
+        HAPRawBufferZero(object, pool->objectSize);
+    } else if (!pool->storage || runLoop.allowHeapFallback) {
+        object = calloc(1, pool->objectSize);
+        if (object) {
+            pool->statistics.numHeapAllocations++;
+        }
+    }
+    if (!object) {
+        pool->statistics.numFailedAllocations++;
+        return NULL;
+    }
+
+    pool->statistics.numObjects++;
+    if (pool->statistics.numObjects > pool->statistics.numObjectsHighWaterMark) {
+        pool->statistics.numObjectsHighWaterMark = pool->statistics.numObjects;
+    }
+    return object;
+}
+
+/**
+ * Returns an object to the pool from which it was allocated.
+ *
+ * @param      pool                 Pool.
+ * @param      object               Object.
+ */
+static void FreePoolObject(HAPPlatformRunLoopPool* pool, void* object) {
+    HAPPrecondition(pool);
+    HAPPrecondition(object);
+    HAPPrecondition(pool->statistics.numObjects);
+
+    pool->statistics.numObjects--;
+
+    uintptr_t storageStart = (uintptr_t) pool->storage;
+    uintptr_t storageEnd = storageStart + pool->statistics.maxObjects * pool->objectSize;
+    if (pool->storage && (uintptr_t) object >= storageStart && (uintptr_t) object < storageEnd) {
+        HAPAssert(((uintptr_t) object - storageStart) % pool->objectSize == 0);
+        *(void**) object = pool->freeObjects;
+        pool->freeObjects = object;
+    } else {
+        HAPPlatformFreeSafe(object);
+    }
+}
+
+#if HAP_PLATFORM_RUN_LOOP_INSTRUMENTATION
+/**
+ * Adds a sample to a histogram.
+ *
+ * @param      histogram            Histogram.
+ * @param      value                Sample.
+ */
+static void RecordHistogramSample(HAPPlatformRunLoopHistogram* histogram, uint64_t value) {
+    HAPPrecondition(histogram);
+
+    size_t i = value ? (size_t)(64 - __builtin_clzll(value)) : 0;
+    if (i >= kHAPPlatformRunLoopHistogram_NumBuckets) {
+        i = kHAPPlatformRunLoopHistogram_NumBuckets - 1;
+    }
+    histogram->numSamplesPerBucket[i]++;
+    histogram->numSamples++;
+    if (value > histogram->maxValue) {
+        histogram->maxValue = value;
+    }
+    histogram->sumValues += value;
+}
+
+/**
+ * Records the duration of a callback invocation.
+ *
+ * @param      kind                 Kind of callback.
+ * @param      function             Address of the callback function.
+ * @param      startTime            Time when the callback was invoked, as returned by
+ *                                  HAPPlatformClockGetCurrentMicroseconds.
+ */
+static void RecordCallbackDuration(HAPPlatformRunLoopCallbackKind kind, const void* function, uint64_t startTime) {
+    HAPPrecondition(function);
+
+    uint64_t duration = HAPPlatformClockGetCurrentMicroseconds() - startTime;
+    HAPPlatformRunLoopSlowCallback* slowestCallbacks = runLoop.instrumentation.slowestCallbacks;
+    size_t n = runLoop.instrumentation.numSlowestCallbacks;
+
+    // Find tracked callback, or claim the entry of the fastest tracked callback if this invocation was slower.
+    size_t i;
+    for (i = 0; i < n; i++) {
+        if (slowestCallbacks[i].function == function && slowestCallbacks[i].kind == kind) {
+            break;
+        }
+    }
+    if (i == n) {
+        if (n < kHAPPlatformRunLoopInstrumentation_MaxSlowestCallbacks) {
+            runLoop.instrumentation.numSlowestCallbacks++;
+        } else if (duration > slowestCallbacks[n - 1].maxMicroseconds) {
+            i = n - 1;
+        } else {
+            return;
+        }
+        HAPRawBufferZero(&slowestCallbacks[i], sizeof slowestCallbacks[i]);
+        slowestCallbacks[i].function = function;
+        slowestCallbacks[i].kind = kind;
+    }
+    slowestCallbacks[i].numInvocations++;
+    slowestCallbacks[i].sumMicroseconds += duration;
+    if (duration > slowestCallbacks[i].maxMicroseconds) {
+        slowestCallbacks[i].maxMicroseconds = duration;
+    }
+
+    // Keep list ordered by decreasing maximum invocation time.
+    while (i && slowestCallbacks[i].maxMicroseconds > slowestCallbacks[i - 1].maxMicroseconds) {
+        HAPPlatformRunLoopSlowCallback slowCallback = slowestCallbacks[i - 1];
+        slowestCallbacks[i - 1] = slowestCallbacks[i];
+        slowestCallbacks[i] = slowCallback;
+        i--;
+    }
+}
+#endif
+
+#if HAP_PLATFORM_RUN_LOOP_USE_POLL
+/**
+ * Ensures that the array of polled file descriptors can hold the given number of file handles.
+ *
+ * @param      numFileHandles       Number of file handles.
+ *
+ * @return kHAPError_None           If successful.
+ * @return kHAPError_OutOfResources If the array of polled file descriptors could not be grown.
+ */
+HAP_RESULT_USE_CHECK
+static HAPError ReservePollFileDescriptors(size_t numFileHandles) {
+    if (numFileHandles <= runLoop.maxPollFileDescriptors) {
+        return kHAPError_None;
+    }
+
+    size_t maxPollFileDescriptors = runLoop.maxPollFileDescriptors ? 2 * runLoop.maxPollFileDescriptors : 8;
+    while (maxPollFileDescriptors < numFileHandles) {
+        maxPollFileDescriptors *= 2;
+    }
+
+    struct pollfd* pollFileDescriptors =
+            realloc(runLoop.pollFileDescriptors, maxPollFileDescriptors * sizeof *pollFileDescriptors);
+    if (!pollFileDescriptors) {
+        return kHAPError_OutOfResources;
+    }
+    runLoop.pollFileDescriptors = pollFileDescriptors;
+
+    HAPPlatformFileHandle** pollFileHandles =
+            realloc(runLoop.pollFileHandles, maxPollFileDescriptors * sizeof *pollFileHandles);
+    if (!pollFileHandles) {
+        return kHAPError_OutOfResources;
+    }
+    runLoop.pollFileHandles = pollFileHandles;
+
+    runLoop.maxPollFileDescriptors = maxPollFileDescriptors;
+    return kHAPError_None;
+}
+
+/**
+ * Removes a file handle from the array of polled file descriptors, if present.
+ *
+ * @param      fileHandle           File handle.
+ */
+static void RemovePollFileDescriptor(HAPPlatformFileHandle* fileHandle) {
+    HAPPrecondition(fileHandle);
+
+    if (fileHandle->pollIndex == SIZE_MAX) {
+        return;
+    }
+
+    // Remove by moving the last entry into the freed position.
+    size_t i = fileHandle->pollIndex;
+    HAPAssert(i < runLoop.numPollFileDescriptors);
+    HAPAssert(runLoop.pollFileHandles[i] == fileHandle);
+    runLoop.numPollFileDescriptors--;
+    if (i != runLoop.numPollFileDescriptors) {
+        runLoop.pollFileDescriptors[i] = runLoop.pollFileDescriptors[runLoop.numPollFileDescriptors];
+        runLoop.pollFileHandles[i] = runLoop.pollFileHandles[runLoop.numPollFileDescriptors];
+        runLoop.pollFileHandles[i]->pollIndex = i;
+    }
+    fileHandle->pollIndex = SIZE_MAX;
+}
+
+/**
+ * Synchronizes the array of polled file descriptors with the interests of a file handle.
+ *
+ * - File handles with empty interests are removed from the array, all others are added or updated in place.
+ *
+ * @param      fileHandle           File handle.
+ */
+static void UpdatePollFileDescriptor(HAPPlatformFileHandle* fileHandle) {
+    HAPPrecondition(fileHandle);
+
+    short events = 0;
+    if (fileHandle->fileDescriptor != -1) {
+        if (fileHandle->interests.isReadyForReading) {
+            events |= POLLIN;
+        }
+        if (fileHandle->interests.isReadyForWriting) {
+            events |= POLLOUT;
+        }
+        if (fileHandle->interests.hasErrorConditionPending) {
+            events |= POLLPRI;
+        }
+    }
+
+    if (!events) {
+        RemovePollFileDescriptor(fileHandle);
+        return;
+    }
+
+    if (fileHandle->pollIndex == SIZE_MAX) {
+        HAPAssert(runLoop.numPollFileDescriptors < runLoop.maxPollFileDescriptors);
+        fileHandle->pollIndex = runLoop.numPollFileDescriptors;
+        runLoop.pollFileHandles[fileHandle->pollIndex] = fileHandle;
+        runLoop.numPollFileDescriptors++;
+    }
+    struct pollfd* pollFileDescriptor = &runLoop.pollFileDescriptors[fileHandle->pollIndex];
+    pollFileDescriptor->fd = fileHandle->fileDescriptor;
+    pollFileDescriptor->events = events;
+    pollFileDescriptor->revents = 0;
+}
+#endif
+
+#if HAP_PLATFORM_RUN_LOOP_USE_EPOLL
+/**
+ * Ensures that the array of events can hold an event for the given number of file handles.
+ *
+ * @param      numFileHandles       Number of file handles.
+ *
+ * @return kHAPError_None           If successful.
+ * @return kHAPError_OutOfResources If the array of events could not be grown.
+ */
+HAP_RESULT_USE_CHECK
+static HAPError ReserveEpollEvents(size_t numFileHandles) {
+    if (numFileHandles <= runLoop.maxEpollEvents) {
+        return kHAPError_None;
+    }
+
+    size_t maxEpollEvents = runLoop.maxEpollEvents ? 2 * runLoop.maxEpollEvents : 8;
+    while (maxEpollEvents < numFileHandles) {
+        maxEpollEvents *= 2;
+    }
+
+    struct epoll_event* epollEvents = realloc(runLoop.epollEvents, maxEpollEvents * sizeof *epollEvents);
+    if (!epollEvents) {
+        return kHAPError_OutOfResources;
+    }
+    runLoop.epollEvents = epollEvents;
+    runLoop.maxEpollEvents = maxEpollEvents;
+    return kHAPError_None;
+}
+
+/**
+ * Registers the file descriptor of a file handle with the `epoll` instance for the given events.
+ *
+ * - If no events are given, the file descriptor is removed from the `epoll` instance.
+ *
+ * @param      fileHandle           File handle.
+ * @param      events               Events.
+ */
+static void SetEpollEvents(HAPPlatformFileHandle* fileHandle, uint32_t events) {
+    HAPPrecondition(fileHandle);
+    HAPPrecondition(runLoop.epollFileDescriptor != -1);
+
+    if (events == fileHandle->epollEvents) {
+        return;
+    }
+
+    int operation = !events ? EPOLL_CTL_DEL : fileHandle->epollEvents ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    struct epoll_event event = { .events = events, .data = { .ptr = fileHandle } };
+    HAPLogDebug(&logObject, "epoll_ctl(%d, %d, %d, 0x%x);", runLoop.epollFileDescriptor, operation,
+                fileHandle->fileDescriptor, (unsigned) events);
+    int e = epoll_ctl(runLoop.epollFileDescriptor, operation, fileHandle->fileDescriptor, &event);
+    if (e != 0) {
+        int _errno = errno;
+        HAPAssert(e == -1);
+        // The kernel drops the registration once the file descriptor is closed, which owners may do before
+        // deregistering the file handle.
+        if (operation != EPOLL_CTL_DEL || (_errno != EBADF && _errno != ENOENT)) {
+            HAPPlatformLogPOSIXError(
+                    kHAPLogType_Error, "System call 'epoll_ctl' failed.", _errno, __func__, HAP_FILE, __LINE__);
+            HAPFatalError();
+        }
+    }
+    fileHandle->epollEvents = events;
+}
+
+/**
+ * Synchronizes the registration with the `epoll` instance with the interests of a file handle.
+ *
+ * - File handles with empty interests are removed from the `epoll` instance, all others are added or modified.
+ *
+ * @param      fileHandle           File handle.
+ */
+static void UpdateEpollFileDescriptor(HAPPlatformFileHandle* fileHandle) {
+    HAPPrecondition(fileHandle);
+
+    uint32_t events = 0;
+    if (fileHandle->fileDescriptor != -1) {
+        if (fileHandle->interests.isReadyForReading) {
+            events |= EPOLLIN;
+        }
+        if (fileHandle->interests.isReadyForWriting) {
+            events |= EPOLLOUT;
+        }
+        if (fileHandle->interests.hasErrorConditionPending) {
+            events |= EPOLLPRI;
+        }
+    }
+    SetEpollEvents(fileHandle, events);
+}
+#endif
+
+#if HAP_PLATFORM_RUN_LOOP_USE_READY_LIST
+/**
+ * Removes a file handle from the list of ready file handles.
+ *
+ * @param      fileHandle           File handle.
+ */
+static void RemoveReadyFileHandle(HAPPlatformFileHandle* fileHandle) {
+    HAPPrecondition(fileHandle);
+
+    if (!fileHandle->isAwaitingEvents) {
+        return;
+    }
+    for (HAPPlatformFileHandle* _Nullable* nextFileHandle = &runLoop.readyFileHandles; *nextFileHandle;
+         nextFileHandle = &(*nextFileHandle)->nextReadyFileHandle) {
+        if (*nextFileHandle == fileHandle) {
+            *nextFileHandle = fileHandle->nextReadyFileHandle;
+            break;
+        }
+    }
+    fileHandle->nextReadyFileHandle = NULL;
+    fileHandle->isAwaitingEvents = false;
+}
+#endif
+
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformFileHandleRegister(
+        HAPPlatformFileHandleRef* fileHandle_,
+        int fileDescriptor,
+        HAPPlatformFileHandleEvent interests,
+        HAPPlatformFileHandleCallback callback,
+        void* _Nullable context) {
+    HAPPrecondition(fileHandle_);
+
+#if HAP_PLATFORM_RUN_LOOP_USE_POLL
+    if (ReservePollFileDescriptors(runLoop.numFileHandles + 1) != kHAPError_None) {
+        HAPLog(&logObject, "Cannot allocate more polled file descriptors.");
+        *fileHandle_ = 0;
+        return kHAPError_OutOfResources;
+    }
+#elif HAP_PLATFORM_RUN_LOOP_USE_EPOLL
+    if (ReserveEpollEvents(runLoop.numFileHandles + 1) != kHAPError_None) {
+        HAPLog(&logObject, "Cannot allocate more epoll events.");
+        *fileHandle_ = 0;
+        return kHAPError_OutOfResources;
+    }
+#endif
+
+    // Prepare fileHandle.
+    HAPPlatformFileHandle* fileHandle = AllocatePoolObject(&runLoop.fileHandlePool);
+    if (!fileHandle) {
+        HAPLog(&logObject, "Cannot allocate more file handles.");
+        *fileHandle_ = 0;
+        return kHAPError_OutOfResources;
+    }
+    fileHandle->fileDescriptor = fileDescriptor;
+    fileHandle->interests = interests;
+    fileHandle->callback = callback;
+    fileHandle->context = context;
+    fileHandle->prevFileHandle = runLoop.fileHandles->prevFileHandle;
+    fileHandle->nextFileHandle = runLoop.fileHandles;
+    fileHandle->isAwaitingEvents = false;
+    runLoop.fileHandles->prevFileHandle->nextFileHandle = fileHandle;
+    runLoop.fileHandles->prevFileHandle = fileHandle;
+
+#if HAP_PLATFORM_RUN_LOOP_USE_READY_LIST
+    runLoop.numFileHandles++;
+    fileHandle->nextReadyFileHandle = NULL;
+#endif
+#if HAP_PLATFORM_RUN_LOOP_USE_POLL
+    fileHandle->pollIndex = SIZE_MAX;
+    UpdatePollFileDescriptor(fileHandle);
+#elif HAP_PLATFORM_RUN_LOOP_USE_EPOLL
+    fileHandle->epollEvents = 0;
+    UpdateEpollFileDescriptor(fileHandle);
+#endif
+
+    *fileHandle_ = (HAPPlatformFileHandleRef) fileHandle;
+    return kHAPError_None;
+}
+
+void HAPPlatformFileHandleUpdateInterests(
+        HAPPlatformFileHandleRef fileHandle_,
+        HAPPlatformFileHandleEvent interests,
+        HAPPlatformFileHandleCallback callback,
+        void* _Nullable context) {
+    HAPPrecondition(fileHandle_);
+    HAPPlatformFileHandle* fileHandle = (HAPPlatformFileHandle * _Nonnull) fileHandle_;
+
+    fileHandle->interests = interests;
+    fileHandle->callback = callback;
+    fileHandle->context = context;
+
+#if HAP_PLATFORM_RUN_LOOP_USE_POLL
+    UpdatePollFileDescriptor(fileHandle);
+#elif HAP_PLATFORM_RUN_LOOP_USE_EPOLL
+    UpdateEpollFileDescriptor(fileHandle);
+#endif
+}
+
+void HAPPlatformFileHandleDeregister(HAPPlatformFileHandleRef fileHandle_) {
+    HAPPrecondition(fileHandle_);
+    HAPPlatformFileHandle* fileHandle = (HAPPlatformFileHandle * _Nonnull) fileHandle_;
+
+    HAPPrecondition(fileHandle->prevFileHandle);
+    HAPPrecondition(fileHandle->nextFileHandle);
+
+    if (fileHandle == runLoop.fileHandleCursor) {
+        runLoop.fileHandleCursor = fileHandle->nextFileHandle;
     }
 
     fileHandle->prevFileHandle->nextFileHandle = fileHandle->nextFileHandle;
     fileHandle->nextFileHandle->prevFileHandle = fileHandle->prevFileHandle;
 
+#if HAP_PLATFORM_RUN_LOOP_USE_READY_LIST
+    RemoveReadyFileHandle(fileHandle);
+    HAPAssert(runLoop.numFileHandles);
+    runLoop.numFileHandles--;
+#endif
+#if HAP_PLATFORM_RUN_LOOP_USE_POLL
+    RemovePollFileDescriptor(fileHandle);
+#elif HAP_PLATFORM_RUN_LOOP_USE_EPOLL
+    SetEpollEvents(fileHandle, 0);
+#endif
+
     fileHandle->fileDescriptor = -1;
     fileHandle->interests.isReadyForReading = false;
     fileHandle->interests.isReadyForWriting = false;
@@ -270,9 +1146,150 @@ void HAPPlatformFileHandleDeregister(HAPPlatformFileHandleRef fileHandle_) {
     fileHandle->nextFileHandle = NULL;
     fileHandle->prevFileHandle = NULL;
     fileHandle->isAwaitingEvents = false;
-    HAPPlatformFreeSafe(fileHandle);
+    FreePoolObject(&runLoop.fileHandlePool, fileHandle);
 }
 
+#if HAVE_VIRTUAL_TIME
+void HAPPlatformFileHandleInjectEvents(HAPPlatformFileHandleRef fileHandle_, HAPPlatformFileHandleEvent events) {
+    HAPPrecondition(fileHandle_);
+    HAPPlatformFileHandle* fileHandle = (HAPPlatformFileHandle * _Nonnull) fileHandle_;
+    HAPPrecondition(fileHandle->prevFileHandle);
+    HAPPrecondition(fileHandle->nextFileHandle);
+
+    fileHandle->injectedEvents.isReadyForReading |= events.isReadyForReading;
+    fileHandle->injectedEvents.isReadyForWriting |= events.isReadyForWriting;
+    fileHandle->injectedEvents.hasErrorConditionPending |= events.hasErrorConditionPending;
+    runLoop.hasInjectedEvents = true;
+}
+
+static void ProcessInjectedFileHandles(void) {
+    runLoop.hasInjectedEvents = false;
+
+    runLoop.fileHandleCursor = runLoop.fileHandles->nextFileHandle;
+    while (runLoop.fileHandleCursor != runLoop.fileHandles) {
+        HAPPlatformFileHandle* fileHandle = runLoop.fileHandleCursor;
+        runLoop.fileHandleCursor = fileHandle->nextFileHandle;
+
+        HAPPlatformFileHandleEvent injectedEvents = fileHandle->injectedEvents;
+        HAPRawBufferZero(&fileHandle->injectedEvents, sizeof fileHandle->injectedEvents);
+        if (fileHandle->callback) {
+            HAPPlatformFileHandleEvent fileHandleEvents;
+            fileHandleEvents.isReadyForReading =
+                    fileHandle->interests.isReadyForReading && injectedEvents.isReadyForReading;
+            fileHandleEvents.isReadyForWriting =
+                    fileHandle->interests.isReadyForWriting && injectedEvents.isReadyForWriting;
+            fileHandleEvents.hasErrorConditionPending =
+                    fileHandle->interests.hasErrorConditionPending && injectedEvents.hasErrorConditionPending;
+
+            if (fileHandleEvents.isReadyForReading || fileHandleEvents.isReadyForWriting ||
+                fileHandleEvents.hasErrorConditionPending) {
+                fileHandle->callback((HAPPlatformFileHandleRef) fileHandle, fileHandleEvents, fileHandle->context);
+            }
+        }
+    }
+}
+#else
+#if HAP_PLATFORM_RUN_LOOP_USE_POLL
+/**
+ * Collects the file handles that were reported as ready by the last call to `poll`.
+ *
+ * - Must be called before any callbacks are invoked, as callbacks may reorder the array of polled file descriptors.
+ *
+ * @param      numReadyFileDescriptors Number of ready file descriptors, as returned by `poll`.
+ */
+static void CollectPolledFileHandles(size_t numReadyFileDescriptors) {
+    HAPAssert(!runLoop.readyFileHandles);
+
+    HAPPlatformFileHandle* _Nullable* lastFileHandle = &runLoop.readyFileHandles;
+    for (size_t i = 0; numReadyFileDescriptors && i < runLoop.numPollFileDescriptors; i++) {
+        short revents = runLoop.pollFileDescriptors[i].revents;
+        if (!revents) {
+            continue;
+        }
+        numReadyFileDescriptors--;
+
+        // Mirror `select` semantics: Error and hang-up conditions are reported as readable / writable so that the
+        // owner of the file descriptor notices them on its next read or write.
+        HAPPlatformFileHandle* fileHandle = runLoop.pollFileHandles[i];
+        HAPAssert(fileHandle->pollIndex == i);
+        fileHandle->readyEvents.isReadyForReading = (revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL)) != 0;
+        fileHandle->readyEvents.isReadyForWriting = (revents & (POLLOUT | POLLERR)) != 0;
+        fileHandle->readyEvents.hasErrorConditionPending = (revents & POLLPRI) != 0;
+        fileHandle->isAwaitingEvents = true;
+        fileHandle->nextReadyFileHandle = NULL;
+        *lastFileHandle = fileHandle;
+        lastFileHandle = &fileHandle->nextReadyFileHandle;
+    }
+}
+#elif HAP_PLATFORM_RUN_LOOP_USE_EPOLL
+/**
+ * Collects the file handles that were reported as ready by the last call to `epoll_wait`.
+ *
+ * - Must be called before any callbacks are invoked, as callbacks may deregister file handles.
+ *
+ * @param      numEvents            Number of events, as returned by `epoll_wait`.
+ */
+static void CollectEpollFileHandles(size_t numEvents) {
+    HAPAssert(!runLoop.readyFileHandles);
+    HAPAssert(numEvents <= runLoop.maxEpollEvents);
+
+    HAPPlatformFileHandle* _Nullable* lastFileHandle = &runLoop.readyFileHandles;
+    for (size_t i = 0; i < numEvents; i++) {
+        uint32_t events = runLoop.epollEvents[i].events;
+
+        // Mirror `select` semantics, like the `poll` backend.
+        HAPPlatformFileHandle* fileHandle = runLoop.epollEvents[i].data.ptr;
+        HAPAssert(fileHandle->epollEvents);
+        fileHandle->readyEvents.isReadyForReading = (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0;
+        fileHandle->readyEvents.isReadyForWriting = (events & (EPOLLOUT | EPOLLERR)) != 0;
+        fileHandle->readyEvents.hasErrorConditionPending = (events & EPOLLPRI) != 0;
+        fileHandle->isAwaitingEvents = true;
+        fileHandle->nextReadyFileHandle = NULL;
+        *lastFileHandle = fileHandle;
+        lastFileHandle = &fileHandle->nextReadyFileHandle;
+    }
+}
+#endif
+
+#if HAP_PLATFORM_RUN_LOOP_USE_READY_LIST
+static void ProcessPolledFileHandles(void) {
+    while (runLoop.readyFileHandles) {
+        // Update head, so that reentrant deregistrations do not interfere.
+        HAPPlatformFileHandle* fileHandle = runLoop.readyFileHandles;
+        runLoop.readyFileHandles = fileHandle->nextReadyFileHandle;
+        fileHandle->nextReadyFileHandle = NULL;
+        fileHandle->isAwaitingEvents = false;
+
+        HAPAssert(fileHandle->fileDescriptor != -1);
+        if (fileHandle->callback) {
+            HAPPlatformFileHandleEvent fileHandleEvents;
+            fileHandleEvents.isReadyForReading =
+                    fileHandle->interests.isReadyForReading && fileHandle->readyEvents.isReadyForReading;
+            fileHandleEvents.isReadyForWriting =
+                    fileHandle->interests.isReadyForWriting && fileHandle->readyEvents.isReadyForWriting;
+            fileHandleEvents.hasErrorConditionPending =
+                    fileHandle->interests.hasErrorConditionPending && fileHandle->readyEvents.hasErrorConditionPending;
+
+            if (fileHandleEvents.isReadyForReading || fileHandleEvents.isReadyForWriting ||
+                fileHandleEvents.hasErrorConditionPending) {
+#if HAP_PLATFORM_RUN_LOOP_INSTRUMENTATION
+                // The callback may deregister the file handle. The loopback callback is not tracked, as it drains the
+                // scheduled callbacks, which are tracked individually.
+                bool isLoopback = (HAPPlatformFileHandleRef) fileHandle == runLoop.loopbackFileHandle;
+                const void* function = (const void*) (uintptr_t) fileHandle->callback;
+                uint64_t startTime = HAPPlatformClockGetCurrentMicroseconds();
+#endif
+                fileHandle->callback((HAPPlatformFileHandleRef) fileHandle, fileHandleEvents, fileHandle->context);
+#if HAP_PLATFORM_RUN_LOOP_INSTRUMENTATION
+                if (!isLoopback) {
+                    RecordCallbackDuration(kHAPPlatformRunLoopCallbackKind_FileHandle, function, startTime);
+                }
+#endif
+            }
+        }
+    }
+}
+#else
 static void ProcessSelectedFileHandles(
         fd_set* readFileDescriptors,
         fd_set* writeFileDescriptors,
@@ -300,105 +1317,619 @@ static void ProcessSelectedFileHandles(
 
                 if (fileHandleEvents.isReadyForReading || fileHandleEvents.isReadyForWriting ||
                     fileHandleEvents.hasErrorConditionPending) {
+#if HAP_PLATFORM_RUN_LOOP_INSTRUMENTATION
+                    // The callback may deregister the file handle. The loopback callback is not tracked, as it
+                    // drains the scheduled callbacks, which are tracked individually.
+                    bool isLoopback = (HAPPlatformFileHandleRef) fileHandle == runLoop.loopbackFileHandle;
+                    const void* function = (const void*) (uintptr_t) fileHandle->callback;
+                    uint64_t startTime = HAPPlatformClockGetCurrentMicroseconds();
+#endif
                     fileHandle->callback((HAPPlatformFileHandleRef) fileHandle, fileHandleEvents, fileHandle->context);
+#if HAP_PLATFORM_RUN_LOOP_INSTRUMENTATION
+                    if (!isLoopback) {
+                        RecordCallbackDuration(kHAPPlatformRunLoopCallbackKind_FileHandle, function, startTime);
+                    }
+#endif
                 }
             }
         }
     }
 }
+#endif
+#endif
+
+/**
+ * Returns whether a timer fires before another timer.
+ *
+ * - Timers fire in ascending order of their deadlines. Timers with the same deadline fire in order of registration.
+ *
+ * @param      timer                Timer.
+ * @param      otherTimer           Other timer.
+ *
+ * @return true                     If the timer fires before the other timer.
+ * @return false                    Otherwise.
+ */
+HAP_RESULT_USE_CHECK
+static bool IsTimerOrderedBefore(const HAPPlatformTimer* timer, const HAPPlatformTimer* otherTimer) {
+    HAPPrecondition(timer);
+    HAPPrecondition(otherTimer);
+
+    if (timer->deadline != otherTimer->deadline) {
+        return timer->deadline < otherTimer->deadline;
+    }
+    return timer->sequenceNumber < otherTimer->sequenceNumber;
+}
+
+/**
+ * Stores a timer at a position in the timer heap.
+ *
+ * @param      i                    Position in the timer heap.
+ * @param      timer                Timer.
+ */
+static void SetTimerHeapElement(size_t i, HAPPlatformTimer* timer) {
+    HAPPrecondition(i < runLoop.numTimers);
+    HAPPrecondition(timer);
+
+    runLoop.timers[i] = timer;
+    timer->heapIndex = i;
+}
+
+/**
+ * Restores the heap property by moving a timer towards the root of the timer heap.
+ *
+ * @param      i                    Position of the timer in the timer heap.
+ */
+static void SiftTimerUp(size_t i) {
+    HAPPrecondition(i < runLoop.numTimers);
+
+    HAPPlatformTimer* timer = runLoop.timers[i];
+    while (i) {
+        size_t parent = (i - 1) / 2;
+        if (!IsTimerOrderedBefore(timer, runLoop.timers[parent])) {
+            break;
+        }
+        SetTimerHeapElement(i, runLoop.timers[parent]);
+        i = parent;
+    }
+    SetTimerHeapElement(i, timer);
+}
+
+/**
+ * Restores the heap property by moving a timer towards the leaves of the timer heap.
+ *
+ * @param      i                    Position of the timer in the timer heap.
+ */
+static void SiftTimerDown(size_t i) {
+    HAPPrecondition(i < runLoop.numTimers);
+
+    HAPPlatformTimer* timer = runLoop.timers[i];
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= runLoop.numTimers) {
+            break;
+        }
+        if (child + 1 < runLoop.numTimers && IsTimerOrderedBefore(runLoop.timers[child + 1], runLoop.timers[child])) {
+            child++;
+        }
+        if (!IsTimerOrderedBefore(runLoop.timers[child], timer)) {
+            break;
+        }
+        SetTimerHeapElement(i, runLoop.timers[child]);
+        i = child;
+    }
+    SetTimerHeapElement(i, timer);
+}
+
+/**
+ * Returns the latest time at which a timer may fire.
+ *
+ * @param      timer                Timer.
+ *
+ * @return Deadline plus leeway, saturated.
+ */
+HAP_RESULT_USE_CHECK
+static HAPTime GetTimerLatestTime(const HAPPlatformTimer* timer) {
+    HAPPrecondition(timer);
+
+    return timer->leeway > UINT64_MAX - timer->deadline ? UINT64_MAX : timer->deadline + timer->leeway;
+}
+
+/**
+ * Removes a timer from the timer heap.
+ *
+ * @param      timer                Timer.
+ */
+static void RemoveTimerHeapElement(HAPPlatformTimer* timer) {
+    HAPPrecondition(timer);
+    HAPPrecondition(timer->heapIndex < runLoop.numTimers);
+    HAPPrecondition(runLoop.timers[timer->heapIndex] == timer);
+
+    // Only the timer that determined the cached wakeup time can raise it.
+    if (runLoop.isTimerWakeupTimeCached && GetTimerLatestTime(timer) <= runLoop.cachedTimerWakeupTime) {
+        runLoop.isTimerWakeupTimeCached = false;
+    }
+
+    size_t i = timer->heapIndex;
+    runLoop.numTimers--;
+    if (i != runLoop.numTimers) {
+        HAPPlatformTimer* lastTimer = runLoop.timers[runLoop.numTimers];
+        SetTimerHeapElement(i, lastTimer);
+        if (i && IsTimerOrderedBefore(lastTimer, runLoop.timers[(i - 1) / 2])) {
+            SiftTimerUp(i);
+        } else {
+            SiftTimerDown(i);
+        }
+    }
+    runLoop.timers[runLoop.numTimers] = NULL;
+    timer->heapIndex = SIZE_MAX;
+}
+
+/**
+ * Returns the time at which the run loop needs to wake up to fire timers.
+ *
+ * - Every timer must fire between its deadline and its deadline plus leeway. The earliest such latest firing time is
+ *   chosen, so that all timers whose deadlines have passed by then fire in the same wakeup.
+ * - Only timers with a deadline before the current candidate can lower it. Due to the heap property, subtrees whose
+ *   root has a later deadline are skipped, so timers without leeway only require a look at the heap root.
+ * - The result is cached until a timer is removed whose latest firing time may have determined it. Registering a
+ *   timer only lowers the cached value, so most iterations do not walk the heap at all.
+ *
+ * @return Time at which the run loop needs to wake up, or 0 if no timers are registered.
+ */
+HAP_RESULT_USE_CHECK
+static HAPTime GetNextTimerWakeupTime(void) {
+    if (!runLoop.numTimers) {
+        return 0;
+    }
+    if (runLoop.isTimerWakeupTimeCached) {
+        return runLoop.cachedTimerWakeupTime;
+    }
+
+    HAPTime wakeupTime = UINT64_MAX;
+    size_t stack[64];
+    size_t numStack = 0;
+    stack[numStack++] = 0;
+    while (numStack) {
+        size_t i = stack[--numStack];
+        const HAPPlatformTimer* timer = runLoop.timers[i];
+        if (timer->deadline >= wakeupTime) {
+            continue;
+        }
+        HAPTime latestTime = GetTimerLatestTime(timer);
+        if (latestTime < wakeupTime) {
+            wakeupTime = latestTime;
+        }
+        for (size_t j = 2 * i + 1; j <= 2 * i + 2 && j < runLoop.numTimers; j++) {
+            HAPAssert(numStack < HAPArrayCount(stack));
+            stack[numStack++] = j;
+        }
+    }
+    runLoop.cachedTimerWakeupTime = wakeupTime;
+    runLoop.isTimerWakeupTimeCached = true;
+    return wakeupTime;
+}
+
+/**
+ * Ensures that the timer heap can hold the given number of timers.
+ *
+ * @param      numTimers            Number of timers.
+ *
+ * @return kHAPError_None           If successful.
+ * @return kHAPError_OutOfResources If the timer heap could not be grown.
+ */
+HAP_RESULT_USE_CHECK
+static HAPError ReserveTimers(size_t numTimers) {
+    if (numTimers <= runLoop.maxTimers) {
+        return kHAPError_None;
+    }
+
+    size_t maxTimers = runLoop.maxTimers ? 2 * runLoop.maxTimers : 8;
+    while (maxTimers < numTimers) {
+        maxTimers *= 2;
+    }
+
+    HAPPlatformTimer** timers = realloc(runLoop.timers, maxTimers * sizeof *timers);
+    if (!timers) {
+        return kHAPError_OutOfResources;
+    }
+    runLoop.timers = timers;
+    runLoop.maxTimers = maxTimers;
+    return kHAPError_None;
+}
 
 HAP_RESULT_USE_CHECK
 HAPError HAPPlatformTimerRegister(
+        HAPPlatformTimerRef* timer,
+        HAPTime deadline,
+        HAPPlatformTimerCallback callback,
+        void* _Nullable context) {
+    return HAPPlatformTimerRegisterWithLeeway(timer, deadline, /* leeway: */ 0, callback, context);
+}
+
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformTimerRegisterWithLeeway(
         HAPPlatformTimerRef* timer_,
         HAPTime deadline,
+        HAPTime leeway,
         HAPPlatformTimerCallback callback,
         void* _Nullable context) {
     HAPPrecondition(timer_);
     HAPPlatformTimer* _Nullable* newTimer = (HAPPlatformTimer * _Nullable*) timer_;
     HAPPrecondition(callback);
 
+    // Grow timer heap.
+    if (ReserveTimers(runLoop.numTimers + 1) != kHAPError_None) {
+        HAPLog(&logObject, "Cannot allocate more timers.");
+        *newTimer = NULL;
+        return kHAPError_OutOfResources;
+    }
+
     // Prepare timer.
-    *newTimer = calloc(1, sizeof(HAPPlatformTimer));
+    *newTimer = AllocatePoolObject(&runLoop.timerPool);
     if (!*newTimer) {
         HAPLog(&logObject, "Cannot allocate more timers.");
         return kHAPError_OutOfResources;
     }
-    (*newTimer)->deadline = deadline ? deadline : 1;
-    (*newTimer)->callback = callback;
-    (*newTimer)->context = context;
+    (*newTimer)->deadline = deadline ? deadline : 1;
+    (*newTimer)->leeway = leeway;
+    (*newTimer)->callback = callback;
+    (*newTimer)->context = context;
+    (*newTimer)->sequenceNumber = runLoop.nextTimerSequenceNumber++;
+
+    // Insert timer.
+    runLoop.numTimers++;
+    SetTimerHeapElement(runLoop.numTimers - 1, *newTimer);
+    SiftTimerUp(runLoop.numTimers - 1);
+    if (runLoop.isTimerWakeupTimeCached && GetTimerLatestTime(*newTimer) < runLoop.cachedTimerWakeupTime) {
+        runLoop.cachedTimerWakeupTime = GetTimerLatestTime(*newTimer);
+    }
+
+    return kHAPError_None;
+}
+
+void HAPPlatformTimerDeregister(HAPPlatformTimerRef timer_) {
+    HAPPrecondition(timer_);
+    HAPPlatformTimer* timer = (HAPPlatformTimer*) timer_;
+
+    if (timer->heapIndex >= runLoop.numTimers || runLoop.timers[timer->heapIndex] != timer) {
+        // Timer not found.
+        HAPFatalError();
+    }
+
+    // Remove timer.
+    RemoveTimerHeapElement(timer);
+    FreePoolObject(&runLoop.timerPool, timer);
+}
+
+/**
+ * Fires all timers whose deadlines have passed.
+ *
+ * @param      now                  Current time.
+ */
+static void ProcessExpiredTimers(HAPTime now) {
+    // Enumerate timers.
+    HAPTime firstDeadline = 0;
+    HAPTime lastDeadline = 0;
+    size_t numDeadlines = 0;
+    while (runLoop.numTimers) {
+        if (runLoop.timers[0]->deadline > now) {
+            break;
+        }
+
+        // Remove from heap, so that reentrant add / removes do not interfere.
+        HAPPlatformTimer* expiredTimer = runLoop.timers[0];
+        RemoveTimerHeapElement(expiredTimer);
+
+        // Count distinct deadlines. Without leeway, each would have required a separate wakeup.
+        if (!numDeadlines) {
+            firstDeadline = expiredTimer->deadline;
+        }
+        if (!numDeadlines || expiredTimer->deadline != lastDeadline) {
+            lastDeadline = expiredTimer->deadline;
+            numDeadlines++;
+        }
+
+        // Invoke callback.
+#if HAP_PLATFORM_RUN_LOOP_INSTRUMENTATION
+        RecordHistogramSample(&runLoop.instrumentation.timerLateness, now - expiredTimer->deadline);
+        uint64_t startTime = HAPPlatformClockGetCurrentMicroseconds();
+#endif
+        expiredTimer->callback((HAPPlatformTimerRef) expiredTimer, expiredTimer->context);
+#if HAP_PLATFORM_RUN_LOOP_INSTRUMENTATION
+        RecordCallbackDuration(
+                kHAPPlatformRunLoopCallbackKind_Timer, (const void*) (uintptr_t) expiredTimer->callback, startTime);
+#endif
+
+        // Free memory.
+        FreePoolObject(&runLoop.timerPool, expiredTimer);
+    }
+
+    if (numDeadlines) {
+        runLoop.timerWakeupStatistics.numWakeups++;
+        if (runLoop.timerWakeupTime > firstDeadline) {
+            // Wakeup was delayed within the leeway of the first timer to fire later timers as well.
+            runLoop.timerWakeupStatistics.numSavedWakeups += numDeadlines - 1;
+        }
+    }
+}
+
+void CloseLoopback(int fileDescriptor)
+{
+    if (fileDescriptor != -1) {
+        HAPLogDebug(&logObject, "close(%d);", fileDescriptor);
+        int e = close(fileDescriptor);
+        if (e != 0) {
+            int _errno = errno;
+            HAPAssert(e == -1);
+            HAPPlatformLogPOSIXError(kHAPLogType_Error, "Closing loopback failed (log, fileDescriptor0).",
+                _errno, __func__, HAP_FILE, __LINE__);
+        }
+    }
+}
+
+/**
+ * Resets a ring buffer to the empty state.
+ *
+ * @param      ring                 Ring buffer.
+ */
+static void ResetRing(HAPPlatformRunLoopRing* ring) {
+    HAPPrecondition(ring);
+
+    HAPRawBufferZero(ring->bytes, ring->numBytes);
+    ring->writePosition = 0;
+    ring->readPosition = 0;
+}
+
+/**
+ * Claims a record in a ring buffer. May be called from any thread.
+ *
+ * - The record must be published with CommitRingRecord.
+ *
+ * @param      ring                 Ring buffer.
+ * @param      numBytes             Size of the record including the header.
+ *
+ * @return Claimed record, or NULL if the ring buffer does not have enough free space.
+ */
+HAP_RESULT_USE_CHECK
+static void* _Nullable ClaimRingRecord(HAPPlatformRunLoopRing* ring, size_t numBytes) {
+    HAPPrecondition(ring);
+    HAPPrecondition(numBytes >= sizeof(HAPPlatformRunLoopRingRecordHeader));
+
+    numBytes = (numBytes + 7) & ~(size_t) 7;
+    if (numBytes > ring->numBytes) {
+        return NULL;
+    }
 
-    // Insert timer.
-    for (HAPPlatformTimer* _Nullable* nextTimer = &runLoop.timers;; nextTimer = &(*nextTimer)->nextTimer) {
-        if (!*nextTimer) {
-            (*newTimer)->nextTimer = NULL;
-            *nextTimer = *newTimer;
-            break;
+    uint32_t position = __atomic_load_n(&ring->writePosition, __ATOMIC_RELAXED);
+    uint32_t numPaddingBytes;
+    for (;;) {
+        uint32_t readPosition = __atomic_load_n(&ring->readPosition, __ATOMIC_ACQUIRE);
+        uint32_t offset = position & (ring->numBytes - 1);
+        numPaddingBytes = offset + numBytes > ring->numBytes ? ring->numBytes - offset : 0;
+        if ((position - readPosition) + numPaddingBytes + numBytes > ring->numBytes) {
+            return NULL;
         }
-        if ((*nextTimer)->deadline > deadline) {
-            // Search condition must be '>' and not '>=' to ensure that timers fire in ascending order of their
-            // deadlines and that timers registered with the same deadline fire in order of registration.
-            (*newTimer)->nextTimer = *nextTimer;
-            *nextTimer = *newTimer;
+        if (__atomic_compare_exchange_n(
+                    &ring->writePosition,
+                    &position,
+                    position + numPaddingBytes + (uint32_t) numBytes,
+                    /* weak: */ true,
+                    __ATOMIC_RELAXED,
+                    __ATOMIC_RELAXED)) {
             break;
         }
     }
 
-    return kHAPError_None;
+    if (numPaddingBytes) {
+        HAPPlatformRunLoopRingRecordHeader* padding =
+                (HAPPlatformRunLoopRingRecordHeader*) &ring->bytes[position & (ring->numBytes - 1)];
+        padding->numBytes = numPaddingBytes;
+        __atomic_store_n(&padding->state, kHAPPlatformRunLoopRingRecordState_Padding, __ATOMIC_RELEASE);
+        position += numPaddingBytes;
+    }
+
+    HAPPlatformRunLoopRingRecordHeader* header =
+            (HAPPlatformRunLoopRingRecordHeader*) &ring->bytes[position & (ring->numBytes - 1)];
+    header->numBytes = (uint32_t) numBytes;
+    return header;
 }
 
-void HAPPlatformTimerDeregister(HAPPlatformTimerRef timer_) {
-    HAPPrecondition(timer_);
-    HAPPlatformTimer* timer = (HAPPlatformTimer*) timer_;
+/**
+ * Publishes a record that was claimed with ClaimRingRecord. May be called from any thread.
+ *
+ * @param      record               Record.
+ */
+static void CommitRingRecord(void* record) {
+    HAPPrecondition(record);
+    HAPPlatformRunLoopRingRecordHeader* header = record;
 
-    // Find and remove timer.
-    for (HAPPlatformTimer* _Nullable* nextTimer = &runLoop.timers; *nextTimer; nextTimer = &(*nextTimer)->nextTimer) {
-        if (*nextTimer == timer) {
-            *nextTimer = timer->nextTimer;
-            HAPPlatformFreeSafe(timer);
-            return;
-        }
-    }
+    __atomic_store_n(&header->state, kHAPPlatformRunLoopRingRecordState_Committed, __ATOMIC_RELEASE);
+}
 
-    // Timer not found.
-    HAPFatalError();
+/**
+ * Releases a record of a ring buffer. May be called from any thread.
+ *
+ * - The space of the record is reclaimed by ReclaimRingRecords once all older records have been released.
+ *
+ * @param      record               Record.
+ */
+static void ReleaseRingRecord(void* record) {
+    HAPPrecondition(record);
+    HAPPlatformRunLoopRingRecordHeader* header = record;
+
+    __atomic_store_n(&header->state, kHAPPlatformRunLoopRingRecordState_Released, __ATOMIC_RELEASE);
 }
 
-static void ProcessExpiredTimers(void) {
-    // Get current time.
-    HAPTime now = HAPPlatformClockGetCurrent();
+/**
+ * Reclaims the space of released records and padding at the start of a ring buffer. Must only be called by the
+ * consumer.
+ *
+ * - Records do not wrap around the end of the ring buffer. Once the ring buffer is empty, both positions are moved to
+ *   the start of the next lap, so that a record of up to the size of the ring buffer can be claimed again.
+ *
+ * @param      ring                 Ring buffer.
+ */
+static void ReclaimRingRecords(HAPPlatformRunLoopRing* ring) {
+    HAPPrecondition(ring);
 
-    // Enumerate timers.
-    while (runLoop.timers) {
-        if (runLoop.timers->deadline > now) {
+    for (;;) {
+        uint32_t position = ring->readPosition;
+        if (position == __atomic_load_n(&ring->writePosition, __ATOMIC_ACQUIRE)) {
+            // Producers that observe the new write position before the new read position see less free space than
+            // there is, which only makes their claims fail conservatively. The skipped space is already zeroed.
+            uint32_t nextLapPosition = (position + ring->numBytes - 1) & ~(ring->numBytes - 1);
+            if (nextLapPosition != position && __atomic_compare_exchange_n(
+                                                       &ring->writePosition,
+                                                       &position,
+                                                       nextLapPosition,
+                                                       /* weak: */ false,
+                                                       __ATOMIC_RELAXED,
+                                                       __ATOMIC_RELAXED)) {
+                __atomic_store_n(&ring->readPosition, nextLapPosition, __ATOMIC_RELEASE);
+            }
+            break;
+        }
+        HAPPlatformRunLoopRingRecordHeader* header =
+                (HAPPlatformRunLoopRingRecordHeader*) &ring->bytes[position & (ring->numBytes - 1)];
+        uint32_t state = __atomic_load_n(&header->state, __ATOMIC_ACQUIRE);
+        if (state != kHAPPlatformRunLoopRingRecordState_Padding &&
+            state != kHAPPlatformRunLoopRingRecordState_Released) {
             break;
         }
 
-        // Update head, so that reentrant add / removes do not interfere.
-        HAPPlatformTimer* expiredTimer = runLoop.timers;
-        runLoop.timers = runLoop.timers->nextTimer;
+        // Zero the record so that its space reads as claimed once it is reused.
+        uint32_t numBytes = header->numBytes;
+        HAPRawBufferZero(header, numBytes);
+        __atomic_store_n(&ring->readPosition, position + numBytes, __ATOMIC_RELEASE);
+    }
+}
 
-        // Invoke callback.
-        expiredTimer->callback((HAPPlatformTimerRef) expiredTimer, expiredTimer->context);
+/**
+ * Returns the oldest record of a ring buffer, if it has been published. Must only be called by the consumer.
+ *
+ * - Only suitable for ring buffers whose records are released in order.
+ *
+ * @param      ring                 Ring buffer.
+ *
+ * @return Oldest record, or NULL if the ring buffer is empty or its oldest record is still being filled in.
+ */
+HAP_RESULT_USE_CHECK
+static void* _Nullable GetNextRingRecord(HAPPlatformRunLoopRing* ring) {
+    HAPPrecondition(ring);
 
-        // Free memory.
-        HAPPlatformFreeSafe(expiredTimer);
+    ReclaimRingRecords(ring);
+    if (ring->readPosition == __atomic_load_n(&ring->writePosition, __ATOMIC_ACQUIRE)) {
+        return NULL;
     }
+    HAPPlatformRunLoopRingRecordHeader* header =
+            (HAPPlatformRunLoopRingRecordHeader*) &ring->bytes[ring->readPosition & (ring->numBytes - 1)];
+    uint32_t state = __atomic_load_n(&header->state, __ATOMIC_ACQUIRE);
+    if (state == kHAPPlatformRunLoopRingRecordState_Claimed) {
+        return NULL;
+    }
+    HAPAssert(state == kHAPPlatformRunLoopRingRecordState_Committed);
+    return header;
 }
 
-void CloseLoopback(int fileDescriptor)
-{
-    if (fileDescriptor != -1) {
-        HAPLogDebug(&logObject, "close(%d);", fileDescriptor);
-        int e = close(fileDescriptor);
-        if (e != 0) {
-            int _errno = errno;
-            HAPAssert(e == -1);
-            HAPPlatformLogPOSIXError(kHAPLogType_Error, "Closing loopback failed (log, fileDescriptor0).",
-                _errno, __func__, HAP_FILE, __LINE__);
+/**
+ * Initializes the scheduled callback ring buffer.
+ */
+static void InitializeScheduledCallbacks(void) {
+    ResetRing(&runLoop.callbackRing);
+    ResetRing(&runLoop.callbackArena);
+    runLoop.isWakeupPending = 0;
+    HAPRawBufferZero(&runLoop.callbackQueueStatistics, sizeof runLoop.callbackQueueStatistics);
+    runLoop.callbackQueueStatistics.maxBytes = runLoop.callbackRing.numBytes;
+    runLoop.callbackQueueStatistics.maxArenaBytes = runLoop.callbackArena.numBytes;
+}
+
+/**
+ * Invokes all scheduled callbacks that have been completely enqueued, in order.
+ *
+ * - Callbacks are invoked in place, with the context still stored in the ring buffer or arena. The remaining records
+ *   are not moved.
+ * - Only callbacks that were enqueued before the drain started are invoked. Callbacks enqueued by them run in the next
+ *   iteration, which the wakeup sent by HAPPlatformRunLoopScheduleCallback triggers, so that a callback that
+ *   reschedules itself cannot starve timers and file handles.
+ * - The arena is reclaimed on every drain, not only after a callback with a large context was invoked.
+ */
+static void ProcessScheduledCallbacks(void) {
+    // Arena records of callbacks that could not be enqueued are released by the producer and only reclaimed here.
+    ReclaimRingRecords(&runLoop.callbackArena);
+
+    uint32_t endPosition = __atomic_load_n(&runLoop.callbackRing.writePosition, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint32_t numBytes = __atomic_load_n(&runLoop.callbackRing.writePosition, __ATOMIC_RELAXED) -
+                            runLoop.callbackRing.readPosition;
+        if (numBytes > runLoop.callbackQueueStatistics.numBytesHighWaterMark) {
+            runLoop.callbackQueueStatistics.numBytesHighWaterMark = numBytes;
+        }
+        uint32_t numArenaBytes = __atomic_load_n(&runLoop.callbackArena.writePosition, __ATOMIC_RELAXED) -
+                                 runLoop.callbackArena.readPosition;
+        if (numArenaBytes > runLoop.callbackQueueStatistics.numArenaBytesHighWaterMark) {
+            runLoop.callbackQueueStatistics.numArenaBytesHighWaterMark = numArenaBytes;
+        }
+
+        ReclaimRingRecords(&runLoop.callbackRing);
+        if ((int32_t)(runLoop.callbackRing.readPosition - endPosition) >= 0) {
+            break;
+        }
+        HAPPlatformRunLoopCallbackRecord* _Nullable record = GetNextRingRecord(&runLoop.callbackRing);
+        if (!record) {
+            // Ring buffer is empty, or the next record is still being filled in by a producer.
+            // The producer sends a wakeup after it has finished.
+            break;
+        }
+
+        HAPAssert(record->callback);
+        size_t contextSize = record->contextSize;
+        void* _Nullable context = NULL;
+        if (record->arenaRecord) {
+            context = &record->arenaRecord[1];
+        } else if (contextSize) {
+            context = record->context;
+        }
+#if HAP_PLATFORM_RUN_LOOP_INSTRUMENTATION
+        uint64_t startTime = HAPPlatformClockGetCurrentMicroseconds();
+#endif
+        record->callback(context, contextSize);
+#if HAP_PLATFORM_RUN_LOOP_INSTRUMENTATION
+        RecordCallbackDuration(
+                kHAPPlatformRunLoopCallbackKind_ScheduledCallback,
+                (const void*) (uintptr_t) record->callback,
+                startTime);
+#endif
+
+        if (record->arenaRecord) {
+            ReleaseRingRecord(record->arenaRecord);
+            ReclaimRingRecords(&runLoop.callbackArena);
         }
+        ReleaseRingRecord(record);
+    }
+}
+
+/**
+ * Invokes all run loop observers, in order.
+ */
+static void ProcessObservers(void) {
+    runLoop.observerCursor = runLoop.observers;
+    while (runLoop.observerCursor) {
+        HAPPlatformRunLoopObserver* observer = runLoop.observerCursor;
+        runLoop.observerCursor = observer->nextObserver;
+
+        HAPAssert(observer->callback);
+#if HAP_PLATFORM_RUN_LOOP_INSTRUMENTATION
+        uint64_t startTime = HAPPlatformClockGetCurrentMicroseconds();
+#endif
+        observer->callback(observer->context);
+#if HAP_PLATFORM_RUN_LOOP_INSTRUMENTATION
+        RecordCallbackDuration(
+                kHAPPlatformRunLoopCallbackKind_Observer, (const void*) (uintptr_t) observer->callback, startTime);
+#endif
     }
 }
 
+#if !HAVE_VIRTUAL_TIME
 static void HandleLoopbackFileHandleCallback(
     HAPPlatformFileHandleRef fileHandle,
     HAPPlatformFileHandleEvent fileHandleEvents,
@@ -408,66 +1939,35 @@ static void HandleLoopbackFileHandleCallback(
     HAPAssert(fileHandle == runLoop.loopbackFileHandle);
     HAPAssert(fileHandleEvents.isReadyForReading);
 
-    HAPAssert(runLoop.numLoopbackBytes < sizeof runLoop.loopbackBytes);
-    
-    ssize_t n;
-    do {
-        n = recvfrom(runLoop.loopbackFileDescriptor,
-                &runLoop.loopbackBytes[runLoop.numLoopbackBytes],
-                sizeof runLoop.loopbackBytes - runLoop.numLoopbackBytes, 0, NULL, NULL);
-    } while (n == -1 && errno == EINTR);
-    if (n == -1 && errno == EAGAIN) {
-        return;
-    }
-
-    if (n < 0) {
-        int _errno = errno;
-        HAPAssert(n == -1);
-        HAPPlatformLogPOSIXError(kHAPLogType_Error,
-            "Loopback read failed.", _errno, __func__, HAP_FILE, __LINE__);
-        HAPFatalError();
-    }
-    if (n == 0) {
-        HAPLogError(&logObject, "Loopback socket read returned no data.");
-        HAPFatalError();
-    }
-
-    HAPAssert((size_t) n <= sizeof runLoop.loopbackBytes - runLoop.numLoopbackBytes);
-    runLoop.numLoopbackBytes += (size_t) n;
+    // Consume wakeups.
     for (;;) {
-        if (runLoop.numLoopbackBytes < sizeof (HAPPlatformRunLoopCallback) + 1) {
+        uint8_t bytes[16];
+        ssize_t n;
+        do {
+            n = recvfrom(runLoop.loopbackFileDescriptor, bytes, sizeof bytes, 0, NULL, NULL);
+        } while (n == -1 && errno == EINTR);
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
             break;
         }
-        size_t contextSize = (size_t) runLoop.loopbackBytes[sizeof (HAPPlatformRunLoopCallback)];
-        if (runLoop.numLoopbackBytes < sizeof (HAPPlatformRunLoopCallback) + 1 + contextSize) {
-            break;
+        if (n < 0) {
+            int _errno = errno;
+            HAPAssert(n == -1);
+            HAPPlatformLogPOSIXError(kHAPLogType_Error,
+                "Loopback read failed.", _errno, __func__, HAP_FILE, __LINE__);
+            HAPFatalError();
         }
+        if (n == 0) {
+            HAPLogError(&logObject, "Loopback socket read returned no data.");
+            HAPFatalError();
+        }
+    }
 
-        HAPPlatformRunLoopCallback callback;
-        HAPRawBufferCopyBytes(
-            &callback,
-            &runLoop.loopbackBytes[0],
-            sizeof (HAPPlatformRunLoopCallback));
-        HAPRawBufferCopyBytes(
-            &runLoop.loopbackBytes[0],
-            &runLoop.loopbackBytes[sizeof (HAPPlatformRunLoopCallback) + 1],
-            runLoop.numLoopbackBytes - (sizeof (HAPPlatformRunLoopCallback) + 1));
-        runLoop.numLoopbackBytes -= (sizeof (HAPPlatformRunLoopCallback) + 1);
-
-        // Issue memory barrier to ensure visibility of data referenced by callback context.
-        __sync_synchronize();
-
-        callback(
-            contextSize ? &runLoop.loopbackBytes[0] : NULL,
-            contextSize);
+    // Re-arm wakeups before draining the queue, so that callbacks enqueued from now on send a new wakeup.
+    __atomic_store_n(&runLoop.isWakeupPending, 0, __ATOMIC_SEQ_CST);
 
-        HAPRawBufferCopyBytes(
-            &runLoop.loopbackBytes[0],
-            &runLoop.loopbackBytes[contextSize],
-            runLoop.numLoopbackBytes - contextSize);
-        runLoop.numLoopbackBytes -= contextSize;
-    }
+    ProcessScheduledCallbacks();
 }
+#endif
 
 void HAPPlatformRunLoopCreate(const HAPPlatformRunLoopOptions* options) {
     HAPPrecondition(options);
@@ -477,10 +1977,59 @@ void HAPPlatformRunLoopCreate(const HAPPlatformRunLoopOptions* options) {
     HAPLogDebug(&logObject, "Storage configuration: runLoop = %lu", (unsigned long) sizeof runLoop);
     HAPLogDebug(&logObject, "Storage configuration: fileHandle = %lu", (unsigned long) sizeof(HAPPlatformFileHandle));
     HAPLogDebug(&logObject, "Storage configuration: timer = %lu", (unsigned long) sizeof(HAPPlatformTimer));
+    HAPLogDebug(&logObject, "Storage configuration: maxTimers = %lu", (unsigned long) options->maxTimers);
+    HAPLogDebug(&logObject, "Storage configuration: maxFileHandles = %lu", (unsigned long) options->maxFileHandles);
+
+    // Preallocate timers and file handles, including the bookkeeping needed to register them, so that registrations
+    // within these limits do not allocate memory.
+#if HAP_PLATFORM_RUN_LOOP_INSTRUMENTATION
+    HAPPlatformRunLoopResetInstrumentation();
+#endif
+
+    runLoop.allowHeapFallback = options->allowHeapFallback;
+    CreatePool(&runLoop.timerPool, options->maxTimers);
+    CreatePool(&runLoop.fileHandlePool, options->maxFileHandles);
+    err = ReserveTimers(options->maxTimers);
+    if (err) {
+        HAPAssert(err == kHAPError_OutOfResources);
+        HAPLogError(&logObject, "Cannot allocate timer heap.");
+        HAPFatalError();
+    }
+#if HAP_PLATFORM_RUN_LOOP_USE_POLL
+    err = ReservePollFileDescriptors(options->maxFileHandles);
+    if (err) {
+        HAPAssert(err == kHAPError_OutOfResources);
+        HAPLogError(&logObject, "Cannot allocate polled file descriptors.");
+        HAPFatalError();
+    }
+#elif HAP_PLATFORM_RUN_LOOP_USE_EPOLL
+    HAPPrecondition(runLoop.epollFileDescriptor == -1);
+    runLoop.epollFileDescriptor = epoll_create1(EPOLL_CLOEXEC);
+    if (runLoop.epollFileDescriptor == -1) {
+        HAPPlatformLogPOSIXError(
+                kHAPLogType_Error, "System call 'epoll_create1' failed.", errno, __func__, HAP_FILE, __LINE__);
+        HAPFatalError();
+    }
+    err = ReserveEpollEvents(options->maxFileHandles);
+    if (err) {
+        HAPAssert(err == kHAPError_OutOfResources);
+        HAPLogError(&logObject, "Cannot allocate epoll events.");
+        HAPFatalError();
+    }
+#endif
 
+    InitializeScheduledCallbacks();
+
+#if HAVE_VIRTUAL_TIME
+    // Scheduled callbacks are processed on every run loop iteration, so no loopback is needed to wake up the run loop.
+    runLoop.virtualTimeDriver = options->virtualTimeDriver;
+    runLoop.virtualTimeDriverContext = options->virtualTimeDriverContext;
+    runLoop.hasInjectedEvents = false;
+#else
     // Open loop back
 
     HAPPrecondition(runLoop.loopbackFileDescriptor == -1);
+    HAPPrecondition(runLoop.loopbackSendFileDescriptor == -1);
     int fileDescriptor = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
     if (fileDescriptor < 0) {
         int _errno = errno;
@@ -513,6 +2062,32 @@ void HAPPlatformRunLoopCreate(const HAPPlatformRunLoopOptions* options) {
 
     runLoop.loopbackFileDescriptor = fileDescriptor;
 
+    // Open persistent socket to send wakeups.
+    fileDescriptor = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (fileDescriptor < 0) {
+        int _errno = errno;
+        HAPPlatformLogPOSIXError(kHAPLogType_Error,
+            "Loopback client socket failed (log, call 'socket').",
+            _errno, __func__, HAP_FILE, __LINE__);
+        HAPFatalError();
+    }
+    e = fcntl(fileDescriptor, F_SETFL, O_NONBLOCK);
+    if (e == -1) {
+        HAPPlatformLogPOSIXError(kHAPLogType_Error,
+            "System call 'fcntl' to set loopback send file descriptor flags to 'non-blocking' failed.",
+            errno, __func__, HAP_FILE, __LINE__);
+        HAPFatalError();
+    }
+    if (connect(fileDescriptor, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        int _errno = errno;
+        CloseLoopback(fileDescriptor);
+        HAPPlatformLogPOSIXError(kHAPLogType_Error,
+            "Loopback client socket failed to connect (log, call 'connect').",
+            _errno, __func__, HAP_FILE, __LINE__);
+        HAPFatalError();
+    }
+    runLoop.loopbackSendFileDescriptor = fileDescriptor;
+
     err = HAPPlatformFileHandleRegister(&runLoop.loopbackFileHandle,
         runLoop.loopbackFileDescriptor,
         (HAPPlatformFileHandleEvent) {
@@ -527,16 +2102,19 @@ void HAPPlatformRunLoopCreate(const HAPPlatformRunLoopOptions* options) {
         HAPFatalError();
     }
     HAPAssert(runLoop.loopbackFileHandle);
+#endif
 
     runLoop.state = kHAPPlatformRunLoopState_Idle;
     
-    // Issue memory barrier to ensure visibility of write to runLoop.selfPipeFileDescriptor1 on other threads.
+    // Issue memory barrier to ensure visibility of write to runLoop.loopbackSendFileDescriptor on other threads.
     __sync_synchronize();
 }
 
 void HAPPlatformRunLoopRelease(void) {
+    CloseLoopback(runLoop.loopbackSendFileDescriptor);
     CloseLoopback(runLoop.loopbackFileDescriptor);
 
+    runLoop.loopbackSendFileDescriptor = -1;
     runLoop.loopbackFileDescriptor = -1;
 
     if (runLoop.loopbackFileHandle) {
@@ -544,18 +2122,271 @@ void HAPPlatformRunLoopRelease(void) {
         runLoop.loopbackFileHandle = 0;
     }
 
+    ReleasePool(&runLoop.timerPool);
+    ReleasePool(&runLoop.fileHandlePool);
+    runLoop.allowHeapFallback = true;
+
+    HAPAssert(!runLoop.numTimers);
+    if (runLoop.timers) {
+        HAPPlatformFreeSafe(runLoop.timers);
+    }
+    runLoop.maxTimers = 0;
+    runLoop.numTimers = 0;
+    runLoop.isTimerWakeupTimeCached = false;
+
+#if HAP_PLATFORM_RUN_LOOP_USE_POLL
+    if (!runLoop.numFileHandles) {
+        HAPAssert(!runLoop.numPollFileDescriptors);
+        if (runLoop.pollFileDescriptors) {
+            HAPPlatformFreeSafe(runLoop.pollFileDescriptors);
+        }
+        if (runLoop.pollFileHandles) {
+            HAPPlatformFreeSafe(runLoop.pollFileHandles);
+        }
+        runLoop.maxPollFileDescriptors = 0;
+    }
+#elif HAP_PLATFORM_RUN_LOOP_USE_EPOLL
+    HAPAssert(!runLoop.numFileHandles);
+    if (runLoop.epollEvents) {
+        HAPPlatformFreeSafe(runLoop.epollEvents);
+    }
+    runLoop.maxEpollEvents = 0;
+    if (runLoop.epollFileDescriptor != -1) {
+        HAPLogDebug(&logObject, "close(%d);", runLoop.epollFileDescriptor);
+        (void) close(runLoop.epollFileDescriptor);
+        runLoop.epollFileDescriptor = -1;
+    }
+#endif
+
     runLoop.state = kHAPPlatformRunLoopState_Idle;
 
-    // Issue memory barrier to ensure visibility of write to runLoop.loopbackFileDescriptor1 on other threads.
+    // Issue memory barrier to ensure visibility of write to runLoop.loopbackSendFileDescriptor on other threads.
     __sync_synchronize();
 }
 
+void HAPPlatformRunLoopGetStatistics(HAPPlatformRunLoopStatistics* statistics) {
+    HAPPrecondition(statistics);
+
+    HAPRawBufferZero(statistics, sizeof *statistics);
+    statistics->timers = runLoop.timerPool.statistics;
+    statistics->fileHandles = runLoop.fileHandlePool.statistics;
+    statistics->timerWakeups = runLoop.timerWakeupStatistics;
+
+    statistics->callbacks.maxBytes = runLoop.callbackQueueStatistics.maxBytes;
+    statistics->callbacks.numBytesHighWaterMark = runLoop.callbackQueueStatistics.numBytesHighWaterMark;
+    statistics->callbacks.numScheduledCallbacks =
+            __atomic_load_n(&runLoop.callbackQueueStatistics.numScheduledCallbacks, __ATOMIC_RELAXED);
+    statistics->callbacks.numDroppedCallbacks =
+            __atomic_load_n(&runLoop.callbackQueueStatistics.numDroppedCallbacks, __ATOMIC_RELAXED);
+    statistics->callbacks.numOversizedCallbacks =
+            __atomic_load_n(&runLoop.callbackQueueStatistics.numOversizedCallbacks, __ATOMIC_RELAXED);
+    statistics->callbacks.numWakeups = __atomic_load_n(&runLoop.callbackQueueStatistics.numWakeups, __ATOMIC_RELAXED);
+    statistics->callbacks.numCoalescedWakeups =
+            __atomic_load_n(&runLoop.callbackQueueStatistics.numCoalescedWakeups, __ATOMIC_RELAXED);
+    statistics->callbacks.numFailedWakeups =
+            __atomic_load_n(&runLoop.callbackQueueStatistics.numFailedWakeups, __ATOMIC_RELAXED);
+
+    statistics->callbacks.maxArenaBytes = runLoop.callbackQueueStatistics.maxArenaBytes;
+    statistics->callbacks.numArenaBytes = __atomic_load_n(&runLoop.callbackArena.writePosition, __ATOMIC_RELAXED) -
+                                          __atomic_load_n(&runLoop.callbackArena.readPosition, __ATOMIC_RELAXED);
+    statistics->callbacks.numArenaBytesHighWaterMark = runLoop.callbackQueueStatistics.numArenaBytesHighWaterMark;
+    statistics->callbacks.numArenaCallbacks =
+            __atomic_load_n(&runLoop.callbackQueueStatistics.numArenaCallbacks, __ATOMIC_RELAXED);
+    statistics->callbacks.numFailedArenaAllocations =
+            __atomic_load_n(&runLoop.callbackQueueStatistics.numFailedArenaAllocations, __ATOMIC_RELAXED);
+}
+
+#if HAP_PLATFORM_RUN_LOOP_INSTRUMENTATION
+void HAPPlatformRunLoopGetInstrumentation(HAPPlatformRunLoopInstrumentation* instrumentation) {
+    HAPPrecondition(instrumentation);
+
+    *instrumentation = runLoop.instrumentation;
+}
+
+void HAPPlatformRunLoopResetInstrumentation(void) {
+    HAPRawBufferZero(&runLoop.instrumentation, sizeof runLoop.instrumentation);
+}
+
+/**
+ * Logs a histogram.
+ *
+ * @param      name                 Name of the histogram.
+ * @param      unit                 Unit of the samples.
+ * @param      histogram            Histogram.
+ */
+static void LogHistogram(const char* name, const char* unit, const HAPPlatformRunLoopHistogram* histogram) {
+    HAPPrecondition(name);
+    HAPPrecondition(unit);
+    HAPPrecondition(histogram);
+
+    HAPLogInfo(
+            &logObject,
+            "%s: %lu samples, avg %llu %s, max %llu %s.",
+            name,
+            (unsigned long) histogram->numSamples,
+            (unsigned long long) (histogram->numSamples ? histogram->sumValues / histogram->numSamples : 0),
+            unit,
+            (unsigned long long) histogram->maxValue,
+            unit);
+    for (size_t i = 0; i < kHAPPlatformRunLoopHistogram_NumBuckets; i++) {
+        if (!histogram->numSamplesPerBucket[i]) {
+            continue;
+        }
+        if (!i) {
+            HAPLogInfo(&logObject, "  %s [0]: %lu", name, (unsigned long) histogram->numSamplesPerBucket[i]);
+        } else {
+            HAPLogInfo(
+                    &logObject,
+                    "  %s [%llu, %llu%s): %lu",
+                    name,
+                    1ull << (i - 1),
+                    1ull << i,
+                    i == kHAPPlatformRunLoopHistogram_NumBuckets - 1 ? "+" : "",
+                    (unsigned long) histogram->numSamplesPerBucket[i]);
+        }
+    }
+}
+
+void HAPPlatformRunLoopLogInstrumentation(void) {
+    const HAPPlatformRunLoopInstrumentation* instrumentation = &runLoop.instrumentation;
+
+    uint64_t totalTime = instrumentation->waitTime.sumValues + instrumentation->dispatchTime.sumValues;
+    HAPLogInfo(
+            &logObject,
+            "Run loop instrumentation: %llu iterations, %llu%% busy.",
+            (unsigned long long) instrumentation->numIterations,
+            (unsigned long long) (totalTime ? instrumentation->dispatchTime.sumValues * 100 / totalTime : 0));
+    LogHistogram("Wait time", "us", &instrumentation->waitTime);
+    LogHistogram("Dispatch time", "us", &instrumentation->dispatchTime);
+    LogHistogram("Timer lateness", "ms", &instrumentation->timerLateness);
+    for (size_t i = 0; i < instrumentation->numSlowestCallbacks; i++) {
+        const HAPPlatformRunLoopSlowCallback* slowCallback = &instrumentation->slowestCallbacks[i];
+        HAPLogInfo(
+                &logObject,
+                "Slow %s callback %p: %lu invocations, avg %llu us, max %llu us.",
+                slowCallback->kind == kHAPPlatformRunLoopCallbackKind_Timer ?
+                        "timer" :
+                        slowCallback->kind == kHAPPlatformRunLoopCallbackKind_FileHandle ? "file handle" :
+                        slowCallback->kind == kHAPPlatformRunLoopCallbackKind_Observer   ? "observer" :
+                                                                                           "scheduled",
+                slowCallback->function,
+                (unsigned long) slowCallback->numInvocations,
+                (unsigned long long) (slowCallback->sumMicroseconds / slowCallback->numInvocations),
+                (unsigned long long) slowCallback->maxMicroseconds);
+    }
+}
+#endif
+
 void HAPPlatformRunLoopRun(void) {
     HAPPrecondition(runLoop.state == kHAPPlatformRunLoopState_Idle);
 
     HAPLogInfo(&logObject, "Entering run loop.");
     runLoop.state = kHAPPlatformRunLoopState_Running;
     do {
+#if HAVE_VIRTUAL_TIME
+        HAPTime nextDeadline = GetNextTimerWakeupTime();
+        runLoop.timerWakeupTime = nextDeadline;
+
+        // Advance virtual time if there is no pending work.
+        bool hasPendingWork = runLoop.hasInjectedEvents ||
+                              runLoop.callbackRing.readPosition !=
+                                      __atomic_load_n(&runLoop.callbackRing.writePosition, __ATOMIC_ACQUIRE);
+        HAPTime now = HAPPlatformClockGetCurrent();
+        if (!hasPendingWork) {
+            HAPTime resumeTime = nextDeadline;
+            if (runLoop.virtualTimeDriver) {
+                resumeTime = runLoop.virtualTimeDriver(nextDeadline, runLoop.virtualTimeDriverContext);
+                HAPPrecondition(resumeTime >= now);
+                if (nextDeadline && resumeTime > nextDeadline) {
+                    resumeTime = nextDeadline;
+                }
+            } else if (!nextDeadline) {
+                HAPLogInfo(&logObject, "No pending work and no timers registered. Stopping virtual time run loop.");
+                HAPPlatformRunLoopStop();
+                continue;
+            }
+            HAPPlatformClockSetVirtualTime(resumeTime);
+            now = resumeTime;
+        }
+
+        ProcessExpiredTimers(now);
+
+        ProcessInjectedFileHandles();
+
+        ProcessScheduledCallbacks();
+
+        ProcessObservers();
+#elif HAP_PLATFORM_RUN_LOOP_USE_READY_LIST
+        int timeout = -1;
+
+        HAPTime nextDeadline = GetNextTimerWakeupTime();
+        runLoop.timerWakeupTime = nextDeadline;
+        if (nextDeadline) {
+            // The coarse time lags behind by the time spent dispatching, which would delay timers by as much.
+            HAPTime now = HAPPlatformClockGetCurrent();
+            HAPTime delta;
+            if (nextDeadline > now) {
+                delta = nextDeadline - now;
+            } else {
+                delta = 0;
+            }
+            timeout = delta > INT_MAX ? INT_MAX : (int) delta;
+        }
+
+#if HAP_PLATFORM_RUN_LOOP_INSTRUMENTATION
+        uint64_t waitStartTime = HAPPlatformClockGetCurrentMicroseconds();
+#endif
+#if HAP_PLATFORM_RUN_LOOP_USE_POLL
+        int e = poll(runLoop.pollFileDescriptors, (nfds_t) runLoop.numPollFileDescriptors, timeout);
+#else
+        HAPAssert(runLoop.maxEpollEvents);
+        int e = epoll_wait(
+                runLoop.epollFileDescriptor,
+                runLoop.epollEvents,
+                runLoop.maxEpollEvents > INT_MAX ? INT_MAX : (int) runLoop.maxEpollEvents,
+                timeout);
+#endif
+        if (e == -1 && errno == EINTR) {
+            continue;
+        }
+        if (e < 0) {
+            int _errno = errno;
+            HAPAssert(e == -1);
+            HAPPlatformLogPOSIXError(
+                    kHAPLogType_Error,
+                    HAP_PLATFORM_RUN_LOOP_USE_POLL ? "System call 'poll' failed." : "System call 'epoll_wait' failed.",
+                    _errno,
+                    __func__,
+                    HAP_FILE,
+                    __LINE__);
+            HAPFatalError();
+        }
+
+#if HAP_PLATFORM_RUN_LOOP_USE_POLL
+        CollectPolledFileHandles((size_t) e);
+#else
+        CollectEpollFileHandles((size_t) e);
+#endif
+
+#if HAP_PLATFORM_RUN_LOOP_INSTRUMENTATION
+        uint64_t dispatchStartTime = HAPPlatformClockGetCurrentMicroseconds();
+        RecordHistogramSample(&runLoop.instrumentation.waitTime, dispatchStartTime - waitStartTime);
+#endif
+
+        // Read the clock once per iteration, after waiting for events.
+        ProcessExpiredTimers(HAPPlatformClockGetCurrent());
+
+        ProcessPolledFileHandles();
+
+        ProcessScheduledCallbacks();
+
+        ProcessObservers();
+#if HAP_PLATFORM_RUN_LOOP_INSTRUMENTATION
+        RecordHistogramSample(
+                &runLoop.instrumentation.dispatchTime, HAPPlatformClockGetCurrentMicroseconds() - dispatchStartTime);
+        runLoop.instrumentation.numIterations++;
+#endif
+#else
         fd_set readFileDescriptors;
         fd_set writeFileDescriptors;
         fd_set errorFileDescriptors;
@@ -604,8 +2435,10 @@ void HAPPlatformRunLoopRun(void) {
         struct timeval timeoutValue;
         struct timeval* timeout = NULL;
 
-        HAPTime nextDeadline = runLoop.timers ? runLoop.timers->deadline : 0;
+        HAPTime nextDeadline = GetNextTimerWakeupTime();
+        runLoop.timerWakeupTime = nextDeadline;
         if (nextDeadline) {
+            // The coarse time lags behind by the time spent dispatching, which would delay timers by as much.
             HAPTime now = HAPPlatformClockGetCurrent();
             HAPTime delta;
             if (nextDeadline > now) {
@@ -622,6 +2455,9 @@ void HAPPlatformRunLoopRun(void) {
         HAPAssert(maxFileDescriptor >= -1);
         HAPAssert(maxFileDescriptor < FD_SETSIZE);
 
+#if HAP_PLATFORM_RUN_LOOP_INSTRUMENTATION
+        uint64_t waitStartTime = HAPPlatformClockGetCurrentMicroseconds();
+#endif
         int e = select(
                 maxFileDescriptor + 1, &readFileDescriptors, &writeFileDescriptors, &errorFileDescriptors, timeout);
         if (e == -1 && errno == EINTR) {
@@ -635,9 +2471,25 @@ void HAPPlatformRunLoopRun(void) {
             HAPFatalError();
         }
 
-        ProcessExpiredTimers();
+#if HAP_PLATFORM_RUN_LOOP_INSTRUMENTATION
+        uint64_t dispatchStartTime = HAPPlatformClockGetCurrentMicroseconds();
+        RecordHistogramSample(&runLoop.instrumentation.waitTime, dispatchStartTime - waitStartTime);
+#endif
+
+        // Read the clock once per iteration, after waiting for events.
+        ProcessExpiredTimers(HAPPlatformClockGetCurrent());
 
         ProcessSelectedFileHandles(&readFileDescriptors, &writeFileDescriptors, &errorFileDescriptors);
+
+        ProcessScheduledCallbacks();
+
+        ProcessObservers();
+#if HAP_PLATFORM_RUN_LOOP_INSTRUMENTATION
+        RecordHistogramSample(
+                &runLoop.instrumentation.dispatchTime, HAPPlatformClockGetCurrentMicroseconds() - dispatchStartTime);
+        runLoop.instrumentation.numIterations++;
+#endif
+#endif
     } while (runLoop.state == kHAPPlatformRunLoopState_Running);
 
     HAPLogInfo(&logObject, "Exiting run loop.");
@@ -651,70 +2503,167 @@ void HAPPlatformRunLoopStop(void) {
     }
 }
 
-HAPError HAPPlatformRunLoopScheduleCallback(
+void HAPPlatformRunLoopAddObserver(
+        HAPPlatformRunLoopObserver* observer,
+        HAPPlatformRunLoopObserverCallback callback,
+        void* _Nullable context) {
+    HAPPrecondition(observer);
+    HAPPrecondition(!observer->isAdded);
+    HAPPrecondition(callback);
+
+    observer->callback = callback;
+    observer->context = context;
+    observer->nextObserver = NULL;
+    observer->isAdded = true;
+
+    HAPPlatformRunLoopObserver** link = &runLoop.observers;
+    while (*link) {
+        link = &(*link)->nextObserver;
+    }
+    *link = observer;
+}
+
+void HAPPlatformRunLoopRemoveObserver(HAPPlatformRunLoopObserver* observer) {
+    HAPPrecondition(observer);
+
+    if (!observer->isAdded) {
+        return;
+    }
+
+    HAPPlatformRunLoopObserver** link = &runLoop.observers;
+    while (*link != observer) {
+        HAPAssert(*link);
+        link = &(*link)->nextObserver;
+    }
+    *link = observer->nextObserver;
+    if (runLoop.observerCursor == observer) {
+        runLoop.observerCursor = observer->nextObserver;
+    }
+
+    observer->nextObserver = NULL;
+    observer->isAdded = false;
+}
+
+/**
+ * Schedules a callback that will be called from the run loop.
+ *
+ * - Contexts of up to UINT8_MAX bytes are stored inline in the scheduled callback ring buffer.
+ *   Larger contexts are stored in the arena.
+ *
+ * @param      callback             Function to call on the run loop.
+ * @param      context              Context that is passed to the callback.
+ * @param      contextSize          Size of context data that is passed to the callback.
+ *
+ * @return kHAPError_None           If successful.
+ * @return kHAPError_OutOfResources If there is not enough space to store the callback.
+ */
+HAP_RESULT_USE_CHECK
+static HAPError ScheduleCallback(
         HAPPlatformRunLoopCallback callback,
-        void* _Nullable const context,
+        const void* _Nullable context,
         size_t contextSize) {
     HAPPrecondition(callback);
     HAPPrecondition(!contextSize || context);
 
+    // Store large context in arena.
+    HAPPlatformRunLoopRingRecordHeader* _Nullable arenaRecord = NULL;
     if (contextSize > UINT8_MAX) {
-        HAPLogError(&logObject, "Contexts larger than UINT8_MAX are not supported.");
-        return kHAPError_OutOfResources;
+        arenaRecord = ClaimRingRecord(&runLoop.callbackArena, sizeof *arenaRecord + contextSize);
+        if (!arenaRecord) {
+            HAPLogError(&logObject, "Scheduled callback arena is full.");
+            __atomic_fetch_add(&runLoop.callbackQueueStatistics.numFailedArenaAllocations, 1, __ATOMIC_RELAXED);
+            return kHAPError_OutOfResources;
+        }
+        HAPRawBufferCopyBytes(&arenaRecord[1], context, contextSize);
+        CommitRingRecord(arenaRecord);
     }
-    if (contextSize + 1 + sizeof callback > PIPE_BUF) {
-        HAPLogError(&logObject, "Context too large (PIPE_BUF).");
+
+    // Claim and publish record.
+    HAPPlatformRunLoopCallbackRecord* _Nullable record = ClaimRingRecord(
+            &runLoop.callbackRing, sizeof(HAPPlatformRunLoopCallbackRecord) + (arenaRecord ? 0 : contextSize));
+    if (!record) {
+        HAPLogError(&logObject, "Scheduled callback buffer is full.");
+        if (arenaRecord) {
+            ReleaseRingRecord(arenaRecord);
+        }
+        __atomic_fetch_add(&runLoop.callbackQueueStatistics.numDroppedCallbacks, 1, __ATOMIC_RELAXED);
         return kHAPError_OutOfResources;
     }
-
-    // Serialize event context.
-    // Format: Callback pointer followed by 1 byte context size and context data.
-    // Context is copied to offset 0 when invoking the callback to ensure proper alignment.
-    uint8_t bytes[sizeof callback + 1 + UINT8_MAX];
-    size_t numBytes = 0;
-    HAPRawBufferCopyBytes(&bytes[numBytes], &callback, sizeof callback);
-    numBytes += sizeof callback;
-    bytes[numBytes] = (uint8_t) contextSize;
-    numBytes++;
-    if (context) {
-        HAPRawBufferCopyBytes(&bytes[numBytes], context, contextSize);
-        numBytes += contextSize;
+    record->callback = callback;
+    record->contextSize = (uint32_t) contextSize;
+    record->arenaRecord = arenaRecord;
+    if (!arenaRecord && contextSize) {
+        HAPRawBufferCopyBytes(record->context, context, contextSize);
     }
-    HAPAssert(numBytes <= sizeof bytes);
-
-    int fileDescriptor = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    if (fileDescriptor < 0) {
-        int _errno = errno;
-        HAPPlatformLogPOSIXError(kHAPLogType_Error,
-            "Loopback client socket failed (log, call 'bind').",
-            _errno, __func__, HAP_FILE, __LINE__);
-        HAPFatalError();
+    CommitRingRecord(record);
+    __atomic_fetch_add(&runLoop.callbackQueueStatistics.numScheduledCallbacks, 1, __ATOMIC_RELAXED);
+    if (arenaRecord) {
+        __atomic_fetch_add(&runLoop.callbackQueueStatistics.numArenaCallbacks, 1, __ATOMIC_RELAXED);
     }
 
-    int e = fcntl(fileDescriptor, F_SETFL, O_NONBLOCK);
-    if (e == -1) {
-        HAPPlatformLogPOSIXError(kHAPLogType_Error,
-            "System call 'fcntl' to set loopback send file descriptor flags to 'non-blocking' failed.",
-            errno, __func__, HAP_FILE, __LINE__);
-        HAPFatalError();
+#if HAVE_VIRTUAL_TIME
+    // Scheduled callbacks are processed on every run loop iteration.
+    return kHAPError_None;
+#else
+    // Wake up run loop, unless a wakeup is already pending.
+    if (__atomic_exchange_n(&runLoop.isWakeupPending, 1, __ATOMIC_SEQ_CST)) {
+        __atomic_fetch_add(&runLoop.callbackQueueStatistics.numCoalescedWakeups, 1, __ATOMIC_RELAXED);
+        return kHAPError_None;
     }
-    
-    struct sockaddr_in to_addr;
-    to_addr.sin_family = AF_INET;
-    to_addr.sin_port = htons(LOOPBACK_PORT);
-    inet_aton("127.0.0.1", &to_addr.sin_addr);
+    uint8_t wakeup = 0;
     ssize_t n;
     do {
-        n = sendto(fileDescriptor, bytes, numBytes, 0, (struct sockaddr *)&to_addr, sizeof(to_addr));
+        n = send(runLoop.loopbackSendFileDescriptor, &wakeup, sizeof wakeup, 0);
     } while (n == -1 && errno == EINTR);
-    close(fileDescriptor);
     if (n == -1) {
+        // The callback stays queued and is invoked on the next run loop iteration. Re-arm wakeups so that the next
+        // scheduled callback retries.
         int _errno = errno;
+        __atomic_store_n(&runLoop.isWakeupPending, 0, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&runLoop.callbackQueueStatistics.numFailedWakeups, 1, __ATOMIC_RELAXED);
         HAPPlatformLogPOSIXError(kHAPLogType_Error,
-            "Loopback client socket failed to send data (log, call 'sendto').",
+            "Loopback client socket failed to send wakeup (log, call 'send').",
             _errno, __func__, HAP_FILE, __LINE__);
-        return kHAPError_Unknown;
+        return kHAPError_None;
     }
+    __atomic_fetch_add(&runLoop.callbackQueueStatistics.numWakeups, 1, __ATOMIC_RELAXED);
 
     return kHAPError_None;
+#endif
+}
+
+HAPError HAPPlatformRunLoopScheduleCallback(
+        HAPPlatformRunLoopCallback callback,
+        void* _Nullable const context,
+        size_t contextSize) {
+    HAPPrecondition(callback);
+    HAPPrecondition(!contextSize || context);
+
+    if (contextSize > UINT8_MAX) {
+        HAPLogError(&logObject, "Contexts larger than UINT8_MAX are not supported.");
+        __atomic_fetch_add(&runLoop.callbackQueueStatistics.numOversizedCallbacks, 1, __ATOMIC_RELAXED);
+        return kHAPError_OutOfResources;
+    }
+
+    return ScheduleCallback(callback, context, contextSize);
+}
+
+HAPError HAPPlatformRunLoopScheduleCallbackWithLargeContext(
+        HAPPlatformRunLoopCallback callback,
+        const void* _Nullable context,
+        size_t contextSize) {
+    HAPPrecondition(callback);
+    HAPPrecondition(!contextSize || context);
+
+    if (contextSize > kHAPPlatformRunLoop_CallbackArenaSize - sizeof(HAPPlatformRunLoopRingRecordHeader)) {
+        HAPLogError(
+                &logObject,
+                "Context of %zu bytes exceeds scheduled callback arena size (%lu bytes).",
+                contextSize,
+                (unsigned long) kHAPPlatformRunLoop_CallbackArenaSize);
+        __atomic_fetch_add(&runLoop.callbackQueueStatistics.numOversizedCallbacks, 1, __ATOMIC_RELAXED);
+        return kHAPError_OutOfResources;
+    }
+
+    return ScheduleCallback(callback, context, contextSize);
 }
@@ -24,16 +24,25 @@
 #include <netdb.h>
 #include <netinet/tcp.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <esp_event.h>
 
 #include "HAPPlatform+Init.h"
+#include "HAPPlatformClock+Init.h"
 #include "HAPPlatformLog+Init.h"
 #include "HAPPlatformTCPStreamManager+Init.h"
 
 static const HAPLogObject logObject = { .subsystem = kHAPPlatform_LogSubsystem, .category = "TCPStreamManager" };
 
+/**
+ * Maximum number of connections that are refused by admission control within a single accept.
+ *
+ * - Bounds the work per run loop iteration during a flood. Remaining connections are handled in later iterations.
+ */
+#define kHAPPlatformTCPStreamManager_MaxRefusalsPerAccept ((size_t) 16)
+
 /**
  * Sets all fields of a TCP stream listener to their initial values.
  *
@@ -54,6 +63,8 @@ static void InitializeTCPStreamListener(HAPPlatformTCPStreamListener* tcpStreamL
 /**
  * Sets all fields of a TCP stream to their initial values.
  *
+ * - The generation, free list link, receive buffer storage and send buffer storage are preserved.
+ *
  * @param      tcpStream            TCP stream.
  */
 static void InitializeTCPStream(HAPPlatformTCPStream* tcpStream) {
@@ -66,15 +77,260 @@ static void InitializeTCPStream(HAPPlatformTCPStream* tcpStream) {
     tcpStream->interests.hasSpaceAvailable = false;
     tcpStream->callback = NULL;
     tcpStream->context = NULL;
+    tcpStream->receiveBuffer.offset = 0;
+    tcpStream->receiveBuffer.numBytes = 0;
+    tcpStream->receiveBuffer.isEndOfStream = false;
+    tcpStream->receiveBuffer.timer = 0;
+    tcpStream->sendBuffer.numBytes = 0;
+    tcpStream->sendBuffer.isBlocked = false;
+    tcpStream->sendBuffer.isOutputClosePending = false;
+    tcpStream->sendBuffer.isClosePending = false;
+    tcpStream->sendBuffer.lingerTimer = 0;
+    HAPRawBufferZero(&tcpStream->statistics, sizeof tcpStream->statistics);
+    tcpStream->requestStartTime = 0;
+    tcpStream->isHandshaking = false;
+    tcpStream->lastActivityTime = 0;
+    tcpStream->lessRecentlyActiveTCPStream = NULL;
+    tcpStream->moreRecentlyActiveTCPStream = NULL;
+}
+
+/**
+ * Removes a TCP stream from the list of active TCP streams.
+ *
+ * @param      tcpStreamManager     TCP stream manager.
+ * @param      tcpStream            TCP stream.
+ */
+static void UnlinkActiveTCPStream(HAPPlatformTCPStreamManagerRef tcpStreamManager, HAPPlatformTCPStream* tcpStream) {
+    HAPPrecondition(tcpStreamManager);
+    HAPPrecondition(tcpStream);
+
+    if (tcpStream->lessRecentlyActiveTCPStream) {
+        tcpStream->lessRecentlyActiveTCPStream->moreRecentlyActiveTCPStream = tcpStream->moreRecentlyActiveTCPStream;
+    } else {
+        HAPAssert(tcpStreamManager->leastRecentlyActiveTCPStream == tcpStream);
+        tcpStreamManager->leastRecentlyActiveTCPStream = tcpStream->moreRecentlyActiveTCPStream;
+    }
+    if (tcpStream->moreRecentlyActiveTCPStream) {
+        tcpStream->moreRecentlyActiveTCPStream->lessRecentlyActiveTCPStream = tcpStream->lessRecentlyActiveTCPStream;
+    } else {
+        HAPAssert(tcpStreamManager->mostRecentlyActiveTCPStream == tcpStream);
+        tcpStreamManager->mostRecentlyActiveTCPStream = tcpStream->lessRecentlyActiveTCPStream;
+    }
+    tcpStream->lessRecentlyActiveTCPStream = NULL;
+    tcpStream->moreRecentlyActiveTCPStream = NULL;
+}
+
+/**
+ * Records activity on a TCP stream, moving it to the most recently active end of the list of active TCP streams.
+ *
+ * - TCP streams that are being evicted are not part of the list.
+ *
+ * @param      tcpStreamManager     TCP stream manager.
+ * @param      tcpStream            TCP stream.
+ */
+static void RecordTCPStreamActivity(HAPPlatformTCPStreamManagerRef tcpStreamManager, HAPPlatformTCPStream* tcpStream) {
+    HAPPrecondition(tcpStreamManager);
+    HAPPrecondition(tcpStream);
+
+    tcpStream->lastActivityTime = HAPPlatformClockGetCurrentCoarse();
+    if (tcpStream == tcpStreamManager->evictedTCPStream || tcpStream == tcpStreamManager->mostRecentlyActiveTCPStream) {
+        return;
+    }
+    if (tcpStream->moreRecentlyActiveTCPStream) {
+        UnlinkActiveTCPStream(tcpStreamManager, tcpStream);
+    }
+    tcpStream->lessRecentlyActiveTCPStream = tcpStreamManager->mostRecentlyActiveTCPStream;
+    if (tcpStreamManager->mostRecentlyActiveTCPStream) {
+        tcpStreamManager->mostRecentlyActiveTCPStream->moreRecentlyActiveTCPStream = tcpStream;
+    } else {
+        tcpStreamManager->leastRecentlyActiveTCPStream = tcpStream;
+    }
+    tcpStreamManager->mostRecentlyActiveTCPStream = tcpStream;
+}
+
+/**
+ * Removes a TCP stream from the number of TCP streams that have not completed their handshake yet, if it is counted.
+ *
+ * - TCP streams are counted from when they are accepted until kHAPPlatformTCPStream_NumHandshakeResponses responses
+ *   have been sent, or until they are evicted or closed.
+ *
+ * @param      tcpStreamManager     TCP stream manager.
+ * @param      tcpStream            TCP stream.
+ */
+static void EndTCPStreamHandshake(HAPPlatformTCPStreamManagerRef tcpStreamManager, HAPPlatformTCPStream* tcpStream) {
+    HAPPrecondition(tcpStreamManager);
+    HAPPrecondition(tcpStream);
+
+    if (!tcpStream->isHandshaking) {
+        return;
+    }
+    tcpStream->isHandshaking = false;
+    HAPAssert(tcpStreamManager->numHandshakingTCPStreams);
+    tcpStreamManager->numHandshakingTCPStreams--;
+}
+
+/**
+ * Records the result of a receive system call on a TCP stream.
+ *
+ * @param      tcpStream            TCP stream.
+ * @param      n                    Return value of the system call.
+ * @param      _errno               Error number of the system call, if it failed.
+ */
+static void RecordTCPStreamReceive(HAPPlatformTCPStream* tcpStream, ssize_t n, int _errno) {
+    HAPPrecondition(tcpStream);
+    HAPPrecondition(tcpStream->tcpStreamManager);
+
+    tcpStream->statistics.numReceiveCalls++;
+    if (n == -1) {
+        if (_errno == EAGAIN || _errno == EWOULDBLOCK) {
+            tcpStream->statistics.numBusyReceiveCalls++;
+        }
+        return;
+    }
+    if (!n) {
+        return;
+    }
+
+    HAPTime now = HAPPlatformClockGetCurrent();
+    if (!tcpStream->statistics.numBytesReceived) {
+        tcpStream->statistics.timeToFirstByte = now - tcpStream->statistics.acceptTime;
+    }
+    if (!tcpStream->requestStartTime) {
+        tcpStream->requestStartTime = now;
+    }
+    tcpStream->statistics.numBytesReceived += (size_t) n;
+    RecordTCPStreamActivity(tcpStream->tcpStreamManager, tcpStream);
+}
+
+/**
+ * Records the result of a send system call on a TCP stream.
+ *
+ * @param      tcpStream            TCP stream.
+ * @param      n                    Return value of the system call.
+ * @param      _errno               Error number of the system call, if it failed.
+ */
+static void RecordTCPStreamSend(HAPPlatformTCPStream* tcpStream, ssize_t n, int _errno) {
+    HAPPrecondition(tcpStream);
+    HAPPrecondition(tcpStream->tcpStreamManager);
+
+    tcpStream->statistics.numSendCalls++;
+    if (n == -1) {
+        if (_errno == EAGAIN || _errno == EWOULDBLOCK) {
+            tcpStream->statistics.numBusySendCalls++;
+        }
+        return;
+    }
+    if (!n) {
+        return;
+    }
+
+    if (tcpStream->requestStartTime) {
+        HAPTime responseLatency = HAPPlatformClockGetCurrent() - tcpStream->requestStartTime;
+        tcpStream->requestStartTime = 0;
+        tcpStream->statistics.numResponses++;
+        if (tcpStream->statistics.numResponses == kHAPPlatformTCPStream_NumHandshakeResponses) {
+            EndTCPStreamHandshake(tcpStream->tcpStreamManager, tcpStream);
+        }
+        tcpStream->statistics.totalResponseLatency += responseLatency;
+        if (responseLatency > tcpStream->statistics.maxResponseLatency) {
+            tcpStream->statistics.maxResponseLatency = responseLatency;
+        }
+    }
+    tcpStream->statistics.numBytesSent += (size_t) n;
+    RecordTCPStreamActivity(tcpStream->tcpStreamManager, tcpStream);
+}
+
+/**
+ * Adds the statistics of a TCP stream to aggregate totals.
+ *
+ * @param[in,out] totals            Aggregate totals.
+ * @param      statistics           TCP stream statistics.
+ */
+static void AccumulateTCPStreamStatistics(
+        HAPPlatformTCPStreamStatistics* totals,
+        const HAPPlatformTCPStreamStatistics* statistics) {
+    HAPPrecondition(totals);
+    HAPPrecondition(statistics);
+
+    totals->numBytesReceived += statistics->numBytesReceived;
+    totals->numBytesSent += statistics->numBytesSent;
+    totals->numReceiveCalls += statistics->numReceiveCalls;
+    totals->numSendCalls += statistics->numSendCalls;
+    totals->numBusyReceiveCalls += statistics->numBusyReceiveCalls;
+    totals->numBusySendCalls += statistics->numBusySendCalls;
+    if (statistics->timeToFirstByte > totals->timeToFirstByte) {
+        totals->timeToFirstByte = statistics->timeToFirstByte;
+    }
+    totals->numResponses += statistics->numResponses;
+    totals->totalResponseLatency += statistics->totalResponseLatency;
+    if (statistics->maxResponseLatency > totals->maxResponseLatency) {
+        totals->maxResponseLatency = statistics->maxResponseLatency;
+    }
+}
+
+/**
+ * Returns the reference of a TCP stream.
+ *
+ * - References encode the slot index plus 1 in the lower 16 bits and the slot generation in the upper bits.
+ *   The generation changes whenever a TCP stream is closed, so that stale references to a reused slot are detected.
+ *
+ * @param      tcpStreamManager     TCP stream manager.
+ * @param      tcpStream            TCP stream.
+ *
+ * @return TCP stream reference.
+ */
+HAP_RESULT_USE_CHECK
+static HAPPlatformTCPStreamRef GetTCPStreamRef(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager,
+        const HAPPlatformTCPStream* tcpStream) {
+    HAPPrecondition(tcpStreamManager);
+    HAPPrecondition(tcpStreamManager->tcpStreams);
+    HAPPrecondition(tcpStream);
+
+    size_t index = (size_t)(tcpStream - tcpStreamManager->tcpStreams);
+    HAPAssert(index < tcpStreamManager->maxTCPStreams);
+    return (HAPPlatformTCPStreamRef)((index + 1) | ((uintptr_t) tcpStream->generation << 16));
+}
+
+/**
+ * Resolves a TCP stream reference.
+ *
+ * - A stale reference to a TCP stream that has been closed results in a fatal error.
+ *
+ * @param      tcpStreamManager     TCP stream manager.
+ * @param      tcpStream_           TCP stream reference.
+ *
+ * @return TCP stream.
+ */
+HAP_RESULT_USE_CHECK
+static HAPPlatformTCPStream* GetTCPStream(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager,
+        HAPPlatformTCPStreamRef tcpStream_) {
+    HAPPrecondition(tcpStreamManager);
+    HAPPrecondition(tcpStreamManager->tcpStreams);
+    HAPPrecondition(tcpStream_);
+
+    size_t index = (size_t)(tcpStream_ & 0xFFFF) - 1;
+    HAPPrecondition(index < tcpStreamManager->maxTCPStreams);
+    HAPPlatformTCPStream* tcpStream = &tcpStreamManager->tcpStreams[index];
+    if (tcpStream->generation != (uint16_t)(tcpStream_ >> 16)) {
+        HAPLogError(
+                &logObject,
+                "Stale TCP stream reference 0x%lx (current generation %u).",
+                (unsigned long) tcpStream_,
+                tcpStream->generation);
+        HAPFatalError();
+    }
+    return tcpStream;
 }
 
 HAP_RESULT_USE_CHECK
 HAPNetworkPort HAPPlatformTCPStreamManagerGetListenerPort(HAPPlatformTCPStreamManagerRef tcpStreamManager) {
     HAPPrecondition(tcpStreamManager);
     HAPPrecondition(tcpStreamManager->tcpStreams);
-    HAPPrecondition(tcpStreamManager->tcpStreamListener.tcpStreamManager);
+    HAPPrecondition(tcpStreamManager->numTCPStreamListeners);
 
-    return tcpStreamManager->tcpStreamListener.port;
+    return tcpStreamManager->tcpStreamListeners[0].port;
 }
 
 /**
@@ -130,17 +386,135 @@ static HAPError SetNodelay(int fileDescriptor) {
     return kHAPError_None;
 }
 
+/**
+ * Sets an integer socket option.
+ *
+ * @param      fileDescriptor       Socket file descriptor.
+ * @param      level                Protocol level.
+ * @param      optionName           Option name.
+ * @param      optionDescription    Option description for logging.
+ * @param      value                Option value.
+ *
+ * @return kHAPError_None           If successful.
+ * @return kHAPError_Unknown        If the socket option could not be set.
+ */
+HAP_RESULT_USE_CHECK
+static HAPError SetIntegerSocketOption(
+        int fileDescriptor,
+        int level,
+        int optionName,
+        const char* optionDescription,
+        int value) {
+    HAPPrecondition(optionDescription);
+
+    HAPLogDebug(
+            &logObject,
+            "setsockopt(%d, %d, %d, %d); // %s",
+            fileDescriptor,
+            level,
+            optionName,
+            value,
+            optionDescription);
+    int e = setsockopt(fileDescriptor, level, optionName, &value, sizeof value);
+    if (e != 0) {
+        int _errno = errno;
+        HAPAssert(e == -1);
+        HAPPlatformLogPOSIXError(
+                kHAPLogType_Error,
+                "System call 'setsockopt' to set socket option failed.",
+                _errno,
+                __func__,
+                HAP_FILE,
+                __LINE__);
+        HAPLogError(&logObject, "Failed to set socket option %s to %d.", optionDescription, value);
+        return kHAPError_Unknown;
+    }
+    return kHAPError_None;
+}
+
+/**
+ * Converts a time to whole seconds, rounding up, as expected by the keepalive socket options.
+ *
+ * @param      time                 Time.
+ *
+ * @return Time in seconds.
+ */
+HAP_RESULT_USE_CHECK
+static int GetSocketOptionSeconds(HAPTime time) {
+    HAPTime seconds = (time + HAPSecond - 1) / HAPSecond;
+    return seconds < INT32_MAX ? (int) seconds : INT32_MAX;
+}
+
+/**
+ * Configures dead peer detection on an accepted TCP stream socket.
+ *
+ * - Failures are logged but not fatal, as the TCP stream remains usable without dead peer detection.
+ *
+ * @param      tcpStreamManager     TCP stream manager.
+ * @param      fileDescriptor       Socket file descriptor.
+ */
+static void SetDeadPeerDetection(HAPPlatformTCPStreamManagerRef tcpStreamManager, int fileDescriptor) {
+    HAPPrecondition(tcpStreamManager);
+
+    HAPError err;
+
+    if (tcpStreamManager->keepAlive.idleTime) {
+        err = SetIntegerSocketOption(fileDescriptor, SOL_SOCKET, SO_KEEPALIVE, "SO_KEEPALIVE", 1);
+        if (!err) {
+            err = SetIntegerSocketOption(
+                    fileDescriptor,
+                    IPPROTO_TCP,
+                    TCP_KEEPIDLE,
+                    "TCP_KEEPIDLE",
+                    GetSocketOptionSeconds(tcpStreamManager->keepAlive.idleTime));
+        }
+        if (!err && tcpStreamManager->keepAlive.interval) {
+            err = SetIntegerSocketOption(
+                    fileDescriptor,
+                    IPPROTO_TCP,
+                    TCP_KEEPINTVL,
+                    "TCP_KEEPINTVL",
+                    GetSocketOptionSeconds(tcpStreamManager->keepAlive.interval));
+        }
+        if (!err && tcpStreamManager->keepAlive.count) {
+            err = SetIntegerSocketOption(
+                    fileDescriptor, IPPROTO_TCP, TCP_KEEPCNT, "TCP_KEEPCNT", tcpStreamManager->keepAlive.count);
+        }
+        if (err) {
+            HAPAssert(err == kHAPError_Unknown);
+            HAPLog(&logObject, "Failed to enable TCP keepalive for TCP stream socket.");
+        }
+    }
+
+#ifdef TCP_USER_TIMEOUT
+    if (tcpStreamManager->userTimeout) {
+        err = SetIntegerSocketOption(
+                fileDescriptor,
+                IPPROTO_TCP,
+                TCP_USER_TIMEOUT,
+                "TCP_USER_TIMEOUT",
+                tcpStreamManager->userTimeout < INT32_MAX ? (int) tcpStreamManager->userTimeout : INT32_MAX);
+        if (err) {
+            HAPAssert(err == kHAPError_Unknown);
+            HAPLog(&logObject, "Failed to set user timeout for TCP stream socket.");
+        }
+    }
+#endif
+}
+
 void HAPPlatformTCPStreamManagerCreate(
         HAPPlatformTCPStreamManagerRef tcpStreamManager,
         const HAPPlatformTCPStreamManagerOptions* options) {
     HAPPrecondition(tcpStreamManager);
     HAPPrecondition(options);
     HAPPrecondition(options->maxConcurrentTCPStreams);
-    
+    HAPPrecondition(options->maxConcurrentTCPStreams <= UINT16_MAX);
+
     HAPRawBufferZero(tcpStreamManager, sizeof *tcpStreamManager);
     tcpStreamManager->tcpStreamListenerConfiguration.port = options->port;
 
     tcpStreamManager->numTCPStreams = 0;
+    tcpStreamManager->numHandshakingTCPStreams = 0;
     tcpStreamManager->maxTCPStreams = options->maxConcurrentTCPStreams;
 
     HAPLogDebug(&logObject, "Storage configuration: tcpStreamManager = %lu", (unsigned long) sizeof *tcpStreamManager);
@@ -150,25 +524,217 @@ void HAPPlatformTCPStreamManagerCreate(
             &logObject,
             "Storage configuration: tcpStreams = %lu",
             (unsigned long) tcpStreamManager->maxTCPStreams * sizeof(HAPPlatformTCPStream));
+    HAPLogDebug(
+            &logObject,
+            "Storage configuration: receiveBuffers = %lu",
+            (unsigned long) (tcpStreamManager->maxTCPStreams * options->receiveBufferSize));
+    HAPLogDebug(
+            &logObject,
+            "Storage configuration: sendBuffers = %lu",
+            (unsigned long) (tcpStreamManager->maxTCPStreams * options->sendBufferSize));
+
+    HAPPrecondition(options->numInterfaceNames <= kHAPPlatformTCPStreamManager_MaxInterfaces);
+    HAPPrecondition(!options->numInterfaceNames || options->interfaceNames);
+    for (size_t i = 0; i < options->numInterfaceNames; i++) {
+        const char* interfaceName = options->interfaceNames[i];
+        HAPPrecondition(interfaceName);
+        size_t numInterfaceNameBytes = HAPStringGetNumBytes(interfaceName);
+        HAPPrecondition(numInterfaceNameBytes && numInterfaceNameBytes < IFNAMSIZ);
+        HAPRawBufferCopyBytes(
+                tcpStreamManager->tcpStreamListenerConfiguration.interfaceNames[i],
+                interfaceName,
+                numInterfaceNameBytes + 1);
+    }
+    tcpStreamManager->tcpStreamListenerConfiguration.numInterfaceNames = options->numInterfaceNames;
+    tcpStreamManager->tcpStreamListenerConfiguration.addressFamily = options->addressFamily;
 
-    InitializeTCPStreamListener(&tcpStreamManager->tcpStreamListener);
+    for (size_t i = 0; i < HAPArrayCount(tcpStreamManager->tcpStreamListeners); i++) {
+        InitializeTCPStreamListener(&tcpStreamManager->tcpStreamListeners[i]);
+    }
 
-    tcpStreamManager->tcpStreams = malloc(tcpStreamManager->maxTCPStreams * sizeof(HAPPlatformTCPStream));
-    if (!tcpStreamManager->tcpStreams) {
-        HAPLogError(&logObject, "Allocating new TCP stream failed: out of memory.");
-        HAPFatalError();
+    if (options->tcpStreams) {
+        tcpStreamManager->tcpStreams = options->tcpStreams;
+        tcpStreamManager->ownsTCPStreams = false;
+    } else {
+        tcpStreamManager->tcpStreams = malloc(tcpStreamManager->maxTCPStreams * sizeof(HAPPlatformTCPStream));
+        if (!tcpStreamManager->tcpStreams) {
+            HAPLogError(&logObject, "Allocating new TCP stream failed: out of memory.");
+            HAPFatalError();
+        }
+        tcpStreamManager->ownsTCPStreams = true;
     }
-    for (size_t i = 0; i < tcpStreamManager->maxTCPStreams; i++) {
-        InitializeTCPStream(&tcpStreamManager->tcpStreams[i]);
+
+    tcpStreamManager->keepAlive.idleTime = options->keepAlive.idleTime;
+    tcpStreamManager->keepAlive.interval = options->keepAlive.interval;
+    tcpStreamManager->keepAlive.count = options->keepAlive.count;
+    tcpStreamManager->userTimeout = options->userTimeout;
+#ifndef TCP_USER_TIMEOUT
+    if (options->userTimeout) {
+        HAPLog(&logObject, "Ignoring user timeout: TCP_USER_TIMEOUT is not supported by the network stack.");
+    }
+#endif
+
+    tcpStreamManager->evictionIdleTimeout = options->evictionIdleTimeout;
+    tcpStreamManager->shouldEvictTCPStream = options->shouldEvictTCPStream;
+    tcpStreamManager->shouldEvictTCPStreamContext = options->shouldEvictTCPStreamContext;
+
+    tcpStreamManager->admission.sourceRate = options->admission.sourceRate;
+    tcpStreamManager->admission.sourceBurst =
+            options->admission.sourceBurst ? options->admission.sourceBurst : options->admission.sourceRate;
+    tcpStreamManager->admission.globalRate = options->admission.globalRate;
+    tcpStreamManager->admission.globalBurst =
+            options->admission.globalBurst ? options->admission.globalBurst : options->admission.globalRate;
+    tcpStreamManager->admission.maxHandshakingTCPStreams = options->admission.maxHandshakingTCPStreams;
+    tcpStreamManager->admission.globalBucket.tokens = (uint32_t) tcpStreamManager->admission.globalBurst * 1000;
+    tcpStreamManager->admission.globalBucket.lastRefillTime = HAPPlatformClockGetCurrent();
+    tcpStreamManager->admission.numSourceBuckets = 0;
+
+    tcpStreamManager->receiveBufferSize = options->receiveBufferSize;
+    if (!tcpStreamManager->receiveBufferSize) {
+        tcpStreamManager->receiveBuffers = NULL;
+        tcpStreamManager->ownsReceiveBuffers = false;
+    } else if (options->receiveBuffers) {
+        tcpStreamManager->receiveBuffers = options->receiveBuffers;
+        tcpStreamManager->ownsReceiveBuffers = false;
+    } else {
+        tcpStreamManager->receiveBuffers = malloc(tcpStreamManager->maxTCPStreams * options->receiveBufferSize);
+        if (!tcpStreamManager->receiveBuffers) {
+            HAPLogError(&logObject, "Allocating TCP stream receive buffers failed: out of memory.");
+            HAPFatalError();
+        }
+        tcpStreamManager->ownsReceiveBuffers = true;
+    }
+
+    tcpStreamManager->sendBufferSize = options->sendBufferSize;
+    if (!tcpStreamManager->sendBufferSize) {
+        tcpStreamManager->sendBuffers = NULL;
+        tcpStreamManager->ownsSendBuffers = false;
+    } else if (options->sendBuffers) {
+        tcpStreamManager->sendBuffers = options->sendBuffers;
+        tcpStreamManager->ownsSendBuffers = false;
+    } else {
+        tcpStreamManager->sendBuffers = malloc(tcpStreamManager->maxTCPStreams * options->sendBufferSize);
+        if (!tcpStreamManager->sendBuffers) {
+            HAPLogError(&logObject, "Allocating TCP stream send buffers failed: out of memory.");
+            HAPFatalError();
+        }
+        tcpStreamManager->ownsSendBuffers = true;
+    }
+
+    // Link all TCP streams into the free list, in ascending order.
+    tcpStreamManager->freeTCPStreams = NULL;
+    for (size_t i = tcpStreamManager->maxTCPStreams; i--;) {
+        HAPPlatformTCPStream* tcpStream = &tcpStreamManager->tcpStreams[i];
+        InitializeTCPStream(tcpStream);
+        tcpStream->generation = 0;
+        tcpStream->receiveBuffer.bytes = tcpStreamManager->receiveBuffers ?
+                                                 &tcpStreamManager->receiveBuffers[i * options->receiveBufferSize] :
+                                                 NULL;
+        tcpStream->sendBuffer.bytes = tcpStreamManager->sendBuffers ?
+                                              &tcpStreamManager->sendBuffers[i * options->sendBufferSize] :
+                                              NULL;
+        tcpStream->nextFreeTCPStream = tcpStreamManager->freeTCPStreams;
+        tcpStreamManager->freeTCPStreams = tcpStream;
     }
 }
 
+static void FinishClosingTCPStream(HAPPlatformTCPStreamManagerRef tcpStreamManager, HAPPlatformTCPStream* tcpStream);
+
 void HAPPlatformTCPStreamManagerRelease(HAPPlatformTCPStreamManagerRef tcpStreamManager) {
     HAPPrecondition(tcpStreamManager);
     HAPPrecondition(tcpStreamManager->tcpStreams);
 
-    HAPPlatformFreeSafe(tcpStreamManager->tcpStreams);
+    // Complete deferred closes. Bytes that have not been sent yet are discarded.
+    for (size_t i = 0; i < tcpStreamManager->maxTCPStreams; i++) {
+        HAPPlatformTCPStream* tcpStream = &tcpStreamManager->tcpStreams[i];
+        if (tcpStream->sendBuffer.isClosePending) {
+            FinishClosingTCPStream(tcpStreamManager, tcpStream);
+        }
+    }
+
+    if (tcpStreamManager->ownsTCPStreams) {
+        HAPPlatformFreeSafe(tcpStreamManager->tcpStreams);
+    }
     tcpStreamManager->tcpStreams = NULL;
+    tcpStreamManager->freeTCPStreams = NULL;
+    tcpStreamManager->ownsTCPStreams = false;
+
+    if (tcpStreamManager->ownsReceiveBuffers) {
+        HAPPlatformFreeSafe(tcpStreamManager->receiveBuffers);
+    }
+    tcpStreamManager->receiveBuffers = NULL;
+    tcpStreamManager->ownsReceiveBuffers = false;
+
+    if (tcpStreamManager->isFlushObserverAdded) {
+        HAPPlatformRunLoopRemoveObserver(&tcpStreamManager->flushObserver);
+        tcpStreamManager->isFlushObserverAdded = false;
+    }
+    if (tcpStreamManager->ownsSendBuffers) {
+        HAPPlatformFreeSafe(tcpStreamManager->sendBuffers);
+    }
+    tcpStreamManager->sendBuffers = NULL;
+    tcpStreamManager->ownsSendBuffers = false;
+}
+
+void HAPPlatformTCPStreamManagerGetStatistics(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager,
+        HAPPlatformTCPStreamManagerStatistics* statistics) {
+    HAPPrecondition(tcpStreamManager);
+    HAPPrecondition(statistics);
+
+    *statistics = tcpStreamManager->statistics;
+}
+
+void HAPPlatformTCPStreamManagerEnumerateTCPStreams(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager,
+        HAPPlatformTCPStreamManagerEnumerateTCPStreamsCallback callback,
+        void* _Nullable context) {
+    HAPPrecondition(tcpStreamManager);
+    HAPPrecondition(tcpStreamManager->tcpStreams);
+    HAPPrecondition(callback);
+
+    bool shouldContinue = true;
+    for (size_t i = 0; shouldContinue && i < tcpStreamManager->maxTCPStreams; i++) {
+        HAPPlatformTCPStream* tcpStream = &tcpStreamManager->tcpStreams[i];
+        if (!tcpStream->tcpStreamManager) {
+            continue;
+        }
+
+        HAPPlatformTCPStreamStatistics statistics = tcpStream->statistics;
+        callback(context, tcpStreamManager, GetTCPStreamRef(tcpStreamManager, tcpStream), &statistics, &shouldContinue);
+    }
+}
+
+void HAPPlatformTCPStreamManagerGetTCPStreamStatisticsTotals(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager,
+        HAPPlatformTCPStreamStatistics* statistics) {
+    HAPPrecondition(tcpStreamManager);
+    HAPPrecondition(tcpStreamManager->tcpStreams);
+    HAPPrecondition(statistics);
+
+    *statistics = tcpStreamManager->closedTCPStreamStatistics;
+    for (size_t i = 0; i < tcpStreamManager->maxTCPStreams; i++) {
+        HAPPlatformTCPStream* tcpStream = &tcpStreamManager->tcpStreams[i];
+        if (tcpStream->tcpStreamManager) {
+            AccumulateTCPStreamStatistics(statistics, &tcpStream->statistics);
+        }
+    }
+}
+
+void HAPPlatformTCPStreamGetStatistics(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager,
+        HAPPlatformTCPStreamRef tcpStream_,
+        HAPPlatformTCPStreamStatistics* statistics) {
+    HAPPrecondition(tcpStreamManager);
+    HAPPrecondition(tcpStreamManager->tcpStreams);
+    HAPPrecondition(tcpStream_);
+    HAPPrecondition(statistics);
+
+    HAPPlatformTCPStream* tcpStream = GetTCPStream(tcpStreamManager, tcpStream_);
+
+    HAPPrecondition(tcpStream->tcpStreamManager == tcpStreamManager);
+
+    *statistics = tcpStream->statistics;
 }
 
 HAP_RESULT_USE_CHECK
@@ -176,7 +742,7 @@ bool HAPPlatformTCPStreamManagerIsListenerOpen(HAPPlatformTCPStreamManagerRef tc
     HAPPrecondition(tcpStreamManager);
     HAPPrecondition(tcpStreamManager->tcpStreams);
 
-    return tcpStreamManager->tcpStreamListener.tcpStreamManager != NULL;
+    return tcpStreamManager->numTCPStreamListeners != 0;
 }
 
 static void HandleTCPStreamListenerFileHandleCallback(
@@ -184,30 +750,68 @@ static void HandleTCPStreamListenerFileHandleCallback(
         HAPPlatformFileHandleEvent fileHandleEvents,
         void* _Nullable context);
 
-void HAPPlatformTCPStreamManagerOpenListener(
+/**
+ * Suspends or resumes monitoring the TCP stream listener sockets for pending connections.
+ *
+ * @param      tcpStreamManager     TCP stream manager.
+ * @param      isReadyForReading    Whether pending connections should be reported.
+ */
+static void UpdateTCPStreamListenerInterests(HAPPlatformTCPStreamManagerRef tcpStreamManager, bool isReadyForReading) {
+    HAPPrecondition(tcpStreamManager);
+    HAPPrecondition(tcpStreamManager->numTCPStreamListeners);
+
+    for (size_t i = 0; i < tcpStreamManager->numTCPStreamListeners; i++) {
+        HAPPlatformTCPStreamListener* tcpStreamListener = &tcpStreamManager->tcpStreamListeners[i];
+        HAPAssert(tcpStreamListener->fileHandle);
+
+        HAPPlatformFileHandleUpdateInterests(
+                tcpStreamListener->fileHandle,
+                (HAPPlatformFileHandleEvent) { .isReadyForReading = isReadyForReading,
+                                               .isReadyForWriting = false,
+                                               .hasErrorConditionPending = false },
+                HandleTCPStreamListenerFileHandleCallback,
+                tcpStreamListener);
+    }
+}
+
+/**
+ * Opens a TCP stream listener socket.
+ *
+ * @param      tcpStreamManager     TCP stream manager.
+ * @param      tcpStreamListener    TCP stream listener.
+ * @param      interfaceName        Name of the network interface to bind to, or NULL for all network interfaces.
+ * @param      port                 Port to bind to, or kHAPNetworkPort_Any for an unused port.
+ * @param      callback             Callback to invoke when a connection is pending.
+ * @param      context              Context that is passed to the callback.
+ */
+static void OpenTCPStreamListener(
         HAPPlatformTCPStreamManagerRef tcpStreamManager,
+        HAPPlatformTCPStreamListener* tcpStreamListener,
+        const char* _Nullable interfaceName,
+        HAPNetworkPort port,
         HAPPlatformTCPStreamListenerCallback callback,
         void* _Nullable context) {
     HAPPrecondition(tcpStreamManager);
-    HAPPrecondition(tcpStreamManager->tcpStreams);
+    HAPPrecondition(tcpStreamListener);
     HAPPrecondition(callback);
 
-    HAPPrecondition(!tcpStreamManager->tcpStreamListener.tcpStreamManager);
-    HAPPrecondition(tcpStreamManager->tcpStreamListener.interfaceIndex == 0);
-    HAPPrecondition(tcpStreamManager->tcpStreamListener.port == 0);
-    HAPPrecondition(tcpStreamManager->tcpStreamListener.fileDescriptor == -1);
-    HAPPrecondition(!tcpStreamManager->tcpStreamListener.fileHandle);
-    HAPPrecondition(!tcpStreamManager->tcpStreamListener.callback);
-    HAPPrecondition(!tcpStreamManager->tcpStreamListener.context);
+    HAPPrecondition(!tcpStreamListener->tcpStreamManager);
+    HAPPrecondition(tcpStreamListener->interfaceIndex == 0);
+    HAPPrecondition(tcpStreamListener->port == 0);
+    HAPPrecondition(tcpStreamListener->fileDescriptor == -1);
+    HAPPrecondition(!tcpStreamListener->fileHandle);
+    HAPPrecondition(!tcpStreamListener->callback);
+    HAPPrecondition(!tcpStreamListener->context);
 
     HAPError err;
     int _errno;
     int e;
 
-    uint32_t interfaceIndex = 0;
-    HAPNetworkPort port = tcpStreamManager->tcpStreamListenerConfiguration.port;
+    HAPPlatformTCPStreamManagerAddressFamily addressFamily =
+            tcpStreamManager->tcpStreamListenerConfiguration.addressFamily;
+    bool isIPv4 = addressFamily == kHAPPlatformTCPStreamManagerAddressFamily_IPv4;
 
-    int fileDescriptor = socket(PF_INET6, SOCK_STREAM, IPPROTO_TCP);
+    int fileDescriptor = socket(isIPv4 ? PF_INET : PF_INET6, SOCK_STREAM, IPPROTO_TCP);
     if (fileDescriptor == -1) {
         HAPLogError(&logObject, "Failed to open TCP stream listener socket.");
         HAPFatalError();
@@ -229,17 +833,84 @@ void HAPPlatformTCPStreamManagerOpenListener(
         HAPFatalError();
     }
 
-    HAPLogDebug(&logObject, "TCP stream listener interface index: %u", (unsigned int) interfaceIndex);
-
-    struct sockaddr_in6 sin6;
-
-    HAPRawBufferZero(&sin6, sizeof sin6);
-    sin6.sin6_family = AF_INET6;
-    sin6.sin6_port = htons(port);
-    sin6.sin6_addr = in6addr_any;
+    if (!isIPv4) {
+        // Set explicitly in both cases, as the default depends on the net.ipv6.bindv6only setting.
+        int isIPv6Only = addressFamily == kHAPPlatformTCPStreamManagerAddressFamily_IPv6;
+        HAPLogBufferDebug(
+                &logObject,
+                &isIPv6Only,
+                sizeof isIPv6Only,
+                "setsockopt(%d, IPPROTO_IPV6, IPV6_V6ONLY, <buffer>);",
+                fileDescriptor);
+        e = setsockopt(fileDescriptor, IPPROTO_IPV6, IPV6_V6ONLY, &isIPv6Only, sizeof isIPv6Only);
+        if (e != 0) {
+            _errno = errno;
+            HAPAssert(e == -1);
+            HAPPlatformLogPOSIXError(
+                    kHAPLogType_Error,
+                    "System call 'setsockopt' with option 'IPV6_V6ONLY' on TCP stream listener socket failed.",
+                    _errno,
+                    __func__,
+                    HAP_FILE,
+                    __LINE__);
+            HAPFatalError();
+        }
+    }
+
+    uint32_t interfaceIndex = 0;
+    if (interfaceName) {
+        interfaceIndex = if_nametoindex(interfaceName);
+        if (!interfaceIndex) {
+            HAPLogError(&logObject, "Network interface %s not found.", interfaceName);
+            HAPFatalError();
+        }
+#ifdef SO_BINDTODEVICE
+        struct ifreq ifr;
+        HAPRawBufferZero(&ifr, sizeof ifr);
+        HAPAssert(HAPStringGetNumBytes(interfaceName) < sizeof ifr.ifr_name);
+        HAPRawBufferCopyBytes(ifr.ifr_name, interfaceName, HAPStringGetNumBytes(interfaceName));
+        HAPLogDebug(&logObject, "setsockopt(%d, SOL_SOCKET, SO_BINDTODEVICE, %s);", fileDescriptor, interfaceName);
+        e = setsockopt(fileDescriptor, SOL_SOCKET, SO_BINDTODEVICE, &ifr, sizeof ifr);
+        if (e != 0) {
+            _errno = errno;
+            HAPAssert(e == -1);
+            HAPPlatformLogPOSIXError(
+                    kHAPLogType_Error,
+                    "System call 'setsockopt' with option 'SO_BINDTODEVICE' on TCP stream listener socket failed.",
+                    _errno,
+                    __func__,
+                    HAP_FILE,
+                    __LINE__);
+            HAPFatalError();
+        }
+#else
+        HAPLog(&logObject, "Ignoring network interface %s: SO_BINDTODEVICE is not supported.", interfaceName);
+#endif
+    }
+    HAPLogDebug(&logObject, "TCP stream listener interface index: %u", (unsigned int) interfaceIndex);
+
+    union {
+        struct sockaddr sa;
+        struct sockaddr_in sin;
+        struct sockaddr_in6 sin6;
+    } address;
+    socklen_t addressLength;
+
+    HAPRawBufferZero(&address, sizeof address);
+    if (isIPv4) {
+        address.sin.sin_family = AF_INET;
+        address.sin.sin_port = htons(port);
+        address.sin.sin_addr.s_addr = htonl(INADDR_ANY);
+        addressLength = sizeof address.sin;
+    } else {
+        address.sin6.sin6_family = AF_INET6;
+        address.sin6.sin6_port = htons(port);
+        address.sin6.sin6_addr = in6addr_any;
+        addressLength = sizeof address.sin6;
+    }
 
-    HAPLogBufferDebug(&logObject, (struct sockaddr*) &sin6, sizeof sin6, "bind(%d, <buffer>);", fileDescriptor);
-    e = bind(fileDescriptor, (struct sockaddr*) &sin6, sizeof sin6);
+    HAPLogBufferDebug(&logObject, &address.sa, addressLength, "bind(%d, <buffer>);", fileDescriptor);
+    e = bind(fileDescriptor, &address.sa, addressLength);
     if (e != 0) {
         _errno = errno;
         HAPAssert(e == -1);
@@ -254,9 +925,8 @@ void HAPPlatformTCPStreamManagerOpenListener(
     }
 
     if (!port) {
-        socklen_t sin6_len = sizeof sin6;
-        HAPRawBufferZero(&sin6, sizeof sin6);
-        e = getsockname(fileDescriptor, (struct sockaddr*) &sin6, &sin6_len);
+        HAPRawBufferZero(&address, sizeof address);
+        e = getsockname(fileDescriptor, &address.sa, &addressLength);
         if (e != 0) {
             _errno = errno;
             HAPAssert(e == -1);
@@ -269,8 +939,8 @@ void HAPPlatformTCPStreamManagerOpenListener(
                     __LINE__);
             HAPFatalError();
         }
-        HAPAssert(sin6.sin6_port);
-        port = ntohs(sin6.sin6_port);
+        port = ntohs(isIPv4 ? address.sin.sin_port : address.sin6.sin6_port);
+        HAPAssert(port);
     }
     HAPLogDebug(&logObject, "TCP stream listener port: %u.", port);
 
@@ -289,6 +959,14 @@ void HAPPlatformTCPStreamManagerOpenListener(
         HAPFatalError();
     }
 
+    // The accept queue is drained until it reports busy, so the listener socket must not block.
+    err = SetNonblocking(fileDescriptor);
+    if (err) {
+        HAPAssert(err == kHAPError_Unknown);
+        HAPLogError(&logObject, "Failed to configure TCP stream listener socket as non-blocking.");
+        HAPFatalError();
+    }
+
     HAPPlatformFileHandleRef fileHandle;
     err = HAPPlatformFileHandleRegister(
             &fileHandle,
@@ -296,36 +974,66 @@ void HAPPlatformTCPStreamManagerOpenListener(
             (HAPPlatformFileHandleEvent) {
                     .isReadyForReading = true, .isReadyForWriting = false, .hasErrorConditionPending = false },
             HandleTCPStreamListenerFileHandleCallback,
-            &tcpStreamManager->tcpStreamListener);
+            tcpStreamListener);
     if (err) {
         HAPLogError(&logObject, "Failed to register TCP stream listener file handle.");
         HAPFatalError();
     }
     HAPAssert(fileHandle);
 
-    tcpStreamManager->tcpStreamListener.tcpStreamManager = tcpStreamManager;
-    tcpStreamManager->tcpStreamListener.port = port;
-    tcpStreamManager->tcpStreamListener.interfaceIndex = interfaceIndex;
-    tcpStreamManager->tcpStreamListener.fileDescriptor = fileDescriptor;
-    tcpStreamManager->tcpStreamListener.fileHandle = fileHandle;
-    tcpStreamManager->tcpStreamListener.callback = callback;
-    tcpStreamManager->tcpStreamListener.context = context;
+    tcpStreamListener->tcpStreamManager = tcpStreamManager;
+    tcpStreamListener->port = port;
+    tcpStreamListener->interfaceIndex = interfaceIndex;
+    tcpStreamListener->fileDescriptor = fileDescriptor;
+    tcpStreamListener->fileHandle = fileHandle;
+    tcpStreamListener->callback = callback;
+    tcpStreamListener->context = context;
 }
 
-void HAPPlatformTCPStreamManagerCloseListener(HAPPlatformTCPStreamManagerRef tcpStreamManager) {
+void HAPPlatformTCPStreamManagerOpenListener(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager,
+        HAPPlatformTCPStreamListenerCallback callback,
+        void* _Nullable context) {
     HAPPrecondition(tcpStreamManager);
     HAPPrecondition(tcpStreamManager->tcpStreams);
-    HAPPrecondition(tcpStreamManager->tcpStreamListener.tcpStreamManager == tcpStreamManager);
-    HAPPrecondition(tcpStreamManager->tcpStreamListener.fileDescriptor != -1);
-    HAPPrecondition(tcpStreamManager->tcpStreamListener.fileHandle);
-    HAPPrecondition(tcpStreamManager->tcpStreamListener.callback);
+    HAPPrecondition(callback);
+    HAPPrecondition(!tcpStreamManager->numTCPStreamListeners);
+
+    // All listeners share the port of the first one, so that a single port can be advertised.
+    HAPNetworkPort port = tcpStreamManager->tcpStreamListenerConfiguration.port;
+    size_t numInterfaceNames = tcpStreamManager->tcpStreamListenerConfiguration.numInterfaceNames;
+    for (size_t i = 0; i < (numInterfaceNames ? numInterfaceNames : 1); i++) {
+        HAPPlatformTCPStreamListener* tcpStreamListener = &tcpStreamManager->tcpStreamListeners[i];
+        OpenTCPStreamListener(
+                tcpStreamManager,
+                tcpStreamListener,
+                numInterfaceNames ? tcpStreamManager->tcpStreamListenerConfiguration.interfaceNames[i] : NULL,
+                port,
+                callback,
+                context);
+        port = tcpStreamListener->port;
+        tcpStreamManager->numTCPStreamListeners++;
+    }
+}
+
+/**
+ * Closes a TCP stream listener socket.
+ *
+ * @param      tcpStreamListener    TCP stream listener.
+ */
+static void CloseTCPStreamListener(HAPPlatformTCPStreamListener* tcpStreamListener) {
+    HAPPrecondition(tcpStreamListener);
+    HAPPrecondition(tcpStreamListener->tcpStreamManager);
+    HAPPrecondition(tcpStreamListener->fileDescriptor != -1);
+    HAPPrecondition(tcpStreamListener->fileHandle);
+    HAPPrecondition(tcpStreamListener->callback);
 
     int e;
 
-    HAPPlatformFileHandleDeregister(tcpStreamManager->tcpStreamListener.fileHandle);
+    HAPPlatformFileHandleDeregister(tcpStreamListener->fileHandle);
 
-    HAPLogDebug(&logObject, "shutdown(%d, SHUT_RDWR);", tcpStreamManager->tcpStreamListener.fileDescriptor);
-    e = shutdown(tcpStreamManager->tcpStreamListener.fileDescriptor, SHUT_RDWR);
+    HAPLogDebug(&logObject, "shutdown(%d, SHUT_RDWR);", tcpStreamListener->fileDescriptor);
+    e = shutdown(tcpStreamListener->fileDescriptor, SHUT_RDWR);
     if (e != 0) {
         int _errno = errno;
         HAPAssert(e == -1);
@@ -338,8 +1046,8 @@ void HAPPlatformTCPStreamManagerCloseListener(HAPPlatformTCPStreamManagerRef tcp
                 __LINE__);
     }
 
-    HAPLogDebug(&logObject, "close(%d);", tcpStreamManager->tcpStreamListener.fileDescriptor);
-    e = close(tcpStreamManager->tcpStreamListener.fileDescriptor);
+    HAPLogDebug(&logObject, "close(%d);", tcpStreamListener->fileDescriptor);
+    e = close(tcpStreamListener->fileDescriptor);
     if (e != 0) {
         int _errno = errno;
         HAPAssert(e == -1);
@@ -352,7 +1060,27 @@ void HAPPlatformTCPStreamManagerCloseListener(HAPPlatformTCPStreamManagerRef tcp
                 __LINE__);
     }
 
-    InitializeTCPStreamListener(&tcpStreamManager->tcpStreamListener);
+    InitializeTCPStreamListener(tcpStreamListener);
+}
+
+void HAPPlatformTCPStreamManagerCloseListener(HAPPlatformTCPStreamManagerRef tcpStreamManager) {
+    HAPPrecondition(tcpStreamManager);
+    HAPPrecondition(tcpStreamManager->tcpStreams);
+    HAPPrecondition(tcpStreamManager->numTCPStreamListeners);
+
+    if (tcpStreamManager->evictionTimer) {
+        HAPPlatformTimerDeregister(tcpStreamManager->evictionTimer);
+        tcpStreamManager->evictionTimer = 0;
+    }
+    tcpStreamManager->admissionStartTime = 0;
+
+    for (size_t i = 0; i < tcpStreamManager->numTCPStreamListeners; i++) {
+        HAPPlatformTCPStreamListener* tcpStreamListener = &tcpStreamManager->tcpStreamListeners[i];
+        HAPPrecondition(tcpStreamListener->tcpStreamManager == tcpStreamManager);
+        CloseTCPStreamListener(tcpStreamListener);
+    }
+    tcpStreamManager->numTCPStreamListeners = 0;
+    tcpStreamManager->activeTCPStreamListener = NULL;
 }
 
 static void HandleTCPStreamFileHandleCallback(
@@ -360,19 +1088,222 @@ static void HandleTCPStreamFileHandleCallback(
         HAPPlatformFileHandleEvent fileHandleEvents,
         void* _Nullable context);
 
+static void ScheduleReceiveBufferEvent(HAPPlatformTCPStream* tcpStream);
+
+static void FlushSendBuffer(HAPPlatformTCPStream* tcpStream);
+
+static void UpdateTCPStreamFileHandleInterests(HAPPlatformTCPStream* tcpStream);
+
+/**
+ * Stores the peer address of an accepted TCP stream as IPv6 address.
+ *
+ * @param      address              Socket address returned by accept.
+ * @param[in,out] statistics        TCP stream statistics.
+ */
+static void GetPeerAddress(const struct sockaddr_storage* address, HAPPlatformTCPStreamStatistics* statistics) {
+    HAPPrecondition(address);
+    HAPPrecondition(statistics);
+
+    HAPRawBufferZero(statistics->peerAddress, sizeof statistics->peerAddress);
+    statistics->peerPort = 0;
+    if (address->ss_family == AF_INET6) {
+        const struct sockaddr_in6* sin6 = (const struct sockaddr_in6*) address;
+        HAPAssert(sizeof sin6->sin6_addr == sizeof statistics->peerAddress);
+        HAPRawBufferCopyBytes(statistics->peerAddress, &sin6->sin6_addr, sizeof statistics->peerAddress);
+        statistics->peerPort = ntohs(sin6->sin6_port);
+    } else if (address->ss_family == AF_INET) {
+        const struct sockaddr_in* sin = (const struct sockaddr_in*) address;
+        statistics->peerAddress[10] = 0xFF;
+        statistics->peerAddress[11] = 0xFF;
+        HAPRawBufferCopyBytes(&statistics->peerAddress[12], &sin->sin_addr, 4);
+        statistics->peerPort = ntohs(sin->sin_port);
+    }
+}
+
+/**
+ * Refills a token bucket.
+ *
+ * - Tokens are counted in thousandths, so that a rate in tokens per second adds `rate` thousandths per millisecond.
+ *
+ * @param[in,out] tokens            Number of thousandths of tokens in the bucket.
+ * @param[in,out] lastRefillTime    Time of the last refill.
+ * @param      now                  Current time.
+ * @param      rate                 Refill rate in tokens per second.
+ * @param      burst                Capacity of the bucket in tokens.
+ */
+static void RefillTokenBucket(uint32_t* tokens, HAPTime* lastRefillTime, HAPTime now, uint16_t rate, uint16_t burst) {
+    HAPPrecondition(tokens);
+    HAPPrecondition(lastRefillTime);
+
+    uint32_t capacity = (uint32_t) burst * 1000;
+    HAPTime elapsed = now > *lastRefillTime ? now - *lastRefillTime : 0;
+    if (elapsed > capacity) {
+        elapsed = capacity;
+    }
+    uint64_t numTokens = *tokens + elapsed * rate;
+    *tokens = numTokens < capacity ? (uint32_t) numTokens : capacity;
+    *lastRefillTime = now;
+}
+
+/**
+ * Decides whether a connection that has just been accepted is admitted.
+ *
+ * - Tokens are only taken if the connection is admitted.
+ *
+ * @param      tcpStreamManager     TCP stream manager.
+ * @param      peerAddress          IPv6 address of the peer. IPv4 peers use IPv4-mapped IPv6 addresses.
+ *
+ * @return true                     If the connection is admitted.
+ * @return false                    Otherwise.
+ */
 HAP_RESULT_USE_CHECK
-HAPError HAPPlatformTCPStreamManagerAcceptTCPStream(
+static bool AdmitTCPStream(HAPPlatformTCPStreamManagerRef tcpStreamManager, const uint8_t peerAddress[16]) {
+    HAPPrecondition(tcpStreamManager);
+    HAPPrecondition(peerAddress);
+
+    if (tcpStreamManager->admission.maxHandshakingTCPStreams &&
+        tcpStreamManager->numHandshakingTCPStreams >= tcpStreamManager->admission.maxHandshakingTCPStreams) {
+        tcpStreamManager->statistics.numHandshakeLimitedTCPStreams++;
+        return false;
+    }
+
+    HAPTime now = HAPPlatformClockGetCurrent();
+
+    uint32_t* sourceTokens = NULL;
+    if (tcpStreamManager->admission.sourceRate) {
+        // Find the bucket of the peer, or reuse a bucket that has fully refilled. Forgetting such a peer loses no
+        // state, as it would start over with a full bucket anyway.
+        size_t i;
+        for (i = 0; i < tcpStreamManager->admission.numSourceBuckets; i++) {
+            if (HAPRawBufferAreEqual(
+                        tcpStreamManager->admission.sourceBuckets[i].peerAddress,
+                        peerAddress,
+                        sizeof tcpStreamManager->admission.sourceBuckets[i].peerAddress)) {
+                break;
+            }
+        }
+        if (i == tcpStreamManager->admission.numSourceBuckets) {
+            if (i < HAPArrayCount(tcpStreamManager->admission.sourceBuckets)) {
+                tcpStreamManager->admission.numSourceBuckets++;
+            } else {
+                for (i = 0; i < HAPArrayCount(tcpStreamManager->admission.sourceBuckets); i++) {
+                    RefillTokenBucket(
+                            &tcpStreamManager->admission.sourceBuckets[i].tokens,
+                            &tcpStreamManager->admission.sourceBuckets[i].lastRefillTime,
+                            now,
+                            tcpStreamManager->admission.sourceRate,
+                            tcpStreamManager->admission.sourceBurst);
+                    if (tcpStreamManager->admission.sourceBuckets[i].tokens ==
+                        (uint32_t) tcpStreamManager->admission.sourceBurst * 1000) {
+                        break;
+                    }
+                }
+                if (i == HAPArrayCount(tcpStreamManager->admission.sourceBuckets)) {
+                    // All tracked peers are still rate limited. Admitting untracked peers would let a peer that
+                    // rotates through more addresses than there are buckets bypass the limit.
+                    tcpStreamManager->statistics.numSourceRateLimitedTCPStreams++;
+                    return false;
+                }
+            }
+            HAPRawBufferCopyBytes(
+                    tcpStreamManager->admission.sourceBuckets[i].peerAddress,
+                    peerAddress,
+                    sizeof tcpStreamManager->admission.sourceBuckets[i].peerAddress);
+            tcpStreamManager->admission.sourceBuckets[i].tokens =
+                    (uint32_t) tcpStreamManager->admission.sourceBurst * 1000;
+            tcpStreamManager->admission.sourceBuckets[i].lastRefillTime = now;
+        }
+
+        RefillTokenBucket(
+                &tcpStreamManager->admission.sourceBuckets[i].tokens,
+                &tcpStreamManager->admission.sourceBuckets[i].lastRefillTime,
+                now,
+                tcpStreamManager->admission.sourceRate,
+                tcpStreamManager->admission.sourceBurst);
+        sourceTokens = &tcpStreamManager->admission.sourceBuckets[i].tokens;
+        if (*sourceTokens < 1000) {
+            tcpStreamManager->statistics.numSourceRateLimitedTCPStreams++;
+            return false;
+        }
+    }
+
+    if (tcpStreamManager->admission.globalRate) {
+        RefillTokenBucket(
+                &tcpStreamManager->admission.globalBucket.tokens,
+                &tcpStreamManager->admission.globalBucket.lastRefillTime,
+                now,
+                tcpStreamManager->admission.globalRate,
+                tcpStreamManager->admission.globalBurst);
+        if (tcpStreamManager->admission.globalBucket.tokens < 1000) {
+            tcpStreamManager->statistics.numGlobalRateLimitedTCPStreams++;
+            return false;
+        }
+        tcpStreamManager->admission.globalBucket.tokens -= 1000;
+    }
+
+    if (sourceTokens) {
+        *sourceTokens -= 1000;
+    }
+    return true;
+}
+
+/**
+ * Resets and closes a connection that has not been admitted.
+ *
+ * @param      fileDescriptor       File descriptor of the accepted connection.
+ */
+static void RefuseTCPStream(int fileDescriptor) {
+    HAPPrecondition(fileDescriptor != -1);
+
+    // Reset the connection, so that no resources are held in TIME_WAIT.
+    struct linger linger = { .l_onoff = 1, .l_linger = 0 };
+    int e = setsockopt(fileDescriptor, SOL_SOCKET, SO_LINGER, &linger, sizeof linger);
+    if (e != 0) {
+        int _errno = errno;
+        HAPAssert(e == -1);
+        HAPPlatformLogPOSIXError(
+                kHAPLogType_Debug,
+                "System call 'setsockopt' with option 'SO_LINGER' on TCP stream socket failed.",
+                _errno,
+                __func__,
+                HAP_FILE,
+                __LINE__);
+    }
+
+    HAPLogDebug(&logObject, "close(%d);", fileDescriptor);
+    e = close(fileDescriptor);
+    if (e != 0) {
+        int _errno = errno;
+        HAPAssert(e == -1);
+        HAPPlatformLogPOSIXError(
+                kHAPLogType_Debug,
+                "System call 'close' on TCP stream socket failed.",
+                _errno,
+                __func__,
+                HAP_FILE,
+                __LINE__);
+    }
+}
+
+HAP_RESULT_USE_CHECK
+static HAPError AcceptTCPStream(
         HAPPlatformTCPStreamManagerRef tcpStreamManager,
         HAPPlatformTCPStreamRef* tcpStream_) {
     HAPPrecondition(tcpStreamManager);
     HAPPrecondition(tcpStreamManager->tcpStreams);
-    HAPPrecondition(tcpStreamManager->tcpStreamListener.tcpStreamManager == tcpStreamManager);
-    HAPPrecondition(tcpStreamManager->tcpStreamListener.fileDescriptor != -1);
-    HAPPrecondition(tcpStreamManager->tcpStreamListener.fileHandle);
+    HAPPrecondition(tcpStreamManager->numTCPStreamListeners);
     HAPPrecondition(tcpStream_);
 
     HAPError err;
 
+    // Accept from the listener that reported the pending connection.
+    HAPPlatformTCPStreamListener* tcpStreamListener = tcpStreamManager->activeTCPStreamListener ?
+                                                              tcpStreamManager->activeTCPStreamListener :
+                                                              &tcpStreamManager->tcpStreamListeners[0];
+    HAPAssert(tcpStreamListener->tcpStreamManager == tcpStreamManager);
+    HAPAssert(tcpStreamListener->fileDescriptor != -1);
+    HAPAssert(tcpStreamListener->fileHandle);
+
     if (tcpStreamManager->numTCPStreams == tcpStreamManager->maxTCPStreams) {
         HAPLog(&logObject, "Cannot accept more TCP streams.");
         *tcpStream_ = (HAPPlatformTCPStreamRef) NULL;
@@ -381,37 +1312,60 @@ HAPError HAPPlatformTCPStreamManagerAcceptTCPStream(
 
     HAPAssert(tcpStreamManager->numTCPStreams < tcpStreamManager->maxTCPStreams);
 
-    // Find free TCP stream.
-    size_t i = 0;
-    while ((i < tcpStreamManager->maxTCPStreams) && (tcpStreamManager->tcpStreams[i].fileDescriptor != -1)) {
-        i++;
-    }
-    HAPAssert(i < tcpStreamManager->maxTCPStreams);
-
-    HAPPlatformTCPStream* tcpStream = &tcpStreamManager->tcpStreams[i];
+    // Get free TCP stream. It is only removed from the free list once the connection has been accepted.
+    HAPPlatformTCPStream* tcpStream = tcpStreamManager->freeTCPStreams;
+    HAPAssert(tcpStream);
 
     HAPAssert(!tcpStream->tcpStreamManager);
     HAPAssert(tcpStream->fileDescriptor == -1);
     HAPAssert(!tcpStream->fileHandle);
 
-    HAPLogDebug(&logObject, "accept(%d, NULL, NULL);", tcpStreamManager->tcpStreamListener.fileDescriptor);
-    int fileDescriptor = accept(tcpStreamManager->tcpStreamListener.fileDescriptor, NULL, NULL);
-    if (fileDescriptor == -1) {
-        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED && errno != EPROTO) {
-            HAPPlatformLogPOSIXError(
-                    kHAPLogType_Error,
-                    "System call 'accept' on TCP stream listener socket failed.",
-                    errno,
-                    __func__,
-                    HAP_FILE,
-                    __LINE__);
+    // Connections that are not admitted are refused here, so that the HAP layer never starts a handshake for them.
+    struct sockaddr_storage peerAddress;
+    int fileDescriptor;
+    size_t numRefusedTCPStreams = 0;
+    for (;;) {
+        socklen_t peerAddressLength = sizeof peerAddress;
+        HAPRawBufferZero(&peerAddress, sizeof peerAddress);
+        HAPLogDebug(&logObject, "accept(%d, <address>, <length>);", tcpStreamListener->fileDescriptor);
+        fileDescriptor = accept(tcpStreamListener->fileDescriptor, (struct sockaddr*) &peerAddress, &peerAddressLength);
+        if (fileDescriptor == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED &&
+                errno != EPROTO) {
+                HAPPlatformLogPOSIXError(
+                        kHAPLogType_Error,
+                        "System call 'accept' on TCP stream listener socket failed.",
+                        errno,
+                        __func__,
+                        HAP_FILE,
+                        __LINE__);
+                *tcpStream_ = (HAPPlatformTCPStreamRef) NULL;
+                return kHAPError_Unknown;
+            }
+
+            HAPLogDebug(&logObject, "System call 'accept' on TCP stream listener socket is busy.");
             *tcpStream_ = (HAPPlatformTCPStreamRef) NULL;
-            return kHAPError_Unknown;
+            return kHAPError_Busy;
         }
 
-        HAPLogDebug(&logObject, "System call 'accept' on TCP stream listener socket is busy.");
-        *tcpStream_ = (HAPPlatformTCPStreamRef) NULL;
-        return kHAPError_Busy;
+        GetPeerAddress(&peerAddress, &tcpStream->statistics);
+        if (AdmitTCPStream(tcpStreamManager, tcpStream->statistics.peerAddress)) {
+            break;
+        }
+        HAPLogBufferDebug(
+                &logObject,
+                tcpStream->statistics.peerAddress,
+                sizeof tcpStream->statistics.peerAddress,
+                "Refusing TCP stream from port %u.",
+                tcpStream->statistics.peerPort);
+        RefuseTCPStream(fileDescriptor);
+        HAPRawBufferZero(&tcpStream->statistics, sizeof tcpStream->statistics);
+
+        numRefusedTCPStreams++;
+        if (numRefusedTCPStreams == kHAPPlatformTCPStreamManager_MaxRefusalsPerAccept) {
+            *tcpStream_ = (HAPPlatformTCPStreamRef) NULL;
+            return kHAPError_Busy;
+        }
     }
 
     // Configure socket.
@@ -425,6 +1379,7 @@ HAPError HAPPlatformTCPStreamManagerAcceptTCPStream(
         HAPLogError(&logObject, "Failed to disable Nagle's algorithm for TCP stream socket.");
         HAPFatalError();
     }
+    SetDeadPeerDetection(tcpStreamManager, fileDescriptor);
 
     HAPPlatformFileHandleRef fileHandle;
     err = HAPPlatformFileHandleRegister(
@@ -440,6 +1395,8 @@ HAPError HAPPlatformTCPStreamManagerAcceptTCPStream(
     }
     HAPAssert(fileHandle);
 
+    tcpStreamManager->freeTCPStreams = tcpStream->nextFreeTCPStream;
+    tcpStream->nextFreeTCPStream = NULL;
     tcpStream->tcpStreamManager = tcpStreamManager;
     tcpStream->fileDescriptor = fileDescriptor;
     tcpStream->fileHandle = fileHandle;
@@ -448,35 +1405,68 @@ HAPError HAPPlatformTCPStreamManagerAcceptTCPStream(
     HAPAssert(!tcpStream->callback);
     HAPAssert(!tcpStream->context);
 
-    *tcpStream_ = (HAPPlatformTCPStreamRef) tcpStream;
+    *tcpStream_ = GetTCPStreamRef(tcpStreamManager, tcpStream);
+    tcpStream->statistics.acceptTime = HAPPlatformClockGetCurrent();
+    HAPLogBufferDebug(
+            &logObject,
+            tcpStream->statistics.peerAddress,
+            sizeof tcpStream->statistics.peerAddress,
+            "Accepted TCP stream 0x%lx from port %u.",
+            (unsigned long) *tcpStream_,
+            tcpStream->statistics.peerPort);
+    RecordTCPStreamActivity(tcpStreamManager, tcpStream);
 
     tcpStreamManager->numTCPStreams++;
+    tcpStream->isHandshaking = true;
+    tcpStreamManager->numHandshakingTCPStreams++;
 
-    if (tcpStreamManager->maxTCPStreams - tcpStreamManager->numTCPStreams == 0) {
+    // With eviction enabled, the listener is kept active so that pending connections trigger an eviction.
+    if (tcpStreamManager->maxTCPStreams - tcpStreamManager->numTCPStreams == 0 &&
+        !tcpStreamManager->evictionIdleTimeout) {
         HAPLogInfo(&logObject, "Suspending accepting new TCP streams on TCP stream listener socket.");
-        HAPPlatformFileHandleUpdateInterests(
-                tcpStreamManager->tcpStreamListener.fileHandle,
-                (HAPPlatformFileHandleEvent) {
-                        .isReadyForReading = false, .isReadyForWriting = false, .hasErrorConditionPending = false },
-                HandleTCPStreamListenerFileHandleCallback,
-                &tcpStreamManager->tcpStreamListener);
+        UpdateTCPStreamListenerInterests(tcpStreamManager, false);
     }
 
     return kHAPError_None;
 }
 
-void HAPPlatformTCPStreamCloseOutput(
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformTCPStreamManagerAcceptTCPStream(
         HAPPlatformTCPStreamManagerRef tcpStreamManager,
-        HAPPlatformTCPStreamRef tcpStream_) {
+        HAPPlatformTCPStreamRef* tcpStream) {
     HAPPrecondition(tcpStreamManager);
-    HAPPrecondition(tcpStreamManager->tcpStreams);
-    HAPPrecondition(tcpStream_);
 
-    HAPPlatformTCPStream* tcpStream = (HAPPlatformTCPStream*) tcpStream_;
+    HAPError err = AcceptTCPStream(tcpStreamManager, tcpStream);
+
+    // Record result, so that the listener callback can decide whether to keep accepting.
+    tcpStreamManager->numAcceptAttempts++;
+    tcpStreamManager->lastAcceptError = err;
+    if (!err) {
+        tcpStreamManager->statistics.numAcceptedTCPStreams++;
+        if (tcpStreamManager->admissionStartTime) {
+            HAPTime admissionLatency = HAPPlatformClockGetCurrentCoarse() - tcpStreamManager->admissionStartTime;
+            tcpStreamManager->admissionStartTime = 0;
+            tcpStreamManager->statistics.totalAdmissionLatency += admissionLatency;
+            if (admissionLatency > tcpStreamManager->statistics.maxAdmissionLatency) {
+                tcpStreamManager->statistics.maxAdmissionLatency = admissionLatency;
+            }
+        }
+    } else if (err != kHAPError_Busy) {
+        tcpStreamManager->statistics.numRejectedTCPStreams++;
+    }
+    return err;
+}
 
-    HAPPrecondition(tcpStream->tcpStreamManager == tcpStreamManager);
+/**
+ * Shuts down the sending direction of the socket of a TCP stream.
+ *
+ * @param      tcpStream            TCP stream.
+ */
+static void ShutdownTCPStreamOutput(HAPPlatformTCPStream* tcpStream) {
+    HAPPrecondition(tcpStream);
     HAPPrecondition(tcpStream->fileDescriptor != -1);
-    HAPPrecondition(tcpStream->fileHandle);
+
+    tcpStream->sendBuffer.isOutputClosePending = false;
 
     HAPLogDebug(&logObject, "shutdown(%d, SHUT_WR);", tcpStream->fileDescriptor);
     int e = shutdown(tcpStream->fileDescriptor, SHUT_WR);
@@ -493,19 +1483,61 @@ void HAPPlatformTCPStreamCloseOutput(
     }
 }
 
-void HAPPlatformTCPStreamClose(HAPPlatformTCPStreamManagerRef tcpStreamManager, HAPPlatformTCPStreamRef tcpStream_) {
+void HAPPlatformTCPStreamCloseOutput(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager,
+        HAPPlatformTCPStreamRef tcpStream_) {
     HAPPrecondition(tcpStreamManager);
     HAPPrecondition(tcpStreamManager->tcpStreams);
     HAPPrecondition(tcpStream_);
 
-    HAPPlatformTCPStream* tcpStream = (HAPPlatformTCPStream*) tcpStream_;
+    HAPPlatformTCPStream* tcpStream = GetTCPStream(tcpStreamManager, tcpStream_);
+
+    HAPPrecondition(tcpStream->tcpStreamManager == tcpStreamManager);
+    HAPPrecondition(tcpStream->fileDescriptor != -1);
+    HAPPrecondition(tcpStream->fileHandle);
+
+    // Buffered bytes must leave before the FIN. If the socket cannot take them right now, shutting down is deferred
+    // until they have been sent. Closing the TCP stream bounds the wait.
+    FlushSendBuffer(tcpStream);
+    if (tcpStream->sendBuffer.numBytes) {
+        HAPLogDebug(
+                &logObject,
+                "Deferring shutdown of TCP stream 0x%lx until %lu buffered bytes have been sent.",
+                (unsigned long) tcpStream_,
+                (unsigned long) tcpStream->sendBuffer.numBytes);
+        tcpStream->sendBuffer.isOutputClosePending = true;
+        return;
+    }
+
+    ShutdownTCPStreamOutput(tcpStream);
+}
 
+/**
+ * Closes the socket of a TCP stream and returns the TCP stream to the free list.
+ *
+ * - Bytes that are still in the send buffer are discarded.
+ *
+ * @param      tcpStreamManager     TCP stream manager.
+ * @param      tcpStream            TCP stream.
+ */
+static void FinishClosingTCPStream(HAPPlatformTCPStreamManagerRef tcpStreamManager, HAPPlatformTCPStream* tcpStream) {
+    HAPPrecondition(tcpStreamManager);
+    HAPPrecondition(tcpStream);
     HAPPrecondition(tcpStream->tcpStreamManager == tcpStreamManager);
     HAPPrecondition(tcpStream->fileDescriptor != -1);
     HAPPrecondition(tcpStream->fileHandle);
 
     int e;
 
+    if (tcpStream->sendBuffer.numBytes) {
+        HAPLog(&logObject,
+               "Discarding %lu buffered bytes of TCP stream.",
+               (unsigned long) tcpStream->sendBuffer.numBytes);
+    }
+    if (tcpStream->sendBuffer.lingerTimer) {
+        HAPPlatformTimerDeregister(tcpStream->sendBuffer.lingerTimer);
+        tcpStream->sendBuffer.lingerTimer = 0;
+    }
     HAPPlatformFileHandleDeregister(tcpStream->fileHandle);
 
     HAPLogDebug(&logObject, "shutdown(%d, SHUT_RDWR);", tcpStream->fileDescriptor);
@@ -536,7 +1568,17 @@ void HAPPlatformTCPStreamClose(HAPPlatformTCPStreamManagerRef tcpStreamManager,
                 __LINE__);
     }
 
+    AccumulateTCPStreamStatistics(&tcpStreamManager->closedTCPStreamStatistics, &tcpStream->statistics);
+
+    EndTCPStreamHandshake(tcpStreamManager, tcpStream);
+    if (tcpStream == tcpStreamManager->evictedTCPStream) {
+        tcpStreamManager->evictedTCPStream = NULL;
+    }
+
+    // Return TCP stream to the free list.
     InitializeTCPStream(tcpStream);
+    tcpStream->nextFreeTCPStream = tcpStreamManager->freeTCPStreams;
+    tcpStreamManager->freeTCPStreams = tcpStream;
 
     HAPAssert(tcpStreamManager->numTCPStreams <= tcpStreamManager->maxTCPStreams);
 
@@ -544,88 +1586,166 @@ void HAPPlatformTCPStreamClose(HAPPlatformTCPStreamManagerRef tcpStreamManager,
 
     tcpStreamManager->numTCPStreams--;
 
-    if (tcpStreamManager->tcpStreamListener.fileDescriptor != -1) {
-        HAPAssert(tcpStreamManager->tcpStreamListener.tcpStreamManager == tcpStreamManager);
-        HAPAssert(tcpStreamManager->tcpStreamListener.fileHandle);
+    if (tcpStreamManager->numTCPStreamListeners) {
         if (tcpStreamManager->maxTCPStreams - tcpStreamManager->numTCPStreams == 1) {
             HAPLogInfo(&logObject, "Resuming accepting new TCP streams on TCP stream listener socket.");
-            HAPPlatformFileHandleUpdateInterests(
-                    tcpStreamManager->tcpStreamListener.fileHandle,
-                    (HAPPlatformFileHandleEvent) {
-                            .isReadyForReading = true, .isReadyForWriting = false, .hasErrorConditionPending = false },
-                    HandleTCPStreamListenerFileHandleCallback,
-                    &tcpStreamManager->tcpStreamListener);
+            UpdateTCPStreamListenerInterests(tcpStreamManager, true);
         }
-    } else {
-        HAPAssert(!tcpStreamManager->tcpStreamListener.tcpStreamManager);
-        HAPAssert(!tcpStreamManager->tcpStreamListener.fileHandle);
     }
 }
 
-void HAPPlatformTCPStreamUpdateInterests(
-        HAPPlatformTCPStreamManagerRef tcpStreamManager,
-        HAPPlatformTCPStreamRef tcpStream_,
-        HAPPlatformTCPStreamEvent interests,
-        HAPPlatformTCPStreamEventCallback _Nullable callback,
-        void* _Nullable context) {
+static void HandleLingerTimerExpired(HAPPlatformTimerRef timer, void* _Nullable context) {
+    HAPAssert(timer);
+    HAPAssert(context);
+
+    HAPPlatformTCPStream* tcpStream = (HAPPlatformTCPStream*) context;
+
+    HAPAssert(tcpStream->tcpStreamManager);
+    HAPAssert(tcpStream->sendBuffer.isClosePending);
+    HAPAssert(tcpStream->sendBuffer.lingerTimer == timer);
+    tcpStream->sendBuffer.lingerTimer = 0;
+
+    HAPLog(&logObject, "Peer did not accept the remaining bytes of a closed TCP stream in time.");
+    FinishClosingTCPStream(tcpStream->tcpStreamManager, tcpStream);
+}
+
+void HAPPlatformTCPStreamClose(HAPPlatformTCPStreamManagerRef tcpStreamManager, HAPPlatformTCPStreamRef tcpStream_) {
     HAPPrecondition(tcpStreamManager);
     HAPPrecondition(tcpStreamManager->tcpStreams);
     HAPPrecondition(tcpStream_);
-    HAPPrecondition(!(interests.hasBytesAvailable || interests.hasSpaceAvailable) || callback != NULL);
 
-    HAPPlatformTCPStream* tcpStream = (HAPPlatformTCPStream*) tcpStream_;
+    HAPPlatformTCPStream* tcpStream = GetTCPStream(tcpStreamManager, tcpStream_);
 
     HAPPrecondition(tcpStream->tcpStreamManager == tcpStreamManager);
     HAPPrecondition(tcpStream->fileDescriptor != -1);
     HAPPrecondition(tcpStream->fileHandle);
 
-    tcpStream->interests.hasBytesAvailable = interests.hasBytesAvailable;
-    tcpStream->interests.hasSpaceAvailable = interests.hasSpaceAvailable;
-    tcpStream->callback = callback;
-    tcpStream->context = context;
+    FlushSendBuffer(tcpStream);
+
+    if (tcpStream->receiveBuffer.timer) {
+        HAPPlatformTimerDeregister(tcpStream->receiveBuffer.timer);
+        tcpStream->receiveBuffer.timer = 0;
+    }
+
+    if (tcpStream != tcpStreamManager->evictedTCPStream) {
+        UnlinkActiveTCPStream(tcpStreamManager, tcpStream);
+    }
+
+    // Invalidate references. The HAP layer no longer receives events for this TCP stream.
+    tcpStream->generation++;
+    tcpStream->interests.hasBytesAvailable = false;
+    tcpStream->interests.hasSpaceAvailable = false;
+    tcpStream->callback = NULL;
+    tcpStream->context = NULL;
+
+    // Keep the socket open while buffered bytes are sent, so that a final response is not cut off.
+    if (tcpStream->sendBuffer.numBytes) {
+        HAPError err = HAPPlatformTimerRegister(
+                &tcpStream->sendBuffer.lingerTimer,
+                HAPPlatformClockGetCurrent() + kHAPPlatformTCPStream_MaxSendBufferLingerDuration,
+                HandleLingerTimerExpired,
+                tcpStream);
+        if (!err) {
+            HAPLogDebug(
+                    &logObject,
+                    "Deferring close of TCP stream 0x%lx until %lu buffered bytes have been sent.",
+                    (unsigned long) tcpStream_,
+                    (unsigned long) tcpStream->sendBuffer.numBytes);
+            tcpStreamManager->statistics.numDeferredCloses++;
+            tcpStream->sendBuffer.isClosePending = true;
+            UpdateTCPStreamFileHandleInterests(tcpStream);
+            return;
+        }
+        HAPAssert(err == kHAPError_OutOfResources);
+        HAPLogError(&logObject, "Not enough resources to defer closing TCP stream 0x%lx.", (unsigned long) tcpStream_);
+    }
+
+    FinishClosingTCPStream(tcpStreamManager, tcpStream);
+}
+
+/**
+ * Updates the file handle interests of a TCP stream.
+ *
+ * - While bytes in the send buffer are blocked, the socket is monitored for writability so that they can be sent.
+ *
+ * @param      tcpStream            TCP stream.
+ */
+static void UpdateTCPStreamFileHandleInterests(HAPPlatformTCPStream* tcpStream) {
+    HAPPrecondition(tcpStream);
+    HAPPrecondition(tcpStream->fileHandle);
 
     HAPPlatformFileHandleUpdateInterests(
             tcpStream->fileHandle,
-            (HAPPlatformFileHandleEvent) { .isReadyForReading = tcpStream->interests.hasBytesAvailable,
-                                           .isReadyForWriting = tcpStream->interests.hasSpaceAvailable,
-                                           .hasErrorConditionPending = false },
+            (HAPPlatformFileHandleEvent) {
+                    .isReadyForReading = tcpStream->interests.hasBytesAvailable,
+                    .isReadyForWriting = tcpStream->interests.hasSpaceAvailable || tcpStream->sendBuffer.isBlocked,
+                    .hasErrorConditionPending = false },
             HandleTCPStreamFileHandleCallback,
             tcpStream);
 }
 
-HAP_RESULT_USE_CHECK
-HAPError HAPPlatformTCPStreamRead(
+void HAPPlatformTCPStreamUpdateInterests(
         HAPPlatformTCPStreamManagerRef tcpStreamManager,
         HAPPlatformTCPStreamRef tcpStream_,
-        void* bytes,
-        size_t maxBytes,
-        size_t* numBytes) {
+        HAPPlatformTCPStreamEvent interests,
+        HAPPlatformTCPStreamEventCallback _Nullable callback,
+        void* _Nullable context) {
     HAPPrecondition(tcpStreamManager);
     HAPPrecondition(tcpStreamManager->tcpStreams);
     HAPPrecondition(tcpStream_);
-    HAPPrecondition(bytes);
-    HAPPrecondition(numBytes);
+    HAPPrecondition(!(interests.hasBytesAvailable || interests.hasSpaceAvailable) || callback != NULL);
 
-    HAPPlatformTCPStream* tcpStream = (HAPPlatformTCPStream*) tcpStream_;
+    HAPPlatformTCPStream* tcpStream = GetTCPStream(tcpStreamManager, tcpStream_);
 
     HAPPrecondition(tcpStream->tcpStreamManager == tcpStreamManager);
     HAPPrecondition(tcpStream->fileDescriptor != -1);
     HAPPrecondition(tcpStream->fileHandle);
 
-    ssize_t n;
-    do {
-        n = recv(tcpStream->fileDescriptor, bytes, maxBytes, 0);
-    } while ((n == -1) && (errno == EINTR));
-    if (n == -1) {
-        if (errno != EAGAIN && errno != EWOULDBLOCK) {
-            HAPPlatformLogPOSIXError(
-                    kHAPLogType_Default,
-                    "System call 'recv' on TCP stream socket failed.",
-                    errno,
-                    __func__,
-                    HAP_FILE,
-                    __LINE__);
-            *numBytes = 0;
+    tcpStream->interests.hasBytesAvailable = interests.hasBytesAvailable;
+    tcpStream->interests.hasSpaceAvailable = interests.hasSpaceAvailable;
+    tcpStream->callback = callback;
+    tcpStream->context = context;
+
+    UpdateTCPStreamFileHandleInterests(tcpStream);
+
+    ScheduleReceiveBufferEvent(tcpStream);
+}
+
+/**
+ * Receives bytes from a TCP stream socket.
+ *
+ * @param      tcpStream            TCP stream.
+ * @param[out] bytes                Buffer that will be filled with data.
+ * @param      maxBytes             Maximum number of bytes to read.
+ * @param[out] numBytes             Number of bytes read. 0 if the peer closed its output.
+ *
+ * @return kHAPError_None           If successful.
+ * @return kHAPError_Unknown        If an unknown error occurred while reading.
+ * @return kHAPError_Busy           If no data can be read at this time. Retry later.
+ */
+HAP_RESULT_USE_CHECK
+static HAPError ReceiveBytes(HAPPlatformTCPStream* tcpStream, void* bytes, size_t maxBytes, size_t* numBytes) {
+    HAPPrecondition(tcpStream);
+    HAPPrecondition(tcpStream->fileDescriptor != -1);
+    HAPPrecondition(bytes);
+    HAPPrecondition(numBytes);
+
+    ssize_t n;
+    do {
+        n = recv(tcpStream->fileDescriptor, bytes, maxBytes, 0);
+    } while ((n == -1) && (errno == EINTR));
+    int _errno = errno;
+    RecordTCPStreamReceive(tcpStream, n, _errno);
+    if (n == -1) {
+        if (_errno != EAGAIN && _errno != EWOULDBLOCK) {
+            HAPPlatformLogPOSIXError(
+                    kHAPLogType_Default,
+                    "System call 'recv' on TCP stream socket failed.",
+                    _errno,
+                    __func__,
+                    HAP_FILE,
+                    __LINE__);
+            *numBytes = 0;
             return kHAPError_Unknown;
         }
 
@@ -640,6 +1760,390 @@ HAPError HAPPlatformTCPStreamRead(
     return kHAPError_None;
 }
 
+/**
+ * Refills the empty receive buffer of a TCP stream with as many bytes as the socket has available.
+ *
+ * @param      tcpStream            TCP stream.
+ *
+ * @return kHAPError_None           If successful. The receive buffer holds data, or the end of stream was reached.
+ * @return kHAPError_Unknown        If an unknown error occurred while reading.
+ * @return kHAPError_Busy           If no data can be read at this time. Retry later.
+ */
+HAP_RESULT_USE_CHECK
+static HAPError FillReceiveBuffer(HAPPlatformTCPStream* tcpStream) {
+    HAPPrecondition(tcpStream);
+    HAPPrecondition(tcpStream->tcpStreamManager);
+    HAPPrecondition(tcpStream->receiveBuffer.bytes);
+    HAPPrecondition(!tcpStream->receiveBuffer.numBytes);
+    HAPPrecondition(!tcpStream->receiveBuffer.isEndOfStream);
+
+    HAPPlatformTCPStreamManagerRef tcpStreamManager = tcpStream->tcpStreamManager;
+
+    size_t numBytes;
+    HAPError err = ReceiveBytes(
+            tcpStream,
+            HAPNonnullVoid(tcpStream->receiveBuffer.bytes),
+            tcpStreamManager->receiveBufferSize,
+            &numBytes);
+    if (err) {
+        HAPAssert(err == kHAPError_Unknown || err == kHAPError_Busy);
+        return err;
+    }
+
+    tcpStreamManager->statistics.numReceiveBufferFills++;
+    tcpStream->receiveBuffer.offset = 0;
+    tcpStream->receiveBuffer.numBytes = numBytes;
+    tcpStream->receiveBuffer.isEndOfStream = numBytes == 0;
+    return kHAPError_None;
+}
+
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformTCPStreamRead(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager,
+        HAPPlatformTCPStreamRef tcpStream_,
+        void* bytes,
+        size_t maxBytes,
+        size_t* numBytes) {
+    HAPPrecondition(tcpStreamManager);
+    HAPPrecondition(tcpStreamManager->tcpStreams);
+    HAPPrecondition(tcpStream_);
+    HAPPrecondition(bytes);
+    HAPPrecondition(numBytes);
+
+    HAPPlatformTCPStream* tcpStream = GetTCPStream(tcpStreamManager, tcpStream_);
+
+    HAPPrecondition(tcpStream->tcpStreamManager == tcpStreamManager);
+    HAPPrecondition(tcpStream->fileDescriptor != -1);
+    HAPPrecondition(tcpStream->fileHandle);
+
+    HAPError err;
+
+    if (!tcpStream->receiveBuffer.bytes) {
+        return ReceiveBytes(tcpStream, bytes, maxBytes, numBytes);
+    }
+
+    if (!tcpStream->receiveBuffer.numBytes) {
+        if (tcpStream->receiveBuffer.isEndOfStream) {
+            *numBytes = 0;
+            return kHAPError_None;
+        }
+
+        // Large reads bypass the receive buffer to avoid copying the data twice.
+        if (maxBytes >= tcpStreamManager->receiveBufferSize) {
+            return ReceiveBytes(tcpStream, bytes, maxBytes, numBytes);
+        }
+
+        err = FillReceiveBuffer(tcpStream);
+        if (err) {
+            HAPAssert(err == kHAPError_Unknown || err == kHAPError_Busy);
+            *numBytes = 0;
+            return err;
+        }
+    } else {
+        tcpStreamManager->statistics.numReceiveBufferHits++;
+    }
+
+    size_t n = maxBytes < tcpStream->receiveBuffer.numBytes ? maxBytes : tcpStream->receiveBuffer.numBytes;
+    HAPRawBufferCopyBytes(bytes, &tcpStream->receiveBuffer.bytes[tcpStream->receiveBuffer.offset], n);
+    tcpStream->receiveBuffer.offset += n;
+    tcpStream->receiveBuffer.numBytes -= n;
+    *numBytes = n;
+    return kHAPError_None;
+}
+
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformTCPStreamPeek(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager,
+        HAPPlatformTCPStreamRef tcpStream_,
+        void* _Nullable* _Nonnull bytes,
+        size_t* numBytes) {
+    HAPPrecondition(tcpStreamManager);
+    HAPPrecondition(tcpStreamManager->tcpStreams);
+    HAPPrecondition(tcpStream_);
+    HAPPrecondition(bytes);
+    HAPPrecondition(numBytes);
+
+    HAPPlatformTCPStream* tcpStream = GetTCPStream(tcpStreamManager, tcpStream_);
+
+    HAPPrecondition(tcpStream->tcpStreamManager == tcpStreamManager);
+    HAPPrecondition(tcpStream->fileDescriptor != -1);
+    HAPPrecondition(tcpStream->fileHandle);
+    HAPPrecondition(tcpStream->receiveBuffer.bytes);
+
+    if (!tcpStream->receiveBuffer.numBytes && !tcpStream->receiveBuffer.isEndOfStream) {
+        HAPError err = FillReceiveBuffer(tcpStream);
+        if (err) {
+            HAPAssert(err == kHAPError_Unknown || err == kHAPError_Busy);
+            *bytes = NULL;
+            *numBytes = 0;
+            return err;
+        }
+    }
+
+    *bytes = &tcpStream->receiveBuffer.bytes[tcpStream->receiveBuffer.offset];
+    *numBytes = tcpStream->receiveBuffer.numBytes;
+    return kHAPError_None;
+}
+
+void HAPPlatformTCPStreamConsume(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager,
+        HAPPlatformTCPStreamRef tcpStream_,
+        size_t numBytes) {
+    HAPPrecondition(tcpStreamManager);
+    HAPPrecondition(tcpStreamManager->tcpStreams);
+    HAPPrecondition(tcpStream_);
+
+    HAPPlatformTCPStream* tcpStream = GetTCPStream(tcpStreamManager, tcpStream_);
+
+    HAPPrecondition(tcpStream->tcpStreamManager == tcpStreamManager);
+    HAPPrecondition(tcpStream->receiveBuffer.bytes);
+    HAPPrecondition(numBytes <= tcpStream->receiveBuffer.numBytes);
+
+    tcpStream->receiveBuffer.offset += numBytes;
+    tcpStream->receiveBuffer.numBytes -= numBytes;
+}
+
+/**
+ * Sends the contents of multiple buffers to a TCP stream socket in a single system call.
+ *
+ * @param      tcpStream            TCP stream.
+ * @param      iov                  Buffers to send.
+ * @param      numIov               Number of buffers.
+ * @param[out] numBytes             Total number of bytes sent.
+ *
+ * @return kHAPError_None           If successful.
+ * @return kHAPError_Unknown        If an unknown error occurred while writing.
+ * @return kHAPError_Busy           If no data can be written at this time. Retry later.
+ */
+HAP_RESULT_USE_CHECK
+static HAPError SendMessage(HAPPlatformTCPStream* tcpStream, struct iovec* iov, size_t numIov, size_t* numBytes) {
+    HAPPrecondition(tcpStream);
+    HAPPrecondition(tcpStream->fileDescriptor != -1);
+    HAPPrecondition(iov);
+    HAPPrecondition(numBytes);
+
+    size_t maxBytes = 0;
+    for (size_t i = 0; i < numIov; i++) {
+        maxBytes += iov[i].iov_len;
+    }
+
+    struct msghdr message;
+    HAPRawBufferZero(&message, sizeof message);
+    message.msg_iov = iov;
+    message.msg_iovlen = (int) numIov;
+
+    ssize_t n;
+    do {
+        n = sendmsg(tcpStream->fileDescriptor, &message, 0);
+    } while ((n == -1) && (errno == EINTR));
+    int _errno = errno;
+    RecordTCPStreamSend(tcpStream, n, _errno);
+    if (n == -1) {
+        if ((_errno != EAGAIN) && (_errno != EWOULDBLOCK)) {
+            HAPPlatformLogPOSIXError(
+                    kHAPLogType_Default,
+                    "System call 'sendmsg' on TCP stream socket failed.",
+                    _errno,
+                    __func__,
+                    HAP_FILE,
+                    __LINE__);
+            *numBytes = 0;
+            return kHAPError_Unknown;
+        }
+
+        HAPLogDebug(&logObject, "System call 'sendmsg' on TCP stream socket is busy.");
+        *numBytes = 0;
+        return kHAPError_Busy;
+    }
+
+    HAPAssert(n >= 0);
+    HAPAssert((size_t) n <= maxBytes);
+    *numBytes = (size_t) n;
+    return kHAPError_None;
+}
+
+/**
+ * Discards bytes from the front of the send buffer of a TCP stream after they have been sent.
+ *
+ * - If bytes remain, the send buffer is blocked until the socket becomes writable.
+ *
+ * @param      tcpStream            TCP stream.
+ * @param      numBytes             Number of bytes that have been sent.
+ */
+static void ConsumeSendBuffer(HAPPlatformTCPStream* tcpStream, size_t numBytes) {
+    HAPPrecondition(tcpStream);
+    HAPPrecondition(tcpStream->sendBuffer.bytes);
+    HAPPrecondition(numBytes <= tcpStream->sendBuffer.numBytes);
+
+    tcpStream->sendBuffer.numBytes -= numBytes;
+    if (numBytes && tcpStream->sendBuffer.numBytes) {
+        memmove(tcpStream->sendBuffer.bytes,
+                &tcpStream->sendBuffer.bytes[numBytes],
+                tcpStream->sendBuffer.numBytes);
+    }
+
+    bool isBlocked = tcpStream->sendBuffer.numBytes != 0;
+    if (isBlocked != tcpStream->sendBuffer.isBlocked) {
+        tcpStream->sendBuffer.isBlocked = isBlocked;
+        UpdateTCPStreamFileHandleInterests(tcpStream);
+    }
+}
+
+/**
+ * Sends the bytes in the send buffer of a TCP stream.
+ *
+ * - Bytes that the socket cannot take are kept and sent once the socket becomes writable.
+ * - If sending fails, the buffered bytes are discarded. The error surfaces on the next read or write.
+ *
+ * @param      tcpStream            TCP stream.
+ */
+static void FlushSendBuffer(HAPPlatformTCPStream* tcpStream) {
+    HAPPrecondition(tcpStream);
+    HAPPrecondition(tcpStream->tcpStreamManager);
+
+    if (!tcpStream->sendBuffer.numBytes) {
+        return;
+    }
+
+    struct iovec iov = { .iov_base = tcpStream->sendBuffer.bytes, .iov_len = tcpStream->sendBuffer.numBytes };
+    size_t numBytes;
+    HAPError err = SendMessage(tcpStream, &iov, 1, &numBytes);
+    tcpStream->tcpStreamManager->statistics.numSendBufferFlushes++;
+    if (err == kHAPError_Unknown) {
+        HAPLog(&logObject,
+               "Discarding %lu buffered bytes of TCP stream.",
+               (unsigned long) tcpStream->sendBuffer.numBytes);
+        numBytes = tcpStream->sendBuffer.numBytes;
+    }
+    ConsumeSendBuffer(tcpStream, numBytes);
+}
+
+/**
+ * Sends the bytes in all send buffers that are not blocked. Invoked at the end of each run loop iteration.
+ *
+ * @param      context              TCP stream manager.
+ */
+static void HandleFlushObserver(void* _Nullable context) {
+    HAPAssert(context);
+
+    HAPPlatformTCPStreamManagerRef tcpStreamManager = context;
+    HAPAssert(tcpStreamManager->tcpStreams);
+
+    if (!tcpStreamManager->hasPendingSendBuffers) {
+        return;
+    }
+    tcpStreamManager->hasPendingSendBuffers = false;
+
+    for (size_t i = 0; i < tcpStreamManager->maxTCPStreams; i++) {
+        HAPPlatformTCPStream* tcpStream = &tcpStreamManager->tcpStreams[i];
+        if (tcpStream->fileDescriptor != -1 && !tcpStream->sendBuffer.isBlocked) {
+            FlushSendBuffer(tcpStream);
+        }
+    }
+}
+
+/**
+ * Writes the contents of multiple buffers to a TCP stream.
+ *
+ * - If the bytes fit into the send buffer, they are copied and sent at the end of the current run loop iteration.
+ * - Otherwise, bytes that are already buffered are sent first, in the same system call. Bytes of the buffers are
+ *   only reported as written once all previously buffered bytes have been sent.
+ *
+ * @param      tcpStream            TCP stream.
+ * @param      buffers              Buffers to write.
+ * @param      numBuffers           Number of buffers.
+ * @param[out] numBytes             Total number of bytes written.
+ *
+ * @return kHAPError_None           If successful.
+ * @return kHAPError_Unknown        If an unknown error occurred while writing.
+ * @return kHAPError_Busy           If no data can be written at this time. Retry later.
+ */
+HAP_RESULT_USE_CHECK
+static HAPError WriteBuffers(
+        HAPPlatformTCPStream* tcpStream,
+        const HAPPlatformTCPStreamBuffer* buffers,
+        size_t numBuffers,
+        size_t* numBytes) {
+    HAPPrecondition(tcpStream);
+    HAPPrecondition(tcpStream->tcpStreamManager);
+    HAPPrecondition(buffers);
+    HAPPrecondition(numBytes);
+
+    HAPPlatformTCPStreamManagerRef tcpStreamManager = tcpStream->tcpStreamManager;
+
+    if (numBuffers > kHAPPlatformTCPStream_MaxWriteBuffers) {
+        numBuffers = kHAPPlatformTCPStream_MaxWriteBuffers;
+    }
+
+    size_t maxBytes = 0;
+    for (size_t i = 0; i < numBuffers; i++) {
+        HAPPrecondition(buffers[i].bytes || !buffers[i].numBytes);
+        maxBytes += buffers[i].numBytes;
+    }
+
+    size_t numBufferedBytes = tcpStream->sendBuffer.numBytes;
+    if (tcpStream->sendBuffer.bytes && !tcpStream->sendBuffer.isBlocked &&
+        maxBytes <= tcpStreamManager->sendBufferSize - numBufferedBytes) {
+        for (size_t i = 0; i < numBuffers; i++) {
+            if (buffers[i].numBytes) {
+                HAPRawBufferCopyBytes(
+                        &tcpStream->sendBuffer.bytes[tcpStream->sendBuffer.numBytes],
+                        buffers[i].bytes,
+                        buffers[i].numBytes);
+                tcpStream->sendBuffer.numBytes += buffers[i].numBytes;
+            }
+        }
+        tcpStreamManager->statistics.numBufferedWrites++;
+
+        // The run loop is created after the TCP stream manager, so the observer is added on first use.
+        tcpStreamManager->hasPendingSendBuffers = true;
+        if (!tcpStreamManager->isFlushObserverAdded) {
+            HAPPlatformRunLoopAddObserver(&tcpStreamManager->flushObserver, HandleFlushObserver, tcpStreamManager);
+            tcpStreamManager->isFlushObserverAdded = true;
+        }
+
+        *numBytes = maxBytes;
+        return kHAPError_None;
+    }
+
+    struct iovec iov[kHAPPlatformTCPStream_MaxWriteBuffers + 1];
+    size_t numIov = 0;
+    if (numBufferedBytes) {
+        iov[numIov].iov_base = tcpStream->sendBuffer.bytes;
+        iov[numIov].iov_len = numBufferedBytes;
+        numIov++;
+    }
+    for (size_t i = 0; i < numBuffers; i++) {
+        iov[numIov].iov_base = (void*) (uintptr_t) buffers[i].bytes;
+        iov[numIov].iov_len = buffers[i].numBytes;
+        numIov++;
+    }
+
+    size_t numSentBytes;
+    HAPError err = SendMessage(tcpStream, iov, numIov, &numSentBytes);
+    if (err) {
+        if (err == kHAPError_Busy && numBufferedBytes) {
+            ConsumeSendBuffer(tcpStream, 0);
+        }
+        *numBytes = 0;
+        return err;
+    }
+
+    if (numBufferedBytes) {
+        size_t numSentBufferedBytes = numSentBytes < numBufferedBytes ? numSentBytes : numBufferedBytes;
+        ConsumeSendBuffer(tcpStream, numSentBufferedBytes);
+        numSentBytes -= numSentBufferedBytes;
+        if (tcpStream->sendBuffer.numBytes) {
+            HAPAssert(!numSentBytes);
+            *numBytes = 0;
+            return kHAPError_Busy;
+        }
+    }
+
+    *numBytes = numSentBytes;
+    return kHAPError_None;
+}
+
 HAP_RESULT_USE_CHECK
 HAPError HAPPlatformTCPStreamWrite(
         HAPPlatformTCPStreamManagerRef tcpStreamManager,
@@ -653,22 +2157,29 @@ HAPError HAPPlatformTCPStreamWrite(
     HAPPrecondition(bytes);
     HAPPrecondition(numBytes);
 
-    HAPPlatformTCPStream* tcpStream = (HAPPlatformTCPStream*) tcpStream_;
+    HAPPlatformTCPStream* tcpStream = GetTCPStream(tcpStreamManager, tcpStream_);
 
     HAPPrecondition(tcpStream->tcpStreamManager == tcpStreamManager);
     HAPPrecondition(tcpStream->fileDescriptor != -1);
     HAPPrecondition(tcpStream->fileHandle);
 
+    if (tcpStream->sendBuffer.bytes) {
+        HAPPlatformTCPStreamBuffer buffer = { .bytes = bytes, .numBytes = maxBytes };
+        return WriteBuffers(tcpStream, &buffer, 1, numBytes);
+    }
+
     ssize_t n;
     do {
         n = send(tcpStream->fileDescriptor, bytes, maxBytes, 0);
     } while ((n == -1) && (errno == EINTR));
+    int _errno = errno;
+    RecordTCPStreamSend(tcpStream, n, _errno);
     if (n == -1) {
-        if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+        if ((_errno != EAGAIN) && (_errno != EWOULDBLOCK)) {
             HAPPlatformLogPOSIXError(
                     kHAPLogType_Default,
                     "System call 'send' on TCP stream socket failed.",
-                    errno,
+                    _errno,
                     __func__,
                     HAP_FILE,
                     __LINE__);
@@ -687,6 +2198,119 @@ HAPError HAPPlatformTCPStreamWrite(
     return kHAPError_None;
 }
 
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformTCPStreamWritev(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager,
+        HAPPlatformTCPStreamRef tcpStream_,
+        const HAPPlatformTCPStreamBuffer* buffers,
+        size_t numBuffers,
+        size_t* numBytes) {
+    HAPPrecondition(tcpStreamManager);
+    HAPPrecondition(tcpStreamManager->tcpStreams);
+    HAPPrecondition(tcpStream_);
+    HAPPrecondition(buffers);
+    HAPPrecondition(numBytes);
+
+    HAPPlatformTCPStream* tcpStream = GetTCPStream(tcpStreamManager, tcpStream_);
+
+    HAPPrecondition(tcpStream->tcpStreamManager == tcpStreamManager);
+    HAPPrecondition(tcpStream->fileDescriptor != -1);
+    HAPPrecondition(tcpStream->fileHandle);
+
+    return WriteBuffers(tcpStream, buffers, numBuffers, numBytes);
+}
+
+static void HandleEvictionTimerExpired(HAPPlatformTimerRef timer, void* _Nullable context) {
+    HAPAssert(timer);
+    HAPAssert(context);
+
+    HAPPlatformTCPStreamManagerRef tcpStreamManager = context;
+    HAPAssert(tcpStreamManager->evictionTimer == timer);
+    tcpStreamManager->evictionTimer = 0;
+
+    // Resume monitoring for pending connections. If one is still pending, eviction is retried.
+    HAPAssert(tcpStreamManager->numTCPStreamListeners);
+    if (!tcpStreamManager->evictedTCPStream) {
+        UpdateTCPStreamListenerInterests(tcpStreamManager, true);
+    }
+}
+
+/**
+ * Shuts down the least recently active idle TCP stream to make room for a pending connection.
+ *
+ * - The evicted TCP stream is reported as closed by the peer, and its slot becomes available once the HAP layer
+ *   closes it. Until then, or until another TCP stream becomes eligible for eviction, the listener is suspended.
+ *
+ * @param      tcpStreamManager     TCP stream manager.
+ */
+static void EvictTCPStream(HAPPlatformTCPStreamManagerRef tcpStreamManager) {
+    HAPPrecondition(tcpStreamManager);
+    HAPPrecondition(tcpStreamManager->evictionIdleTimeout);
+    HAPPrecondition(tcpStreamManager->numTCPStreams == tcpStreamManager->maxTCPStreams);
+
+    HAPTime now = HAPPlatformClockGetCurrentCoarse();
+    if (!tcpStreamManager->admissionStartTime) {
+        tcpStreamManager->admissionStartTime = now;
+        tcpStreamManager->statistics.numDelayedAdmissions++;
+    }
+
+    UpdateTCPStreamListenerInterests(tcpStreamManager, false);
+    if (tcpStreamManager->evictedTCPStream) {
+        // Waiting for the HAP layer to close the previously evicted TCP stream.
+        return;
+    }
+
+    HAPPlatformTCPStream* _Nullable tcpStream = tcpStreamManager->leastRecentlyActiveTCPStream;
+    while (tcpStream && now - tcpStream->lastActivityTime >= tcpStreamManager->evictionIdleTimeout) {
+        HAPPlatformTCPStreamRef tcpStream_ = GetTCPStreamRef(tcpStreamManager, tcpStream);
+        HAPTime idleDuration = now - tcpStream->lastActivityTime;
+        if (tcpStreamManager->shouldEvictTCPStream &&
+            !tcpStreamManager->shouldEvictTCPStream(
+                    tcpStreamManager, tcpStream_, idleDuration, tcpStreamManager->shouldEvictTCPStreamContext)) {
+            tcpStreamManager->statistics.numVetoedEvictions++;
+            tcpStream = tcpStream->moreRecentlyActiveTCPStream;
+            continue;
+        }
+
+        HAPLogInfo(
+                &logObject,
+                "Evicting TCP stream 0x%lx (idle for %llu ms) to admit a new connection.",
+                (unsigned long) tcpStream_,
+                (unsigned long long) idleDuration);
+        UnlinkActiveTCPStream(tcpStreamManager, tcpStream);
+        EndTCPStreamHandshake(tcpStreamManager, tcpStream);
+        tcpStreamManager->evictedTCPStream = tcpStream;
+        tcpStreamManager->statistics.numEvictedTCPStreams++;
+
+        HAPLogDebug(&logObject, "shutdown(%d, SHUT_RDWR);", tcpStream->fileDescriptor);
+        int e = shutdown(tcpStream->fileDescriptor, SHUT_RDWR);
+        if (e != 0) {
+            int _errno = errno;
+            HAPAssert(e == -1);
+            HAPPlatformLogPOSIXError(
+                    kHAPLogType_Debug,
+                    "System call 'shutdown' on TCP stream socket failed.",
+                    _errno,
+                    __func__,
+                    HAP_FILE,
+                    __LINE__);
+        }
+        return;
+    }
+
+    // No TCP stream can be evicted yet. Retry when the next TCP stream reaches the idle timeout.
+    if (!tcpStreamManager->evictionTimer) {
+        HAPTime deadline = tcpStream ? tcpStream->lastActivityTime + tcpStreamManager->evictionIdleTimeout :
+                                       now + tcpStreamManager->evictionIdleTimeout;
+        HAPError err = HAPPlatformTimerRegister(
+                &tcpStreamManager->evictionTimer, deadline, HandleEvictionTimerExpired, tcpStreamManager);
+        if (err) {
+            HAPAssert(err == kHAPError_OutOfResources);
+            HAPLogError(&logObject, "Not enough resources to schedule TCP stream eviction.");
+        }
+    }
+}
+
 static void HandleTCPStreamListenerFileHandleCallback(
         HAPPlatformFileHandleRef fileHandle,
         HAPPlatformFileHandleEvent fileHandleEvents,
@@ -703,7 +2327,52 @@ static void HandleTCPStreamListenerFileHandleCallback(
 
     HAPAssert(fileHandleEvents.isReadyForReading);
 
-    listener->callback(listener->tcpStreamManager, listener->context);
+    HAPPlatformTCPStreamManagerRef tcpStreamManager = listener->tcpStreamManager;
+
+    if (tcpStreamManager->numTCPStreams == tcpStreamManager->maxTCPStreams) {
+        HAPAssert(tcpStreamManager->evictionIdleTimeout);
+        EvictTCPStream(tcpStreamManager);
+        return;
+    }
+
+    tcpStreamManager->statistics.numAcceptBatches++;
+
+    // Drain the accept queue up to the number of free TCP streams. The listener callback accepts at most one TCP
+    // stream per invocation, so it is invoked until accepting reports that no more connections are pending.
+    size_t numAccepted = 0;
+    size_t numRejected = 0;
+    while (tcpStreamManager->numTCPStreams < tcpStreamManager->maxTCPStreams) {
+        size_t numAcceptAttempts = tcpStreamManager->numAcceptAttempts;
+        tcpStreamManager->activeTCPStreamListener = listener;
+        listener->callback(tcpStreamManager, listener->context);
+        tcpStreamManager->activeTCPStreamListener = NULL;
+        if (tcpStreamManager->numAcceptAttempts == numAcceptAttempts) {
+            // Callback did not accept a TCP stream.
+            break;
+        }
+        if (tcpStreamManager->lastAcceptError == kHAPError_Busy) {
+            // No more pending connections.
+            break;
+        }
+        if (tcpStreamManager->lastAcceptError) {
+            numRejected++;
+            break;
+        }
+        numAccepted++;
+        if (listener->fileDescriptor == -1) {
+            // Listener has been closed.
+            break;
+        }
+    }
+
+    if (numAccepted > tcpStreamManager->statistics.maxAcceptBatchSize) {
+        tcpStreamManager->statistics.maxAcceptBatchSize = numAccepted;
+    }
+    HAPLogDebug(
+            &logObject,
+            "Accepted %lu TCP streams (%lu rejected).",
+            (unsigned long) numAccepted,
+            (unsigned long) numRejected);
 }
 
 static void HandleTCPStreamFileHandleCallback(
@@ -721,13 +2390,84 @@ static void HandleTCPStreamFileHandleCallback(
 
     HAPAssert(fileHandleEvents.isReadyForReading || fileHandleEvents.isReadyForWriting);
 
+    // Blocked bytes in the send buffer are sent before the TCP stream reports that more bytes can be written.
+    if (fileHandleEvents.isReadyForWriting && tcpStream->sendBuffer.isBlocked) {
+        FlushSendBuffer(tcpStream);
+    }
+
+    // Complete a deferred shutdown or close once the send buffer has been sent.
+    if (tcpStream->sendBuffer.isClosePending) {
+        if (!tcpStream->sendBuffer.numBytes) {
+            FinishClosingTCPStream(tcpStream->tcpStreamManager, tcpStream);
+        }
+        return;
+    }
+    if (tcpStream->sendBuffer.isOutputClosePending && !tcpStream->sendBuffer.numBytes) {
+        ShutdownTCPStreamOutput(tcpStream);
+    }
+
     HAPPlatformTCPStreamEvent tcpStreamEvents;
     tcpStreamEvents.hasBytesAvailable = tcpStream->interests.hasBytesAvailable && fileHandleEvents.isReadyForReading;
-    tcpStreamEvents.hasSpaceAvailable = tcpStream->interests.hasSpaceAvailable && fileHandleEvents.isReadyForWriting;
+    tcpStreamEvents.hasSpaceAvailable = tcpStream->interests.hasSpaceAvailable && fileHandleEvents.isReadyForWriting &&
+                                        !tcpStream->sendBuffer.isBlocked;
 
     if (tcpStreamEvents.hasBytesAvailable || tcpStreamEvents.hasSpaceAvailable) {
         HAPAssert(tcpStream->callback);
-        HAPPlatformTCPStreamRef tcpStream_ = (HAPPlatformTCPStreamRef) tcpStream;
+        HAPPlatformTCPStreamRef tcpStream_ = GetTCPStreamRef(tcpStream->tcpStreamManager, tcpStream);
         tcpStream->callback(tcpStream->tcpStreamManager, tcpStream_, tcpStreamEvents, tcpStream->context);
+
+        // Bytes that were read ahead no longer make the socket readable, so they are reported separately.
+        if (tcpStream->generation == (uint16_t)(tcpStream_ >> 16)) {
+            ScheduleReceiveBufferEvent(tcpStream);
+        }
+    }
+}
+
+static void HandleReceiveBufferTimerExpired(HAPPlatformTimerRef timer, void* _Nullable context) {
+    HAPAssert(timer);
+    HAPAssert(context);
+
+    HAPPlatformTCPStream* tcpStream = (HAPPlatformTCPStream*) context;
+
+    HAPAssert(tcpStream->tcpStreamManager);
+    HAPAssert(tcpStream->receiveBuffer.timer == timer);
+    tcpStream->receiveBuffer.timer = 0;
+
+    if (!tcpStream->interests.hasBytesAvailable ||
+        (!tcpStream->receiveBuffer.numBytes && !tcpStream->receiveBuffer.isEndOfStream)) {
+        return;
+    }
+
+    HAPAssert(tcpStream->callback);
+    HAPPlatformTCPStreamRef tcpStream_ = GetTCPStreamRef(tcpStream->tcpStreamManager, tcpStream);
+    tcpStream->callback(
+            tcpStream->tcpStreamManager,
+            tcpStream_,
+            (HAPPlatformTCPStreamEvent) { .hasBytesAvailable = true, .hasSpaceAvailable = false },
+            tcpStream->context);
+
+    if (tcpStream->generation == (uint16_t)(tcpStream_ >> 16)) {
+        ScheduleReceiveBufferEvent(tcpStream);
+    }
+}
+
+/**
+ * Schedules a bytes available event if the receive buffer of a TCP stream holds data the HAP layer is waiting for.
+ *
+ * @param      tcpStream            TCP stream.
+ */
+static void ScheduleReceiveBufferEvent(HAPPlatformTCPStream* tcpStream) {
+    HAPPrecondition(tcpStream);
+
+    if (!tcpStream->tcpStreamManager || tcpStream->receiveBuffer.timer || !tcpStream->interests.hasBytesAvailable ||
+        (!tcpStream->receiveBuffer.numBytes && !tcpStream->receiveBuffer.isEndOfStream)) {
+        return;
+    }
+
+    HAPError err = HAPPlatformTimerRegister(
+            &tcpStream->receiveBuffer.timer, 0, HandleReceiveBufferTimerExpired, tcpStream);
+    if (err) {
+        HAPAssert(err == kHAPError_OutOfResources);
+        HAPLogError(&logObject, "Not enough resources to report buffered TCP stream data.");
     }
 }
@@ -0,0 +1,126 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmark of HAPPlatformClockGetCurrentCoarse against HAPPlatformClockGetCurrent and
+// HAPPlatformClockGetCurrentMicroseconds. Reports the cost per call of each clock. Checks that the coarse clock returns
+// the time of the most recent call to HAPPlatformClockGetCurrent, that it is not refreshed while a run loop callback
+// runs, and that the microsecond clock advances at the same rate as the millisecond clock.
+
+#include <stdio.h>
+#include <time.h>
+
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformClock+Init.h"
+#include "HAPPlatformKeyValueStore+Init.h"
+#include "HAPPlatformRunLoop+Init.h"
+
+/** Number of calls that are measured for each clock. */
+#define kNumCalls ((size_t) 1000000)
+
+/** Time that the timer callback spends between reading the coarse clock and the current time, in microseconds. */
+#define kCallbackDuration ((uint64_t) 5000)
+
+/** Time over which the microsecond clock is compared with the millisecond clock, in milliseconds. */
+#define kComparisonDuration ((HAPTime) 50)
+
+static volatile uint64_t sink;
+
+static uint64_t GetNanoseconds(void) {
+    struct timespec now;
+    int e = clock_gettime(CLOCK_MONOTONIC, &now);
+    HAPAssert(!e);
+    return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
+static double MeasureGetCurrent(void) {
+    uint64_t startTime = GetNanoseconds();
+    for (size_t i = 0; i < kNumCalls; i++) {
+        sink += HAPPlatformClockGetCurrent();
+    }
+    return (double) (GetNanoseconds() - startTime) / kNumCalls;
+}
+
+static double MeasureGetCurrentCoarse(void) {
+    uint64_t startTime = GetNanoseconds();
+    for (size_t i = 0; i < kNumCalls; i++) {
+        sink += HAPPlatformClockGetCurrentCoarse();
+    }
+    return (double) (GetNanoseconds() - startTime) / kNumCalls;
+}
+
+static double MeasureGetCurrentMicroseconds(void) {
+    uint64_t startTime = GetNanoseconds();
+    for (size_t i = 0; i < kNumCalls; i++) {
+        sink += HAPPlatformClockGetCurrentMicroseconds();
+    }
+    return (double) (GetNanoseconds() - startTime) / kNumCalls;
+}
+
+static void HandleTimerExpired(HAPPlatformTimerRef timer HAP_UNUSED, void* _Nullable context HAP_UNUSED) {
+    // The run loop read the clock before invoking the callback. Until the next call to HAPPlatformClockGetCurrent,
+    // the coarse clock lags behind by the time spent in the callback.
+    HAPTime coarseNow = HAPPlatformClockGetCurrentCoarse();
+    uint64_t startTime = HAPPlatformClockGetCurrentMicroseconds();
+    while (HAPPlatformClockGetCurrentMicroseconds() - startTime < kCallbackDuration) {
+        HAPAssert(HAPPlatformClockGetCurrentCoarse() == coarseNow);
+    }
+    HAPTime now = HAPPlatformClockGetCurrent();
+    printf("Coarse clock lag after a %llu us callback: %llu ms\n",
+           (unsigned long long) kCallbackDuration,
+           (unsigned long long) (now - coarseNow));
+    HAPAssert(now - coarseNow >= kCallbackDuration / 1000 - 1);
+    HAPAssert(HAPPlatformClockGetCurrentCoarse() == now);
+    HAPPlatformRunLoopStop();
+}
+
+int main(void) {
+    // The run loop only requires a key-value store to be present.
+    static HAPPlatformKeyValueStore keyValueStore;
+    HAPPlatformRunLoopCreate(&(const HAPPlatformRunLoopOptions) { .keyValueStore = &keyValueStore });
+
+    // The coarse clock returns the time of the most recent call to HAPPlatformClockGetCurrent.
+    HAPTime now = HAPPlatformClockGetCurrent();
+    HAPAssert(HAPPlatformClockGetCurrentCoarse() == now);
+
+    printf("%-40s  %9s\n", "Clock", "ns/call");
+    printf("%-40s  %9.1f\n", "HAPPlatformClockGetCurrent", MeasureGetCurrent());
+    printf("%-40s  %9.1f\n", "HAPPlatformClockGetCurrentCoarse", MeasureGetCurrentCoarse());
+    printf("%-40s  %9.1f\n", "HAPPlatformClockGetCurrentMicroseconds", MeasureGetCurrentMicroseconds());
+
+    // The microsecond clock advances at the same rate as the millisecond clock.
+    HAPTime startTime = HAPPlatformClockGetCurrent();
+    uint64_t startMicroseconds = HAPPlatformClockGetCurrentMicroseconds();
+    while (HAPPlatformClockGetCurrent() - startTime < kComparisonDuration) {
+    }
+    uint64_t elapsedMicroseconds = HAPPlatformClockGetCurrentMicroseconds() - startMicroseconds;
+    HAPTime elapsed = HAPPlatformClockGetCurrent() - startTime;
+    printf("Elapsed: %llu ms, %llu us\n", (unsigned long long) elapsed, (unsigned long long) elapsedMicroseconds);
+    HAPAssert(elapsedMicroseconds + 2000 >= elapsed * 1000);
+    HAPAssert(elapsedMicroseconds <= elapsed * 1000 + 2000);
+
+    HAPPlatformTimerRef timer;
+    HAPError err = HAPPlatformTimerRegister(&timer, HAPPlatformClockGetCurrent() + 1, HandleTimerExpired, NULL);
+    HAPAssert(!err);
+    HAPPlatformRunLoopRun();
+    fflush(stdout);
+
+    HAPPlatformRunLoopRelease();
+    return 0;
+}
@@ -0,0 +1,462 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks of the NVS backend of the key-value store against the in-memory NVS stand-in, with simulated flash
+// access times. Each benchmark compares a configuration with and without one of the caches of the key-value store.
+
+#include <stdio.h>
+#include <time.h>
+
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformClock+Init.h"
+#include "HAPPlatformKeyValueStore+Init.h"
+#include "HAPPlatformRunLoop+Init.h"
+#include "NVSHost.h"
+
+/**
+ * Simulated flash access times, in the order of magnitude of an ESP32.
+ */
+static const NVSHostLatencies flashLatencies = { .open = 50, .read = 100, .write = 500, .iterate = 20 };
+
+static uint64_t GetMicroseconds(void) {
+    struct timespec now;
+    int e = clock_gettime(CLOCK_MONOTONIC, &now);
+    HAPAssert(!e);
+    return (uint64_t) now.tv_sec * 1000000 + (uint64_t) now.tv_nsec / 1000;
+}
+
+static void HandleStopTimerExpired(HAPPlatformTimerRef timer HAP_UNUSED, void* _Nullable context HAP_UNUSED) {
+    HAPPlatformRunLoopStop();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Write-back: accessory state that changes often, e.g., while a brightness slider is dragged.
+
+/** Number of state changes. */
+#define kNumStateChanges ((uint32_t) 200)
+
+/** Number of keys that hold accessory state. */
+#define kNumStateKeys ((uint32_t) 4)
+
+/** Time between state changes. */
+#define kStateChangeInterval ((HAPTime) 2)
+
+typedef struct {
+    HAPPlatformKeyValueStore keyValueStore;
+    uint32_t numStateChanges;
+    uint64_t setMicroseconds;
+} WriteBackBenchmark;
+
+static void HandleStateChangeTimerExpired(HAPPlatformTimerRef timer_ HAP_UNUSED, void* _Nullable context) {
+    HAPPrecondition(context);
+    WriteBackBenchmark* benchmark = context;
+
+    uint32_t value = benchmark->numStateChanges;
+    uint64_t startTime = GetMicroseconds();
+    HAPError err = HAPPlatformKeyValueStoreSet(
+            &benchmark->keyValueStore,
+            0x00,
+            (HAPPlatformKeyValueStoreKey)(value % kNumStateKeys),
+            &value,
+            sizeof value);
+    benchmark->setMicroseconds += GetMicroseconds() - startTime;
+    HAPAssert(!err);
+
+    HAPPlatformTimerRef timer;
+    if (++benchmark->numStateChanges < kNumStateChanges) {
+        err = HAPPlatformTimerRegister(
+                &timer, HAPPlatformClockGetCurrent() + kStateChangeInterval, HandleStateChangeTimerExpired, benchmark);
+    } else {
+        err = HAPPlatformTimerRegister(&timer, HAPPlatformClockGetCurrent(), HandleStopTimerExpired, NULL);
+    }
+    HAPAssert(!err);
+}
+
+/**
+ * Applies state changes to a key-value store, and checks that the last value of each key is persisted.
+ *
+ * @param      maxWriteBackItems    Number of pending writes that are held in RAM.
+ *
+ * @return Number of values that were written to flash.
+ */
+static size_t MeasureWriteBack(size_t maxWriteBackItems) {
+    HAPError err;
+
+    NVSHostReset();
+    NVSHostSetLatencies(&flashLatencies);
+    static WriteBackBenchmark benchmark;
+    HAPRawBufferZero(&benchmark, sizeof benchmark);
+    HAPPlatformKeyValueStoreCreate(
+            &benchmark.keyValueStore,
+            &(const HAPPlatformKeyValueStoreOptions) { .part_name = "nvs",
+                                                       .namespace_prefix = "hap",
+                                                       .maxWriteBackItems = maxWriteBackItems,
+                                                       .writeBackDelay = 100 });
+
+    HAPPlatformTimerRef timer;
+    err = HAPPlatformTimerRegister(&timer, HAPPlatformClockGetCurrent(), HandleStateChangeTimerExpired, &benchmark);
+    HAPAssert(!err);
+    HAPPlatformRunLoopRun();
+    err = HAPPlatformKeyValueStoreFlush(&benchmark.keyValueStore);
+    HAPAssert(!err);
+
+    HAPPlatformKeyValueStoreStatistics statistics;
+    HAPPlatformKeyValueStoreGetStatistics(&benchmark.keyValueStore, &statistics);
+    HAPPlatformKeyValueStoreRelease(&benchmark.keyValueStore);
+
+    NVSHostStatistics nvsStatistics;
+    NVSHostGetStatistics(&nvsStatistics);
+    printf("%10zu  %6zu  %12zu  %7zu  %13.1f\n",
+           maxWriteBackItems,
+           statistics.numSets,
+           nvsStatistics.numWrites,
+           nvsStatistics.numCommits,
+           (double) benchmark.setMicroseconds / kNumStateChanges);
+    HAPAssert(statistics.numFlashWrites == nvsStatistics.numWrites);
+
+    // Check that the last values were persisted.
+    HAPPlatformKeyValueStore keyValueStore;
+    HAPPlatformKeyValueStoreCreate(
+            &keyValueStore, &(const HAPPlatformKeyValueStoreOptions) { .part_name = "nvs", .namespace_prefix = "hap" });
+    for (uint32_t i = 0; i < kNumStateKeys; i++) {
+        uint32_t value;
+        size_t numBytes;
+        bool found;
+        err = HAPPlatformKeyValueStoreGet(
+                &keyValueStore, 0x00, (HAPPlatformKeyValueStoreKey) i, &value, sizeof value, &numBytes, &found);
+        HAPAssert(!err && found && numBytes == sizeof value);
+        HAPAssert(value == kNumStateChanges - kNumStateKeys + i);
+    }
+    HAPPlatformKeyValueStoreRelease(&keyValueStore);
+
+    return nvsStatistics.numWrites;
+}
+
+static void BenchmarkWriteBack(void) {
+    printf("Write-back of %lu state changes to %lu keys, every %lu ms:\n",
+           (unsigned long) kNumStateChanges,
+           (unsigned long) kNumStateKeys,
+           (unsigned long) kStateChangeInterval);
+    printf("%10s  %6s  %12s  %7s  %13s\n", "Items", "Sets", "Flash writes", "Commits", "Set time (us)");
+    size_t numWriteThroughWrites = MeasureWriteBack(0);
+    size_t numWriteBackWrites = MeasureWriteBack(8);
+    printf("Flash writes saved: %zu of %zu\n\n", numWriteThroughWrites - numWriteBackWrites, numWriteThroughWrites);
+    HAPAssert(numWriteBackWrites * 4 < numWriteThroughWrites);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Handle cache: gets of a few domains keep their NVS namespaces open, gets that cycle through more domains than
+// kHAPPlatformKeyValueStore_MaxOpenNamespaces open a namespace every time, like before namespaces were kept open.
+
+/** Number of gets per measurement. */
+#define kNumGets ((size_t) 2000)
+
+/**
+ * Measures gets that cycle through a number of domains.
+ *
+ * @param      numDomains           Number of domains.
+ *
+ * @return Time per get in microseconds.
+ */
+static double MeasureNamespaceGets(size_t numDomains) {
+    NVSHostReset();
+    HAPPlatformKeyValueStore keyValueStore;
+    HAPPlatformKeyValueStoreCreate(
+            &keyValueStore, &(const HAPPlatformKeyValueStoreOptions) { .part_name = "nvs", .namespace_prefix = "hap" });
+    for (size_t i = 0; i < numDomains; i++) {
+        uint8_t value[32] = { (uint8_t) i };
+        HAPError err = HAPPlatformKeyValueStoreSet(
+                &keyValueStore, (HAPPlatformKeyValueStoreDomain)(0x90 + i), 0x00, value, sizeof value);
+        HAPAssert(!err);
+    }
+    NVSHostSetLatencies(&flashLatencies);
+    NVSHostResetStatistics();
+    HAPPlatformKeyValueStoreStatistics before;
+    HAPPlatformKeyValueStoreGetStatistics(&keyValueStore, &before);
+
+    uint64_t startTime = GetMicroseconds();
+    for (size_t i = 0; i < kNumGets; i++) {
+        uint8_t value[32];
+        size_t numBytes;
+        bool found;
+        HAPError err = HAPPlatformKeyValueStoreGet(
+                &keyValueStore,
+                (HAPPlatformKeyValueStoreDomain)(0x90 + i % numDomains),
+                0x00,
+                value,
+                sizeof value,
+                &numBytes,
+                &found);
+        HAPAssert(!err && found && value[0] == (uint8_t)(i % numDomains));
+    }
+    uint64_t duration = GetMicroseconds() - startTime;
+
+    HAPPlatformKeyValueStoreStatistics after;
+    HAPPlatformKeyValueStoreGetStatistics(&keyValueStore, &after);
+    HAPPlatformKeyValueStoreRelease(&keyValueStore);
+
+    NVSHostStatistics nvsStatistics;
+    NVSHostGetStatistics(&nvsStatistics);
+    double getTime = (double) duration / kNumGets;
+    printf("%7zu  %5zu  %15zu  %13.1f\n",
+           numDomains,
+           kNumGets,
+           after.numNamespaceOpens - before.numNamespaceOpens,
+           getTime);
+    HAPAssert(nvsStatistics.numOpens == after.numNamespaceOpens - before.numNamespaceOpens);
+    return getTime;
+}
+
+static void BenchmarkHandleCache(void) {
+    printf("Gets with a cache of %zu open namespaces:\n", kHAPPlatformKeyValueStore_MaxOpenNamespaces);
+    printf("%7s  %5s  %15s  %13s\n", "Domains", "Gets", "Namespace opens", "Get time (us)");
+    double cachedGetTime = MeasureNamespaceGets(kHAPPlatformKeyValueStore_MaxOpenNamespaces);
+    double uncachedGetTime = MeasureNamespaceGets(kHAPPlatformKeyValueStore_MaxOpenNamespaces + 1);
+    printf("Get time saved by open namespaces: %.1f us\n\n", uncachedGetTime - cachedGetTime);
+    HAPAssert(cachedGetTime < uncachedGetTime);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Read cache: the reads of a pair verify, which looks up the configuration (domain 0x90) and searches the pairings
+// (domain 0xA0) for the controller.
+
+/** Number of stored pairings. */
+#define kNumPairings ((size_t) 8)
+
+/** Number of pair verifies per measurement. */
+#define kNumPairVerifies ((size_t) 200)
+
+/**
+ * Performs the reads of a pair verify.
+ *
+ * @param      keyValueStore        Key-value store.
+ * @param      pairingIndex         Key of the pairing of the controller.
+ */
+static void ReadPairVerifyValues(HAPPlatformKeyValueStoreRef keyValueStore, size_t pairingIndex) {
+    HAPError err;
+    uint8_t bytes[128];
+    size_t numBytes;
+    bool found;
+
+    // Long-term secret key and configuration number.
+    err = HAPPlatformKeyValueStoreGet(keyValueStore, 0x90, 0x00, bytes, sizeof bytes, &numBytes, &found);
+    HAPAssert(!err && found && numBytes == 32);
+    err = HAPPlatformKeyValueStoreGet(keyValueStore, 0x90, 0x01, bytes, sizeof bytes, &numBytes, &found);
+    HAPAssert(!err && found && numBytes == 4);
+
+    // Key that is not set, e.g., an optional setting.
+    err = HAPPlatformKeyValueStoreGet(keyValueStore, 0x90, 0x02, bytes, sizeof bytes, &numBytes, &found);
+    HAPAssert(!err && !found);
+
+    // Search the pairings for the controller.
+    for (size_t i = 0;; i++) {
+        HAPAssert(i < kNumPairings);
+        err = HAPPlatformKeyValueStoreGet(
+                keyValueStore, 0xA0, (HAPPlatformKeyValueStoreKey) i, bytes, sizeof bytes, &numBytes, &found);
+        HAPAssert(!err && found && numBytes == 100);
+        if (bytes[0] == pairingIndex) {
+            break;
+        }
+    }
+}
+
+/**
+ * Measures pair verifies of controllers with different pairings.
+ *
+ * @param      readCacheSize        Size of the read cache in bytes.
+ *
+ * @return Time per pair verify in microseconds.
+ */
+static double MeasurePairVerifies(size_t readCacheSize) {
+    NVSHostReset();
+    static const HAPPlatformKeyValueStoreDomain readCacheDomains[] = { 0x90, 0xA0 };
+    HAPPlatformKeyValueStore keyValueStore;
+    HAPPlatformKeyValueStoreCreate(
+            &keyValueStore,
+            &(const HAPPlatformKeyValueStoreOptions) { .part_name = "nvs",
+                                                       .namespace_prefix = "hap",
+                                                       .readCacheSize = readCacheSize,
+                                                       .readCacheDomains = readCacheDomains,
+                                                       .numReadCacheDomains = HAPArrayCount(readCacheDomains) });
+    uint8_t bytes[100] = { 0 };
+    HAPError err = HAPPlatformKeyValueStoreSet(&keyValueStore, 0x90, 0x00, bytes, 32);
+    HAPAssert(!err);
+    err = HAPPlatformKeyValueStoreSet(&keyValueStore, 0x90, 0x01, bytes, 4);
+    HAPAssert(!err);
+    for (size_t i = 0; i < kNumPairings; i++) {
+        bytes[0] = (uint8_t) i;
+        err = HAPPlatformKeyValueStoreSet(&keyValueStore, 0xA0, (HAPPlatformKeyValueStoreKey) i, bytes, sizeof bytes);
+        HAPAssert(!err);
+    }
+    NVSHostSetLatencies(&flashLatencies);
+    NVSHostResetStatistics();
+
+    uint64_t startTime = GetMicroseconds();
+    for (size_t i = 0; i < kNumPairVerifies; i++) {
+        ReadPairVerifyValues(&keyValueStore, i % kNumPairings);
+    }
+    uint64_t duration = GetMicroseconds() - startTime;
+
+    HAPPlatformKeyValueStoreStatistics statistics;
+    HAPPlatformKeyValueStoreGetStatistics(&keyValueStore, &statistics);
+    HAPPlatformKeyValueStoreRelease(&keyValueStore);
+
+    NVSHostStatistics nvsStatistics;
+    NVSHostGetStatistics(&nvsStatistics);
+    double pairVerifyTime = (double) duration / kNumPairVerifies;
+    printf("%13zu  %6zu  %6zu  %11zu  %21.1f\n",
+           readCacheSize,
+           statistics.numReadCacheHits,
+           statistics.numReadCacheMisses,
+           nvsStatistics.numReads,
+           pairVerifyTime);
+    return pairVerifyTime;
+}
+
+static void BenchmarkReadCache(void) {
+    printf("Reads of %zu pair verifies with %zu pairings:\n", kNumPairVerifies, kNumPairings);
+    printf("%13s  %6s  %6s  %11s  %21s\n", "Cache (bytes)", "Hits", "Misses", "Flash reads", "Pair verify time (us)");
+    double uncachedPairVerifyTime = MeasurePairVerifies(0);
+    double cachedPairVerifyTime = MeasurePairVerifies(2048);
+    printf("Pair verify time saved by the read cache: %.1f us\n\n", uncachedPairVerifyTime - cachedPairVerifyTime);
+    HAPAssert(cachedPairVerifyTime < uncachedPairVerifyTime);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Index: enumerations of a domain, from the index or by scanning the NVS partition. Keys are set in scrambled order
+// and include hex digits A-F, to check the order of the index and the parsing of NVS key names.
+
+/** Number of enumerations per measurement. */
+#define kNumEnumerations ((size_t) 50)
+
+typedef struct {
+    bool isKeyEnumerated[256];
+    size_t numKeys;
+    int previousKey;
+    bool isOrdered;
+} EnumerationContext;
+
+HAP_RESULT_USE_CHECK
+static HAPError EnumerateKey(
+        void* _Nullable context_,
+        HAPPlatformKeyValueStoreRef keyValueStore HAP_UNUSED,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreKey key,
+        bool* shouldContinue) {
+    HAPPrecondition(context_);
+    HAPPrecondition(shouldContinue);
+    EnumerationContext* context = context_;
+    HAPAssert(domain == 0x50);
+    HAPAssert(!context->isKeyEnumerated[key]);
+    context->isKeyEnumerated[key] = true;
+    context->numKeys++;
+    context->isOrdered = context->isOrdered && key > context->previousKey;
+    context->previousKey = key;
+    return kHAPError_None;
+}
+
+/**
+ * Returns the key with a given number. Keys are spread over the key range in scrambled order.
+ */
+static HAPPlatformKeyValueStoreKey GetEnumeratedKey(size_t i) {
+    return (HAPPlatformKeyValueStoreKey)(i * 167 + 0xAB);
+}
+
+/**
+ * Measures enumerations of a domain.
+ *
+ * @param      numKeys              Number of keys in the enumerated domain.
+ * @param      maxIndexEntries      Maximum number of keys in the index.
+ *
+ * @return Time per enumeration in microseconds.
+ */
+static double MeasureEnumerations(size_t numKeys, size_t maxIndexEntries) {
+    NVSHostReset();
+    HAPPlatformKeyValueStore keyValueStore;
+    HAPPlatformKeyValueStoreCreate(
+            &keyValueStore,
+            &(const HAPPlatformKeyValueStoreOptions) {
+                    .part_name = "nvs", .namespace_prefix = "hap", .maxIndexEntries = maxIndexEntries });
+    for (size_t i = 0; i < numKeys; i++) {
+        uint8_t value = (uint8_t) i;
+        HAPError err = HAPPlatformKeyValueStoreSet(&keyValueStore, 0x50, GetEnumeratedKey(i), &value, sizeof value);
+        HAPAssert(!err);
+        // Keys of another domain, which must not be enumerated.
+        err = HAPPlatformKeyValueStoreSet(&keyValueStore, 0x51, GetEnumeratedKey(i), &value, sizeof value);
+        HAPAssert(!err);
+    }
+    NVSHostSetLatencies(&flashLatencies);
+    NVSHostResetStatistics();
+
+    EnumerationContext context;
+    uint64_t startTime = GetMicroseconds();
+    for (size_t i = 0; i < kNumEnumerations; i++) {
+        HAPRawBufferZero(&context, sizeof context);
+        context.previousKey = -1;
+        context.isOrdered = true;
+        HAPError err = HAPPlatformKeyValueStoreEnumerate(&keyValueStore, 0x50, EnumerateKey, &context);
+        HAPAssert(!err);
+    }
+    uint64_t duration = GetMicroseconds() - startTime;
+    HAPPlatformKeyValueStoreRelease(&keyValueStore);
+
+    HAPAssert(context.numKeys == numKeys);
+    for (size_t i = 0; i < numKeys; i++) {
+        HAPAssert(context.isKeyEnumerated[GetEnumeratedKey(i)]);
+    }
+    HAPAssert(context.isOrdered || !maxIndexEntries);
+
+    NVSHostStatistics nvsStatistics;
+    NVSHostGetStatistics(&nvsStatistics);
+    double enumerationTime = (double) duration / kNumEnumerations;
+    printf("%4zu  %5s  %14zu  %7s  %20.1f\n",
+           numKeys,
+           maxIndexEntries ? "yes" : "no",
+           nvsStatistics.numIterations / kNumEnumerations,
+           context.isOrdered ? "yes" : "no",
+           enumerationTime);
+    return enumerationTime;
+}
+
+static void BenchmarkIndex(void) {
+    printf("Enumerations of a domain, with as many keys in another domain:\n");
+    printf("%4s  %5s  %14s  %7s  %20s\n", "Keys", "Index", "NVS iterations", "Ordered", "Enumerate time (us)");
+    static const size_t numKeys[] = { 16, 100 };
+    for (size_t i = 0; i < HAPArrayCount(numKeys); i++) {
+        double scanTime = MeasureEnumerations(numKeys[i], 0);
+        double indexTime = MeasureEnumerations(numKeys[i], 256);
+        HAPAssert(indexTime < scanTime);
+    }
+    printf("\n");
+}
+
+int main(void) {
+    // The run loop only requires a key-value store to be present.
+    static HAPPlatformKeyValueStore keyValueStore;
+    HAPPlatformRunLoopCreate(&(const HAPPlatformRunLoopOptions) { .keyValueStore = &keyValueStore });
+
+    BenchmarkWriteBack();
+    BenchmarkHandleCache();
+    BenchmarkReadCache();
+    BenchmarkIndex();
+
+    HAPPlatformRunLoopRelease();
+    return 0;
+}
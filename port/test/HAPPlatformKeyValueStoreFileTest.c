@@ -0,0 +1,285 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Recovery and throughput driver of the log-structured key-value store (CONFIG_HAP_KEY_VALUE_STORE_BACKEND_FILE).
+//
+// - Values survive reopening the store, and a record that was torn by a crash is discarded on replay.
+// - Superseded records are compacted on the run loop.
+// - The factory store is loaded from the accessory setup CSV.
+// - Get / Set / Remove / Enumerate throughput and replay time are measured, with pread and with mmap reads.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformClock+Init.h"
+#include "HAPPlatformKeyValueStore+Init.h"
+#include "HAPPlatformRunLoop+Init.h"
+
+static char logPath[64];
+
+static HAPPlatformKeyValueStore keyValueStore;
+
+static void OpenKeyValueStore(bool useMemoryMappedReads, size_t compactionThreshold) {
+    HAPPlatformKeyValueStoreCreate(
+            &keyValueStore,
+            &(const HAPPlatformKeyValueStoreOptions) { .part_name = logPath,
+                                                       .namespace_prefix = "hap",
+                                                       .useMemoryMappedReads = useMemoryMappedReads,
+                                                       .compactionThreshold = compactionThreshold });
+}
+
+static size_t GetLogFileSize(void) {
+    struct stat st;
+    HAPAssert(stat(logPath, &st) == 0);
+    return (size_t) st.st_size;
+}
+
+static void SetValue(HAPPlatformKeyValueStoreDomain domain, HAPPlatformKeyValueStoreKey key, uint8_t value, size_t n) {
+    uint8_t bytes[64];
+    HAPAssert(n <= sizeof bytes);
+    for (size_t i = 0; i < n; i++) {
+        bytes[i] = (uint8_t)(value + i);
+    }
+    HAPError err = HAPPlatformKeyValueStoreSet(&keyValueStore, domain, key, bytes, n);
+    HAPAssert(!err);
+}
+
+static bool HasValue(HAPPlatformKeyValueStoreDomain domain, HAPPlatformKeyValueStoreKey key, uint8_t value, size_t n) {
+    uint8_t bytes[64];
+    size_t numBytes;
+    bool found;
+    HAPError err = HAPPlatformKeyValueStoreGet(&keyValueStore, domain, key, bytes, sizeof bytes, &numBytes, &found);
+    HAPAssert(!err);
+    if (!found || numBytes != n) {
+        return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (bytes[i] != (uint8_t)(value + i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool HasKey(HAPPlatformKeyValueStoreDomain domain, HAPPlatformKeyValueStoreKey key) {
+    bool found;
+    HAPError err = HAPPlatformKeyValueStoreGet(&keyValueStore, domain, key, NULL, 0, NULL, &found);
+    HAPAssert(!err);
+    return found;
+}
+
+static HAPError CountKey(
+        void* _Nullable context,
+        HAPPlatformKeyValueStoreRef keyValueStore_ HAP_UNUSED,
+        HAPPlatformKeyValueStoreDomain domain HAP_UNUSED,
+        HAPPlatformKeyValueStoreKey key HAP_UNUSED,
+        bool* shouldContinue) {
+    HAPAssert(context);
+    HAPAssert(shouldContinue);
+    (*(size_t*) context)++;
+    return kHAPError_None;
+}
+
+static size_t GetNumKeys(HAPPlatformKeyValueStoreDomain domain) {
+    size_t numKeys = 0;
+    HAPError err = HAPPlatformKeyValueStoreEnumerate(&keyValueStore, domain, CountKey, &numKeys);
+    HAPAssert(!err);
+    return numKeys;
+}
+
+static void HandleStopTimerExpired(HAPPlatformTimerRef timer HAP_UNUSED, void* _Nullable context HAP_UNUSED) {
+    HAPPlatformRunLoopStop();
+}
+
+/**
+ * Runs the run loop for a short time, so that a scheduled compaction takes place.
+ */
+static void RunRunLoop(void) {
+    HAPPlatformTimerRef timer;
+    HAPError err =
+            HAPPlatformTimerRegister(&timer, HAPPlatformClockGetCurrent() + 10, HandleStopTimerExpired, NULL);
+    HAPAssert(!err);
+    HAPPlatformRunLoopRun();
+}
+
+static void TestPersistence(void) {
+    OpenKeyValueStore(false, 0);
+    for (uint8_t i = 0; i < 5; i++) {
+        SetValue(0xA0, (HAPPlatformKeyValueStoreKey)(0x1F - i), i, 10 + i);
+    }
+    SetValue(0x90, 0x00, 9, 3);
+    HAPError err = HAPPlatformKeyValueStoreRemove(&keyValueStore, 0xA0, 0x1D);
+    HAPAssert(!err);
+    HAPPlatformKeyValueStoreRelease(&keyValueStore);
+
+    OpenKeyValueStore(false, 0);
+    HAPAssert(GetNumKeys(0xA0) == 4);
+    HAPAssert(HasValue(0xA0, 0x1B, 4, 14));
+    HAPAssert(!HasKey(0xA0, 0x1D));
+    HAPAssert(HasValue(0x90, 0x00, 9, 3));
+    HAPPlatformKeyValueStoreRelease(&keyValueStore);
+}
+
+static void TestCrashRecovery(void) {
+    OpenKeyValueStore(false, SIZE_MAX);
+    SetValue(0xA0, 0x01, 42, 20);
+    HAPPlatformKeyValueStoreRelease(&keyValueStore);
+
+    // Tear the last record, as if the accessory lost power while appending it.
+    HAPAssert(truncate(logPath, (off_t)(GetLogFileSize() - 5)) == 0);
+
+    OpenKeyValueStore(false, SIZE_MAX);
+    HAPPlatformKeyValueStoreStatistics statistics;
+    HAPPlatformKeyValueStoreGetStatistics(&keyValueStore, &statistics);
+    size_t numDiscardedLogBytes = statistics.numDiscardedLogBytes;
+    HAPAssert(numDiscardedLogBytes);
+    HAPAssert(!HasKey(0xA0, 0x01));
+    HAPAssert(HasValue(0xA0, 0x1B, 4, 14));
+
+    // Appending after the discarded bytes must produce a valid log.
+    SetValue(0xA0, 0x01, 43, 20);
+    HAPPlatformKeyValueStoreRelease(&keyValueStore);
+    OpenKeyValueStore(false, SIZE_MAX);
+    HAPPlatformKeyValueStoreGetStatistics(&keyValueStore, &statistics);
+    HAPAssert(!statistics.numDiscardedLogBytes);
+    HAPAssert(HasValue(0xA0, 0x01, 43, 20));
+    HAPPlatformKeyValueStoreRelease(&keyValueStore);
+
+    printf("Crash recovery: discarded %zu bytes of a torn record.\n", numDiscardedLogBytes);
+}
+
+static void TestCompaction(void) {
+    OpenKeyValueStore(false, 256);
+    for (size_t i = 0; i < 200; i++) {
+        SetValue(0x10, (HAPPlatformKeyValueStoreKey)(i % 4), (uint8_t) i, 32);
+    }
+    size_t numBytesBefore = GetLogFileSize();
+    RunRunLoop();
+    size_t numBytesAfter = GetLogFileSize();
+
+    HAPPlatformKeyValueStoreStatistics statistics;
+    HAPPlatformKeyValueStoreGetStatistics(&keyValueStore, &statistics);
+    HAPAssert(statistics.numCompactions);
+    HAPAssert(numBytesAfter < numBytesBefore);
+    for (size_t i = 196; i < 200; i++) {
+        HAPAssert(HasValue(0x10, (HAPPlatformKeyValueStoreKey)(i % 4), (uint8_t) i, 32));
+    }
+    HAPPlatformKeyValueStoreRelease(&keyValueStore);
+
+    OpenKeyValueStore(false, 256);
+    HAPAssert(GetNumKeys(0x10) == 4);
+    HAPAssert(HasValue(0xA0, 0x1B, 4, 14));
+    HAPPlatformKeyValueStoreRelease(&keyValueStore);
+
+    printf("Compaction: log shrank from %zu to %zu bytes.\n", numBytesBefore, numBytesAfter);
+}
+
+static void TestAccessorySetupCSV(void) {
+    HAPPlatformKeyValueStoreCreate(
+            &keyValueStore,
+            &(const HAPPlatformKeyValueStoreOptions) {
+                    .part_name = ACCESSORY_SETUP_CSV, .namespace_prefix = "hap", .read_only = true });
+    HAPAssert(GetNumKeys(0x40) == 2);
+    HAPAssert(HasKey(0x40, 0x10));
+    HAPAssert(HasKey(0x40, 0x11));
+    uint8_t bytes[1] = { 0 };
+    HAPError err = HAPPlatformKeyValueStoreSet(&keyValueStore, 0x40, 0x11, bytes, sizeof bytes);
+    HAPAssert(err);
+    HAPPlatformKeyValueStoreRelease(&keyValueStore);
+}
+
+/**
+ * Measures throughput and replay time with a log of numKeys live keys.
+ *
+ * @param      useMemoryMappedReads Whether values are read through a memory mapping.
+ */
+static void BenchmarkThroughput(bool useMemoryMappedReads) {
+    enum { kNumKeys = 256, kNumSets = 1024, kNumGets = 100000, kNumEnumerations = 1000 };
+
+    HAPAssert(unlink(logPath) == 0);
+    OpenKeyValueStore(useMemoryMappedReads, SIZE_MAX);
+
+    uint64_t startTime = HAPPlatformClockGetCurrentMicroseconds();
+    for (size_t i = 0; i < kNumSets; i++) {
+        SetValue((HAPPlatformKeyValueStoreDomain)(0x80 + i % kNumKeys / 64), (uint8_t)(i % 64), (uint8_t) i, 32);
+    }
+    uint64_t setTime = HAPPlatformClockGetCurrentMicroseconds() - startTime;
+
+    startTime = HAPPlatformClockGetCurrentMicroseconds();
+    for (size_t i = 0; i < kNumGets; i++) {
+        HAPAssert(HasValue(0x80, (uint8_t)(i % 64), (uint8_t)(kNumSets - kNumKeys + i % 64), 32));
+    }
+    uint64_t getTime = HAPPlatformClockGetCurrentMicroseconds() - startTime;
+
+    startTime = HAPPlatformClockGetCurrentMicroseconds();
+    for (size_t i = 0; i < kNumEnumerations; i++) {
+        HAPAssert(GetNumKeys(0x81) == 64);
+    }
+    uint64_t enumerateTime = HAPPlatformClockGetCurrentMicroseconds() - startTime;
+    HAPPlatformKeyValueStoreRelease(&keyValueStore);
+
+    size_t numLogBytes = GetLogFileSize();
+    startTime = HAPPlatformClockGetCurrentMicroseconds();
+    OpenKeyValueStore(useMemoryMappedReads, SIZE_MAX);
+    uint64_t replayTime = HAPPlatformClockGetCurrentMicroseconds() - startTime;
+
+    startTime = HAPPlatformClockGetCurrentMicroseconds();
+    for (size_t i = 0; i < 64; i++) {
+        HAPError err = HAPPlatformKeyValueStoreRemove(&keyValueStore, 0x82, (uint8_t) i);
+        HAPAssert(!err);
+    }
+    uint64_t removeTime = HAPPlatformClockGetCurrentMicroseconds() - startTime;
+    HAPAssert(!GetNumKeys(0x82));
+    HAPPlatformKeyValueStoreRelease(&keyValueStore);
+
+    printf("%-6s  %10.2f  %10.3f  %10.2f  %16.2f  %8llu us for %zu bytes\n",
+           useMemoryMappedReads ? "mmap" : "pread",
+           (double) setTime / kNumSets,
+           (double) getTime / kNumGets,
+           (double) removeTime / 64,
+           (double) enumerateTime / kNumEnumerations,
+           (unsigned long long) replayTime,
+           numLogBytes);
+}
+
+int main(void) {
+    char directory[] = "/tmp/HAPPlatformKeyValueStoreFileTest.XXXXXX";
+    HAPAssert(mkdtemp(directory));
+    snprintf(logPath, sizeof logPath, "%s/kvs.log", directory);
+
+    HAPPlatformRunLoopCreate(&(const HAPPlatformRunLoopOptions) { .keyValueStore = &keyValueStore });
+
+    TestPersistence();
+    TestCrashRecovery();
+    TestCompaction();
+    TestAccessorySetupCSV();
+
+    printf("Reads   Set (us)    Get (us)  Remove (us)  Enumerate 64 (us)  Replay\n");
+    BenchmarkThroughput(false);
+    BenchmarkThroughput(true);
+
+    HAPPlatformRunLoopRelease();
+    HAPAssert(unlink(logPath) == 0);
+    HAPAssert(rmdir(directory) == 0);
+    return 0;
+}
@@ -0,0 +1,267 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Checks that the run loop does not allocate memory in steady state once timers and file handles are preallocated,
+// and that releasing the run loop frees everything that creating it allocated, so that it can be created again.
+// Allocations are counted by wrapping malloc, calloc, realloc and free at link time.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformClock+Init.h"
+#include "HAPPlatformKeyValueStore+Init.h"
+#include "HAPPlatformRunLoop+Init.h"
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* _Nullable ptr, size_t size);
+void __real_free(void* _Nullable ptr);
+
+static bool isCountingAllocations;
+static size_t numAllocations;
+
+/** Number of blocks that have been allocated but not yet freed. */
+static size_t numLiveBlocks;
+
+void* __wrap_malloc(size_t size) {
+    numAllocations += isCountingAllocations;
+    void* _Nullable ptr = __real_malloc(size);
+    numLiveBlocks += ptr != NULL;
+    return ptr;
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    numAllocations += isCountingAllocations;
+    void* _Nullable ptr = __real_calloc(count, size);
+    numLiveBlocks += ptr != NULL;
+    return ptr;
+}
+
+void* __wrap_realloc(void* _Nullable ptr, size_t size) {
+    numAllocations += isCountingAllocations;
+    void* _Nullable newPtr = __real_realloc(ptr, size);
+    numLiveBlocks += !ptr && newPtr;
+    return newPtr;
+}
+
+void __wrap_free(void* _Nullable ptr) {
+    numAllocations += isCountingAllocations && ptr;
+    numLiveBlocks -= ptr != NULL;
+    __real_free(ptr);
+}
+
+/** Number of iterations before allocations are counted. */
+#define kNumWarmUpRounds ((size_t) 100)
+
+/** Number of iterations during which allocations are counted. */
+#define kNumRounds ((size_t) 1000)
+
+static int fileDescriptors[2];
+static HAPPlatformFileHandleRef fileHandle;
+static HAPPlatformTimerRef roundTimer;
+static HAPPlatformRunLoopObserver observer;
+
+static size_t numRounds;
+static size_t numBytesRead;
+static size_t numCallbacks;
+static size_t numObserverInvocations;
+
+static void HandleFileHandleCallback(
+        HAPPlatformFileHandleRef fileHandle_ HAP_UNUSED,
+        HAPPlatformFileHandleEvent fileHandleEvents,
+        void* _Nullable context HAP_UNUSED) {
+    HAPAssert(fileHandleEvents.isReadyForReading);
+    uint8_t byte;
+    ssize_t n = read(fileDescriptors[0], &byte, sizeof byte);
+    HAPAssert(n == 1);
+    numBytesRead++;
+}
+
+static void HandleScheduledCallback(void* _Nullable context, size_t contextSize) {
+    HAPAssert(context);
+    HAPAssert(contextSize == 1 || contextSize == 512);
+    numCallbacks++;
+}
+
+static void HandleObserverCallback(void* _Nullable context HAP_UNUSED) {
+    numObserverInvocations++;
+}
+
+static void HandleCancelledTimerExpired(HAPPlatformTimerRef timer HAP_UNUSED, void* _Nullable context HAP_UNUSED) {
+    HAPFatalError();
+}
+
+static void HandleRoundTimerExpired(HAPPlatformTimerRef timer HAP_UNUSED, void* _Nullable context HAP_UNUSED) {
+    HAPError err;
+
+    if (numRounds == kNumWarmUpRounds) {
+        numAllocations = 0;
+        isCountingAllocations = true;
+    }
+    if (numRounds == kNumWarmUpRounds + kNumRounds) {
+        isCountingAllocations = false;
+        HAPPlatformRunLoopStop();
+        return;
+    }
+    numRounds++;
+
+    // Produce data for the file handle.
+    uint8_t byte = (uint8_t) numRounds;
+    ssize_t n = write(fileDescriptors[1], &byte, sizeof byte);
+    HAPAssert(n == 1);
+
+    // Schedule callbacks with small and large contexts.
+    err = HAPPlatformRunLoopScheduleCallback(HandleScheduledCallback, &byte, sizeof byte);
+    HAPAssert(!err);
+    static uint8_t largeContext[512];
+    err = HAPPlatformRunLoopScheduleCallbackWithLargeContext(
+            HandleScheduledCallback, largeContext, sizeof largeContext);
+    HAPAssert(!err);
+
+    // Arm and cancel timers, like idle timeouts that are pushed back on activity.
+    HAPPlatformTimerRef timers[4];
+    for (size_t i = 0; i < HAPArrayCount(timers); i++) {
+        err = HAPPlatformTimerRegisterWithLeeway(
+                &timers[i],
+                HAPPlatformClockGetCurrent() + HAPMinute,
+                (HAPTime) i,
+                HandleCancelledTimerExpired,
+                NULL);
+        HAPAssert(!err);
+    }
+    for (size_t i = 0; i < HAPArrayCount(timers); i++) {
+        HAPPlatformTimerDeregister(timers[i]);
+    }
+
+    // Re-register the file handle now and then, like a connection that is closed and accepted again.
+    if (numRounds % 16 == 0) {
+        HAPPlatformFileHandleDeregister(fileHandle);
+        err = HAPPlatformFileHandleRegister(
+                &fileHandle,
+                fileDescriptors[0],
+                (HAPPlatformFileHandleEvent) { .isReadyForReading = true },
+                HandleFileHandleCallback,
+                NULL);
+        HAPAssert(!err);
+    }
+
+    // Toggle the observer.
+    if (numRounds % 2 == 0) {
+        HAPPlatformRunLoopRemoveObserver(&observer);
+    } else {
+        HAPPlatformRunLoopAddObserver(&observer, HandleObserverCallback, NULL);
+    }
+
+    // Wait for the next millisecond, so that the scheduled callbacks and file handle events are processed first.
+    err = HAPPlatformTimerRegister(&roundTimer, HAPPlatformClockGetCurrent() + 1, HandleRoundTimerExpired, NULL);
+    HAPAssert(!err);
+}
+
+/**
+ * Creates and releases the run loop a few times, and checks that everything that was allocated is freed again.
+ *
+ * @param      keyValueStore        Key-value store.
+ */
+static void CheckRelease(HAPPlatformKeyValueStoreRef keyValueStore) {
+    HAPPrecondition(keyValueStore);
+
+    size_t numLiveBlocksBefore = numLiveBlocks;
+    for (size_t i = 0; i < 2; i++) {
+        HAPPlatformRunLoopCreate(&(const HAPPlatformRunLoopOptions) {
+                .keyValueStore = keyValueStore, .maxTimers = 8, .maxFileHandles = 2, .allowHeapFallback = false });
+        HAPError err = HAPPlatformTimerRegister(
+                &roundTimer, HAPPlatformClockGetCurrent() + HAPMinute, HandleCancelledTimerExpired, NULL);
+        HAPAssert(!err);
+        HAPPlatformTimerDeregister(roundTimer);
+        HAPPlatformRunLoopRelease();
+    }
+    printf("Blocks leaked by creating and releasing the run loop: %zd\n",
+           (ssize_t) (numLiveBlocks - numLiveBlocksBefore));
+    fflush(stdout);
+    HAPAssert(numLiveBlocks == numLiveBlocksBefore);
+}
+
+int main(void) {
+    HAPError err;
+
+    // The run loop only requires a key-value store to be present.
+    static HAPPlatformKeyValueStore keyValueStore;
+
+    // Let the clock and stdio allocate what they keep for the lifetime of the process.
+    (void) HAPPlatformClockGetCurrent();
+    printf("Checking run loop release.\n");
+    CheckRelease(&keyValueStore);
+
+    HAPPlatformRunLoopCreate(&(const HAPPlatformRunLoopOptions) {
+            .keyValueStore = &keyValueStore, .maxTimers = 8, .maxFileHandles = 2, .allowHeapFallback = false });
+
+    int e = socketpair(AF_UNIX, SOCK_STREAM, 0, fileDescriptors);
+    HAPAssert(!e);
+    err = HAPPlatformFileHandleRegister(
+            &fileHandle,
+            fileDescriptors[0],
+            (HAPPlatformFileHandleEvent) { .isReadyForReading = true },
+            HandleFileHandleCallback,
+            NULL);
+    HAPAssert(!err);
+    err = HAPPlatformTimerRegister(&roundTimer, HAPPlatformClockGetCurrent(), HandleRoundTimerExpired, NULL);
+    HAPAssert(!err);
+    HAPPlatformRunLoopRun();
+
+    HAPPlatformRunLoopStatistics statistics;
+    HAPPlatformRunLoopGetStatistics(&statistics);
+    printf("Rounds: %zu, bytes read: %zu, callbacks: %zu, observer invocations: %zu\n",
+           kNumRounds,
+           numBytesRead,
+           numCallbacks,
+           numObserverInvocations);
+    printf("Allocations in steady state: %zu\n", numAllocations);
+    printf("Timers: high-water mark %zu of %zu, %zu heap allocations, %zu failed allocations\n",
+           statistics.timers.numObjectsHighWaterMark,
+           statistics.timers.maxObjects,
+           statistics.timers.numHeapAllocations,
+           statistics.timers.numFailedAllocations);
+    printf("File handles: high-water mark %zu of %zu, %zu heap allocations, %zu failed allocations\n",
+           statistics.fileHandles.numObjectsHighWaterMark,
+           statistics.fileHandles.maxObjects,
+           statistics.fileHandles.numHeapAllocations,
+           statistics.fileHandles.numFailedAllocations);
+
+    fflush(stdout);
+    HAPAssert(numAllocations == 0);
+    HAPAssert(numBytesRead >= kNumRounds);
+    HAPAssert(numCallbacks >= 2 * kNumRounds);
+    HAPAssert(numObserverInvocations > 0);
+    HAPAssert(statistics.timers.numObjectsHighWaterMark <= statistics.timers.maxObjects);
+    HAPAssert(!statistics.timers.numHeapAllocations && !statistics.timers.numFailedAllocations);
+    HAPAssert(statistics.fileHandles.numObjectsHighWaterMark <= statistics.fileHandles.maxObjects);
+    HAPAssert(!statistics.fileHandles.numHeapAllocations && !statistics.fileHandles.numFailedAllocations);
+    HAPAssert(!statistics.callbacks.numDroppedCallbacks && !statistics.callbacks.numFailedArenaAllocations);
+
+    HAPPlatformRunLoopRemoveObserver(&observer);
+    HAPPlatformFileHandleDeregister(fileHandle);
+    close(fileDescriptors[0]);
+    close(fileDescriptors[1]);
+    HAPPlatformRunLoopRelease();
+    return 0;
+}
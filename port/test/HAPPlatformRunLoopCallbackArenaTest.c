@@ -0,0 +1,166 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Test of the scheduled callback arena that stores contexts larger than UINT8_MAX bytes.
+// Fills the scheduled callback ring buffer, so that callbacks with large contexts are rejected after their context has
+// already been copied into the arena. Checks that the arena is reclaimed once the ring buffer drains, and that contexts
+// larger than half the arena, up to the arena size minus the record header, can be scheduled again.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformClock+Init.h"
+#include "HAPPlatformKeyValueStore+Init.h"
+#include "HAPPlatformRunLoop+Init.h"
+
+/** Size of the arena, as configured in CMakeLists.txt. */
+#define kArenaSize ((size_t) CONFIG_HAP_RUN_LOOP_CALLBACK_ARENA_SIZE)
+
+/** Size of the contexts that are rejected while the ring buffer is full. */
+#define kRejectedContextSize ((size_t) 1024)
+
+/** Number of callbacks with large contexts that are rejected while the ring buffer is full. */
+#define kNumRejectedCallbacks ((size_t) 3)
+
+/** Size of the context that is scheduled after the ring buffer has drained. Does not fit behind the rejected ones. */
+#define kLargeContextSize ((size_t) 3000)
+
+/** Largest context that the arena can hold. */
+#define kMaxContextSize (kArenaSize - 8)
+
+static uint8_t contextBytes[kArenaSize];
+
+static size_t numQueuedCallbacks;
+static size_t numInvokedCallbacks;
+static bool didInvokeLargeCallback;
+static bool didInvokeMaxCallback;
+
+static void FillContext(size_t contextSize, uint8_t seed) {
+    HAPPrecondition(contextSize <= sizeof contextBytes);
+    for (size_t i = 0; i < contextSize; i++) {
+        contextBytes[i] = (uint8_t)(seed + i * 7);
+    }
+}
+
+static void VerifyContext(const void* _Nullable context_, size_t contextSize, uint8_t seed) {
+    HAPPrecondition(context_);
+    const uint8_t* context = context_;
+    for (size_t i = 0; i < contextSize; i++) {
+        HAPAssert(context[i] == (uint8_t)(seed + i * 7));
+    }
+}
+
+static void HandleMaxCallback(void* _Nullable context, size_t contextSize) {
+    HAPAssert(contextSize == kMaxContextSize);
+    VerifyContext(context, contextSize, 3);
+    didInvokeMaxCallback = true;
+    HAPPlatformRunLoopStop();
+}
+
+static void HandleStepCallback(void* _Nullable context HAP_UNUSED, size_t contextSize) {
+    HAPAssert(!contextSize);
+
+    // The large context has been released, so the arena is empty again.
+    FillContext(kMaxContextSize, 3);
+    HAPError err = HAPPlatformRunLoopScheduleCallbackWithLargeContext(HandleMaxCallback, contextBytes, kMaxContextSize);
+    HAPAssert(!err);
+}
+
+static void HandleLargeCallback(void* _Nullable context, size_t contextSize) {
+    HAPAssert(contextSize == kLargeContextSize);
+    VerifyContext(context, contextSize, 2);
+    didInvokeLargeCallback = true;
+
+    HAPError err = HAPPlatformRunLoopScheduleCallback(HandleStepCallback, NULL, 0);
+    HAPAssert(!err);
+}
+
+static void HandleRejectedCallback(void* _Nullable context HAP_UNUSED, size_t contextSize HAP_UNUSED) {
+    HAPFatalError();
+}
+
+static void HandleQueuedCallback(void* _Nullable context HAP_UNUSED, size_t contextSize) {
+    HAPAssert(!contextSize);
+    numInvokedCallbacks++;
+    if (numInvokedCallbacks != numQueuedCallbacks) {
+        return;
+    }
+
+    // The rejected contexts ended near the end of the arena. This context only fits at the start of the next lap.
+    FillContext(kLargeContextSize, 2);
+    HAPError err =
+            HAPPlatformRunLoopScheduleCallbackWithLargeContext(HandleLargeCallback, contextBytes, kLargeContextSize);
+    HAPAssert(!err);
+}
+
+int main(void) {
+    HAPAssert(kNumRejectedCallbacks * (8 + kRejectedContextSize) <= kArenaSize);
+    HAPAssert(kNumRejectedCallbacks * (8 + kRejectedContextSize) + 8 + kLargeContextSize > kArenaSize);
+
+    // The run loop only requires a key-value store to be present.
+    static HAPPlatformKeyValueStore keyValueStore;
+    HAPPlatformRunLoopCreate(&(const HAPPlatformRunLoopOptions) { .keyValueStore = &keyValueStore });
+
+    // Fill the ring buffer.
+    for (;;) {
+        HAPError err = HAPPlatformRunLoopScheduleCallback(HandleQueuedCallback, NULL, 0);
+        if (err) {
+            HAPAssert(err == kHAPError_OutOfResources);
+            break;
+        }
+        numQueuedCallbacks++;
+    }
+    HAPAssert(numQueuedCallbacks);
+
+    // Reject callbacks with large contexts. Each of them leaves a released record in the arena.
+    HAPPlatformRunLoopStatistics before;
+    HAPPlatformRunLoopGetStatistics(&before);
+    FillContext(kRejectedContextSize, 1);
+    for (size_t i = 0; i < kNumRejectedCallbacks; i++) {
+        HAPError err = HAPPlatformRunLoopScheduleCallbackWithLargeContext(
+                HandleRejectedCallback, contextBytes, kRejectedContextSize);
+        HAPAssert(err == kHAPError_OutOfResources);
+    }
+    HAPPlatformRunLoopStatistics after;
+    HAPPlatformRunLoopGetStatistics(&after);
+    HAPAssert(after.callbacks.numDroppedCallbacks - before.callbacks.numDroppedCallbacks == kNumRejectedCallbacks);
+    HAPAssert(after.callbacks.numFailedArenaAllocations == before.callbacks.numFailedArenaAllocations);
+
+    HAPPlatformRunLoopRun();
+
+    HAPPlatformRunLoopStatistics statistics;
+    HAPPlatformRunLoopGetStatistics(&statistics);
+    printf("%zu queued callbacks, %zu rejected large contexts, %zu failed arena allocations, %zu arena bytes left\n",
+           numQueuedCallbacks,
+           statistics.callbacks.numDroppedCallbacks,
+           statistics.callbacks.numFailedArenaAllocations,
+           statistics.callbacks.numArenaBytes);
+    fflush(stdout);
+
+    HAPAssert(numInvokedCallbacks == numQueuedCallbacks);
+    HAPAssert(didInvokeLargeCallback);
+    HAPAssert(didInvokeMaxCallback);
+    HAPAssert(!statistics.callbacks.numFailedArenaAllocations);
+    HAPAssert(statistics.callbacks.numArenaCallbacks == 2);
+
+    HAPPlatformRunLoopRelease();
+    return 0;
+}
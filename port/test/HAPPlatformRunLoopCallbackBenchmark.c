@@ -0,0 +1,190 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmark of HAPPlatformRunLoopScheduleCallback with several producer threads and the run loop as consumer.
+// Reports enqueue latency, end-to-end throughput and how many wakeups were coalesced. Also checks that no callback is
+// lost and that the callbacks of each producer are invoked in the order in which they were scheduled.
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformClock+Init.h"
+#include "HAPPlatformKeyValueStore+Init.h"
+#include "HAPPlatformRunLoop+Init.h"
+
+/** Maximum number of producer threads. */
+#define kMaxProducers ((size_t) 8)
+
+/** Number of callbacks that each producer schedules. */
+#define kNumCallbacksPerProducer ((uint32_t) 50000)
+
+typedef struct {
+    uint32_t producerIndex;
+    uint32_t sequenceNumber;
+} CallbackContext;
+
+typedef struct {
+    pthread_t thread;
+    uint32_t producerIndex;
+    uint64_t sumNanoseconds;
+    uint64_t maxNanoseconds;
+    size_t numRetries;
+} Producer;
+
+static Producer producers[kMaxProducers];
+static size_t numProducers;
+static pthread_barrier_t startBarrier;
+
+static uint32_t lastSequenceNumbers[kMaxProducers];
+static size_t numReceivedCallbacks;
+
+static uint64_t GetNanoseconds(void) {
+    struct timespec now;
+    int e = clock_gettime(CLOCK_MONOTONIC, &now);
+    HAPAssert(!e);
+    return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
+static void HandleCallback(void* _Nullable context_, size_t contextSize) {
+    HAPPrecondition(context_);
+    HAPPrecondition(contextSize == sizeof(CallbackContext));
+    const CallbackContext* context = context_;
+    HAPAssert(context->producerIndex < numProducers);
+    HAPAssert(context->sequenceNumber == lastSequenceNumbers[context->producerIndex] + 1);
+    lastSequenceNumbers[context->producerIndex] = context->sequenceNumber;
+
+    numReceivedCallbacks++;
+    if (numReceivedCallbacks == numProducers * kNumCallbacksPerProducer) {
+        HAPPlatformRunLoopStop();
+    }
+}
+
+static void* _Nullable RunProducer(void* _Nullable context) {
+    HAPPrecondition(context);
+    Producer* producer = context;
+
+    pthread_barrier_wait(&startBarrier);
+    for (uint32_t i = 1; i <= kNumCallbacksPerProducer; i++) {
+        CallbackContext callbackContext = { .producerIndex = producer->producerIndex, .sequenceNumber = i };
+        for (;;) {
+            uint64_t startTime = GetNanoseconds();
+            HAPError err = HAPPlatformRunLoopScheduleCallback(HandleCallback, &callbackContext, sizeof callbackContext);
+            uint64_t duration = GetNanoseconds() - startTime;
+            if (!err) {
+                producer->sumNanoseconds += duration;
+                producer->maxNanoseconds = HAPMax(producer->maxNanoseconds, duration);
+                break;
+            }
+            // The queue is full. Let the run loop catch up.
+            HAPAssert(err == kHAPError_OutOfResources);
+            producer->numRetries++;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void MeasureProducers(size_t numProducers_) {
+    HAPPrecondition(numProducers_ <= kMaxProducers);
+    numProducers = numProducers_;
+    numReceivedCallbacks = 0;
+    HAPRawBufferZero(producers, sizeof producers);
+    HAPRawBufferZero(lastSequenceNumbers, sizeof lastSequenceNumbers);
+
+    HAPPlatformRunLoopStatistics before;
+    HAPPlatformRunLoopGetStatistics(&before);
+
+    int e = pthread_barrier_init(&startBarrier, NULL, (unsigned) numProducers + 1);
+    HAPAssert(!e);
+    for (size_t i = 0; i < numProducers; i++) {
+        producers[i].producerIndex = (uint32_t) i;
+        e = pthread_create(&producers[i].thread, NULL, RunProducer, &producers[i]);
+        HAPAssert(!e);
+    }
+    pthread_barrier_wait(&startBarrier);
+    uint64_t startTime = GetNanoseconds();
+    HAPPlatformRunLoopRun();
+    uint64_t duration = GetNanoseconds() - startTime;
+    for (size_t i = 0; i < numProducers; i++) {
+        e = pthread_join(producers[i].thread, NULL);
+        HAPAssert(!e);
+    }
+    e = pthread_barrier_destroy(&startBarrier);
+    HAPAssert(!e);
+
+    HAPPlatformRunLoopStatistics after;
+    HAPPlatformRunLoopGetStatistics(&after);
+
+    uint64_t sumNanoseconds = 0;
+    uint64_t maxNanoseconds = 0;
+    size_t numRetries = 0;
+    for (size_t i = 0; i < numProducers; i++) {
+        HAPAssert(lastSequenceNumbers[i] == kNumCallbacksPerProducer);
+        sumNanoseconds += producers[i].sumNanoseconds;
+        maxNanoseconds = HAPMax(maxNanoseconds, producers[i].maxNanoseconds);
+        numRetries += producers[i].numRetries;
+    }
+    size_t numCallbacks = numProducers * kNumCallbacksPerProducer;
+    HAPAssert(numReceivedCallbacks == numCallbacks);
+    HAPAssert(after.callbacks.numScheduledCallbacks - before.callbacks.numScheduledCallbacks == numCallbacks);
+
+    printf("%9zu  %9.0f  %9llu  %12.0f  %7zu  %7zu  %9zu  %7zu\n",
+           numProducers,
+           (double) sumNanoseconds / (double) numCallbacks,
+           (unsigned long long) maxNanoseconds,
+           (double) numCallbacks * 1000000000 / (double) duration,
+           numRetries,
+           after.callbacks.numWakeups - before.callbacks.numWakeups,
+           after.callbacks.numCoalescedWakeups - before.callbacks.numCoalescedWakeups,
+           after.callbacks.numFailedWakeups - before.callbacks.numFailedWakeups);
+}
+
+int main(void) {
+    // The run loop only requires a key-value store to be present.
+    static HAPPlatformKeyValueStore keyValueStore;
+    HAPPlatformRunLoopCreate(&(const HAPPlatformRunLoopOptions) { .keyValueStore = &keyValueStore });
+
+    printf("%9s  %9s  %9s  %12s  %7s  %7s  %9s  %7s\n",
+           "Producers",
+           "Avg (ns)",
+           "Max (ns)",
+           "Callbacks/s",
+           "Retries",
+           "Wakeups",
+           "Coalesced",
+           "Failed");
+    static const size_t numProducersToMeasure[] = { 1, 2, 4, 8 };
+    for (size_t i = 0; i < HAPArrayCount(numProducersToMeasure); i++) {
+        MeasureProducers(numProducersToMeasure[i]);
+    }
+
+    HAPPlatformRunLoopStatistics statistics;
+    HAPPlatformRunLoopGetStatistics(&statistics);
+    printf("Queue high-water mark: %zu of %zu bytes, %zu rejected while full\n",
+           statistics.callbacks.numBytesHighWaterMark,
+           statistics.callbacks.maxBytes,
+           statistics.callbacks.numDroppedCallbacks);
+
+    HAPPlatformRunLoopRelease();
+    return 0;
+}
@@ -0,0 +1,171 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmark of draining bursts of 1, 16 and 256 callbacks that were scheduled with HAPPlatformRunLoopScheduleCallback
+// before the run loop got to process them. Reports the cost per callback of scheduling and of draining the ring buffer,
+// next to a reference that decodes the same records from a flat buffer, moving the remaining bytes down after each
+// callback like the former loopback buffer did. Checks that every burst is drained in order with a single wakeup.
+
+#include <stdio.h>
+#include <time.h>
+
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformClock+Init.h"
+#include "HAPPlatformKeyValueStore+Init.h"
+#include "HAPPlatformRunLoop+Init.h"
+
+/** Maximum number of callbacks in a burst. Must fit into CONFIG_HAP_RUN_LOOP_CALLBACK_BUFFER_SIZE. */
+#define kMaxBurstSize ((size_t) 256)
+
+/** Number of callbacks that are measured for each burst size. */
+#define kNumCallbacksPerBurstSize ((size_t) 256 * 1024)
+
+typedef struct {
+    uint32_t sequenceNumber;
+    uint32_t burstSize;
+} CallbackContext;
+
+/** Record of the reference, laid out like a record of the former loopback buffer. */
+typedef struct {
+    HAPPlatformRunLoopCallback callback;
+    size_t contextSize;
+    CallbackContext context;
+} ReferenceRecord;
+
+static uint32_t lastSequenceNumber;
+static volatile uint32_t referenceSum;
+
+static uint64_t GetNanoseconds(void) {
+    struct timespec now;
+    int e = clock_gettime(CLOCK_MONOTONIC, &now);
+    HAPAssert(!e);
+    return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
+static void HandleCallback(void* _Nullable context_, size_t contextSize) {
+    HAPPrecondition(context_);
+    HAPPrecondition(contextSize == sizeof(CallbackContext));
+    const CallbackContext* context = context_;
+    HAPAssert(context->sequenceNumber == lastSequenceNumber + 1);
+    lastSequenceNumber = context->sequenceNumber;
+
+    if (context->sequenceNumber == context->burstSize) {
+        HAPPlatformRunLoopStop();
+    }
+}
+
+static void HandleReferenceCallback(void* _Nullable context_, size_t contextSize) {
+    HAPPrecondition(context_);
+    HAPPrecondition(contextSize == sizeof(CallbackContext));
+    const CallbackContext* context = context_;
+    referenceSum += context->sequenceNumber;
+}
+
+/**
+ * Drains a burst from a flat buffer, moving the remaining records down after each one.
+ */
+static void DrainReferenceBurst(uint8_t* bytes, size_t numBytes) {
+    while (numBytes) {
+        HAPAssert(numBytes >= sizeof(ReferenceRecord));
+        ReferenceRecord record;
+        HAPRawBufferCopyBytes(&record, bytes, sizeof record);
+        numBytes -= sizeof record;
+        HAPRawBufferCopyBytes(bytes, &bytes[sizeof record], numBytes);
+        record.callback(&record.context, record.contextSize);
+    }
+}
+
+static void MeasureBurstSize(size_t burstSize) {
+    HAPPrecondition(burstSize && burstSize <= kMaxBurstSize);
+    size_t numBursts = kNumCallbacksPerBurstSize / burstSize;
+
+    HAPPlatformRunLoopStatistics before;
+    HAPPlatformRunLoopGetStatistics(&before);
+
+    uint64_t scheduleNanoseconds = 0;
+    uint64_t drainNanoseconds = 0;
+    for (size_t i = 0; i < numBursts; i++) {
+        uint64_t startTime = GetNanoseconds();
+        for (uint32_t j = 1; j <= burstSize; j++) {
+            CallbackContext context = { .sequenceNumber = j, .burstSize = (uint32_t) burstSize };
+            HAPError err = HAPPlatformRunLoopScheduleCallback(HandleCallback, &context, sizeof context);
+            HAPAssert(!err);
+        }
+        uint64_t drainStartTime = GetNanoseconds();
+        lastSequenceNumber = 0;
+        HAPPlatformRunLoopRun();
+        HAPAssert(lastSequenceNumber == burstSize);
+        uint64_t endTime = GetNanoseconds();
+        scheduleNanoseconds += drainStartTime - startTime;
+        drainNanoseconds += endTime - drainStartTime;
+    }
+
+    HAPPlatformRunLoopStatistics after;
+    HAPPlatformRunLoopGetStatistics(&after);
+    size_t numCallbacks = numBursts * burstSize;
+    HAPAssert(after.callbacks.numScheduledCallbacks - before.callbacks.numScheduledCallbacks == numCallbacks);
+    HAPAssert(after.callbacks.numDroppedCallbacks == before.callbacks.numDroppedCallbacks);
+    HAPAssert(after.callbacks.numWakeups - before.callbacks.numWakeups == numBursts);
+    HAPAssert(after.callbacks.numCoalescedWakeups - before.callbacks.numCoalescedWakeups == numCallbacks - numBursts);
+
+    static uint8_t referenceBytes[kMaxBurstSize * sizeof(ReferenceRecord)];
+    uint64_t referenceNanoseconds = 0;
+    for (size_t i = 0; i < numBursts; i++) {
+        for (uint32_t j = 1; j <= burstSize; j++) {
+            ReferenceRecord record = { .callback = HandleReferenceCallback,
+                                       .contextSize = sizeof record.context,
+                                       .context = { .sequenceNumber = j, .burstSize = (uint32_t) burstSize } };
+            HAPRawBufferCopyBytes(&referenceBytes[(j - 1) * sizeof record], &record, sizeof record);
+        }
+        uint64_t startTime = GetNanoseconds();
+        DrainReferenceBurst(referenceBytes, burstSize * sizeof(ReferenceRecord));
+        referenceNanoseconds += GetNanoseconds() - startTime;
+    }
+
+    printf("%5zu  %13.1f  %10.1f  %14.1f  %7zu\n",
+           burstSize,
+           (double) scheduleNanoseconds / (double) numCallbacks,
+           (double) drainNanoseconds / (double) numCallbacks,
+           (double) referenceNanoseconds / (double) numCallbacks,
+           after.callbacks.numWakeups - before.callbacks.numWakeups);
+}
+
+int main(void) {
+    // The run loop only requires a key-value store to be present.
+    static HAPPlatformKeyValueStore keyValueStore;
+    HAPPlatformRunLoopCreate(&(const HAPPlatformRunLoopOptions) { .keyValueStore = &keyValueStore });
+
+    printf("%5s  %13s  %10s  %14s  %7s\n", "Burst", "Schedule (ns)", "Drain (ns)", "Reference (ns)", "Wakeups");
+    static const size_t burstSizes[] = { 1, 16, 256 };
+    for (size_t i = 0; i < HAPArrayCount(burstSizes); i++) {
+        MeasureBurstSize(burstSizes[i]);
+    }
+
+    HAPPlatformRunLoopStatistics statistics;
+    HAPPlatformRunLoopGetStatistics(&statistics);
+    printf("Queue high-water mark: %zu of %zu bytes\n",
+           statistics.callbacks.numBytesHighWaterMark,
+           statistics.callbacks.maxBytes);
+    fflush(stdout);
+    HAPAssert(statistics.callbacks.numBytesHighWaterMark <= statistics.callbacks.maxBytes);
+
+    HAPPlatformRunLoopRelease();
+    return 0;
+}
@@ -0,0 +1,420 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Test of the file handle paths of the run loop. The test is built once for each backend that waits for file handle
+// events: `select`, `poll` (CONFIG_HAP_RUN_LOOP_BACKEND_POLL) and `epoll` (CONFIG_HAP_RUN_LOOP_BACKEND_EPOLL).
+// Covers readability, writability, urgent data, hang-ups, interest updates, deregistration of file handles that are
+// already reported as ready, reuse of file descriptors, and more file handles than are initially preallocated.
+
+#include <netinet/in.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformClock+Init.h"
+#include "HAPPlatformKeyValueStore+Init.h"
+#include "HAPPlatformRunLoop+Init.h"
+
+#if defined(CONFIG_HAP_RUN_LOOP_BACKEND_EPOLL)
+#define kBackendName "epoll"
+#elif defined(CONFIG_HAP_RUN_LOOP_BACKEND_POLL)
+#define kBackendName "poll"
+#else
+#define kBackendName "select"
+#endif
+
+/** Time after which a test step is considered to hang. */
+#define kStepTimeout ((HAPTime)(5 * HAPSecond))
+
+/** Time during which no further callbacks may be invoked after a test step. */
+#define kQuietDuration ((HAPTime) 20)
+
+/** Number of file handles of the test with many file handles. Exceeds the preallocated file handles. */
+#define kNumManyFileHandles ((size_t) 200)
+
+typedef struct {
+    int fileDescriptors[2];
+    HAPPlatformFileHandleRef fileHandle;
+    size_t numCallbacks;
+    HAPPlatformFileHandleEvent lastEvents;
+} Endpoint;
+
+static void HandleStepTimeoutExpired(HAPPlatformTimerRef timer HAP_UNUSED, void* _Nullable context HAP_UNUSED) {
+    fprintf(stderr, "Test step did not complete in time.\n");
+    HAPFatalError();
+}
+
+static void HandleQuietTimerExpired(HAPPlatformTimerRef timer HAP_UNUSED, void* _Nullable context HAP_UNUSED) {
+    HAPPlatformRunLoopStop();
+}
+
+/**
+ * Runs the run loop until a callback stops it.
+ */
+static void RunUntilStopped(void) {
+    HAPPlatformTimerRef timer;
+    HAPError err = HAPPlatformTimerRegister(
+            &timer, HAPPlatformClockGetCurrent() + kStepTimeout, HandleStepTimeoutExpired, NULL);
+    HAPAssert(!err);
+    HAPPlatformRunLoopRun();
+    HAPPlatformTimerDeregister(timer);
+}
+
+/**
+ * Runs the run loop for a short time, so that callbacks that are not expected have a chance to be invoked.
+ */
+static void RunQuietly(void) {
+    HAPPlatformTimerRef timer;
+    HAPError err = HAPPlatformTimerRegister(
+            &timer, HAPPlatformClockGetCurrent() + kQuietDuration, HandleQuietTimerExpired, NULL);
+    HAPAssert(!err);
+    HAPPlatformRunLoopRun();
+}
+
+static void OpenEndpoint(Endpoint* endpoint) {
+    HAPPrecondition(endpoint);
+
+    HAPRawBufferZero(endpoint, sizeof *endpoint);
+    int e = socketpair(AF_UNIX, SOCK_STREAM, 0, endpoint->fileDescriptors);
+    HAPAssert(!e);
+}
+
+static void CloseEndpoint(Endpoint* endpoint) {
+    HAPPrecondition(endpoint);
+
+    if (endpoint->fileHandle) {
+        HAPPlatformFileHandleDeregister(endpoint->fileHandle);
+        endpoint->fileHandle = 0;
+    }
+    for (size_t i = 0; i < HAPArrayCount(endpoint->fileDescriptors); i++) {
+        if (endpoint->fileDescriptors[i] != -1) {
+            close(endpoint->fileDescriptors[i]);
+            endpoint->fileDescriptors[i] = -1;
+        }
+    }
+}
+
+static void RegisterEndpoint(
+        Endpoint* endpoint,
+        HAPPlatformFileHandleEvent interests,
+        HAPPlatformFileHandleCallback callback) {
+    HAPPrecondition(endpoint);
+
+    HAPError err = HAPPlatformFileHandleRegister(
+            &endpoint->fileHandle, endpoint->fileDescriptors[0], interests, callback, endpoint);
+    HAPAssert(!err);
+}
+
+static void SendByte(int fileDescriptor) {
+    uint8_t byte = 0x5A;
+    ssize_t n = send(fileDescriptor, &byte, sizeof byte, 0);
+    HAPAssert(n == (ssize_t) sizeof byte);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void HandleReadableCallback(
+        HAPPlatformFileHandleRef fileHandle,
+        HAPPlatformFileHandleEvent fileHandleEvents,
+        void* _Nullable context) {
+    HAPPrecondition(context);
+    Endpoint* endpoint = context;
+    HAPAssert(fileHandle == endpoint->fileHandle);
+
+    endpoint->numCallbacks++;
+    endpoint->lastEvents = fileHandleEvents;
+    uint8_t bytes[16];
+    ssize_t n = recv(endpoint->fileDescriptors[0], bytes, sizeof bytes, 0);
+    HAPAssert(n >= 0);
+    HAPPlatformRunLoopStop();
+}
+
+static void TestReadable(void) {
+    Endpoint endpoint;
+    OpenEndpoint(&endpoint);
+    RegisterEndpoint(&endpoint, (HAPPlatformFileHandleEvent) { .isReadyForReading = true }, HandleReadableCallback);
+
+    RunQuietly();
+    HAPAssert(!endpoint.numCallbacks);
+
+    SendByte(endpoint.fileDescriptors[1]);
+    RunUntilStopped();
+    HAPAssert(endpoint.numCallbacks == 1);
+    HAPAssert(endpoint.lastEvents.isReadyForReading);
+    HAPAssert(!endpoint.lastEvents.isReadyForWriting);
+    HAPAssert(!endpoint.lastEvents.hasErrorConditionPending);
+
+    // The byte has been consumed.
+    RunQuietly();
+    HAPAssert(endpoint.numCallbacks == 1);
+
+    // Closing the peer is reported as readable.
+    close(endpoint.fileDescriptors[1]);
+    endpoint.fileDescriptors[1] = -1;
+    RunUntilStopped();
+    HAPAssert(endpoint.numCallbacks == 2);
+    HAPAssert(endpoint.lastEvents.isReadyForReading);
+
+    CloseEndpoint(&endpoint);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void HandleWritableCallback(
+        HAPPlatformFileHandleRef fileHandle,
+        HAPPlatformFileHandleEvent fileHandleEvents,
+        void* _Nullable context) {
+    HAPPrecondition(context);
+    Endpoint* endpoint = context;
+    HAPAssert(fileHandle == endpoint->fileHandle);
+
+    endpoint->numCallbacks++;
+    endpoint->lastEvents = fileHandleEvents;
+
+    // Stop monitoring from within the callback.
+    HAPPlatformFileHandleUpdateInterests(
+            fileHandle, (HAPPlatformFileHandleEvent) { .isReadyForWriting = false }, HandleWritableCallback, context);
+    HAPPlatformRunLoopStop();
+}
+
+static void TestInterestUpdates(void) {
+    Endpoint endpoint;
+    OpenEndpoint(&endpoint);
+    RegisterEndpoint(&endpoint, (HAPPlatformFileHandleEvent) { .isReadyForWriting = false }, HandleWritableCallback);
+
+    // Without interests, the file handle is not monitored even though it is writable.
+    RunQuietly();
+    HAPAssert(!endpoint.numCallbacks);
+
+    HAPPlatformFileHandleUpdateInterests(
+            endpoint.fileHandle,
+            (HAPPlatformFileHandleEvent) { .isReadyForWriting = true },
+            HandleWritableCallback,
+            &endpoint);
+    RunUntilStopped();
+    HAPAssert(endpoint.numCallbacks == 1);
+    HAPAssert(endpoint.lastEvents.isReadyForWriting);
+    HAPAssert(!endpoint.lastEvents.isReadyForReading);
+
+    // Interests were cleared by the callback.
+    RunQuietly();
+    HAPAssert(endpoint.numCallbacks == 1);
+
+    // Events that are not of interest are not reported.
+    SendByte(endpoint.fileDescriptors[1]);
+    RunQuietly();
+    HAPAssert(endpoint.numCallbacks == 1);
+
+    CloseEndpoint(&endpoint);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static Endpoint pairedEndpoints[2];
+
+static void HandlePairedCallback(
+        HAPPlatformFileHandleRef fileHandle,
+        HAPPlatformFileHandleEvent fileHandleEvents,
+        void* _Nullable context) {
+    HAPPrecondition(context);
+    Endpoint* endpoint = context;
+    HAPAssert(fileHandle == endpoint->fileHandle);
+    HAPAssert(fileHandleEvents.isReadyForReading);
+    endpoint->numCallbacks++;
+
+    // Both file handles are ready. Deregister and close the other one before its callback is invoked.
+    for (size_t i = 0; i < HAPArrayCount(pairedEndpoints); i++) {
+        CloseEndpoint(&pairedEndpoints[i]);
+    }
+    HAPPlatformRunLoopStop();
+}
+
+static void TestDeregisterReady(void) {
+    for (size_t i = 0; i < HAPArrayCount(pairedEndpoints); i++) {
+        OpenEndpoint(&pairedEndpoints[i]);
+        RegisterEndpoint(
+                &pairedEndpoints[i],
+                (HAPPlatformFileHandleEvent) { .isReadyForReading = true },
+                HandlePairedCallback);
+        SendByte(pairedEndpoints[i].fileDescriptors[1]);
+    }
+
+    RunUntilStopped();
+    RunQuietly();
+    HAPAssert(pairedEndpoints[0].numCallbacks + pairedEndpoints[1].numCallbacks == 1);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void TestReusedFileDescriptor(void) {
+    // Close the file descriptor before deregistering the file handle, then reuse the file descriptor number.
+    Endpoint endpoint;
+    OpenEndpoint(&endpoint);
+    RegisterEndpoint(&endpoint, (HAPPlatformFileHandleEvent) { .isReadyForReading = true }, HandleReadableCallback);
+    int fileDescriptor = endpoint.fileDescriptors[0];
+    close(endpoint.fileDescriptors[0]);
+    close(endpoint.fileDescriptors[1]);
+    HAPPlatformFileHandleDeregister(endpoint.fileHandle);
+
+    OpenEndpoint(&endpoint);
+    HAPAssert(endpoint.fileDescriptors[0] == fileDescriptor);
+    RegisterEndpoint(&endpoint, (HAPPlatformFileHandleEvent) { .isReadyForReading = true }, HandleReadableCallback);
+    SendByte(endpoint.fileDescriptors[1]);
+    RunUntilStopped();
+    HAPAssert(endpoint.numCallbacks == 1);
+
+    CloseEndpoint(&endpoint);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static Endpoint manyEndpoints[kNumManyFileHandles];
+static size_t numManyCallbacks;
+
+static void HandleManyCallback(
+        HAPPlatformFileHandleRef fileHandle,
+        HAPPlatformFileHandleEvent fileHandleEvents,
+        void* _Nullable context) {
+    HAPPrecondition(context);
+    Endpoint* endpoint = context;
+    HAPAssert(fileHandle == endpoint->fileHandle);
+    HAPAssert(fileHandleEvents.isReadyForReading);
+
+    uint8_t byte;
+    ssize_t n = recv(endpoint->fileDescriptors[0], &byte, sizeof byte, 0);
+    HAPAssert(n == (ssize_t) sizeof byte);
+    endpoint->numCallbacks++;
+    numManyCallbacks++;
+    if (numManyCallbacks == kNumManyFileHandles) {
+        HAPPlatformRunLoopStop();
+    }
+}
+
+static void TestManyFileHandles(void) {
+    for (size_t i = 0; i < kNumManyFileHandles; i++) {
+        OpenEndpoint(&manyEndpoints[i]);
+        RegisterEndpoint(
+                &manyEndpoints[i], (HAPPlatformFileHandleEvent) { .isReadyForReading = true }, HandleManyCallback);
+    }
+    for (size_t i = 0; i < kNumManyFileHandles; i++) {
+        SendByte(manyEndpoints[i].fileDescriptors[1]);
+    }
+
+    RunUntilStopped();
+    RunQuietly();
+    for (size_t i = 0; i < kNumManyFileHandles; i++) {
+        HAPAssert(manyEndpoints[i].numCallbacks == 1);
+        CloseEndpoint(&manyEndpoints[i]);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void HandleUrgentCallback(
+        HAPPlatformFileHandleRef fileHandle,
+        HAPPlatformFileHandleEvent fileHandleEvents,
+        void* _Nullable context) {
+    HAPPrecondition(context);
+    Endpoint* endpoint = context;
+    HAPAssert(fileHandle == endpoint->fileHandle);
+
+    endpoint->numCallbacks++;
+    endpoint->lastEvents = fileHandleEvents;
+    uint8_t byte;
+    ssize_t n = recv(endpoint->fileDescriptors[0], &byte, sizeof byte, MSG_OOB);
+    HAPAssert(n == (ssize_t) sizeof byte);
+    HAPPlatformRunLoopStop();
+}
+
+static void TestErrorCondition(void) {
+    // Urgent data on a TCP connection is reported as an error condition, like by `select`.
+    int listenerFileDescriptor = socket(AF_INET, SOCK_STREAM, 0);
+    HAPAssert(listenerFileDescriptor != -1);
+    struct sockaddr_in address = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t addressLength = sizeof address;
+    int e = bind(listenerFileDescriptor, (const struct sockaddr*) &address, sizeof address);
+    HAPAssert(!e);
+    e = listen(listenerFileDescriptor, 1);
+    HAPAssert(!e);
+    e = getsockname(listenerFileDescriptor, (struct sockaddr*) &address, &addressLength);
+    HAPAssert(!e);
+
+    Endpoint endpoint;
+    HAPRawBufferZero(&endpoint, sizeof endpoint);
+    endpoint.fileDescriptors[1] = socket(AF_INET, SOCK_STREAM, 0);
+    HAPAssert(endpoint.fileDescriptors[1] != -1);
+    e = connect(endpoint.fileDescriptors[1], (const struct sockaddr*) &address, sizeof address);
+    HAPAssert(!e);
+    endpoint.fileDescriptors[0] = accept(listenerFileDescriptor, NULL, NULL);
+    HAPAssert(endpoint.fileDescriptors[0] != -1);
+    close(listenerFileDescriptor);
+
+    RegisterEndpoint(
+            &endpoint, (HAPPlatformFileHandleEvent) { .hasErrorConditionPending = true }, HandleUrgentCallback);
+    uint8_t byte = 0xA5;
+    ssize_t n = send(endpoint.fileDescriptors[1], &byte, sizeof byte, MSG_OOB);
+    HAPAssert(n == (ssize_t) sizeof byte);
+    RunUntilStopped();
+    HAPAssert(endpoint.numCallbacks == 1);
+    HAPAssert(endpoint.lastEvents.hasErrorConditionPending);
+    HAPAssert(!endpoint.lastEvents.isReadyForReading);
+
+    CloseEndpoint(&endpoint);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int main(void) {
+    // The run loop only requires a key-value store to be present.
+    static HAPPlatformKeyValueStore keyValueStore;
+    HAPPlatformRunLoopCreate(&(const HAPPlatformRunLoopOptions) {
+            .keyValueStore = &keyValueStore, .maxFileHandles = 4, .allowHeapFallback = true });
+
+    static const struct {
+        const char* name;
+        void (*function)(void);
+    } tests[] = {
+        { "Readable and hang-up", TestReadable },
+        { "Interest updates", TestInterestUpdates },
+        { "Deregistration of a ready file handle", TestDeregisterReady },
+        { "Reused file descriptor", TestReusedFileDescriptor },
+        { "Many file handles", TestManyFileHandles },
+        { "Urgent data", TestErrorCondition },
+    };
+    for (size_t i = 0; i < HAPArrayCount(tests); i++) {
+        tests[i].function();
+        printf("%-6s  %-40s  ok\n", kBackendName, tests[i].name);
+    }
+
+    HAPPlatformRunLoopStatistics statistics;
+    HAPPlatformRunLoopGetStatistics(&statistics);
+    printf("%-6s  File handles: high-water mark %zu, %zu preallocated, %zu heap allocations\n",
+           kBackendName,
+           statistics.fileHandles.numObjectsHighWaterMark,
+           statistics.fileHandles.maxObjects,
+           statistics.fileHandles.numHeapAllocations);
+    fflush(stdout);
+    // Only the loopback file handle of the run loop remains.
+    HAPAssert(statistics.fileHandles.numObjects == 1);
+
+    HAPPlatformRunLoopRelease();
+    return 0;
+}
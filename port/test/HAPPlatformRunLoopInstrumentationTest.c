@@ -0,0 +1,260 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Test of the run loop instrumentation (CONFIG_HAP_RUN_LOOP_INSTRUMENTATION). Runs timers and scheduled callbacks of
+// known duration and checks the histogram buckets into which the wait time, dispatch time and timer lateness fall, and
+// that the slowest callbacks are attributed to the right functions.
+
+#include <stdio.h>
+
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformClock+Init.h"
+#include "HAPPlatformKeyValueStore+Init.h"
+#include "HAPPlatformRunLoop+Init.h"
+
+/** Number of periodic timers and of scheduled callbacks. */
+#define kNumInvocations ((size_t) 20)
+
+/** Time between a periodic timer callback and the deadline of the next timer, in milliseconds. */
+#define kTimerInterval ((HAPTime) 12)
+
+/** Duration of a periodic timer callback and of a scheduled callback, in microseconds. */
+#define kCallbackDuration ((uint64_t) 2300)
+
+/** Duration of the blocking timer callback, in microseconds. */
+#define kBlockingCallbackDuration ((uint64_t) 24000)
+
+/** Time between the deadline of the blocking timer and the deadline of the late timer, in milliseconds. */
+#define kLateTimerOffset ((HAPTime) 4)
+
+/**
+ * Minimum number of samples expected in the bucket of a known duration. The remaining samples may fall into later
+ * buckets when the test is preempted.
+ */
+#define kMinSamplesInBucket ((uint32_t)(kNumInvocations * 3 / 4))
+
+static size_t numInvocations;
+
+/**
+ * Returns the index of the histogram bucket that counts the given value.
+ */
+static size_t GetBucketIndex(uint64_t value) {
+    size_t i = value ? (size_t)(64 - __builtin_clzll(value)) : 0;
+    return HAPMin(i, kHAPPlatformRunLoopHistogram_NumBuckets - 1);
+}
+
+/**
+ * Returns the number of samples in the buckets counting values in [minValue, maxValue].
+ */
+static uint32_t CountSamples(const HAPPlatformRunLoopHistogram* histogram, uint64_t minValue, uint64_t maxValue) {
+    uint32_t numSamples = 0;
+    for (size_t i = GetBucketIndex(minValue); i <= GetBucketIndex(maxValue); i++) {
+        numSamples += histogram->numSamplesPerBucket[i];
+    }
+    return numSamples;
+}
+
+static const HAPPlatformRunLoopSlowCallback* _Nullable FindSlowCallback(
+        const HAPPlatformRunLoopInstrumentation* instrumentation,
+        const void* function) {
+    for (size_t i = 0; i < instrumentation->numSlowestCallbacks; i++) {
+        if (instrumentation->slowestCallbacks[i].function == function) {
+            return &instrumentation->slowestCallbacks[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Spins for the given duration. Unlike sleeping, this does not depend on how soon the thread is woken up again.
+ */
+static void Spin(uint64_t microseconds) {
+    uint64_t startTime = HAPPlatformClockGetCurrentMicroseconds();
+    while (HAPPlatformClockGetCurrentMicroseconds() - startTime < microseconds) {
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void HandlePeriodicTimerExpired(HAPPlatformTimerRef timer HAP_UNUSED, void* _Nullable context HAP_UNUSED) {
+    Spin(kCallbackDuration);
+    numInvocations++;
+    if (numInvocations == kNumInvocations) {
+        HAPPlatformRunLoopStop();
+        return;
+    }
+    HAPPlatformTimerRef nextTimer;
+    HAPError err = HAPPlatformTimerRegister(
+            &nextTimer, HAPPlatformClockGetCurrent() + kTimerInterval, HandlePeriodicTimerExpired, NULL);
+    HAPAssert(!err);
+}
+
+static void TestPeriodicTimers(void) {
+    HAPPlatformRunLoopResetInstrumentation();
+    numInvocations = 0;
+    HAPPlatformTimerRef timer;
+    HAPError err = HAPPlatformTimerRegister(
+            &timer, HAPPlatformClockGetCurrent() + kTimerInterval, HandlePeriodicTimerExpired, NULL);
+    HAPAssert(!err);
+    HAPPlatformRunLoopRun();
+    HAPAssert(numInvocations == kNumInvocations);
+
+    HAPPlatformRunLoopInstrumentation instrumentation;
+    HAPPlatformRunLoopGetInstrumentation(&instrumentation);
+    HAPPlatformRunLoopLogInstrumentation();
+    printf("Periodic timers: %llu iterations, wait time bucket %zu: %u, dispatch time bucket %zu: %u\n",
+           (unsigned long long) instrumentation.numIterations,
+           GetBucketIndex(kTimerInterval * 1000),
+           instrumentation.waitTime.numSamplesPerBucket[GetBucketIndex(kTimerInterval * 1000)],
+           GetBucketIndex(kCallbackDuration),
+           instrumentation.dispatchTime.numSamplesPerBucket[GetBucketIndex(kCallbackDuration)]);
+    fflush(stdout);
+
+    // Every timer fires in its own iteration after waiting for the interval.
+    HAPAssert(instrumentation.numIterations >= kNumInvocations);
+    HAPAssert(instrumentation.waitTime.numSamples == instrumentation.numIterations);
+    HAPAssert(instrumentation.dispatchTime.numSamples == instrumentation.numIterations);
+    HAPAssert(CountSamples(&instrumentation.waitTime, (kTimerInterval - 1) * 1000, UINT64_MAX) == kNumInvocations);
+    HAPAssert(
+            instrumentation.waitTime.numSamplesPerBucket[GetBucketIndex(kTimerInterval * 1000)] >= kMinSamplesInBucket);
+    HAPAssert(CountSamples(&instrumentation.dispatchTime, kCallbackDuration, UINT64_MAX) == kNumInvocations);
+    HAPAssert(
+            instrumentation.dispatchTime.numSamplesPerBucket[GetBucketIndex(kCallbackDuration)] >= kMinSamplesInBucket);
+    HAPAssert(instrumentation.dispatchTime.sumValues >= kNumInvocations * kCallbackDuration);
+
+    // Timers fire within a few milliseconds of their deadline.
+    HAPAssert(instrumentation.timerLateness.numSamples == kNumInvocations);
+    HAPAssert(CountSamples(&instrumentation.timerLateness, 0, 3) == kNumInvocations);
+
+    const HAPPlatformRunLoopSlowCallback* slowCallback =
+            FindSlowCallback(&instrumentation, (const void*) (uintptr_t) HandlePeriodicTimerExpired);
+    HAPAssert(slowCallback);
+    HAPAssert(slowCallback == &instrumentation.slowestCallbacks[0]);
+    HAPAssert(slowCallback->kind == kHAPPlatformRunLoopCallbackKind_Timer);
+    HAPAssert(slowCallback->numInvocations == kNumInvocations);
+    HAPAssert(slowCallback->maxMicroseconds >= kCallbackDuration);
+    HAPAssert(slowCallback->sumMicroseconds >= kNumInvocations * kCallbackDuration);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void HandleBlockingTimerExpired(HAPPlatformTimerRef timer HAP_UNUSED, void* _Nullable context HAP_UNUSED) {
+    Spin(kBlockingCallbackDuration);
+}
+
+static void HandleLateTimerExpired(HAPPlatformTimerRef timer HAP_UNUSED, void* _Nullable context HAP_UNUSED) {
+    HAPPlatformRunLoopStop();
+}
+
+static void TestLateTimer(void) {
+    // The late timer becomes due while the blocking timer callback runs, so it fires late by about the difference.
+    HAPPlatformRunLoopResetInstrumentation();
+    HAPTime now = HAPPlatformClockGetCurrent();
+    HAPPlatformTimerRef timer;
+    HAPError err = HAPPlatformTimerRegister(&timer, now + 1, HandleBlockingTimerExpired, NULL);
+    HAPAssert(!err);
+    err = HAPPlatformTimerRegister(&timer, now + 1 + kLateTimerOffset, HandleLateTimerExpired, NULL);
+    HAPAssert(!err);
+    HAPPlatformRunLoopRun();
+
+    HAPPlatformRunLoopInstrumentation instrumentation;
+    HAPPlatformRunLoopGetInstrumentation(&instrumentation);
+    uint64_t expectedLateness = kBlockingCallbackDuration / 1000 - kLateTimerOffset;
+    printf("Late timer: lateness %llu ms, bucket %zu: %u\n",
+           (unsigned long long) instrumentation.timerLateness.maxValue,
+           GetBucketIndex(expectedLateness),
+           instrumentation.timerLateness.numSamplesPerBucket[GetBucketIndex(expectedLateness)]);
+    fflush(stdout);
+
+    HAPAssert(instrumentation.timerLateness.numSamples == 2);
+    HAPAssert(instrumentation.timerLateness.numSamplesPerBucket[GetBucketIndex(expectedLateness)] == 1);
+    HAPAssert(instrumentation.timerLateness.maxValue >= expectedLateness);
+    HAPAssert(CountSamples(&instrumentation.dispatchTime, kBlockingCallbackDuration, UINT64_MAX) == 1);
+
+    HAPAssert(instrumentation.numSlowestCallbacks == 2);
+    const HAPPlatformRunLoopSlowCallback* slowCallback = &instrumentation.slowestCallbacks[0];
+    HAPAssert(slowCallback->function == (const void*) (uintptr_t) HandleBlockingTimerExpired);
+    HAPAssert(slowCallback->kind == kHAPPlatformRunLoopCallbackKind_Timer);
+    HAPAssert(slowCallback->numInvocations == 1);
+    HAPAssert(slowCallback->maxMicroseconds >= kBlockingCallbackDuration);
+    HAPAssert(instrumentation.slowestCallbacks[1].function == (const void*) (uintptr_t) HandleLateTimerExpired);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void HandleScheduledCallback(void* _Nullable context HAP_UNUSED, size_t contextSize HAP_UNUSED) {
+    Spin(kCallbackDuration);
+    numInvocations++;
+    HAPPlatformRunLoopStop();
+}
+
+static void TestScheduledCallbacks(void) {
+    HAPPlatformRunLoopResetInstrumentation();
+    numInvocations = 0;
+    for (size_t i = 0; i < kNumInvocations; i++) {
+        HAPError err = HAPPlatformRunLoopScheduleCallback(HandleScheduledCallback, NULL, 0);
+        HAPAssert(!err);
+        HAPPlatformRunLoopRun();
+    }
+    HAPAssert(numInvocations == kNumInvocations);
+
+    HAPPlatformRunLoopInstrumentation instrumentation;
+    HAPPlatformRunLoopGetInstrumentation(&instrumentation);
+    printf("Scheduled callbacks: %llu iterations, dispatch time bucket %zu: %u\n",
+           (unsigned long long) instrumentation.numIterations,
+           GetBucketIndex(kCallbackDuration),
+           instrumentation.dispatchTime.numSamplesPerBucket[GetBucketIndex(kCallbackDuration)]);
+    fflush(stdout);
+
+    HAPAssert(CountSamples(&instrumentation.dispatchTime, kCallbackDuration, UINT64_MAX) == kNumInvocations);
+    HAPAssert(
+            instrumentation.dispatchTime.numSamplesPerBucket[GetBucketIndex(kCallbackDuration)] >= kMinSamplesInBucket);
+    HAPAssert(!instrumentation.timerLateness.numSamples);
+
+    const HAPPlatformRunLoopSlowCallback* slowCallback =
+            FindSlowCallback(&instrumentation, (const void*) (uintptr_t) HandleScheduledCallback);
+    HAPAssert(slowCallback);
+    HAPAssert(slowCallback == &instrumentation.slowestCallbacks[0]);
+    HAPAssert(slowCallback->kind == kHAPPlatformRunLoopCallbackKind_ScheduledCallback);
+    HAPAssert(slowCallback->numInvocations == kNumInvocations);
+    HAPAssert(slowCallback->maxMicroseconds >= kCallbackDuration);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+int main(void) {
+    // The run loop only requires a key-value store to be present.
+    static HAPPlatformKeyValueStore keyValueStore;
+    HAPPlatformRunLoopCreate(&(const HAPPlatformRunLoopOptions) { .keyValueStore = &keyValueStore });
+
+    TestPeriodicTimers();
+    TestLateTimer();
+    TestScheduledCallbacks();
+
+    HAPPlatformRunLoopResetInstrumentation();
+    HAPPlatformRunLoopInstrumentation instrumentation;
+    HAPPlatformRunLoopGetInstrumentation(&instrumentation);
+    HAPAssert(!instrumentation.numIterations);
+    HAPAssert(!instrumentation.waitTime.numSamples);
+    HAPAssert(!instrumentation.numSlowestCallbacks);
+
+    HAPPlatformRunLoopRelease();
+    return 0;
+}
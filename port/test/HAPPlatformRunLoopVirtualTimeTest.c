@@ -0,0 +1,258 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Simulation of accessory traffic with the virtual time run loop (CONFIG_HAP_VIRTUAL_TIME). A scripted driver injects
+// requests on the file handles of several sessions at pseudo random times. Each request pushes back the idle timeout
+// of its session, and a periodic housekeeping timer runs with some leeway. The simulation runs twice to check that it
+// is deterministic, and reports how much faster than real time it ran.
+
+#include <stdio.h>
+#include <time.h>
+
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformClock+Init.h"
+#include "HAPPlatformKeyValueStore+Init.h"
+#include "HAPPlatformRunLoop+Init.h"
+
+/** Number of simulated sessions. */
+#define kNumSessions ((size_t) 16)
+
+/** Simulated duration. */
+#define kSimulatedDuration ((HAPTime)(4 * HAPHour))
+
+/** Maximum time between two requests, over all sessions. */
+#define kMaxRequestInterval ((HAPTime)(10 * HAPSecond))
+
+/** Time after which a session without requests times out. */
+#define kSessionIdleTimeout ((HAPTime)(60 * HAPSecond))
+
+/** Housekeeping interval. */
+#define kHousekeepingInterval ((HAPTime)(10 * HAPSecond))
+
+/** Housekeeping leeway. */
+#define kHousekeepingLeeway ((HAPTime)(1 * HAPSecond))
+
+typedef struct {
+    HAPPlatformFileHandleRef fileHandle;
+    HAPPlatformTimerRef idleTimer;
+    bool isIdleTimerArmed;
+} Session;
+
+typedef struct {
+    HAPTime startTime;
+    HAPTime nextRequestTime;
+    size_t nextSessionIndex;
+    uint32_t randomState;
+
+    size_t numRequests;
+    size_t numResponses;
+    size_t numTimeouts;
+    size_t numHousekeepingRuns;
+    HAPTime maxHousekeepingLateness;
+    uint64_t traceHash;
+} Simulation;
+
+static Session sessions[kNumSessions];
+static HAPPlatformTimerRef housekeepingTimer;
+static Simulation simulation;
+
+static uint32_t GetRandomNumber(void) {
+    simulation.randomState ^= simulation.randomState << 13;
+    simulation.randomState ^= simulation.randomState >> 17;
+    simulation.randomState ^= simulation.randomState << 5;
+    return simulation.randomState;
+}
+
+/**
+ * Adds an event to the trace, identified by its kind, its session and the simulated time at which it occurred.
+ */
+static void TraceEvent(uint8_t kind, size_t sessionIndex) {
+    uint64_t values[] = { kind, sessionIndex, HAPPlatformClockGetCurrent() - simulation.startTime };
+    for (size_t i = 0; i < HAPArrayCount(values); i++) {
+        simulation.traceHash = (simulation.traceHash ^ values[i]) * 0x100000001B3;
+    }
+}
+
+static void HandleIdleTimerExpired(HAPPlatformTimerRef timer HAP_UNUSED, void* _Nullable context) {
+    HAPPrecondition(context);
+    Session* session = context;
+    session->isIdleTimerArmed = false;
+    simulation.numTimeouts++;
+    TraceEvent('T', (size_t)(session - sessions));
+}
+
+static void HandleResponse(void* _Nullable context, size_t contextSize) {
+    HAPPrecondition(context);
+    HAPPrecondition(contextSize == sizeof(size_t));
+    size_t sessionIndex = *(const size_t*) context;
+    simulation.numResponses++;
+    TraceEvent('S', sessionIndex);
+}
+
+static void HandleFileHandleCallback(
+        HAPPlatformFileHandleRef fileHandle HAP_UNUSED,
+        HAPPlatformFileHandleEvent fileHandleEvents,
+        void* _Nullable context) {
+    HAPPrecondition(context);
+    HAPPrecondition(fileHandleEvents.isReadyForReading);
+    Session* session = context;
+    size_t sessionIndex = (size_t)(session - sessions);
+    simulation.numRequests++;
+    TraceEvent('R', sessionIndex);
+
+    // Push back the idle timeout.
+    if (session->isIdleTimerArmed) {
+        HAPPlatformTimerDeregister(session->idleTimer);
+    }
+    HAPError err = HAPPlatformTimerRegister(
+            &session->idleTimer, HAPPlatformClockGetCurrent() + kSessionIdleTimeout, HandleIdleTimerExpired, session);
+    HAPAssert(!err);
+    session->isIdleTimerArmed = true;
+
+    // Respond on a later run loop iteration.
+    err = HAPPlatformRunLoopScheduleCallback(HandleResponse, &sessionIndex, sizeof sessionIndex);
+    HAPAssert(!err);
+}
+
+static void HandleHousekeepingTimerExpired(HAPPlatformTimerRef timer HAP_UNUSED, void* _Nullable context) {
+    HAPPrecondition(context);
+    HAPTime deadline = *(const HAPTime*) context;
+    HAPTime now = HAPPlatformClockGetCurrent();
+    HAPAssert(now >= deadline && now <= deadline + kHousekeepingLeeway);
+    simulation.maxHousekeepingLateness = HAPMax(simulation.maxHousekeepingLateness, now - deadline);
+    simulation.numHousekeepingRuns++;
+    TraceEvent('H', 0);
+
+    static HAPTime nextDeadline;
+    nextDeadline = deadline + kHousekeepingInterval;
+    HAPError err = HAPPlatformTimerRegisterWithLeeway(
+            &housekeepingTimer, nextDeadline, kHousekeepingLeeway, HandleHousekeepingTimerExpired, &nextDeadline);
+    HAPAssert(!err);
+}
+
+/**
+ * Scripted driver: Advances virtual time to the next request or timer deadline, and injects the next request.
+ */
+static HAPTime DriveVirtualTime(HAPTime nextWakeupTime, void* _Nullable context HAP_UNUSED) {
+    HAPTime endTime = simulation.startTime + kSimulatedDuration;
+    if (simulation.nextRequestTime >= endTime) {
+        if (!nextWakeupTime || nextWakeupTime >= endTime) {
+            HAPPlatformRunLoopStop();
+            return HAPMax(HAPPlatformClockGetCurrent(), endTime);
+        }
+        return nextWakeupTime;
+    }
+    if (nextWakeupTime && nextWakeupTime < simulation.nextRequestTime) {
+        return nextWakeupTime;
+    }
+
+    HAPPlatformFileHandleInjectEvents(
+            sessions[simulation.nextSessionIndex].fileHandle,
+            (HAPPlatformFileHandleEvent) { .isReadyForReading = true });
+    HAPTime requestTime = simulation.nextRequestTime;
+    simulation.nextRequestTime += GetRandomNumber() % kMaxRequestInterval;
+    simulation.nextSessionIndex = GetRandomNumber() % kNumSessions;
+    return requestTime;
+}
+
+static void RunSimulation(void) {
+    HAPError err;
+
+    HAPRawBufferZero(&simulation, sizeof simulation);
+    simulation.startTime = HAPPlatformClockGetCurrent();
+    simulation.nextRequestTime = simulation.startTime;
+    simulation.randomState = 1;
+    simulation.traceHash = 0xCBF29CE484222325;
+
+    // With virtual time, file descriptors are not monitored, so the sessions do not need real sockets.
+    for (size_t i = 0; i < kNumSessions; i++) {
+        err = HAPPlatformFileHandleRegister(
+                &sessions[i].fileHandle,
+                (int) i,
+                (HAPPlatformFileHandleEvent) { .isReadyForReading = true },
+                HandleFileHandleCallback,
+                &sessions[i]);
+        HAPAssert(!err);
+    }
+    static HAPTime deadline;
+    deadline = simulation.startTime + kHousekeepingInterval;
+    err = HAPPlatformTimerRegisterWithLeeway(
+            &housekeepingTimer, deadline, kHousekeepingLeeway, HandleHousekeepingTimerExpired, &deadline);
+    HAPAssert(!err);
+
+    HAPPlatformRunLoopRun();
+
+    for (size_t i = 0; i < kNumSessions; i++) {
+        if (sessions[i].isIdleTimerArmed) {
+            HAPPlatformTimerDeregister(sessions[i].idleTimer);
+            sessions[i].isIdleTimerArmed = false;
+        }
+        HAPPlatformFileHandleDeregister(sessions[i].fileHandle);
+    }
+    HAPPlatformTimerDeregister(housekeepingTimer);
+}
+
+static uint64_t GetWallClockMicroseconds(void) {
+    struct timespec now;
+    int e = clock_gettime(CLOCK_MONOTONIC, &now);
+    HAPAssert(!e);
+    return (uint64_t) now.tv_sec * 1000000 + (uint64_t) now.tv_nsec / 1000;
+}
+
+int main(void) {
+    // The run loop only requires a key-value store to be present.
+    static HAPPlatformKeyValueStore keyValueStore;
+    HAPPlatformRunLoopCreate(&(const HAPPlatformRunLoopOptions) { .keyValueStore = &keyValueStore,
+                                                                 .virtualTimeDriver = DriveVirtualTime });
+
+    uint64_t startTime = GetWallClockMicroseconds();
+    RunSimulation();
+    uint64_t duration = GetWallClockMicroseconds() - startTime;
+    Simulation firstSimulation = simulation;
+    HAPTime simulatedDuration = HAPPlatformClockGetCurrent() - firstSimulation.startTime;
+
+    RunSimulation();
+
+    printf("Simulated %llu s in %llu ms of wall time (%.0fx real time).\n",
+           (unsigned long long) (simulatedDuration / HAPSecond),
+           (unsigned long long) (duration / 1000),
+           (double) simulatedDuration * 1000 / (double) HAPMax(duration, 1));
+    printf("Requests: %zu, responses: %zu, session timeouts: %zu, housekeeping runs: %zu (up to %llu ms late)\n",
+           firstSimulation.numRequests,
+           firstSimulation.numResponses,
+           firstSimulation.numTimeouts,
+           firstSimulation.numHousekeepingRuns,
+           (unsigned long long) firstSimulation.maxHousekeepingLateness);
+    printf("Trace hash: %016llx, %016llx\n",
+           (unsigned long long) firstSimulation.traceHash,
+           (unsigned long long) simulation.traceHash);
+    fflush(stdout);
+
+    HAPAssert(simulatedDuration >= kSimulatedDuration);
+    HAPAssert(firstSimulation.numRequests > 0 && firstSimulation.numResponses == firstSimulation.numRequests);
+    HAPAssert(firstSimulation.numTimeouts > 0);
+    HAPAssert(firstSimulation.numHousekeepingRuns >= kSimulatedDuration / kHousekeepingInterval - 1);
+    HAPAssert(simulation.numRequests == firstSimulation.numRequests);
+    HAPAssert(simulation.numTimeouts == firstSimulation.numTimeouts);
+    HAPAssert(simulation.traceHash == firstSimulation.traceHash);
+
+    HAPPlatformRunLoopRelease();
+    return 0;
+}
@@ -0,0 +1,233 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Burst test of the accept path of the TCP stream manager. 50 loopback connections are established at once before
+// the run loop gets to accept them, like when several controllers reconnect after a Wi-Fi roam. The listener callback
+// accepts a single TCP stream per invocation, like the HAP layer does. The test checks that all connections are taken
+// in one readiness event, that the accept queue is empty afterwards, and reports the time until all were accepted.
+// With fewer free TCP streams than pending connections, it checks that a batch stops at the free TCP streams and that
+// the remaining connections are accepted in one more batch once TCP streams have been closed.
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformClock+Init.h"
+#include "HAPPlatformKeyValueStore+Init.h"
+#include "HAPPlatformRunLoop+Init.h"
+#include "HAPPlatformTCPStreamManager+Init.h"
+
+/** Number of connections of the burst. */
+#define kNumBurstConnections ((size_t) 50)
+
+/** Maximum number of concurrent TCP streams if all connections of the burst fit. */
+#define kMaxTCPStreams ((size_t) 64)
+
+/** Maximum number of concurrent TCP streams if not all connections of the burst fit. */
+#define kMaxLimitedTCPStreams ((size_t) 32)
+
+static HAPPlatformTCPStreamManager tcpStreamManager;
+static HAPPlatformTCPStream tcpStreams[kMaxTCPStreams];
+
+static HAPPlatformTCPStreamRef acceptedTCPStreams[kNumBurstConnections];
+static size_t numAcceptedTCPStreams;
+static size_t numTCPStreamsToAccept;
+static size_t numListenerCallbacks;
+static uint64_t lastAcceptTime;
+
+static int clientFileDescriptors[kNumBurstConnections];
+
+static uint64_t GetMicroseconds(void) {
+    struct timespec now;
+    int e = clock_gettime(CLOCK_MONOTONIC, &now);
+    HAPAssert(!e);
+    return (uint64_t) now.tv_sec * 1000000 + (uint64_t) now.tv_nsec / 1000;
+}
+
+static void HandleListenerCallback(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager_,
+        void* _Nullable context HAP_UNUSED) {
+    numListenerCallbacks++;
+
+    // Like the HAP layer, accept at most one TCP stream per invocation.
+    HAPPlatformTCPStreamRef tcpStream;
+    HAPError err = HAPPlatformTCPStreamManagerAcceptTCPStream(tcpStreamManager_, &tcpStream);
+    if (err) {
+        HAPAssert(err == kHAPError_Busy);
+        return;
+    }
+    HAPAssert(numAcceptedTCPStreams < kNumBurstConnections);
+    acceptedTCPStreams[numAcceptedTCPStreams] = tcpStream;
+    numAcceptedTCPStreams++;
+    lastAcceptTime = GetMicroseconds();
+    if (numAcceptedTCPStreams == numTCPStreamsToAccept) {
+        HAPPlatformRunLoopStop();
+    }
+}
+
+/**
+ * Returns whether connections are pending in the accept queue of the listener, without accepting them.
+ */
+static bool HasPendingConnections(void) {
+    HAPAssert(tcpStreamManager.numTCPStreamListeners == 1);
+    struct pollfd pollFileDescriptor = { .fd = tcpStreamManager.tcpStreamListeners[0].fileDescriptor,
+                                         .events = POLLIN };
+    int e = poll(&pollFileDescriptor, 1, 0);
+    HAPAssert(e >= 0);
+    return e && (pollFileDescriptor.revents & POLLIN);
+}
+
+/**
+ * Establishes all connections of the burst. The kernel completes the handshakes into the accept queue of the
+ * listener while the run loop is not running.
+ *
+ * @return Time when the first connection was started.
+ */
+static uint64_t ConnectBurst(HAPNetworkPort port) {
+    uint64_t startTime = GetMicroseconds();
+    for (size_t i = 0; i < kNumBurstConnections; i++) {
+        clientFileDescriptors[i] = socket(AF_INET, SOCK_STREAM, 0);
+        HAPAssert(clientFileDescriptors[i] != -1);
+        struct sockaddr_in address = { .sin_family = AF_INET,
+                                       .sin_port = htons(port),
+                                       .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+        int e = connect(clientFileDescriptors[i], (const struct sockaddr*) &address, sizeof address);
+        HAPAssert(!e);
+    }
+    return startTime;
+}
+
+static void CloseBurst(void) {
+    for (size_t i = 0; i < kNumBurstConnections; i++) {
+        close(clientFileDescriptors[i]);
+    }
+}
+
+static void CloseAcceptedTCPStreams(void) {
+    for (size_t i = 0; i < numAcceptedTCPStreams; i++) {
+        HAPPlatformTCPStreamClose(&tcpStreamManager, acceptedTCPStreams[i]);
+    }
+    numAcceptedTCPStreams = 0;
+}
+
+static void CreateTCPStreamManager(size_t maxTCPStreams) {
+    HAPPlatformTCPStreamManagerCreate(
+            &tcpStreamManager,
+            &(const HAPPlatformTCPStreamManagerOptions) {
+                    .addressFamily = kHAPPlatformTCPStreamManagerAddressFamily_IPv4,
+                    .maxConcurrentTCPStreams = maxTCPStreams,
+                    .tcpStreams = tcpStreams });
+    HAPPlatformTCPStreamManagerOpenListener(&tcpStreamManager, HandleListenerCallback, NULL);
+    numAcceptedTCPStreams = 0;
+    numListenerCallbacks = 0;
+}
+
+static void ReleaseTCPStreamManager(void) {
+    HAPPlatformTCPStreamManagerCloseListener(&tcpStreamManager);
+    HAPPlatformTCPStreamManagerRelease(&tcpStreamManager);
+}
+
+static void TestBurst(void) {
+    CreateTCPStreamManager(kMaxTCPStreams);
+    uint64_t startTime = ConnectBurst(HAPPlatformTCPStreamManagerGetListenerPort(&tcpStreamManager));
+    HAPAssert(HasPendingConnections());
+
+    numTCPStreamsToAccept = kNumBurstConnections;
+    uint64_t runStartTime = GetMicroseconds();
+    HAPPlatformRunLoopRun();
+
+    HAPPlatformTCPStreamManagerStatistics statistics;
+    HAPPlatformTCPStreamManagerGetStatistics(&tcpStreamManager, &statistics);
+    printf("Burst of %zu connections: all accepted after %llu us (%llu us after the run loop started), "
+           "%zu batches, largest batch %zu, %zu listener callbacks\n",
+           kNumBurstConnections,
+           (unsigned long long) (lastAcceptTime - startTime),
+           (unsigned long long) (lastAcceptTime - runStartTime),
+           statistics.numAcceptBatches,
+           statistics.maxAcceptBatchSize,
+           numListenerCallbacks);
+    fflush(stdout);
+
+    // All pending connections are taken in a single readiness event, which ends once accepting reports busy.
+    HAPAssert(numAcceptedTCPStreams == kNumBurstConnections);
+    HAPAssert(statistics.numAcceptedTCPStreams == kNumBurstConnections);
+    HAPAssert(!statistics.numRejectedTCPStreams);
+    HAPAssert(statistics.numAcceptBatches == 1);
+    HAPAssert(statistics.maxAcceptBatchSize == kNumBurstConnections);
+    HAPAssert(numListenerCallbacks == kNumBurstConnections + 1);
+    HAPAssert(!HasPendingConnections());
+
+    CloseAcceptedTCPStreams();
+    CloseBurst();
+    ReleaseTCPStreamManager();
+}
+
+static void TestLimitedBurst(void) {
+    CreateTCPStreamManager(kMaxLimitedTCPStreams);
+    (void) ConnectBurst(HAPPlatformTCPStreamManagerGetListenerPort(&tcpStreamManager));
+
+    // A batch stops once all TCP streams are in use. The remaining connections stay queued.
+    numTCPStreamsToAccept = kMaxLimitedTCPStreams;
+    HAPPlatformRunLoopRun();
+    HAPPlatformTCPStreamManagerStatistics statistics;
+    HAPPlatformTCPStreamManagerGetStatistics(&tcpStreamManager, &statistics);
+    HAPAssert(numAcceptedTCPStreams == kMaxLimitedTCPStreams);
+    HAPAssert(statistics.numAcceptBatches == 1);
+    HAPAssert(statistics.maxAcceptBatchSize == kMaxLimitedTCPStreams);
+    HAPAssert(numListenerCallbacks == kMaxLimitedTCPStreams);
+    HAPAssert(HasPendingConnections());
+
+    // Once TCP streams are closed, the remaining connections are accepted in one more batch.
+    CloseAcceptedTCPStreams();
+    numTCPStreamsToAccept = kNumBurstConnections - kMaxLimitedTCPStreams;
+    HAPPlatformRunLoopRun();
+    HAPPlatformTCPStreamManagerGetStatistics(&tcpStreamManager, &statistics);
+    printf("Burst of %zu connections with %zu TCP streams: %zu batches, largest batch %zu\n",
+           kNumBurstConnections,
+           kMaxLimitedTCPStreams,
+           statistics.numAcceptBatches,
+           statistics.maxAcceptBatchSize);
+    fflush(stdout);
+    HAPAssert(numAcceptedTCPStreams == kNumBurstConnections - kMaxLimitedTCPStreams);
+    HAPAssert(statistics.numAcceptedTCPStreams == kNumBurstConnections);
+    HAPAssert(statistics.numAcceptBatches == 2);
+    HAPAssert(statistics.maxAcceptBatchSize == kMaxLimitedTCPStreams);
+    HAPAssert(!HasPendingConnections());
+
+    CloseAcceptedTCPStreams();
+    CloseBurst();
+    ReleaseTCPStreamManager();
+}
+
+int main(void) {
+    // The run loop only requires a key-value store to be present.
+    static HAPPlatformKeyValueStore keyValueStore;
+    HAPPlatformRunLoopCreate(&(const HAPPlatformRunLoopOptions) { .keyValueStore = &keyValueStore });
+
+    TestBurst();
+    TestLimitedBurst();
+
+    HAPPlatformRunLoopRelease();
+    return 0;
+}
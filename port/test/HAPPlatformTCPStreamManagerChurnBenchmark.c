@@ -0,0 +1,268 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmark of connection churn on the TCP stream manager at maxConcurrentTCPStreams of 9, 32 and 128. All slots but
+// one are held by idle connections, while a client repeatedly connects over loopback TCP, exchanges a byte and
+// disconnects. Reports the time spent in HAPPlatformTCPStreamManagerAcceptTCPStream and HAPPlatformTCPStreamClose,
+// and the time that the former linear scan for a free slot would have taken on the same table. Checks that the
+// churned connection always reuses the free slot with a new generation, so that its references never repeat.
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformClock+Init.h"
+#include "HAPPlatformKeyValueStore+Init.h"
+#include "HAPPlatformRunLoop+Init.h"
+#include "HAPPlatformTCPStreamManager+Init.h"
+
+/** Largest number of concurrent TCP streams that is measured. */
+#define kMaxTCPStreams ((size_t) 128)
+
+/** Number of connections that are opened and closed for each number of concurrent TCP streams. */
+#define kNumChurnConnections ((size_t) 2000)
+
+/** Number of times the linear scan is repeated per accepted TCP stream, to measure it with enough resolution. */
+#define kNumScanRepetitions ((size_t) 64)
+
+static HAPPlatformTCPStreamManager tcpStreamManager;
+static HAPPlatformTCPStream tcpStreams[kMaxTCPStreams];
+static HAPNetworkPort port;
+static size_t maxTCPStreams;
+
+static volatile size_t numAcceptedTCPStreams;
+static volatile size_t numClosedTCPStreams;
+
+static HAPPlatformTCPStreamRef lastChurnTCPStream;
+static uint64_t acceptNanoseconds;
+static uint64_t closeNanoseconds;
+static uint64_t scanNanoseconds;
+static volatile size_t scanSink;
+
+static uint64_t GetNanoseconds(void) {
+    struct timespec now;
+    int e = clock_gettime(CLOCK_MONOTONIC, &now);
+    HAPAssert(!e);
+    return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
+/**
+ * Finds a free TCP stream like HAPPlatformTCPStreamManagerAcceptTCPStream did before the free list: by scanning the
+ * table for the first TCP stream without a file descriptor.
+ */
+static size_t ScanForFreeTCPStream(void) {
+    for (size_t i = 0; i < tcpStreamManager.maxTCPStreams; i++) {
+        if (tcpStreamManager.tcpStreams[i].fileDescriptor == -1) {
+            return i;
+        }
+    }
+    return tcpStreamManager.maxTCPStreams;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Accessory: echoes a byte and closes the TCP stream once the peer has closed its output.
+
+static void HandleTCPStreamEvent(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager_,
+        HAPPlatformTCPStreamRef tcpStream,
+        HAPPlatformTCPStreamEvent event,
+        void* _Nullable context HAP_UNUSED) {
+    HAPPrecondition(event.hasBytesAvailable);
+
+    uint8_t byte;
+    size_t numBytes;
+    HAPError err = HAPPlatformTCPStreamRead(tcpStreamManager_, tcpStream, &byte, sizeof byte, &numBytes);
+    if (err == kHAPError_Busy) {
+        return;
+    }
+    if (err || !numBytes) {
+        uint64_t startTime = GetNanoseconds();
+        HAPPlatformTCPStreamClose(tcpStreamManager_, tcpStream);
+        closeNanoseconds += GetNanoseconds() - startTime;
+        __atomic_fetch_add(&numClosedTCPStreams, 1, __ATOMIC_RELEASE);
+        return;
+    }
+    size_t numBytesWritten;
+    err = HAPPlatformTCPStreamWrite(tcpStreamManager_, tcpStream, &byte, sizeof byte, &numBytesWritten);
+    HAPAssert(!err && numBytesWritten == sizeof byte);
+}
+
+static void HandleListenerCallback(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager_,
+        void* _Nullable context HAP_UNUSED) {
+    for (;;) {
+        bool isChurn = numAcceptedTCPStreams >= maxTCPStreams - 1;
+        size_t freeIndex = 0;
+        if (isChurn) {
+            uint64_t startTime = GetNanoseconds();
+            for (size_t i = 0; i < kNumScanRepetitions; i++) {
+                freeIndex = ScanForFreeTCPStream();
+                scanSink += freeIndex;
+            }
+            scanNanoseconds += (GetNanoseconds() - startTime) / kNumScanRepetitions;
+        }
+
+        HAPPlatformTCPStreamRef tcpStream;
+        uint64_t startTime = GetNanoseconds();
+        HAPError err = HAPPlatformTCPStreamManagerAcceptTCPStream(tcpStreamManager_, &tcpStream);
+        uint64_t duration = GetNanoseconds() - startTime;
+        if (err) {
+            return;
+        }
+        if (isChurn) {
+            // The only free slot is reused, with a new generation.
+            acceptNanoseconds += duration;
+            HAPAssert((size_t)(tcpStream & 0xFFFF) - 1 == freeIndex);
+            if (lastChurnTCPStream) {
+                HAPAssert((tcpStream & 0xFFFF) == (lastChurnTCPStream & 0xFFFF));
+                HAPAssert(tcpStream != lastChurnTCPStream);
+            }
+            lastChurnTCPStream = tcpStream;
+        }
+        __atomic_fetch_add(&numAcceptedTCPStreams, 1, __ATOMIC_RELEASE);
+        HAPPlatformTCPStreamUpdateInterests(
+                tcpStreamManager_,
+                tcpStream,
+                (HAPPlatformTCPStreamEvent) { .hasBytesAvailable = true },
+                HandleTCPStreamEvent,
+                NULL);
+    }
+}
+
+static void HandleStopCallback(void* _Nullable context HAP_UNUSED, size_t contextSize HAP_UNUSED) {
+    HAPPlatformRunLoopStop();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Client: holds idle connections and churns through the remaining slot.
+
+static void WaitForCount(volatile size_t* count, size_t value) {
+    while (__atomic_load_n(count, __ATOMIC_ACQUIRE) < value) {
+        sched_yield();
+    }
+}
+
+static int Connect(void) {
+    int fileDescriptor = socket(AF_INET, SOCK_STREAM, 0);
+    HAPAssert(fileDescriptor != -1);
+    int e = setsockopt(fileDescriptor, IPPROTO_TCP, TCP_NODELAY, &(int) { 1 }, sizeof(int));
+    HAPAssert(!e);
+    struct sockaddr_in address = { .sin_family = AF_INET,
+                                   .sin_port = htons(port),
+                                   .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    e = connect(fileDescriptor, (const struct sockaddr*) &address, sizeof address);
+    HAPAssert(!e);
+    return fileDescriptor;
+}
+
+static uint64_t churnNanoseconds;
+
+static void* _Nullable RunClient(void* _Nullable context HAP_UNUSED) {
+    int idleFileDescriptors[kMaxTCPStreams];
+    for (size_t i = 0; i < maxTCPStreams - 1; i++) {
+        idleFileDescriptors[i] = Connect();
+    }
+    WaitForCount(&numAcceptedTCPStreams, maxTCPStreams - 1);
+
+    uint64_t startTime = GetNanoseconds();
+    for (size_t i = 0; i < kNumChurnConnections; i++) {
+        int fileDescriptor = Connect();
+        uint8_t byte = (uint8_t) i;
+        ssize_t n = send(fileDescriptor, &byte, sizeof byte, 0);
+        HAPAssert(n == (ssize_t) sizeof byte);
+        n = recv(fileDescriptor, &byte, sizeof byte, 0);
+        HAPAssert(n == (ssize_t) sizeof byte && byte == (uint8_t) i);
+        close(fileDescriptor);
+        WaitForCount(&numClosedTCPStreams, i + 1);
+    }
+    churnNanoseconds = GetNanoseconds() - startTime;
+
+    for (size_t i = 0; i < maxTCPStreams - 1; i++) {
+        close(idleFileDescriptors[i]);
+    }
+    WaitForCount(&numClosedTCPStreams, kNumChurnConnections + maxTCPStreams - 1);
+
+    HAPError err = HAPPlatformRunLoopScheduleCallback(HandleStopCallback, NULL, 0);
+    HAPAssert(!err);
+    return NULL;
+}
+
+static void MeasureChurn(size_t maxTCPStreams_) {
+    HAPPrecondition(maxTCPStreams_ >= 2 && maxTCPStreams_ <= kMaxTCPStreams);
+    maxTCPStreams = maxTCPStreams_;
+    numAcceptedTCPStreams = 0;
+    numClosedTCPStreams = 0;
+    lastChurnTCPStream = 0;
+    acceptNanoseconds = 0;
+    closeNanoseconds = 0;
+    scanNanoseconds = 0;
+
+    HAPPlatformTCPStreamManagerCreate(
+            &tcpStreamManager,
+            &(const HAPPlatformTCPStreamManagerOptions) {
+                    .addressFamily = kHAPPlatformTCPStreamManagerAddressFamily_IPv4,
+                    .maxConcurrentTCPStreams = maxTCPStreams,
+                    .tcpStreams = tcpStreams });
+    HAPPlatformTCPStreamManagerOpenListener(&tcpStreamManager, HandleListenerCallback, NULL);
+    port = HAPPlatformTCPStreamManagerGetListenerPort(&tcpStreamManager);
+
+    pthread_t clientThread;
+    int e = pthread_create(&clientThread, NULL, RunClient, NULL);
+    HAPAssert(!e);
+    HAPPlatformRunLoopRun();
+    e = pthread_join(clientThread, NULL);
+    HAPAssert(!e);
+
+    HAPPlatformTCPStreamManagerStatistics statistics;
+    HAPPlatformTCPStreamManagerGetStatistics(&tcpStreamManager, &statistics);
+    HAPAssert(statistics.numAcceptedTCPStreams == kNumChurnConnections + maxTCPStreams - 1);
+    HAPAssert(numClosedTCPStreams == statistics.numAcceptedTCPStreams);
+    printf("%7zu  %11.0f  %10.0f  %9.0f  %9.0f\n",
+           maxTCPStreams,
+           (double) kNumChurnConnections * 1000000000 / (double) churnNanoseconds,
+           (double) acceptNanoseconds / kNumChurnConnections,
+           (double) closeNanoseconds / kNumChurnConnections,
+           (double) scanNanoseconds / kNumChurnConnections);
+
+    HAPPlatformTCPStreamManagerCloseListener(&tcpStreamManager);
+    HAPPlatformTCPStreamManagerRelease(&tcpStreamManager);
+}
+
+int main(void) {
+    // The run loop only requires a key-value store to be present.
+    static HAPPlatformKeyValueStore keyValueStore;
+    HAPPlatformRunLoopCreate(&(const HAPPlatformRunLoopOptions) { .keyValueStore = &keyValueStore });
+
+    printf("%7s  %11s  %10s  %9s  %9s\n", "Streams", "Connects/s", "Accept(ns)", "Close(ns)", "Scan(ns)");
+    static const size_t numTCPStreamsToMeasure[] = { 9, 32, 128 };
+    for (size_t i = 0; i < HAPArrayCount(numTCPStreamsToMeasure); i++) {
+        MeasureChurn(numTCPStreamsToMeasure[i]);
+    }
+    fflush(stdout);
+
+    HAPPlatformRunLoopRelease();
+    return 0;
+}
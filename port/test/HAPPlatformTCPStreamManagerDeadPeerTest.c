@@ -0,0 +1,224 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Test of dead peer detection on accepted TCP streams. A TCP stream is accepted from a loopback peer, and then every
+// packet between the two is dropped by taking the loopback interface down, like a controller that left the network
+// without closing its connections. The test checks that the TCP stream fails within the configured bound:
+// - with keepalive, after the idle time and the unanswered probes,
+// - with the user timeout, after data stayed unacknowledged for the user timeout.
+// The test runs in its own network namespace and is skipped without the privilege to create one.
+
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sched.h>
+#include <stdio.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformClock+Init.h"
+#include "HAPPlatformKeyValueStore+Init.h"
+#include "HAPPlatformRunLoop+Init.h"
+#include "HAPPlatformTCPStreamManager+Init.h"
+
+/** Exit code that marks the test as skipped. */
+#define kSkipExitCode (77)
+
+/** Idle time before the first keepalive probe. */
+#define kKeepAliveIdleTime ((HAPTime) 1 * HAPSecond)
+
+/** Time between unanswered keepalive probes. */
+#define kKeepAliveInterval ((HAPTime) 1 * HAPSecond)
+
+/** Number of unanswered keepalive probes. */
+#define kKeepAliveCount ((uint8_t) 2)
+
+/** User timeout. */
+#define kUserTimeout ((HAPTime) 1500 * HAPMillisecond)
+
+/** Time that the TCP stream may take to fail beyond the configured bound. */
+#define kTolerance ((HAPTime) 1 * HAPSecond)
+
+/** Time after which the test gives up waiting for the TCP stream to fail. */
+#define kMaxWaitTime ((HAPTime) 10 * HAPSecond)
+
+static HAPPlatformTCPStreamManager tcpStreamManager;
+static HAPPlatformTCPStream tcpStreams[1];
+static HAPPlatformTCPStreamRef tcpStream;
+
+static int clientFileDescriptor;
+static bool shouldWrite;
+static HAPTime blackholeTime;
+static HAPTime failureTime;
+static HAPPlatformTimerRef timeoutTimer;
+
+/**
+ * Brings the loopback interface of the network namespace up or down.
+ */
+static void SetLoopbackUp(bool isUp) {
+    int fileDescriptor = socket(AF_INET, SOCK_DGRAM, 0);
+    HAPAssert(fileDescriptor != -1);
+    struct ifreq request = { .ifr_name = "lo" };
+    int e = ioctl(fileDescriptor, SIOCGIFFLAGS, &request);
+    HAPAssert(!e);
+    if (isUp) {
+        request.ifr_flags |= IFF_UP;
+    } else {
+        request.ifr_flags &= ~IFF_UP;
+    }
+    e = ioctl(fileDescriptor, SIOCSIFFLAGS, &request);
+    HAPAssert(!e);
+    close(fileDescriptor);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void HandleTimeoutTimerExpired(HAPPlatformTimerRef timer HAP_UNUSED, void* _Nullable context HAP_UNUSED) {
+    timeoutTimer = 0;
+    HAPPlatformRunLoopStop();
+}
+
+static void HandleTCPStreamEvent(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager_,
+        HAPPlatformTCPStreamRef tcpStream_,
+        HAPPlatformTCPStreamEvent event,
+        void* _Nullable context HAP_UNUSED) {
+    HAPAssert(event.hasBytesAvailable);
+
+    uint8_t bytes[64];
+    size_t numBytes;
+    HAPError err = HAPPlatformTCPStreamRead(tcpStreamManager_, tcpStream_, bytes, sizeof bytes, &numBytes);
+    if (err == kHAPError_Busy) {
+        return;
+    }
+    // The peer never sends data or closes, so any event must be the failure.
+    HAPAssert(err == kHAPError_Unknown);
+
+    failureTime = HAPPlatformClockGetCurrent();
+    HAPPlatformTCPStreamUpdateInterests(
+            tcpStreamManager_, tcpStream_, (HAPPlatformTCPStreamEvent) { .hasBytesAvailable = false }, NULL, NULL);
+    HAPPlatformTimerDeregister(timeoutTimer);
+    timeoutTimer = 0;
+    HAPPlatformRunLoopStop();
+}
+
+static void HandleListenerCallback(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager_,
+        void* _Nullable context HAP_UNUSED) {
+    HAPError err = HAPPlatformTCPStreamManagerAcceptTCPStream(tcpStreamManager_, &tcpStream);
+    HAPAssert(!err);
+    HAPPlatformTCPStreamManagerCloseListener(tcpStreamManager_);
+    HAPPlatformTCPStreamUpdateInterests(
+            tcpStreamManager_,
+            tcpStream,
+            (HAPPlatformTCPStreamEvent) { .hasBytesAvailable = true },
+            HandleTCPStreamEvent,
+            NULL);
+
+    SetLoopbackUp(false);
+    blackholeTime = HAPPlatformClockGetCurrent();
+    if (shouldWrite) {
+        static const uint8_t bytes[100];
+        size_t numBytes;
+        err = HAPPlatformTCPStreamWrite(tcpStreamManager_, tcpStream, bytes, sizeof bytes, &numBytes);
+        HAPAssert(!err);
+        HAPAssert(numBytes == sizeof bytes);
+    }
+
+    err = HAPPlatformTimerRegister(&timeoutTimer, blackholeTime + kMaxWaitTime, HandleTimeoutTimerExpired, NULL);
+    HAPAssert(!err);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/**
+ * Accepts a TCP stream, drops all packets, and returns the time until the TCP stream failed.
+ */
+static HAPTime MeasureTimeToFailure(const HAPPlatformTCPStreamManagerOptions* options, bool shouldWrite_) {
+    HAPPlatformTCPStreamManagerCreate(&tcpStreamManager, options);
+    HAPPlatformTCPStreamManagerOpenListener(&tcpStreamManager, HandleListenerCallback, NULL);
+
+    clientFileDescriptor = socket(AF_INET, SOCK_STREAM, 0);
+    HAPAssert(clientFileDescriptor != -1);
+    struct sockaddr_in address = { .sin_family = AF_INET,
+                                   .sin_port = htons(HAPPlatformTCPStreamManagerGetListenerPort(&tcpStreamManager)),
+                                   .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    int e = connect(clientFileDescriptor, (const struct sockaddr*) &address, sizeof address);
+    HAPAssert(!e);
+
+    shouldWrite = shouldWrite_;
+    failureTime = 0;
+    HAPPlatformRunLoopRun();
+    HAPAssert(failureTime);
+
+    HAPPlatformTCPStreamClose(&tcpStreamManager, tcpStream);
+    close(clientFileDescriptor);
+    HAPPlatformTCPStreamManagerRelease(&tcpStreamManager);
+    SetLoopbackUp(true);
+    return failureTime - blackholeTime;
+}
+
+int main(void) {
+    if (unshare(CLONE_NEWNET)) {
+        printf("Skipped: Creating a network namespace requires CAP_SYS_ADMIN.\n");
+        return kSkipExitCode;
+    }
+    SetLoopbackUp(true);
+
+    // The run loop only requires a key-value store to be present.
+    static HAPPlatformKeyValueStore keyValueStore;
+    HAPPlatformRunLoopCreate(&(const HAPPlatformRunLoopOptions) { .keyValueStore = &keyValueStore });
+
+    HAPTime keepAliveDuration = MeasureTimeToFailure(
+            &(const HAPPlatformTCPStreamManagerOptions) {
+                    .addressFamily = kHAPPlatformTCPStreamManagerAddressFamily_IPv4,
+                    .maxConcurrentTCPStreams = HAPArrayCount(tcpStreams),
+                    .tcpStreams = tcpStreams,
+                    .keepAlive = { .idleTime = kKeepAliveIdleTime,
+                                   .interval = kKeepAliveInterval,
+                                   .count = kKeepAliveCount } },
+            /* shouldWrite: */ false);
+    HAPTime keepAliveBound = kKeepAliveIdleTime + kKeepAliveCount * kKeepAliveInterval;
+    printf("Keepalive:    failed after %llu ms (bound %llu ms).\n",
+           (unsigned long long) keepAliveDuration,
+           (unsigned long long) keepAliveBound);
+
+    HAPTime userTimeoutDuration = MeasureTimeToFailure(
+            &(const HAPPlatformTCPStreamManagerOptions) {
+                    .addressFamily = kHAPPlatformTCPStreamManagerAddressFamily_IPv4,
+                    .maxConcurrentTCPStreams = HAPArrayCount(tcpStreams),
+                    .tcpStreams = tcpStreams,
+                    .userTimeout = kUserTimeout },
+            /* shouldWrite: */ true);
+    printf("User timeout: failed after %llu ms (bound %llu ms).\n",
+           (unsigned long long) userTimeoutDuration,
+           (unsigned long long) kUserTimeout);
+    fflush(stdout);
+
+    // Keepalive gives up at the last unanswered probe, the user timeout once it has elapsed.
+    HAPAssert(keepAliveDuration >= kKeepAliveIdleTime + (kKeepAliveCount - 1) * kKeepAliveInterval);
+    HAPAssert(keepAliveDuration <= keepAliveBound + kTolerance);
+    HAPAssert(userTimeoutDuration >= kUserTimeout);
+    HAPAssert(userTimeoutDuration <= kUserTimeout + kTolerance);
+
+    HAPPlatformRunLoopRelease();
+    return 0;
+}
@@ -0,0 +1,363 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Flood test of the admission control of the TCP stream manager. While connections are opened as fast as possible from
+// many loopback addresses and never complete a handshake, a legitimate controller on an established connection keeps
+// sending requests. The test checks that the latency of these requests stays bounded, and reports how many flood
+// connections were refused by each limit.
+// A second flood rotates through more peer addresses than the admission control tracks, against a TCP stream manager
+// that only limits the rate per peer address. The test checks that the number of admitted connections stays within
+// what the per-source limit allows for the tracked addresses.
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformClock+Init.h"
+#include "HAPPlatformKeyValueStore+Init.h"
+#include "HAPPlatformRunLoop+Init.h"
+#include "HAPPlatformTCPStreamManager+Init.h"
+
+/** Maximum number of concurrent TCP streams of the accessory. */
+#define kMaxTCPStreams ((size_t) 16)
+
+/** Number of requests that the controller sends before and during the flood. */
+#define kNumRequests ((size_t) 200)
+
+/** Size of a request and of its response. */
+#define kRequestSize ((size_t) 64)
+
+/** Number of flood connections that are kept open at the same time. */
+#define kMaxFloodConnections ((size_t) 64)
+
+/** Number of loopback addresses from which the flood originates. */
+#define kNumFloodAddresses ((uint32_t) 64)
+
+/** Maximum latency of a request during the flood, in milliseconds. */
+#define kMaxRequestLatency ((HAPTime) 250)
+
+/** Number of loopback addresses through which the rotating flood cycles. */
+#define kNumRotatingAddresses ((uint32_t)(4 * kHAPPlatformTCPStreamManager_MaxAdmissionSources))
+
+/** Number of connections of the rotating flood. */
+#define kNumRotatingConnections ((size_t) 512)
+
+/** Number of connections of the rotating flood that are kept open at the same time. */
+#define kMaxRotatingConnections ((size_t) 4)
+
+static HAPPlatformTCPStreamManager tcpStreamManager;
+static HAPPlatformTCPStream tcpStreams[kMaxTCPStreams];
+static HAPNetworkPort port;
+
+static HAPPlatformTCPStreamManager rotatingTCPStreamManager;
+static HAPPlatformTCPStream rotatingTCPStreams[kMaxTCPStreams];
+static HAPNetworkPort rotatingPort;
+static uint64_t rotatingFloodDuration;
+
+static volatile bool isFlooding;
+static size_t numFloodConnections;
+
+typedef struct {
+    uint64_t sumMicroseconds;
+    uint64_t maxMicroseconds;
+} Latencies;
+
+static uint64_t GetMicroseconds(void) {
+    struct timespec now;
+    int e = clock_gettime(CLOCK_MONOTONIC, &now);
+    HAPAssert(!e);
+    return (uint64_t) now.tv_sec * 1000000 + (uint64_t) now.tv_nsec / 1000;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Accessory: echoes requests on the run loop, like the HAP layer does for Pair Verify and subsequent requests.
+
+static void HandleTCPStreamEvent(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager_,
+        HAPPlatformTCPStreamRef tcpStream,
+        HAPPlatformTCPStreamEvent event,
+        void* _Nullable context HAP_UNUSED) {
+    HAPPrecondition(event.hasBytesAvailable);
+
+    uint8_t bytes[kRequestSize];
+    size_t numBytes;
+    HAPError err = HAPPlatformTCPStreamRead(tcpStreamManager_, tcpStream, bytes, sizeof bytes, &numBytes);
+    if (err == kHAPError_Busy) {
+        return;
+    }
+    if (err || !numBytes) {
+        HAPPlatformTCPStreamClose(tcpStreamManager_, tcpStream);
+        return;
+    }
+    size_t numBytesWritten;
+    err = HAPPlatformTCPStreamWrite(tcpStreamManager_, tcpStream, bytes, numBytes, &numBytesWritten);
+    HAPAssert(!err && numBytesWritten == numBytes);
+}
+
+static void HandleListenerCallback(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager_,
+        void* _Nullable context HAP_UNUSED) {
+    for (;;) {
+        HAPPlatformTCPStreamRef tcpStream;
+        HAPError err = HAPPlatformTCPStreamManagerAcceptTCPStream(tcpStreamManager_, &tcpStream);
+        if (err) {
+            return;
+        }
+        HAPPlatformTCPStreamUpdateInterests(
+                tcpStreamManager_,
+                tcpStream,
+                (HAPPlatformTCPStreamEvent) { .hasBytesAvailable = true },
+                HandleTCPStreamEvent,
+                NULL);
+    }
+}
+
+static void HandleStopCallback(void* _Nullable context HAP_UNUSED, size_t contextSize HAP_UNUSED) {
+    HAPPlatformRunLoopStop();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Attacker: opens connections from many addresses and never sends anything.
+
+static void* _Nullable RunFlood(void* _Nullable context HAP_UNUSED) {
+    int fileDescriptors[kMaxFloodConnections];
+    for (size_t i = 0; i < kMaxFloodConnections; i++) {
+        fileDescriptors[i] = -1;
+    }
+
+    for (size_t i = 0; isFlooding; i = (i + 1) % kMaxFloodConnections) {
+        if (fileDescriptors[i] != -1) {
+            close(fileDescriptors[i]);
+        }
+        int fileDescriptor = socket(AF_INET, SOCK_STREAM, 0);
+        HAPAssert(fileDescriptor != -1);
+        // Every other connection comes from the same address, the others from varying addresses.
+        uint32_t addressIndex = numFloodConnections % 2 ? (uint32_t) numFloodConnections % kNumFloodAddresses : 0;
+        struct sockaddr_in address = { .sin_family = AF_INET,
+                                       .sin_addr.s_addr = htonl(INADDR_LOOPBACK + 1 + addressIndex) };
+        int e = bind(fileDescriptor, (const struct sockaddr*) &address, sizeof address);
+        HAPAssert(!e);
+        e = fcntl(fileDescriptor, F_SETFL, O_NONBLOCK);
+        HAPAssert(!e);
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        (void) connect(fileDescriptor, (const struct sockaddr*) &address, sizeof address);
+        fileDescriptors[i] = fileDescriptor;
+        numFloodConnections++;
+        usleep(100);
+    }
+
+    for (size_t i = 0; i < kMaxFloodConnections; i++) {
+        if (fileDescriptors[i] != -1) {
+            close(fileDescriptors[i]);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Opens connections from addresses that rotate through more addresses than the admission control tracks, as fast as
+ * the accessory takes them, and never sends anything.
+ */
+static void RunRotatingFlood(void) {
+    int fileDescriptors[kMaxRotatingConnections];
+    for (size_t i = 0; i < kMaxRotatingConnections; i++) {
+        fileDescriptors[i] = -1;
+    }
+
+    uint64_t startTime = GetMicroseconds();
+    for (size_t i = 0; i < kNumRotatingConnections; i++) {
+        int* fileDescriptor = &fileDescriptors[i % kMaxRotatingConnections];
+        if (*fileDescriptor != -1) {
+            close(*fileDescriptor);
+        }
+        *fileDescriptor = socket(AF_INET, SOCK_STREAM, 0);
+        HAPAssert(*fileDescriptor != -1);
+        uint32_t addressIndex = (uint32_t) i % kNumRotatingAddresses;
+        struct sockaddr_in address = { .sin_family = AF_INET,
+                                       .sin_addr.s_addr = htonl(INADDR_LOOPBACK + 0x100 + 1 + addressIndex) };
+        int e = bind(*fileDescriptor, (const struct sockaddr*) &address, sizeof address);
+        HAPAssert(!e);
+        address.sin_port = htons(rotatingPort);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        e = connect(*fileDescriptor, (const struct sockaddr*) &address, sizeof address);
+        HAPAssert(!e);
+        usleep(100);
+    }
+    rotatingFloodDuration = GetMicroseconds() - startTime;
+
+    // Let the accessory process the remaining connections.
+    usleep(100000);
+    for (size_t i = 0; i < kMaxRotatingConnections; i++) {
+        close(fileDescriptors[i]);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+// Controller: sends requests on an established connection and measures the time until the response arrives.
+
+static void SendRequests(int fileDescriptor, size_t numRequests, Latencies* latencies) {
+    for (size_t i = 0; i < numRequests; i++) {
+        uint8_t bytes[kRequestSize];
+        memset(bytes, (int) (uint8_t) i, sizeof bytes);
+        uint64_t startTime = GetMicroseconds();
+        ssize_t n = send(fileDescriptor, bytes, sizeof bytes, 0);
+        HAPAssert(n == (ssize_t) sizeof bytes);
+        size_t numBytes = 0;
+        while (numBytes < sizeof bytes) {
+            n = recv(fileDescriptor, &bytes[numBytes], sizeof bytes - numBytes, 0);
+            HAPAssert(n > 0);
+            numBytes += (size_t) n;
+        }
+        uint64_t latency = GetMicroseconds() - startTime;
+        HAPAssert(bytes[0] == (uint8_t) i);
+        if (latencies) {
+            latencies->sumMicroseconds += latency;
+            latencies->maxMicroseconds = HAPMax(latencies->maxMicroseconds, latency);
+        }
+        usleep(1000);
+    }
+}
+
+static Latencies idleLatencies;
+static Latencies floodLatencies;
+
+static void* _Nullable RunController(void* _Nullable context HAP_UNUSED) {
+    int fileDescriptor = socket(AF_INET, SOCK_STREAM, 0);
+    HAPAssert(fileDescriptor != -1);
+    int e = setsockopt(fileDescriptor, IPPROTO_TCP, TCP_NODELAY, &(int) { 1 }, sizeof(int));
+    HAPAssert(!e);
+    struct sockaddr_in address = { .sin_family = AF_INET,
+                                   .sin_port = htons(port),
+                                   .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    e = connect(fileDescriptor, (const struct sockaddr*) &address, sizeof address);
+    HAPAssert(!e);
+
+    // Complete the handshake before the flood starts.
+    SendRequests(fileDescriptor, kHAPPlatformTCPStream_NumHandshakeResponses, NULL);
+    SendRequests(fileDescriptor, kNumRequests, &idleLatencies);
+
+    pthread_t floodThread;
+    isFlooding = true;
+    e = pthread_create(&floodThread, NULL, RunFlood, NULL);
+    HAPAssert(!e);
+    usleep(100000);
+    SendRequests(fileDescriptor, kNumRequests, &floodLatencies);
+    isFlooding = false;
+    e = pthread_join(floodThread, NULL);
+    HAPAssert(!e);
+
+    RunRotatingFlood();
+
+    close(fileDescriptor);
+    HAPError err = HAPPlatformRunLoopScheduleCallback(HandleStopCallback, NULL, 0);
+    HAPAssert(!err);
+    return NULL;
+}
+
+int main(void) {
+    // The run loop only requires a key-value store to be present.
+    static HAPPlatformKeyValueStore keyValueStore;
+    HAPPlatformRunLoopCreate(&(const HAPPlatformRunLoopOptions) { .keyValueStore = &keyValueStore });
+
+    HAPPlatformTCPStreamManagerCreate(
+            &tcpStreamManager,
+            &(const HAPPlatformTCPStreamManagerOptions) {
+                    .addressFamily = kHAPPlatformTCPStreamManagerAddressFamily_IPv4,
+                    .maxConcurrentTCPStreams = kMaxTCPStreams,
+                    .tcpStreams = tcpStreams,
+                    .admission = { .sourceRate = 2,
+                                   .sourceBurst = 2,
+                                   .globalRate = 20,
+                                   .globalBurst = 10,
+                                   .maxHandshakingTCPStreams = kMaxTCPStreams / 2 } });
+    HAPPlatformTCPStreamManagerOpenListener(&tcpStreamManager, HandleListenerCallback, NULL);
+    port = HAPPlatformTCPStreamManagerGetListenerPort(&tcpStreamManager);
+
+    HAPPlatformTCPStreamManagerCreate(
+            &rotatingTCPStreamManager,
+            &(const HAPPlatformTCPStreamManagerOptions) {
+                    .addressFamily = kHAPPlatformTCPStreamManagerAddressFamily_IPv4,
+                    .maxConcurrentTCPStreams = kMaxTCPStreams,
+                    .tcpStreams = rotatingTCPStreams,
+                    .admission = { .sourceRate = 1, .sourceBurst = 1 } });
+    HAPPlatformTCPStreamManagerOpenListener(&rotatingTCPStreamManager, HandleListenerCallback, NULL);
+    rotatingPort = HAPPlatformTCPStreamManagerGetListenerPort(&rotatingTCPStreamManager);
+
+    pthread_t controllerThread;
+    int e = pthread_create(&controllerThread, NULL, RunController, NULL);
+    HAPAssert(!e);
+    HAPPlatformRunLoopRun();
+    e = pthread_join(controllerThread, NULL);
+    HAPAssert(!e);
+
+    HAPPlatformTCPStreamManagerStatistics statistics;
+    HAPPlatformTCPStreamManagerGetStatistics(&tcpStreamManager, &statistics);
+    printf("Request latency without flood: %llu us average, %llu us max\n",
+           (unsigned long long) (idleLatencies.sumMicroseconds / kNumRequests),
+           (unsigned long long) idleLatencies.maxMicroseconds);
+    printf("Request latency during flood: %llu us average, %llu us max\n",
+           (unsigned long long) (floodLatencies.sumMicroseconds / kNumRequests),
+           (unsigned long long) floodLatencies.maxMicroseconds);
+    printf("Flood connections: %zu, accepted TCP streams: %zu\n",
+           numFloodConnections,
+           statistics.numAcceptedTCPStreams);
+    printf("Refused: %zu by source rate, %zu by global rate, %zu by handshake limit\n",
+           statistics.numSourceRateLimitedTCPStreams,
+           statistics.numGlobalRateLimitedTCPStreams,
+           statistics.numHandshakeLimitedTCPStreams);
+
+    // Every tracked address is admitted once, and once more for each second that its bucket needs to refill.
+    HAPPlatformTCPStreamManagerStatistics rotatingStatistics;
+    HAPPlatformTCPStreamManagerGetStatistics(&rotatingTCPStreamManager, &rotatingStatistics);
+    size_t maxRotatingAcceptedTCPStreams =
+            kHAPPlatformTCPStreamManager_MaxAdmissionSources * (2 + (size_t)(rotatingFloodDuration / 1000000));
+    printf("Rotating flood from %u addresses: %zu connections in %llu ms, accepted TCP streams: %zu (at most %zu), "
+           "refused by source rate: %zu\n",
+           (unsigned) kNumRotatingAddresses,
+           kNumRotatingConnections,
+           (unsigned long long) (rotatingFloodDuration / 1000),
+           rotatingStatistics.numAcceptedTCPStreams,
+           maxRotatingAcceptedTCPStreams,
+           rotatingStatistics.numSourceRateLimitedTCPStreams);
+    fflush(stdout);
+
+    HAPAssert(floodLatencies.maxMicroseconds < kMaxRequestLatency * 1000);
+    HAPAssert(statistics.numSourceRateLimitedTCPStreams && statistics.numGlobalRateLimitedTCPStreams);
+    HAPAssert(statistics.numAcceptedTCPStreams < numFloodConnections / 2);
+    HAPAssert(rotatingStatistics.numAcceptedTCPStreams >= kHAPPlatformTCPStreamManager_MaxAdmissionSources);
+    HAPAssert(rotatingStatistics.numAcceptedTCPStreams <= maxRotatingAcceptedTCPStreams);
+
+    HAPPlatformTCPStreamManagerCloseListener(&rotatingTCPStreamManager);
+    HAPPlatformTCPStreamManagerRelease(&rotatingTCPStreamManager);
+
+    HAPPlatformTCPStreamManagerCloseListener(&tcpStreamManager);
+    HAPPlatformTCPStreamManagerRelease(&tcpStreamManager);
+    HAPPlatformRunLoopRelease();
+    return 0;
+}
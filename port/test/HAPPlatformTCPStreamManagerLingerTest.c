@@ -0,0 +1,326 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Test of deferred closes of TCP streams with a send buffer. A final response is buffered while the peer does not
+// read, so the socket cannot take it, and then the TCP stream is closed, like after a last response to a controller
+// on a congested network. The test checks that closing is deferred while the TCP stream keeps its slot, and that:
+// - once the peer reads, the final response is sent, the close completes, and the peer sees the end of the stream,
+// - if the peer never reads, the close completes when the linger time runs out, and the final response is discarded,
+// - releasing the TCP stream manager completes a pending close.
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformClock+Init.h"
+#include "HAPPlatformKeyValueStore+Init.h"
+#include "HAPPlatformRunLoop+Init.h"
+#include "HAPPlatformTCPStreamManager+Init.h"
+
+/** Size of the send buffer. */
+#define kSendBufferSize ((size_t) 1024)
+
+/** Size of the socket buffers, kept small so that they fill quickly. */
+#define kSocketBufferSize (4096)
+
+/** Size of the writes that fill the socket. Larger than the send buffer, so that they are not buffered. */
+#define kFillWriteSize ((size_t) 2048)
+
+/** Number of consecutive rounds without progress after which the socket is considered full. */
+#define kNumIdleFillRounds ((size_t) 5)
+
+/** Size of the final response, which is buffered. */
+#define kFinalResponseSize ((size_t) 200)
+
+/** Byte value of the final response. */
+#define kFinalResponseByte ((uint8_t) 0xA5)
+
+/** Time between checks of the TCP stream slot. */
+#define kPollInterval ((HAPTime) 10 * HAPMillisecond)
+
+/** Time after closing at which the peer starts reading, if it reads. */
+#define kPeerReadDelay ((HAPTime) 100 * HAPMillisecond)
+
+/** Time that completing the close may take beyond the linger duration. */
+#define kTolerance ((HAPTime) 500 * HAPMillisecond)
+
+static HAPPlatformTCPStreamManager tcpStreamManager;
+static HAPPlatformTCPStream tcpStreams[1];
+static uint8_t sendBuffers[HAPArrayCount(tcpStreams) * kSendBufferSize];
+
+static HAPPlatformTCPStreamRef tcpStream;
+
+static int peerFileDescriptor;
+static bool shouldPeerRead;
+static bool hasPeerReachedEnd;
+static HAPTime closeTime;
+static HAPTime finishTime;
+
+static uint8_t sentBytes[256 * 1024];
+static size_t numSentBytes;
+static uint8_t receivedBytes[sizeof sentBytes];
+static size_t numReceivedBytes;
+
+/**
+ * Reads what the peer has received so far.
+ */
+static void DrainPeer(void) {
+    while (!hasPeerReachedEnd) {
+        HAPAssert(numReceivedBytes < sizeof receivedBytes);
+        ssize_t n = recv(
+                peerFileDescriptor,
+                &receivedBytes[numReceivedBytes],
+                sizeof receivedBytes - numReceivedBytes,
+                MSG_DONTWAIT);
+        if (n == -1) {
+            HAPAssert(errno == EAGAIN || errno == EWOULDBLOCK);
+            return;
+        }
+        if (!n) {
+            hasPeerReachedEnd = true;
+            return;
+        }
+        numReceivedBytes += (size_t) n;
+    }
+}
+
+/**
+ * Fills the socket of a TCP stream until it stays busy, then buffers the final response.
+ */
+static void FillTCPStream(void) {
+    // The socket is full once the peer has taken what fits into its receive window, and no further write succeeds.
+    for (size_t numIdleRounds = 0; numIdleRounds < kNumIdleFillRounds; numIdleRounds++) {
+        usleep(20000);
+        for (;;) {
+            HAPAssert(numSentBytes + kFillWriteSize <= sizeof sentBytes);
+            uint8_t* bytes = &sentBytes[numSentBytes];
+            for (size_t i = 0; i < kFillWriteSize; i++) {
+                bytes[i] = (uint8_t)((numSentBytes + i) % 251);
+            }
+            size_t numBytes;
+            HAPError err =
+                    HAPPlatformTCPStreamWrite(&tcpStreamManager, tcpStream, bytes, kFillWriteSize, &numBytes);
+            if (err == kHAPError_Busy) {
+                break;
+            }
+            HAPAssert(!err);
+            numSentBytes += numBytes;
+            numIdleRounds = 0;
+        }
+    }
+
+    HAPPlatformTCPStreamManagerStatistics statistics;
+    HAPPlatformTCPStreamManagerGetStatistics(&tcpStreamManager, &statistics);
+    size_t numBufferedWrites = statistics.numBufferedWrites;
+
+    uint8_t* bytes = &sentBytes[numSentBytes];
+    for (size_t i = 0; i < kFinalResponseSize; i++) {
+        bytes[i] = kFinalResponseByte;
+    }
+    size_t numBytes;
+    HAPError err = HAPPlatformTCPStreamWrite(&tcpStreamManager, tcpStream, bytes, kFinalResponseSize, &numBytes);
+    HAPAssert(!err);
+    HAPAssert(numBytes == kFinalResponseSize);
+    numSentBytes += numBytes;
+
+    HAPPlatformTCPStreamManagerGetStatistics(&tcpStreamManager, &statistics);
+    HAPAssert(statistics.numBufferedWrites == numBufferedWrites + 1);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void HandlePollTimerExpired(HAPPlatformTimerRef timer HAP_UNUSED, void* _Nullable context HAP_UNUSED) {
+    HAPTime now = HAPPlatformClockGetCurrent();
+    bool isPeerReading = shouldPeerRead && now >= closeTime + kPeerReadDelay;
+    if (isPeerReading) {
+        DrainPeer();
+    }
+
+    if (!finishTime && tcpStreams[0].fileDescriptor == -1) {
+        finishTime = now;
+    }
+    if (finishTime && (!shouldPeerRead || hasPeerReachedEnd)) {
+        HAPPlatformRunLoopStop();
+        return;
+    }
+    HAPAssert(now < closeTime + 2 * kHAPPlatformTCPStream_MaxSendBufferLingerDuration);
+
+    HAPPlatformTimerRef nextTimer;
+    HAPError err = HAPPlatformTimerRegister(&nextTimer, now + kPollInterval, HandlePollTimerExpired, NULL);
+    HAPAssert(!err);
+}
+
+static void HandleListenerCallback(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager_,
+        void* _Nullable context HAP_UNUSED) {
+    HAPError err = HAPPlatformTCPStreamManagerAcceptTCPStream(tcpStreamManager_, &tcpStream);
+    HAPAssert(!err);
+    HAPPlatformRunLoopStop();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/**
+ * Accepts a TCP stream, fills it, and closes it with the final response still in the send buffer.
+ */
+static void OpenAndCloseTCPStream(void) {
+    HAPPlatformTCPStreamManagerCreate(
+            &tcpStreamManager,
+            &(const HAPPlatformTCPStreamManagerOptions) {
+                    .addressFamily = kHAPPlatformTCPStreamManagerAddressFamily_IPv4,
+                    .maxConcurrentTCPStreams = HAPArrayCount(tcpStreams),
+                    .tcpStreams = tcpStreams,
+                    .sendBufferSize = kSendBufferSize,
+                    .sendBuffers = sendBuffers });
+    HAPPlatformTCPStreamManagerOpenListener(&tcpStreamManager, HandleListenerCallback, NULL);
+
+    peerFileDescriptor = socket(AF_INET, SOCK_STREAM, 0);
+    HAPAssert(peerFileDescriptor != -1);
+    int v = kSocketBufferSize;
+    int e = setsockopt(peerFileDescriptor, SOL_SOCKET, SO_RCVBUF, &v, sizeof v);
+    HAPAssert(!e);
+    struct sockaddr_in address = { .sin_family = AF_INET,
+                                   .sin_port = htons(HAPPlatformTCPStreamManagerGetListenerPort(&tcpStreamManager)),
+                                   .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    e = connect(peerFileDescriptor, (const struct sockaddr*) &address, sizeof address);
+    HAPAssert(!e);
+
+    HAPPlatformRunLoopRun();
+    e = setsockopt(tcpStreams[0].fileDescriptor, SOL_SOCKET, SO_SNDBUF, &v, sizeof v);
+    HAPAssert(!e);
+
+    numSentBytes = 0;
+    numReceivedBytes = 0;
+    hasPeerReachedEnd = false;
+    FillTCPStream();
+
+    HAPPlatformTCPStreamClose(&tcpStreamManager, tcpStream);
+    closeTime = HAPPlatformClockGetCurrent();
+    finishTime = 0;
+
+    HAPPlatformTCPStreamManagerStatistics statistics;
+    HAPPlatformTCPStreamManagerGetStatistics(&tcpStreamManager, &statistics);
+    HAPAssert(statistics.numDeferredCloses == 1);
+    HAPAssert(tcpStreams[0].sendBuffer.isClosePending);
+    HAPAssert(tcpStreams[0].fileDescriptor != -1);
+    HAPAssert(tcpStreamManager.numTCPStreams == 1);
+}
+
+static void CloseTCPStreamManager(void) {
+    HAPAssert(tcpStreams[0].fileDescriptor == -1);
+    HAPAssert(!tcpStreams[0].sendBuffer.isClosePending);
+    HAPAssert(!tcpStreams[0].sendBuffer.lingerTimer);
+    HAPAssert(!tcpStreamManager.numTCPStreams);
+
+    close(peerFileDescriptor);
+    HAPPlatformTCPStreamManagerCloseListener(&tcpStreamManager);
+    HAPPlatformTCPStreamManagerRelease(&tcpStreamManager);
+}
+
+/**
+ * The peer reads after the close: the final response is delivered and the close completes.
+ */
+static void TestDeferredClose(void) {
+    OpenAndCloseTCPStream();
+
+    shouldPeerRead = true;
+    HAPPlatformTimerRef timer;
+    HAPError err = HAPPlatformTimerRegister(&timer, 0, HandlePollTimerExpired, NULL);
+    HAPAssert(!err);
+    HAPPlatformRunLoopRun();
+
+    printf("Deferred close: %zu bytes received, closed after %llu ms.\n",
+           numReceivedBytes,
+           (unsigned long long) (finishTime - closeTime));
+    fflush(stdout);
+    HAPAssert(hasPeerReachedEnd);
+    HAPAssert(numReceivedBytes == numSentBytes);
+    HAPAssert(HAPRawBufferAreEqual(receivedBytes, sentBytes, numSentBytes));
+    HAPAssert(receivedBytes[numReceivedBytes - 1] == kFinalResponseByte);
+    HAPAssert(finishTime - closeTime >= kPeerReadDelay);
+    HAPAssert(finishTime - closeTime < kHAPPlatformTCPStream_MaxSendBufferLingerDuration);
+    CloseTCPStreamManager();
+}
+
+/**
+ * The peer does not read: the close completes when the linger time runs out.
+ */
+static void TestLingerTimeout(void) {
+    OpenAndCloseTCPStream();
+
+    shouldPeerRead = false;
+    HAPPlatformTimerRef timer;
+    HAPError err = HAPPlatformTimerRegister(&timer, 0, HandlePollTimerExpired, NULL);
+    HAPAssert(!err);
+    HAPPlatformRunLoopRun();
+
+    // The bytes that the socket took are still delivered, followed by the end of the stream.
+    struct timeval timeout = { .tv_sec = 2 };
+    int e = setsockopt(peerFileDescriptor, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+    HAPAssert(!e);
+    while (!hasPeerReachedEnd) {
+        ssize_t n = recv(
+                peerFileDescriptor, &receivedBytes[numReceivedBytes], sizeof receivedBytes - numReceivedBytes, 0);
+        HAPAssert(n >= 0);
+        hasPeerReachedEnd = !n;
+        numReceivedBytes += (size_t) n;
+    }
+
+    printf("Linger timeout: %zu of %zu bytes received, closed after %llu ms.\n",
+           numReceivedBytes,
+           numSentBytes,
+           (unsigned long long) (finishTime - closeTime));
+    fflush(stdout);
+    HAPAssert(finishTime - closeTime >= kHAPPlatformTCPStream_MaxSendBufferLingerDuration);
+    HAPAssert(finishTime - closeTime <= kHAPPlatformTCPStream_MaxSendBufferLingerDuration + kTolerance);
+    HAPAssert(numReceivedBytes == numSentBytes - kFinalResponseSize);
+    HAPAssert(HAPRawBufferAreEqual(receivedBytes, sentBytes, numReceivedBytes));
+    CloseTCPStreamManager();
+}
+
+/**
+ * The TCP stream manager is released while a close is pending.
+ */
+static void TestReleaseWithPendingClose(void) {
+    OpenAndCloseTCPStream();
+
+    close(peerFileDescriptor);
+    HAPPlatformTCPStreamManagerCloseListener(&tcpStreamManager);
+    HAPPlatformTCPStreamManagerRelease(&tcpStreamManager);
+    HAPAssert(tcpStreams[0].fileDescriptor == -1);
+    HAPAssert(!tcpStreams[0].sendBuffer.lingerTimer);
+    printf("Release: pending close completed.\n");
+}
+
+int main(void) {
+    // The run loop only requires a key-value store to be present.
+    static HAPPlatformKeyValueStore keyValueStore;
+    HAPPlatformRunLoopCreate(&(const HAPPlatformRunLoopOptions) { .keyValueStore = &keyValueStore });
+
+    TestDeferredClose();
+    TestLingerTimeout();
+    TestReleaseWithPendingClose();
+
+    HAPPlatformRunLoopRelease();
+    return 0;
+}
@@ -0,0 +1,424 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Test of the TCP stream listeners per address family and network interface.
+// - On loopback, it checks that the listener of each address family accepts exactly the IPv4 and IPv6 connections
+//   that it should, with IPv4 peers of dual-stack listeners reported as IPv4-mapped IPv6 addresses, and that a
+//   listener bound to a network interface takes the configured port.
+// - In a network namespace with veth pairs, it checks that the listeners of several network interfaces share one
+//   port, that each connection is queued on the listener of the network interface it arrived on, that a network
+//   interface without listener refuses connections, and that dual-stack listeners accept IPv4 connections even if
+//   net.ipv6.bindv6only is set. This part is skipped without the privilege to create network namespaces or without
+//   the ip command.
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformClock+Init.h"
+#include "HAPPlatformKeyValueStore+Init.h"
+#include "HAPPlatformRunLoop+Init.h"
+#include "HAPPlatformTCPStreamManager+Init.h"
+
+/** Maximum number of connections that are accepted at once. */
+#define kMaxConnections ((size_t) 4)
+
+/** Time after which the test gives up waiting for connections to be accepted. */
+#define kMaxAcceptTime ((HAPTime) 1 * HAPSecond)
+
+static HAPPlatformTCPStreamManager tcpStreamManager;
+static HAPPlatformTCPStream tcpStreams[kMaxConnections];
+
+static HAPPlatformTCPStreamRef acceptedTCPStreams[kMaxConnections];
+static size_t numAcceptedTCPStreams;
+static size_t numExpectedTCPStreams;
+static HAPPlatformTimerRef timeoutTimer;
+
+static void CreateTCPStreamManager(
+        HAPPlatformTCPStreamManagerAddressFamily addressFamily,
+        HAPNetworkPort port,
+        const char* _Nonnull const* _Nullable interfaceNames,
+        size_t numInterfaceNames) {
+    HAPPlatformTCPStreamManagerCreate(
+            &tcpStreamManager,
+            &(const HAPPlatformTCPStreamManagerOptions) { .port = port,
+                                                          .interfaceNames = interfaceNames,
+                                                          .numInterfaceNames = numInterfaceNames,
+                                                          .addressFamily = addressFamily,
+                                                          .maxConcurrentTCPStreams = HAPArrayCount(tcpStreams),
+                                                          .tcpStreams = tcpStreams });
+}
+
+/**
+ * Connects to a port from a new socket.
+ *
+ * @return Socket file descriptor, or -1 if the connection was refused.
+ */
+static int Connect(const char* addressString, HAPNetworkPort port) {
+    union {
+        struct sockaddr sa;
+        struct sockaddr_in sin;
+        struct sockaddr_in6 sin6;
+    } address;
+    socklen_t addressLength;
+    HAPRawBufferZero(&address, sizeof address);
+    if (inet_pton(AF_INET, addressString, &address.sin.sin_addr) == 1) {
+        address.sin.sin_family = AF_INET;
+        address.sin.sin_port = htons(port);
+        addressLength = sizeof address.sin;
+    } else {
+        int e = inet_pton(AF_INET6, addressString, &address.sin6.sin6_addr);
+        HAPAssert(e == 1);
+        address.sin6.sin6_family = AF_INET6;
+        address.sin6.sin6_port = htons(port);
+        addressLength = sizeof address.sin6;
+    }
+
+    int fileDescriptor = socket(address.sa.sa_family, SOCK_STREAM, 0);
+    HAPAssert(fileDescriptor != -1);
+    int e = connect(fileDescriptor, &address.sa, addressLength);
+    if (e) {
+        HAPAssert(errno == ECONNREFUSED);
+        close(fileDescriptor);
+        return -1;
+    }
+    return fileDescriptor;
+}
+
+/**
+ * Checks whether a listener has a connection pending in its accept queue, waiting up to the given timeout.
+ */
+static bool HasPendingConnection(size_t listenerIndex, int timeoutMilliseconds) {
+    HAPPrecondition(listenerIndex < tcpStreamManager.numTCPStreamListeners);
+    struct pollfd pollFileDescriptor = { .fd = tcpStreamManager.tcpStreamListeners[listenerIndex].fileDescriptor,
+                                         .events = POLLIN };
+    int n = poll(&pollFileDescriptor, 1, timeoutMilliseconds);
+    HAPAssert(n >= 0);
+    return n == 1;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void HandleTimeoutTimerExpired(HAPPlatformTimerRef timer HAP_UNUSED, void* _Nullable context HAP_UNUSED) {
+    timeoutTimer = 0;
+    HAPPlatformRunLoopStop();
+}
+
+static void HandleListenerCallback(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager_,
+        void* _Nullable context HAP_UNUSED) {
+    HAPPrecondition(numAcceptedTCPStreams < HAPArrayCount(acceptedTCPStreams));
+
+    HAPError err = HAPPlatformTCPStreamManagerAcceptTCPStream(
+            tcpStreamManager_, &acceptedTCPStreams[numAcceptedTCPStreams]);
+    if (err) {
+        return;
+    }
+    numAcceptedTCPStreams++;
+    if (numAcceptedTCPStreams == numExpectedTCPStreams) {
+        HAPPlatformTimerDeregister(timeoutTimer);
+        timeoutTimer = 0;
+        HAPPlatformRunLoopStop();
+    }
+}
+
+/**
+ * Runs the run loop until the given number of connections has been accepted, or the accept time ran out.
+ */
+static void AcceptTCPStreams(size_t numTCPStreams) {
+    HAPPrecondition(numTCPStreams <= HAPArrayCount(acceptedTCPStreams));
+
+    numAcceptedTCPStreams = 0;
+    numExpectedTCPStreams = numTCPStreams;
+    HAPError err = HAPPlatformTimerRegister(
+            &timeoutTimer, HAPPlatformClockGetCurrent() + kMaxAcceptTime, HandleTimeoutTimerExpired, NULL);
+    HAPAssert(!err);
+    HAPPlatformRunLoopRun();
+    if (timeoutTimer) {
+        HAPPlatformTimerDeregister(timeoutTimer);
+        timeoutTimer = 0;
+    }
+    HAPAssert(numAcceptedTCPStreams == numTCPStreams);
+}
+
+/**
+ * Checks the peer address of an accepted TCP stream, as IPv6 address.
+ */
+static void CheckPeerAddress(HAPPlatformTCPStreamRef tcpStream, const char* addressString) {
+    uint8_t address[16];
+    int e = inet_pton(AF_INET6, addressString, address);
+    HAPAssert(e == 1);
+
+    HAPPlatformTCPStreamStatistics statistics;
+    HAPPlatformTCPStreamGetStatistics(&tcpStreamManager, tcpStream, &statistics);
+    HAPAssert(HAPRawBufferAreEqual(statistics.peerAddress, address, sizeof address));
+}
+
+static void CloseTCPStreams(void) {
+    for (size_t i = 0; i < numAcceptedTCPStreams; i++) {
+        HAPPlatformTCPStreamClose(&tcpStreamManager, acceptedTCPStreams[i]);
+    }
+    numAcceptedTCPStreams = 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void TestLoopback(void) {
+    static const struct {
+        HAPPlatformTCPStreamManagerAddressFamily addressFamily;
+        const char* name;
+        bool acceptsIPv4;
+        bool acceptsIPv6;
+    } cases[] = {
+        { kHAPPlatformTCPStreamManagerAddressFamily_Any, "Any", true, true },
+        { kHAPPlatformTCPStreamManagerAddressFamily_IPv4, "IPv4", true, false },
+        { kHAPPlatformTCPStreamManagerAddressFamily_IPv6, "IPv6", false, true },
+    };
+    for (size_t i = 0; i < HAPArrayCount(cases); i++) {
+        CreateTCPStreamManager(cases[i].addressFamily, kHAPNetworkPort_Any, NULL, 0);
+        HAPPlatformTCPStreamManagerOpenListener(&tcpStreamManager, HandleListenerCallback, NULL);
+        HAPNetworkPort port = HAPPlatformTCPStreamManagerGetListenerPort(&tcpStreamManager);
+
+        int ipv4FileDescriptor = Connect("127.0.0.1", port);
+        int ipv6FileDescriptor = Connect("::1", port);
+        printf("Loopback, %-4s: IPv4 %s, IPv6 %s.\n",
+               cases[i].name,
+               ipv4FileDescriptor != -1 ? "accepted" : "refused",
+               ipv6FileDescriptor != -1 ? "accepted" : "refused");
+        HAPAssert((ipv4FileDescriptor != -1) == cases[i].acceptsIPv4);
+        HAPAssert((ipv6FileDescriptor != -1) == cases[i].acceptsIPv6);
+
+        // Connections are accepted in the order in which they were established.
+        AcceptTCPStreams((size_t) cases[i].acceptsIPv4 + (size_t) cases[i].acceptsIPv6);
+        size_t j = 0;
+        if (cases[i].acceptsIPv4) {
+            CheckPeerAddress(acceptedTCPStreams[j++], "::ffff:127.0.0.1");
+        }
+        if (cases[i].acceptsIPv6) {
+            CheckPeerAddress(acceptedTCPStreams[j++], "::1");
+        }
+
+        CloseTCPStreams();
+        if (ipv4FileDescriptor != -1) {
+            close(ipv4FileDescriptor);
+        }
+        if (ipv6FileDescriptor != -1) {
+            close(ipv6FileDescriptor);
+        }
+        HAPPlatformTCPStreamManagerCloseListener(&tcpStreamManager);
+        HAPPlatformTCPStreamManagerRelease(&tcpStreamManager);
+    }
+
+    // A listener bound to a network interface takes the configured port.
+    CreateTCPStreamManager(kHAPPlatformTCPStreamManagerAddressFamily_IPv4, kHAPNetworkPort_Any, NULL, 0);
+    HAPPlatformTCPStreamManagerOpenListener(&tcpStreamManager, HandleListenerCallback, NULL);
+    HAPNetworkPort port = HAPPlatformTCPStreamManagerGetListenerPort(&tcpStreamManager);
+    HAPPlatformTCPStreamManagerCloseListener(&tcpStreamManager);
+    HAPPlatformTCPStreamManagerRelease(&tcpStreamManager);
+
+    CreateTCPStreamManager(kHAPPlatformTCPStreamManagerAddressFamily_Any, port, (const char* const[]) { "lo" }, 1);
+    HAPPlatformTCPStreamManagerOpenListener(&tcpStreamManager, HandleListenerCallback, NULL);
+    HAPAssert(HAPPlatformTCPStreamManagerGetListenerPort(&tcpStreamManager) == port);
+    int fileDescriptor = Connect("127.0.0.1", port);
+    HAPAssert(fileDescriptor != -1);
+    AcceptTCPStreams(1);
+    CheckPeerAddress(acceptedTCPStreams[0], "::ffff:127.0.0.1");
+    printf("Loopback, lo  : Listening on configured port %u.\n", port);
+
+    CloseTCPStreams();
+    close(fileDescriptor);
+    HAPPlatformTCPStreamManagerCloseListener(&tcpStreamManager);
+    HAPPlatformTCPStreamManagerRelease(&tcpStreamManager);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/**
+ * Runs a shell command.
+ *
+ * @return true                     If the command succeeded.
+ * @return false                    Otherwise.
+ */
+static bool RunCommand(const char* format, ...) {
+    char command[256];
+    va_list arguments;
+    va_start(arguments, format);
+    int n = vsnprintf(command, sizeof command, format, arguments);
+    va_end(arguments);
+    HAPAssert(n > 0 && (size_t) n < sizeof command);
+    return system(command) == 0;
+}
+
+static int accessoryNetworkNamespace = -1;
+static int peerNetworkNamespace = -1;
+
+static void EnterNetworkNamespace(int networkNamespace) {
+    int e = setns(networkNamespace, CLONE_NEWNET);
+    HAPAssert(!e);
+}
+
+/**
+ * Creates a network namespace for the accessory with three network interfaces, each connected by a veth pair to a
+ * network namespace for the peers:
+ * - veth0: 10.0.0.1, peer 10.0.0.2.
+ * - veth1: 10.0.1.1 and fd00:1::1, peer 10.0.1.2 and fd00:1::2.
+ * - veth2: 10.0.2.1, peer 10.0.2.2.
+ * The calling thread is left in the network namespace of the accessory.
+ *
+ * @return true                     If successful.
+ * @return false                    If network namespaces or the ip command are not available.
+ */
+static bool CreateNetworkNamespaces(void) {
+    if (unshare(CLONE_NEWNET)) {
+        printf("Skipped network interfaces: Creating a network namespace requires CAP_SYS_ADMIN.\n");
+        return false;
+    }
+    if (!RunCommand("ip link set lo up 2>/dev/null")) {
+        printf("Skipped network interfaces: The ip command is not available.\n");
+        return false;
+    }
+    accessoryNetworkNamespace = open("/proc/self/ns/net", O_RDONLY);
+    HAPAssert(accessoryNetworkNamespace != -1);
+    int e = unshare(CLONE_NEWNET);
+    HAPAssert(!e);
+    // Not opened with O_CLOEXEC, so that the ip command can move network interfaces into it.
+    peerNetworkNamespace = open("/proc/self/ns/net", O_RDONLY);
+    HAPAssert(peerNetworkNamespace != -1);
+
+    EnterNetworkNamespace(accessoryNetworkNamespace);
+    for (int i = 0; i < 3; i++) {
+        HAPAssert(RunCommand("ip link add veth%d type veth peer name veth%dp", i, i));
+        HAPAssert(RunCommand("ip link set veth%dp netns /proc/self/fd/%d", i, peerNetworkNamespace));
+        HAPAssert(RunCommand("ip address add 10.0.%d.1/24 dev veth%d", i, i));
+        HAPAssert(RunCommand("ip link set veth%d up", i));
+    }
+    HAPAssert(RunCommand("ip address add fd00:1::1/64 dev veth1 nodad"));
+
+    EnterNetworkNamespace(peerNetworkNamespace);
+    for (int i = 0; i < 3; i++) {
+        HAPAssert(RunCommand("ip address add 10.0.%d.2/24 dev veth%dp", i, i));
+        HAPAssert(RunCommand("ip link set veth%dp up", i));
+    }
+    HAPAssert(RunCommand("ip address add fd00:1::2/64 dev veth1p nodad"));
+
+    EnterNetworkNamespace(accessoryNetworkNamespace);
+    return true;
+}
+
+/**
+ * Connects to the accessory from the peer network namespace.
+ *
+ * @return Socket file descriptor, or -1 if the connection was refused.
+ */
+static int ConnectFromPeer(const char* addressString, HAPNetworkPort port) {
+    EnterNetworkNamespace(peerNetworkNamespace);
+    int fileDescriptor = Connect(addressString, port);
+    EnterNetworkNamespace(accessoryNetworkNamespace);
+    return fileDescriptor;
+}
+
+static void TestNetworkInterfaces(void) {
+    if (!CreateNetworkNamespaces()) {
+        return;
+    }
+
+    // Dual-stack listeners must not depend on the system default of IPV6_V6ONLY.
+    FILE* file = fopen("/proc/sys/net/ipv6/bindv6only", "w");
+    HAPAssert(file);
+    fputs("1", file);
+    int e = fclose(file);
+    HAPAssert(!e);
+
+    CreateTCPStreamManager(
+            kHAPPlatformTCPStreamManagerAddressFamily_Any,
+            kHAPNetworkPort_Any,
+            (const char* const[]) { "veth0", "veth1" },
+            2);
+    HAPPlatformTCPStreamManagerOpenListener(&tcpStreamManager, HandleListenerCallback, NULL);
+    HAPAssert(tcpStreamManager.numTCPStreamListeners == 2);
+    HAPNetworkPort port = HAPPlatformTCPStreamManagerGetListenerPort(&tcpStreamManager);
+    for (size_t i = 0; i < tcpStreamManager.numTCPStreamListeners; i++) {
+        struct sockaddr_in6 address;
+        socklen_t addressLength = sizeof address;
+        e = getsockname(
+                tcpStreamManager.tcpStreamListeners[i].fileDescriptor, (struct sockaddr*) &address, &addressLength);
+        HAPAssert(!e);
+        HAPAssert(address.sin6_family == AF_INET6);
+        HAPAssert(ntohs(address.sin6_port) == port);
+    }
+    printf("Network interfaces: Listening on veth0 and veth1 on port %u.\n", port);
+
+    static const struct {
+        const char* address;
+        size_t listenerIndex;
+        const char* peerAddress;
+    } connections[] = {
+        { "10.0.0.1", 0, "::ffff:10.0.0.2" },
+        { "10.0.1.1", 1, "::ffff:10.0.1.2" },
+        { "fd00:1::1", 1, "fd00:1::2" },
+    };
+    int fileDescriptors[HAPArrayCount(connections)];
+    for (size_t i = 0; i < HAPArrayCount(connections); i++) {
+        fileDescriptors[i] = ConnectFromPeer(connections[i].address, port);
+        HAPAssert(fileDescriptors[i] != -1);
+        HAPAssert(HasPendingConnection(connections[i].listenerIndex, 1000));
+        HAPAssert(!HasPendingConnection(1 - connections[i].listenerIndex, 0));
+        AcceptTCPStreams(1);
+        CheckPeerAddress(acceptedTCPStreams[0], connections[i].peerAddress);
+        printf("Network interfaces: %-9s accepted on veth%zu.\n",
+               connections[i].address,
+               connections[i].listenerIndex);
+        CloseTCPStreams();
+    }
+
+    // veth2 has no listener.
+    int fileDescriptor = ConnectFromPeer("10.0.2.1", port);
+    printf("Network interfaces: %-9s %s.\n", "10.0.2.1", fileDescriptor != -1 ? "accepted" : "refused");
+    HAPAssert(fileDescriptor == -1);
+
+    for (size_t i = 0; i < HAPArrayCount(fileDescriptors); i++) {
+        close(fileDescriptors[i]);
+    }
+    HAPPlatformTCPStreamManagerCloseListener(&tcpStreamManager);
+    HAPPlatformTCPStreamManagerRelease(&tcpStreamManager);
+    close(peerNetworkNamespace);
+    close(accessoryNetworkNamespace);
+}
+
+int main(void) {
+    // The run loop only requires a key-value store to be present.
+    static HAPPlatformKeyValueStore keyValueStore;
+    HAPPlatformRunLoopCreate(&(const HAPPlatformRunLoopOptions) { .keyValueStore = &keyValueStore });
+
+    TestLoopback();
+    TestNetworkInterfaces();
+
+    HAPPlatformRunLoopRelease();
+    return 0;
+}
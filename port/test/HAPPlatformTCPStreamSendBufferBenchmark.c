@@ -0,0 +1,232 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmark of the send buffer of TCP streams. Bursts of small writes, like a burst of event notifications, are
+// issued from a single run loop iteration over loopback TCP, without and with a send buffer. With a send buffer, the
+// writes are collected and the flush observer sends them at the end of the run loop iteration. Reports the send
+// system calls and the TCP data segments per burst. The segments are taken from TCP_INFO of the accepted socket.
+
+#include <errno.h>
+#include <linux/tcp.h>
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformClock+Init.h"
+#include "HAPPlatformKeyValueStore+Init.h"
+#include "HAPPlatformRunLoop+Init.h"
+#include "HAPPlatformTCPStreamManager+Init.h"
+
+/** Size of the send buffer when buffering is enabled. */
+#define kSendBufferSize ((size_t) 1024)
+
+/** Size of each write, about the size of an encrypted event notification. */
+#define kWriteSize ((size_t) 96)
+
+/** Number of bursts that are measured per configuration. */
+#define kNumBursts ((size_t) 100)
+
+/** Time between bursts, so that each burst is issued from its own run loop iteration. */
+#define kBurstInterval ((HAPTime) 1 * HAPMillisecond)
+
+static HAPPlatformTCPStreamManager tcpStreamManager;
+static HAPPlatformTCPStream tcpStreams[1];
+static uint8_t sendBuffers[HAPArrayCount(tcpStreams) * kSendBufferSize];
+static HAPPlatformTCPStreamRef tcpStream;
+
+static int peerFileDescriptor;
+static size_t numWritesPerBurst;
+static size_t numBursts;
+static size_t numSentBytes;
+static size_t numReceivedBytes;
+
+/**
+ * Returns the number of TCP data segments that the accepted socket has sent.
+ */
+static uint32_t GetNumDataSegments(void) {
+    struct tcp_info info;
+    socklen_t infoLength = sizeof info;
+    int e = getsockopt(tcpStreams[0].fileDescriptor, IPPROTO_TCP, TCP_INFO, &info, &infoLength);
+    HAPAssert(!e);
+    HAPAssert(infoLength >= offsetof(struct tcp_info, tcpi_data_segs_out) + sizeof info.tcpi_data_segs_out);
+    return info.tcpi_data_segs_out;
+}
+
+/**
+ * Reads everything the peer has received so far.
+ */
+static void DrainPeer(void) {
+    for (;;) {
+        uint8_t bytes[4096];
+        ssize_t n = recv(peerFileDescriptor, bytes, sizeof bytes, MSG_DONTWAIT);
+        if (n == -1) {
+            HAPAssert(errno == EAGAIN || errno == EWOULDBLOCK);
+            return;
+        }
+        HAPAssert(n > 0);
+        numReceivedBytes += (size_t) n;
+    }
+}
+
+/**
+ * Computes the number of send system calls of a burst with a send buffer: a write that does not fit is sent together
+ * with the buffered bytes, and the remaining bytes are sent by the flush observer.
+ */
+static size_t GetExpectedNumBufferedSendCalls(size_t numWrites) {
+    size_t numSendCalls = 0;
+    size_t numBufferedBytes = 0;
+    for (size_t i = 0; i < numWrites; i++) {
+        if (numBufferedBytes + kWriteSize <= kSendBufferSize) {
+            numBufferedBytes += kWriteSize;
+        } else {
+            numSendCalls++;
+            numBufferedBytes = 0;
+        }
+    }
+    return numSendCalls + (numBufferedBytes ? 1 : 0);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void HandleBurstTimerExpired(HAPPlatformTimerRef timer HAP_UNUSED, void* _Nullable context HAP_UNUSED) {
+    DrainPeer();
+    if (numBursts == kNumBursts) {
+        HAPPlatformRunLoopStop();
+        return;
+    }
+    numBursts++;
+
+    for (size_t i = 0; i < numWritesPerBurst; i++) {
+        static const uint8_t bytes[kWriteSize];
+        size_t numBytes;
+        HAPError err = HAPPlatformTCPStreamWrite(&tcpStreamManager, tcpStream, bytes, sizeof bytes, &numBytes);
+        HAPAssert(!err);
+        HAPAssert(numBytes == sizeof bytes);
+        numSentBytes += numBytes;
+    }
+
+    HAPPlatformTimerRef nextTimer;
+    HAPError err = HAPPlatformTimerRegister(
+            &nextTimer, HAPPlatformClockGetCurrent() + kBurstInterval, HandleBurstTimerExpired, NULL);
+    HAPAssert(!err);
+}
+
+static void HandleListenerCallback(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager_,
+        void* _Nullable context HAP_UNUSED) {
+    HAPError err = HAPPlatformTCPStreamManagerAcceptTCPStream(tcpStreamManager_, &tcpStream);
+    HAPAssert(!err);
+
+    HAPPlatformTimerRef timer;
+    err = HAPPlatformTimerRegister(&timer, 0, HandleBurstTimerExpired, NULL);
+    HAPAssert(!err);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void MeasureBursts(size_t sendBufferSize, size_t numWrites) {
+    HAPPlatformTCPStreamManagerCreate(
+            &tcpStreamManager,
+            &(const HAPPlatformTCPStreamManagerOptions) {
+                    .addressFamily = kHAPPlatformTCPStreamManagerAddressFamily_IPv4,
+                    .maxConcurrentTCPStreams = HAPArrayCount(tcpStreams),
+                    .tcpStreams = tcpStreams,
+                    .sendBufferSize = sendBufferSize,
+                    .sendBuffers = sendBufferSize ? sendBuffers : NULL });
+    HAPPlatformTCPStreamManagerOpenListener(&tcpStreamManager, HandleListenerCallback, NULL);
+
+    peerFileDescriptor = socket(AF_INET, SOCK_STREAM, 0);
+    HAPAssert(peerFileDescriptor != -1);
+    struct sockaddr_in address = { .sin_family = AF_INET,
+                                   .sin_port = htons(HAPPlatformTCPStreamManagerGetListenerPort(&tcpStreamManager)),
+                                   .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    int e = connect(peerFileDescriptor, (const struct sockaddr*) &address, sizeof address);
+    HAPAssert(!e);
+
+    // The run loop accepts the connection and then issues one burst per timer expiration.
+    numWritesPerBurst = numWrites;
+    numBursts = 0;
+    numSentBytes = 0;
+    numReceivedBytes = 0;
+    HAPPlatformTCPStreamManagerStatistics managerStatistics;
+    HAPPlatformTCPStreamManagerGetStatistics(&tcpStreamManager, &managerStatistics);
+    HAPAssert(!managerStatistics.numBufferedWrites && !managerStatistics.numSendBufferFlushes);
+    HAPPlatformRunLoopRun();
+
+    HAPPlatformTCPStreamStatistics statistics;
+    HAPPlatformTCPStreamGetStatistics(&tcpStreamManager, tcpStream, &statistics);
+    HAPPlatformTCPStreamManagerGetStatistics(&tcpStreamManager, &managerStatistics);
+    size_t numSendCalls = statistics.numSendCalls - statistics.numBusySendCalls;
+    uint32_t numDataSegments = GetNumDataSegments();
+    printf("%-10s  %6zu  %6zu  %10.2f  %13.2f  %15zu  %7zu\n",
+           sendBufferSize ? "Buffered" : "Unbuffered",
+           numWrites,
+           numWrites * kWriteSize,
+           (double) numSendCalls / kNumBursts,
+           (double) numDataSegments / kNumBursts,
+           managerStatistics.numBufferedWrites,
+           managerStatistics.numSendBufferFlushes);
+    fflush(stdout);
+
+    HAPAssert(numBursts == kNumBursts);
+    HAPAssert(numReceivedBytes == numSentBytes);
+    HAPAssert(numSentBytes == kNumBursts * numWrites * kWriteSize);
+    if (!sendBufferSize) {
+        HAPAssert(numSendCalls == kNumBursts * numWrites);
+        HAPAssert(!managerStatistics.numBufferedWrites);
+    } else {
+        size_t numExpectedSendCalls = GetExpectedNumBufferedSendCalls(numWrites);
+        HAPAssert(numSendCalls == kNumBursts * numExpectedSendCalls);
+        HAPAssert(numDataSegments <= numSendCalls);
+        HAPAssert(managerStatistics.numBufferedWrites == kNumBursts * (numWrites - (numExpectedSendCalls - 1)));
+        HAPAssert(managerStatistics.numSendBufferFlushes == kNumBursts);
+    }
+
+    HAPPlatformTCPStreamClose(&tcpStreamManager, tcpStream);
+    close(peerFileDescriptor);
+    HAPPlatformTCPStreamManagerCloseListener(&tcpStreamManager);
+    HAPPlatformTCPStreamManagerRelease(&tcpStreamManager);
+}
+
+int main(void) {
+    // The run loop only requires a key-value store to be present.
+    static HAPPlatformKeyValueStore keyValueStore;
+    HAPPlatformRunLoopCreate(&(const HAPPlatformRunLoopOptions) { .keyValueStore = &keyValueStore });
+
+    printf("%-10s  %6s  %6s  %10s  %13s  %15s  %7s\n",
+           "Mode",
+           "Writes",
+           "Bytes",
+           "Send calls",
+           "Data segments",
+           "Buffered writes",
+           "Flushes");
+    static const size_t numWrites[] = { 1, 4, 16 };
+    for (size_t i = 0; i < HAPArrayCount(numWrites); i++) {
+        MeasureBursts(0, numWrites[i]);
+        MeasureBursts(kSendBufferSize, numWrites[i]);
+    }
+
+    HAPPlatformRunLoopRelease();
+    return 0;
+}
@@ -0,0 +1,326 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmark of HAPPlatformTCPStreamWritev against HAPPlatformTCPStreamWrite for HAP responses that are framed like
+// by the IP security layer: every chunk of up to 1024 bytes is preceded by a 2-byte length and followed by a 16-byte
+// authentication tag. Each response is sent over loopback TCP in three ways:
+// - Copy: the frames are staged in one contiguous buffer, which is written with HAPPlatformTCPStreamWrite.
+// - Write: every length, ciphertext and tag segment is written with its own HAPPlatformTCPStreamWrite.
+// - Writev: the segments are written with HAPPlatformTCPStreamWritev, up to kHAPPlatformTCPStream_MaxWriteBuffers at a
+//   time.
+// Reports send system calls, bytes copied and time per response, and checks that the peer receives identical bytes.
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformClock+Init.h"
+#include "HAPPlatformKeyValueStore+Init.h"
+#include "HAPPlatformRunLoop+Init.h"
+#include "HAPPlatformTCPStreamManager+Init.h"
+
+/** Maximum number of ciphertext bytes per frame. */
+#define kMaxFrameBytes ((size_t) 1024)
+
+/** Size of the length prefix of a frame. */
+#define kLengthSize ((size_t) 2)
+
+/** Size of the authentication tag of a frame. */
+#define kTagSize ((size_t) 16)
+
+/** Largest response that is measured. */
+#define kMaxResponseSize ((size_t) 32 * 1024)
+
+/** Maximum number of frames of a response. */
+#define kMaxFrames ((kMaxResponseSize + kMaxFrameBytes - 1) / kMaxFrameBytes)
+
+/** Number of responses that are sent per response size and method. */
+#define kNumResponses ((size_t) 300)
+
+typedef enum { kMethod_Copy, kMethod_Write, kMethod_Writev, kNumMethods } Method;
+
+static const char* const methodNames[] = { "Copy", "Write", "Writev" };
+
+static HAPPlatformTCPStreamManager tcpStreamManager;
+static HAPPlatformTCPStream tcpStreams[1];
+static HAPPlatformTCPStreamRef tcpStream;
+
+static uint8_t response[kMaxResponseSize];
+static uint8_t lengths[kMaxFrames][kLengthSize];
+static uint8_t tags[kMaxFrames][kTagSize];
+static uint8_t stagingBuffer[kMaxResponseSize + kMaxFrames * (kLengthSize + kTagSize)];
+
+static uint64_t sentHash;
+static uint64_t numSentBytes;
+static uint64_t numCopiedBytes;
+
+static volatile uint64_t receivedHash;
+static volatile uint64_t numReceivedBytes;
+static volatile bool isReceiving;
+
+static uint64_t GetNanoseconds(void) {
+    struct timespec now;
+    int e = clock_gettime(CLOCK_MONOTONIC, &now);
+    HAPAssert(!e);
+    return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
+/**
+ * Adds bytes to an FNV-1a hash.
+ */
+static uint64_t HashBytes(uint64_t hash, const uint8_t* bytes, size_t numBytes) {
+    for (size_t i = 0; i < numBytes; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3;
+    }
+    return hash;
+}
+
+/**
+ * Writes all bytes of the given buffers, retrying while the socket is busy or the write is partial.
+ */
+static void WriteAll(HAPPlatformTCPStreamBuffer* buffers, size_t numBuffers, bool isVectored) {
+    size_t i = 0;
+    while (i < numBuffers) {
+        size_t numBytes;
+        HAPError err;
+        if (isVectored) {
+            err = HAPPlatformTCPStreamWritev(&tcpStreamManager, tcpStream, &buffers[i], numBuffers - i, &numBytes);
+        } else {
+            err = HAPPlatformTCPStreamWrite(
+                    &tcpStreamManager, tcpStream, buffers[i].bytes, buffers[i].numBytes, &numBytes);
+        }
+        if (err == kHAPError_Busy) {
+            sched_yield();
+            continue;
+        }
+        HAPAssert(!err);
+
+        // Skip the written bytes.
+        while (i < numBuffers && numBytes >= buffers[i].numBytes) {
+            numBytes -= buffers[i].numBytes;
+            i++;
+        }
+        if (numBytes) {
+            buffers[i].bytes = &((const uint8_t*) buffers[i].bytes)[numBytes];
+            buffers[i].numBytes -= numBytes;
+        }
+    }
+}
+
+/**
+ * Frames and sends a response of the given size.
+ */
+static void SendResponse(size_t responseSize, Method method) {
+    HAPPrecondition(responseSize <= kMaxResponseSize);
+
+    // Describe the segments of all frames. In the HAP layer, each frame would be encrypted in place.
+    static HAPPlatformTCPStreamBuffer buffers[3 * kMaxFrames];
+    size_t numBuffers = 0;
+    for (size_t offset = 0, frameIndex = 0; offset < responseSize; offset += kMaxFrameBytes, frameIndex++) {
+        size_t numFrameBytes = HAPMin(kMaxFrameBytes, responseSize - offset);
+        lengths[frameIndex][0] = (uint8_t)(numFrameBytes & 0xFF);
+        lengths[frameIndex][1] = (uint8_t)(numFrameBytes >> 8);
+        buffers[numBuffers++] = (HAPPlatformTCPStreamBuffer) { .bytes = lengths[frameIndex], .numBytes = kLengthSize };
+        buffers[numBuffers++] = (HAPPlatformTCPStreamBuffer) { .bytes = &response[offset], .numBytes = numFrameBytes };
+        buffers[numBuffers++] = (HAPPlatformTCPStreamBuffer) { .bytes = tags[frameIndex], .numBytes = kTagSize };
+    }
+    for (size_t i = 0; i < numBuffers; i++) {
+        sentHash = HashBytes(sentHash, buffers[i].bytes, buffers[i].numBytes);
+        numSentBytes += buffers[i].numBytes;
+    }
+
+    switch (method) {
+        case kMethod_Copy: {
+            size_t numBytes = 0;
+            for (size_t i = 0; i < numBuffers; i++) {
+                HAPRawBufferCopyBytes(&stagingBuffer[numBytes], buffers[i].bytes, buffers[i].numBytes);
+                numBytes += buffers[i].numBytes;
+            }
+            numCopiedBytes += numBytes;
+            HAPPlatformTCPStreamBuffer buffer = { .bytes = stagingBuffer, .numBytes = numBytes };
+            WriteAll(&buffer, 1, false);
+            return;
+        }
+        case kMethod_Write: {
+            WriteAll(buffers, numBuffers, false);
+            return;
+        }
+        case kMethod_Writev: {
+            WriteAll(buffers, numBuffers, true);
+            return;
+        }
+        case kNumMethods: {
+        }
+    }
+    HAPFatalError();
+}
+
+static void MeasureResponses(size_t responseSize, Method method) {
+    HAPPlatformTCPStreamStatistics before;
+    HAPPlatformTCPStreamGetStatistics(&tcpStreamManager, tcpStream, &before);
+    numCopiedBytes = 0;
+
+    uint64_t startTime = GetNanoseconds();
+    for (size_t i = 0; i < kNumResponses; i++) {
+        SendResponse(responseSize, method);
+    }
+    uint64_t duration = GetNanoseconds() - startTime;
+
+    HAPPlatformTCPStreamStatistics after;
+    HAPPlatformTCPStreamGetStatistics(&tcpStreamManager, tcpStream, &after);
+    size_t numBusySendCalls = after.numBusySendCalls - before.numBusySendCalls;
+    size_t numSendCalls = after.numSendCalls - before.numSendCalls - numBusySendCalls;
+    size_t numFrames = (responseSize + kMaxFrameBytes - 1) / kMaxFrameBytes;
+    printf("%8zu  %-6s  %10.1f  %11.1f  %12.0f  %9.1f\n",
+           responseSize,
+           methodNames[method],
+           (double) numSendCalls / kNumResponses,
+           (double) numBusySendCalls / kNumResponses,
+           (double) numCopiedBytes / kNumResponses,
+           (double) duration / kNumResponses / 1000);
+
+    switch (method) {
+        case kMethod_Copy: {
+            HAPAssert(numCopiedBytes == kNumResponses * (responseSize + numFrames * (kLengthSize + kTagSize)));
+            HAPAssert(numSendCalls >= kNumResponses);
+            break;
+        }
+        case kMethod_Write: {
+            HAPAssert(!numCopiedBytes);
+            HAPAssert(numSendCalls >= kNumResponses * 3 * numFrames);
+            break;
+        }
+        case kMethod_Writev: {
+            // Partial writes may take additional calls.
+            HAPAssert(!numCopiedBytes);
+            size_t minSendCalls =
+                    (3 * numFrames + kHAPPlatformTCPStream_MaxWriteBuffers - 1) / kHAPPlatformTCPStream_MaxWriteBuffers;
+            HAPAssert(numSendCalls >= kNumResponses * minSendCalls);
+            HAPAssert(numSendCalls < kNumResponses * 3 * numFrames);
+            break;
+        }
+        case kNumMethods: {
+            HAPFatalError();
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void HandleListenerCallback(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager_,
+        void* _Nullable context HAP_UNUSED) {
+    HAPError err = HAPPlatformTCPStreamManagerAcceptTCPStream(tcpStreamManager_, &tcpStream);
+    if (err) {
+        return;
+    }
+
+    printf("%8s  %-6s  %10s  %11s  %12s  %9s\n", "Response", "Method", "Send calls", "Busy calls", "Bytes copied",
+           "Time (us)");
+    static const size_t responseSizes[] = { 1024, 6 * 1024, kMaxResponseSize };
+    for (size_t i = 0; i < HAPArrayCount(responseSizes); i++) {
+        for (Method method = 0; method < kNumMethods; method++) {
+            MeasureResponses(responseSizes[i], method);
+        }
+    }
+
+    // Wait until the peer has received everything.
+    while (__atomic_load_n(&numReceivedBytes, __ATOMIC_ACQUIRE) < numSentBytes) {
+        sched_yield();
+    }
+    HAPPlatformTCPStreamClose(tcpStreamManager_, tcpStream);
+    HAPPlatformRunLoopStop();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void* _Nullable RunReceiver(void* _Nullable context) {
+    HAPPrecondition(context);
+    HAPNetworkPort port = *(const HAPNetworkPort*) context;
+
+    int fileDescriptor = socket(AF_INET, SOCK_STREAM, 0);
+    HAPAssert(fileDescriptor != -1);
+    struct sockaddr_in address = { .sin_family = AF_INET,
+                                   .sin_port = htons(port),
+                                   .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    int e = connect(fileDescriptor, (const struct sockaddr*) &address, sizeof address);
+    HAPAssert(!e);
+
+    uint64_t hash = 0xCBF29CE484222325;
+    for (;;) {
+        static uint8_t bytes[64 * 1024];
+        ssize_t n = recv(fileDescriptor, bytes, sizeof bytes, 0);
+        HAPAssert(n >= 0);
+        if (!n) {
+            break;
+        }
+        hash = HashBytes(hash, bytes, (size_t) n);
+        receivedHash = hash;
+        __atomic_fetch_add(&numReceivedBytes, (uint64_t) n, __ATOMIC_RELEASE);
+    }
+    close(fileDescriptor);
+    return NULL;
+}
+
+int main(void) {
+    // The run loop only requires a key-value store to be present.
+    static HAPPlatformKeyValueStore keyValueStore;
+    HAPPlatformRunLoopCreate(&(const HAPPlatformRunLoopOptions) { .keyValueStore = &keyValueStore });
+
+    for (size_t i = 0; i < sizeof response; i++) {
+        response[i] = (uint8_t)(i * 7);
+    }
+    for (size_t i = 0; i < kMaxFrames; i++) {
+        for (size_t j = 0; j < kTagSize; j++) {
+            tags[i][j] = (uint8_t)(0xA0 + i);
+        }
+    }
+    sentHash = 0xCBF29CE484222325;
+
+    HAPPlatformTCPStreamManagerCreate(
+            &tcpStreamManager,
+            &(const HAPPlatformTCPStreamManagerOptions) {
+                    .addressFamily = kHAPPlatformTCPStreamManagerAddressFamily_IPv4,
+                    .maxConcurrentTCPStreams = HAPArrayCount(tcpStreams),
+                    .tcpStreams = tcpStreams });
+    HAPPlatformTCPStreamManagerOpenListener(&tcpStreamManager, HandleListenerCallback, NULL);
+    HAPNetworkPort port = HAPPlatformTCPStreamManagerGetListenerPort(&tcpStreamManager);
+
+    pthread_t receiverThread;
+    int e = pthread_create(&receiverThread, NULL, RunReceiver, &port);
+    HAPAssert(!e);
+    HAPPlatformRunLoopRun();
+    e = pthread_join(receiverThread, NULL);
+    HAPAssert(!e);
+    fflush(stdout);
+
+    HAPAssert(numReceivedBytes == numSentBytes);
+    HAPAssert(receivedHash == sentHash);
+
+    HAPPlatformTCPStreamManagerCloseListener(&tcpStreamManager);
+    HAPPlatformTCPStreamManagerRelease(&tcpStreamManager);
+    HAPPlatformRunLoopRelease();
+    return 0;
+}
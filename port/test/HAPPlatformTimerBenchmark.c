@@ -0,0 +1,188 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmark of the timer heap against the sorted linked list that the run loop used before, with 10, 100 and 1000
+// live timers. Each operation cancels a random live timer and arms a new one with a random deadline, like session
+// idle timeouts that are pushed back on activity. Also checks that timers fire in order of their deadlines, and that
+// timers with equal deadlines fire in order of registration.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformClock+Init.h"
+#include "HAPPlatformKeyValueStore+Init.h"
+#include "HAPPlatformRunLoop+Init.h"
+
+/**
+ * Timer of the reference implementation: a singly linked list sorted by deadline, with one heap allocation per timer.
+ */
+typedef struct ListTimer ListTimer;
+struct ListTimer {
+    HAPTime deadline;
+    ListTimer* _Nullable nextTimer;
+};
+
+static ListTimer* _Nullable listTimers;
+
+static ListTimer* RegisterListTimer(HAPTime deadline) {
+    ListTimer* newTimer = calloc(1, sizeof *newTimer);
+    HAPAssert(newTimer);
+    newTimer->deadline = deadline;
+    for (ListTimer* _Nullable* nextTimer = &listTimers;; nextTimer = &(*nextTimer)->nextTimer) {
+        if (!*nextTimer || (*nextTimer)->deadline > deadline) {
+            newTimer->nextTimer = *nextTimer;
+            *nextTimer = newTimer;
+            return newTimer;
+        }
+    }
+}
+
+static void DeregisterListTimer(ListTimer* timer) {
+    for (ListTimer* _Nullable* nextTimer = &listTimers; *nextTimer; nextTimer = &(*nextTimer)->nextTimer) {
+        if (*nextTimer == timer) {
+            *nextTimer = timer->nextTimer;
+            free(timer);
+            return;
+        }
+    }
+    HAPFatalError();
+}
+
+static uint32_t randomState = 1;
+
+/**
+ * Returns a pseudo random number, so that both implementations see the same sequence of deadlines.
+ */
+static uint32_t GetRandomNumber(void) {
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+static void HandleTimerExpired(HAPPlatformTimerRef timer HAP_UNUSED, void* _Nullable context HAP_UNUSED) {
+    HAPFatalError();
+}
+
+/**
+ * Measures the time of cancelling and re-arming a timer.
+ *
+ * @param      numTimers            Number of live timers.
+ * @param      numOperations        Number of operations.
+ * @param      useList              Whether the reference implementation is measured instead of the run loop.
+ *
+ * @return Time per operation in nanoseconds.
+ */
+static double MeasureTimerChurn(size_t numTimers, size_t numOperations, bool useList) {
+    HAPTime baseTime = HAPPlatformClockGetCurrent() + HAPMinute;
+    HAPPlatformTimerRef* timers = calloc(numTimers, sizeof *timers);
+    ListTimer** listTimerRefs = calloc(numTimers, sizeof *listTimerRefs);
+    HAPAssert(timers && listTimerRefs);
+
+    randomState = 1;
+    for (size_t i = 0; i < numTimers; i++) {
+        HAPTime deadline = baseTime + GetRandomNumber() % HAPMinute;
+        if (useList) {
+            listTimerRefs[i] = RegisterListTimer(deadline);
+        } else {
+            HAPError err = HAPPlatformTimerRegister(&timers[i], deadline, HandleTimerExpired, NULL);
+            HAPAssert(!err);
+        }
+    }
+
+    uint64_t startTime = HAPPlatformClockGetCurrentMicroseconds();
+    for (size_t j = 0; j < numOperations; j++) {
+        size_t i = GetRandomNumber() % numTimers;
+        HAPTime deadline = baseTime + GetRandomNumber() % HAPMinute;
+        if (useList) {
+            DeregisterListTimer(listTimerRefs[i]);
+            listTimerRefs[i] = RegisterListTimer(deadline);
+        } else {
+            HAPPlatformTimerDeregister(timers[i]);
+            HAPError err = HAPPlatformTimerRegister(&timers[i], deadline, HandleTimerExpired, NULL);
+            HAPAssert(!err);
+        }
+    }
+    uint64_t duration = HAPPlatformClockGetCurrentMicroseconds() - startTime;
+
+    for (size_t i = 0; i < numTimers; i++) {
+        if (useList) {
+            DeregisterListTimer(listTimerRefs[i]);
+        } else {
+            HAPPlatformTimerDeregister(timers[i]);
+        }
+    }
+    free(timers);
+    free(listTimerRefs);
+    return (double) duration * 1000 / (double) numOperations;
+}
+
+static int firedTimers[32];
+static size_t numFiredTimers;
+
+static void HandleOrderedTimerExpired(HAPPlatformTimerRef timer HAP_UNUSED, void* _Nullable context) {
+    HAPAssert(numFiredTimers < HAPArrayCount(firedTimers));
+    firedTimers[numFiredTimers++] = (int) (intptr_t) context;
+}
+
+static void HandleStopTimerExpired(HAPPlatformTimerRef timer HAP_UNUSED, void* _Nullable context HAP_UNUSED) {
+    HAPPlatformRunLoopStop();
+}
+
+static void TestTimerOrder(void) {
+    // Timer i fires after timer j if its deadline is later, or if the deadlines are equal and i > j.
+    HAPTime now = HAPPlatformClockGetCurrent();
+    HAPPlatformTimerRef timer;
+    for (int i = 0; i < 32; i++) {
+        HAPError err = HAPPlatformTimerRegister(
+                &timer, now + 1 + (HAPTime)((i * 7) % 4), HandleOrderedTimerExpired, (void*) (intptr_t) i);
+        HAPAssert(!err);
+    }
+    HAPError err = HAPPlatformTimerRegister(&timer, now + 10, HandleStopTimerExpired, NULL);
+    HAPAssert(!err);
+    HAPPlatformRunLoopRun();
+
+    HAPAssert(numFiredTimers == 32);
+    for (size_t k = 1; k < numFiredTimers; k++) {
+        int i = firedTimers[k - 1];
+        int j = firedTimers[k];
+        HAPAssert((i * 7) % 4 < (j * 7) % 4 || ((i * 7) % 4 == (j * 7) % 4 && i < j));
+    }
+}
+
+int main(void) {
+    // The run loop only requires a key-value store to be present.
+    static HAPPlatformKeyValueStore keyValueStore;
+    HAPPlatformRunLoopCreate(&(const HAPPlatformRunLoopOptions) { .keyValueStore = &keyValueStore });
+
+    TestTimerOrder();
+
+    printf("Timers  List (ns/op)  Heap (ns/op)\n");
+    static const size_t numTimers[] = { 10, 100, 1000 };
+    for (size_t i = 0; i < HAPArrayCount(numTimers); i++) {
+        double listTime = MeasureTimerChurn(numTimers[i], 200000, true);
+        double heapTime = MeasureTimerChurn(numTimers[i], 200000, false);
+        printf("%6zu  %12.1f  %12.1f\n", numTimers[i], listTime, heapTime);
+    }
+
+    HAPPlatformRunLoopRelease();
+    return 0;
+}
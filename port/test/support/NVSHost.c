@@ -0,0 +1,343 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "NVSHost.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+
+/**
+ * Maximum number of keys in all namespaces.
+ */
+#define kNVSHost_MaxEntries ((size_t) 1024)
+
+/**
+ * Maximum number of handles that are open at the same time.
+ */
+#define kNVSHost_MaxHandles ((size_t) 64)
+
+/**
+ * Maximum length of a value.
+ */
+#define kNVSHost_MaxValueBytes ((size_t) 4000)
+
+typedef struct {
+    bool isUsed;
+    char namespaceName[16];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    uint8_t* bytes;
+    size_t numBytes;
+} NVSHostEntry;
+
+struct nvs_opaque_iterator_t {
+    char namespaceName[16];
+    size_t entryIndex;
+};
+
+static struct {
+    NVSHostEntry entries[kNVSHost_MaxEntries];
+    struct {
+        bool isOpen;
+        char namespaceName[16];
+    } handles[kNVSHost_MaxHandles];
+    NVSHostStatistics statistics;
+    NVSHostLatencies latencies;
+} nvs;
+
+/**
+ * Busy waits to simulate the duration of a flash access. Sleeping is too coarse for durations of a few microseconds.
+ *
+ * @param      microseconds         Duration.
+ */
+static void SimulateLatency(uint32_t microseconds) {
+    if (!microseconds) {
+        return;
+    }
+    struct timespec start;
+    (void) clock_gettime(CLOCK_MONOTONIC, &start);
+    for (;;) {
+        struct timespec now;
+        (void) clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t elapsed = (int64_t)(now.tv_sec - start.tv_sec) * 1000000 + (now.tv_nsec - start.tv_nsec) / 1000;
+        if (elapsed >= microseconds) {
+            return;
+        }
+    }
+}
+
+/**
+ * Returns the namespace of an open handle.
+ *
+ * @param      handle               Handle.
+ *
+ * @return Namespace name if the handle is open. NULL otherwise.
+ */
+static const char* GetNamespace(nvs_handle_t handle) {
+    if (!handle || handle > kNVSHost_MaxHandles || !nvs.handles[handle - 1].isOpen) {
+        return NULL;
+    }
+    return nvs.handles[handle - 1].namespaceName;
+}
+
+/**
+ * Finds the entry of a key.
+ *
+ * @param      namespaceName        Namespace.
+ * @param      key                  Key.
+ *
+ * @return Entry if the key exists. NULL otherwise.
+ */
+static NVSHostEntry* FindEntry(const char* namespaceName, const char* key) {
+    for (size_t i = 0; i < kNVSHost_MaxEntries; i++) {
+        NVSHostEntry* entry = &nvs.entries[i];
+        if (entry->isUsed && !strcmp(entry->namespaceName, namespaceName) && !strcmp(entry->key, key)) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void RemoveEntry(NVSHostEntry* entry) {
+    free(entry->bytes);
+    memset(entry, 0, sizeof *entry);
+}
+
+void NVSHostReset(void) {
+    for (size_t i = 0; i < kNVSHost_MaxEntries; i++) {
+        if (nvs.entries[i].isUsed) {
+            RemoveEntry(&nvs.entries[i]);
+        }
+    }
+    memset(&nvs.statistics, 0, sizeof nvs.statistics);
+    memset(&nvs.latencies, 0, sizeof nvs.latencies);
+}
+
+void NVSHostSetLatencies(const NVSHostLatencies* latencies) {
+    nvs.latencies = *latencies;
+}
+
+void NVSHostGetStatistics(NVSHostStatistics* statistics) {
+    *statistics = nvs.statistics;
+}
+
+void NVSHostResetStatistics(void) {
+    memset(&nvs.statistics, 0, sizeof nvs.statistics);
+}
+
+esp_err_t nvs_flash_init_partition(const char* part_name) {
+    return part_name ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t nvs_flash_erase(void) {
+    NVSHostReset();
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase_partition(const char* part_name) {
+    (void) part_name;
+    NVSHostReset();
+    return ESP_OK;
+}
+
+esp_err_t nvs_open_from_partition(
+        const char* part_name,
+        const char* name,
+        nvs_open_mode_t open_mode,
+        nvs_handle_t* out_handle) {
+    (void) part_name;
+    (void) open_mode;
+    nvs.statistics.numOpens++;
+    SimulateLatency(nvs.latencies.open);
+
+    if (!name || strlen(name) >= sizeof nvs.handles[0].namespaceName) {
+        return ESP_ERR_NVS_INVALID_NAME;
+    }
+    for (size_t i = 0; i < kNVSHost_MaxHandles; i++) {
+        if (!nvs.handles[i].isOpen) {
+            nvs.handles[i].isOpen = true;
+            strcpy(nvs.handles[i].namespaceName, name);
+            *out_handle = (nvs_handle_t)(i + 1);
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+}
+
+void nvs_close(nvs_handle_t handle) {
+    if (GetNamespace(handle)) {
+        nvs.handles[handle - 1].isOpen = false;
+    }
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out_value, size_t* length) {
+    nvs.statistics.numReads++;
+    SimulateLatency(nvs.latencies.read);
+
+    const char* namespaceName = GetNamespace(handle);
+    if (!namespaceName) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    const NVSHostEntry* entry = FindEntry(namespaceName, key);
+    if (!entry) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (out_value) {
+        if (*length < entry->numBytes) {
+            return ESP_ERR_NVS_INVALID_LENGTH;
+        }
+        memcpy(out_value, entry->bytes, entry->numBytes);
+    }
+    *length = entry->numBytes;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length) {
+    nvs.statistics.numWrites++;
+    SimulateLatency(nvs.latencies.write);
+
+    const char* namespaceName = GetNamespace(handle);
+    if (!namespaceName) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (!key || strlen(key) >= NVS_KEY_NAME_MAX_SIZE) {
+        return ESP_ERR_NVS_INVALID_NAME;
+    }
+    if (length > kNVSHost_MaxValueBytes) {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    NVSHostEntry* entry = FindEntry(namespaceName, key);
+    if (!entry) {
+        for (size_t i = 0; i < kNVSHost_MaxEntries && !entry; i++) {
+            if (!nvs.entries[i].isUsed) {
+                entry = &nvs.entries[i];
+            }
+        }
+        if (!entry) {
+            return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        }
+        entry->isUsed = true;
+        strcpy(entry->namespaceName, namespaceName);
+        strcpy(entry->key, key);
+    }
+    uint8_t* bytes = malloc(length ? length : 1);
+    if (!bytes) {
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+    memcpy(bytes, value, length);
+    free(entry->bytes);
+    entry->bytes = bytes;
+    entry->numBytes = length;
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key) {
+    nvs.statistics.numWrites++;
+    SimulateLatency(nvs.latencies.write);
+
+    const char* namespaceName = GetNamespace(handle);
+    if (!namespaceName) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    NVSHostEntry* entry = FindEntry(namespaceName, key);
+    if (!entry) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    RemoveEntry(entry);
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle) {
+    nvs.statistics.numWrites++;
+    SimulateLatency(nvs.latencies.write);
+
+    const char* namespaceName = GetNamespace(handle);
+    if (!namespaceName) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    for (size_t i = 0; i < kNVSHost_MaxEntries; i++) {
+        if (nvs.entries[i].isUsed && !strcmp(nvs.entries[i].namespaceName, namespaceName)) {
+            RemoveEntry(&nvs.entries[i]);
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+    nvs.statistics.numCommits++;
+    SimulateLatency(nvs.latencies.write);
+
+    return GetNamespace(handle) ? ESP_OK : ESP_ERR_NVS_INVALID_HANDLE;
+}
+
+/**
+ * Advances an iterator to the next matching entry, starting with the current one.
+ *
+ * @param      iterator             Iterator.
+ *
+ * @return Iterator if a matching entry has been found. NULL otherwise, in which case the iterator is released.
+ */
+static nvs_iterator_t AdvanceIterator(nvs_iterator_t iterator) {
+    nvs.statistics.numIterations++;
+    SimulateLatency(nvs.latencies.iterate);
+
+    for (; iterator->entryIndex < kNVSHost_MaxEntries; iterator->entryIndex++) {
+        const NVSHostEntry* entry = &nvs.entries[iterator->entryIndex];
+        if (entry->isUsed && (!iterator->namespaceName[0] || !strcmp(entry->namespaceName, iterator->namespaceName))) {
+            return iterator;
+        }
+    }
+    free(iterator);
+    return NULL;
+}
+
+nvs_iterator_t nvs_entry_find(const char* part_name, const char* namespace_name, nvs_type_t type) {
+    (void) part_name;
+    (void) type;
+
+    nvs_iterator_t iterator = calloc(1, sizeof *iterator);
+    if (!iterator) {
+        return NULL;
+    }
+    if (namespace_name) {
+        strncpy(iterator->namespaceName, namespace_name, sizeof iterator->namespaceName - 1);
+    }
+    return AdvanceIterator(iterator);
+}
+
+nvs_iterator_t nvs_entry_next(nvs_iterator_t iterator) {
+    iterator->entryIndex++;
+    return AdvanceIterator(iterator);
+}
+
+void nvs_entry_info(nvs_iterator_t iterator, nvs_entry_info_t* out_info) {
+    const NVSHostEntry* entry = &nvs.entries[iterator->entryIndex];
+    memset(out_info, 0, sizeof *out_info);
+    strcpy(out_info->namespace_name, entry->namespaceName);
+    strcpy(out_info->key, entry->key);
+    out_info->type = NVS_TYPE_BLOB;
+}
+
+void nvs_release_iterator(nvs_iterator_t iterator) {
+    free(iterator);
+}
@@ -0,0 +1,121 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NVS_HOST_H
+#define NVS_HOST_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**@file
+ * In-memory stand-in for the ESP-IDF NVS API, so that the key-value store can be exercised on a host.
+ *
+ * - All partitions share one set of namespaces.
+ * - Flash access times can be simulated, so that benchmarks reflect the cost of avoided NVS calls.
+ */
+
+/**
+ * NVS stand-in statistics.
+ */
+typedef struct {
+    /**
+     * Number of calls to nvs_open_from_partition.
+     */
+    size_t numOpens;
+
+    /**
+     * Number of calls to nvs_get_blob.
+     */
+    size_t numReads;
+
+    /**
+     * Number of calls to nvs_set_blob and nvs_erase_key.
+     */
+    size_t numWrites;
+
+    /**
+     * Number of calls to nvs_commit.
+     */
+    size_t numCommits;
+
+    /**
+     * Number of calls to nvs_entry_find and nvs_entry_next.
+     */
+    size_t numIterations;
+} NVSHostStatistics;
+
+/**
+ * Simulated durations of NVS calls, in microseconds.
+ */
+typedef struct {
+    /**
+     * Duration of nvs_open_from_partition.
+     */
+    uint32_t open;
+
+    /**
+     * Duration of nvs_get_blob.
+     */
+    uint32_t read;
+
+    /**
+     * Duration of nvs_set_blob, nvs_erase_key and nvs_commit.
+     */
+    uint32_t write;
+
+    /**
+     * Duration of nvs_entry_find and of each nvs_entry_next.
+     */
+    uint32_t iterate;
+} NVSHostLatencies;
+
+/**
+ * Erases all namespaces and resets statistics and latencies.
+ */
+void NVSHostReset(void);
+
+/**
+ * Sets the simulated durations of NVS calls.
+ *
+ * @param      latencies            Simulated durations.
+ */
+void NVSHostSetLatencies(const NVSHostLatencies* latencies);
+
+/**
+ * Fetches statistics.
+ *
+ * @param[out] statistics           Statistics.
+ */
+void NVSHostGetStatistics(NVSHostStatistics* statistics);
+
+/**
+ * Resets statistics.
+ */
+void NVSHostResetStatistics(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif